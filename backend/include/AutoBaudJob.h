@@ -0,0 +1,64 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUTO_BAUD_JOB_H
+#define AUTO_BAUD_JOB_H
+#include "PortJob.h"
+
+// finds the baud rate of the traffic on RX and switches the port to it
+// the shortest pulse timed by the UART picks a few standard rates, each is then listened to and the one with the fewest line errors wins
+// the result is [u32 measured baud][u32 chosen baud][u32 measured bit time][u32 achieved bit time][u32 edges][u32 errors], bit times in 1/16 clock cycles
+class AutoBaudJob : public PortJob
+{
+public:
+    enum Flags : uint8_t
+    {
+        // report the measurement without trying or changing the rate
+        FlagMeasureOnly = 1
+    };
+
+    enum Stage : uint8_t
+    {
+        StageMeasure = 0,
+        StageScore
+    };
+
+    // the job takes no streamed input
+    static const uint32_t inputBufferSize = 1;
+    static const uint32_t resultSize = 24;
+
+    AutoBaudJob(uint8_t flags);
+
+    uint32_t getResult(uint8_t *dst, uint32_t size) override;
+
+protected:
+    bool execute(PortIO &io) override;
+
+private:
+    static const uint32_t maxCandidates = 3;
+
+    const uint8_t flags;
+    uint32_t measuredBaudRate;
+    uint32_t chosenBaudRate;
+    uint32_t measuredBitTime;
+    uint32_t achievedBitTime;
+    uint32_t edges;
+    uint32_t errors;
+
+    uint32_t findCandidates(uint32_t measured, uint32_t *candidates);
+};
+#endif
@@ -0,0 +1,83 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef BRIDGE_REWRITER_H
+#define BRIDGE_REWRITER_H
+#include <stdint.h>
+#include <functional>
+
+// replaces byte sequences in one direction of a port bridge as the data passes through the port task
+// rules are tried in order and the first one whose match is complete is applied, the match is not searched
+// for again inside its own replacement. bytes that may be the start of a match are held back until
+// the rest arrives, or until flush() when the line goes idle
+class BridgeRewriter
+{
+public:
+    static const uint8_t maxRules = 8;
+    static const uint8_t maxMatchLength = 16;
+    static const uint8_t maxReplaceLength = 16;
+
+    struct Rule
+    {
+        uint8_t matchLength;
+        uint8_t match[maxMatchLength];
+        // 0 drops the match
+        uint8_t replaceLength;
+        uint8_t replace[maxReplaceLength];
+    };
+
+    struct Config
+    {
+        // 0 passes the data through unchanged
+        uint8_t count;
+        Rule rules[maxRules];
+    };
+
+    // called with each run of output bytes in order
+    typedef std::function<void(const uint8_t *data, uint32_t length)> OutputHandler;
+
+    BridgeRewriter();
+
+    /**
+     * replaces the rules, anything held back is discarded
+     * @return false if a rule is over the limits or has an empty match
+     */
+    bool configure(const Config &config);
+
+    bool isActive()
+    {
+        return config.count > 0;
+    }
+
+    void feed(const uint8_t *data, uint32_t length, const OutputHandler &out);
+
+    /**
+     * sends the bytes held back for a match that has not completed
+     */
+    void flush(const OutputHandler &out);
+
+private:
+    Config config;
+    // true for bytes that start a match, everything else goes straight through
+    bool firstBytes[256];
+    uint8_t held[maxMatchLength];
+    uint8_t heldLength;
+
+    void resolve(const OutputHandler &out, bool final);
+    void dropHeld(uint8_t length);
+};
+
+#endif
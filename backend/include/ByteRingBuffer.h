@@ -0,0 +1,101 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef BYTE_RING_BUFFER_H
+#define BYTE_RING_BUFFER_H
+#include <stdint.h>
+#include <atomic>
+
+// lock free single producer / single consumer byte ring
+// one task may call the producer methods and one other task the consumer methods
+class ByteRingBuffer
+{
+private:
+    uint8_t *buffer;
+    uint32_t capacity;
+    uint32_t mask;
+    // free running positions, only the producer writes head and only the consumer writes tail
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+
+    std::atomic<uint32_t> highWaterMark;
+    std::atomic<uint32_t> overflowBytes;
+    std::atomic<uint32_t> overflowCount;
+
+    void copyIn(uint32_t position, const uint8_t *src, uint32_t len);
+    void copyOut(uint32_t position, uint8_t *dst, uint32_t len);
+    void updateHighWaterMark(uint32_t used);
+
+public:
+    ByteRingBuffer();
+    ~ByteRingBuffer();
+
+    /**
+     * allocates the storage, size is rounded up to a power of 2
+     * must be called while neither side is in use
+     */
+    bool allocate(uint32_t size);
+    void release();
+    bool isAllocated() { return buffer != nullptr; }
+    uint32_t size() { return capacity; }
+
+    /**
+     * producer: copies as much of src as fits
+     * bytes that do not fit are dropped and counted as an overflow
+     * @return the number of bytes written
+     */
+    uint32_t write(const uint8_t *src, uint32_t len);
+    /**
+     * producer: writes header followed by payload, or nothing if both do not fit
+     * the consumer never sees one without the other
+     * @return false if the data was dropped
+     */
+    bool writeAll(const uint8_t *header, uint32_t headerLen, const uint8_t *payload, uint32_t payloadLen);
+    /**
+     * producer: space available for writing
+     */
+    uint32_t freeSpace();
+
+    /**
+     * consumer: number of bytes waiting to be read
+     */
+    uint32_t available();
+    /**
+     * consumer: copies up to len bytes out of the ring
+     * @return the number of bytes read
+     */
+    uint32_t read(uint8_t *dst, uint32_t len);
+    /**
+     * consumer: copies up to len bytes without removing them
+     * @return the number of bytes copied
+     */
+    uint32_t peek(uint8_t *dst, uint32_t len);
+    /**
+     * consumer: removes up to len bytes without copying them
+     */
+    void skip(uint32_t len);
+    /**
+     * consumer: discard everything currently buffered
+     */
+    void clear();
+
+    uint32_t getHighWaterMark() { return highWaterMark.load(std::memory_order_relaxed); }
+    uint32_t getOverflowBytes() { return overflowBytes.load(std::memory_order_relaxed); }
+    uint32_t getOverflowCount() { return overflowCount.load(std::memory_order_relaxed); }
+    void resetStats();
+};
+#endif
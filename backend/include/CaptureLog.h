@@ -0,0 +1,184 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef CAPTURE_LOG_H
+#define CAPTURE_LOG_H
+#include <stdint.h>
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_partition.h"
+#include "ByteRingBuffer.h"
+#include "Request.h"
+#include "Response.h"
+
+using SimpleHTTP::Request;
+using SimpleHTTP::Response;
+
+class Port;
+// records the traffic of one port to the capture partition so it can be looked at after the fact
+//
+// the partition is split into segments that are reused oldest first, each starts with a header and
+// a sparse index of the time of the first record in each flash block. the server task only copies
+// records into a RAM buffer, a low priority task writes them to flash in batches and erases ahead
+// so the live stream never waits on flash
+//
+// the log is read as one byte stream, a position is sequence * segmentDataSize + offset in the segment
+// so a position stays valid until its segment is reused. each record is a RecordHeader then its data,
+// RecordTypeEnd means the rest of the segment is unused, skip to the next multiple of segmentDataSize
+class CaptureLog
+{
+public:
+    enum RecordType
+    {
+        RecordTypeRx = 0,
+        RecordTypeTx = 1,
+        // payload is the LineEvent byte
+        RecordTypeLineEvent = 2,
+        // payload is the u32 number of bytes that were dropped because the RAM buffer was full
+        RecordTypeLost = 3,
+        RecordTypeEnd = 0xFF
+    };
+
+    struct RecordHeader
+    {
+        uint8_t type;
+        uint8_t port;
+        uint8_t length[2];
+        // log clock in us, keeps counting up across reboots
+        uint8_t time[8];
+    };
+
+    static const uint32_t segmentSize = 64 * 1024;
+    static const uint32_t headerAreaSize = 256;
+    static const uint32_t segmentDataSize = segmentSize - headerAreaSize;
+    static const uint32_t maxRecordData = 1024;
+
+    /**
+     * finds the capture partition, recovers the end of the log and starts recording if it is enabled
+     * @return false if there is no capture partition
+     */
+    static bool init();
+
+    /**
+     * adds a record if port is the one being recorded, never blocks
+     * must be called from the server task
+     */
+    static void record(Port *port, uint8_t type, const uint8_t *data, uint32_t length);
+
+    /**
+     * true if the port should keep reading when it has no subscribers
+     */
+    static bool isRecording(Port *port)
+    {
+        return recordPort == port;
+    }
+
+    /**
+     * GET returns the state of the log as json, PUT {"enabled":true,"port":"UART 1","baudRate":115200} sets what is recorded
+     */
+    static void captureRequest(Request *req, Response *resp);
+    /**
+     * GET the log bytes, a Range header selects positions, see captureFindRequest
+     */
+    static void captureDataRequest(Request *req, Response *resp);
+    /**
+     * body {"from":us,"to":us} in log clock time, returns {"start":position,"end":position}
+     * for a Range request covering the records in that time
+     */
+    static void captureFindRequest(Request *req, Response *resp);
+
+private:
+    struct SegmentHeader
+    {
+        uint32_t magic;
+        uint32_t sequence;
+        uint32_t eraseCount;
+        uint32_t reserved;
+        // log time of the first record
+        uint64_t startTime;
+    };
+
+    // one per flash block, erased (all 0xFF) until a record starts in the block
+    struct IndexEntry
+    {
+        uint32_t offset;
+        // ms after the segment start time, rounded down
+        uint32_t timeMs;
+    };
+
+    struct Segment
+    {
+        bool valid;
+        uint32_t sequence;
+        uint32_t eraseCount;
+        uint64_t startTime;
+    };
+
+    static const uint32_t magic = 0x53504331;
+    static const uint32_t indexOffset = 32;
+    static const uint32_t blockSize = 4096;
+    static const uint32_t indexEntries = segmentSize / blockSize;
+    static const uint32_t ringSize = 16 * 1024;
+    // flash writes are held until this much is waiting or flushIntervalMs has passed
+    static const uint32_t batchSize = 1024;
+    static const uint32_t batchBufferSize = 4096;
+    static const uint32_t flushIntervalMs = 1000;
+    // max bytes sent in response to one data request, a larger one is answered 206 with the first part
+    static const uint32_t maxRangeResponse = 64 * 1024;
+
+    static const esp_partition_t *partition;
+    static Segment *segments;
+    static uint32_t segmentCount;
+    static SemaphoreHandle_t lock;
+    static TaskHandle_t task;
+    static ByteRingBuffer ring;
+    static std::atomic<Port *> recordPort;
+    static int64_t clockBase;
+    static uint32_t pendingLost;
+    static std::atomic<uint32_t> lostBytes;
+
+    // state of the segment being written, owned by the capture task
+    // hasSegment, currentSequence and writeOffset are also read under lock
+    static bool hasSegment;
+    static uint32_t currentSequence;
+    static uint32_t writeOffset;
+    static uint16_t indexedBlocks;
+    static IndexEntry pendingIndex[];
+    static uint32_t erasedAhead;
+    static uint8_t *batch;
+    static uint32_t batchUsed;
+
+    static int64_t now();
+    static void captureTask(void *arg);
+    static void flush();
+    static bool writeBatch();
+    static bool openNextSegment(uint64_t startTime);
+    static bool eraseAhead();
+    static bool recover();
+    static uint64_t segmentAddress(uint32_t sequence);
+    static uint64_t startPosition();
+    static uint64_t endPosition();
+    static void readLog(uint64_t position, uint8_t *dst, uint32_t length);
+    static uint64_t findPosition(uint64_t time);
+    static bool parseRange(const char *value, uint64_t size, uint64_t *first, uint64_t *last);
+
+    static bool loadConfig(bool *enabled, char *portName, uint32_t portNameSize, uint32_t *baudRate);
+    static bool saveConfig(bool enabled, const char *portName, uint32_t baudRate);
+    static bool applyConfig(bool enabled, const char *portName, uint32_t baudRate);
+};
+#endif
@@ -17,9 +17,14 @@
 
 #pragma once
 #include "Port.h"
+#include "PortSubscription.h"
+#include "PortJob.h"
 #include "ClientMessageEncoding.h"
 #include "esp_http_server.h"
 #include <string>
+#include <list>
+#include <deque>
+#include <memory>
 //WebSocket Message Handling
 class ClientConnection
 {
@@ -32,18 +37,120 @@ protected:
         OperationResultFailed,
         OperationNotPermitted
     };
-    Port *port;
     bool authenticated;
 
 public:
-    ClientConnection() : port(nullptr),authenticated(false), lastModeRequest({}){};
+    // ports one socket can have open at once, v1 clients only use channel 0
+    static const int maxChannels = 4;
+
+    ClientConnection() : authenticated(false), protocolVersion(MessageEncoding::protocolVersion1)
+    {
+        for (int i = 0; i < maxChannels; i++)
+        {
+            channels[i].id = i;
+        }
+        activeConnections.push_back(this);
+    };
     virtual ~ClientConnection();
     void handleMessage(char *payload, int size);
+    /**
+     * forwards data collected by the port task to the client
+     * must be called from the server task
+     */
+    void process();
+    /**
+     * calls process() on every open connection
+     */
+    static void processAll();
 
 private:
-    MessageEncoding::ModeRequest lastModeRequest;
+    static std::list<ClientConnection *> activeConnections;
+    // the version of the last request, unsolicited messages are sent in it
+    uint8_t protocolVersion;
+
+    // responses are sent in request order, a read holds back every response after it until it completes
+    // v2 responses carry the request id so only reads wait, for the port to finish the read before them
+    struct QueuedResponse
+    {
+        enum Kind
+        {
+            KindMessage,
+            KindError,
+            KindRead
+        } kind;
+        MessageDecoder::MessageType msgType;
+        MessageEncoding::ResponseHeader header;
+        std::string payload;
+        MessageDecoder::ReadDataRequest readRequest;
+    };
+
+    // the state for one port opened on this connection
+    struct PortChannel
+    {
+        PortChannel() : id(0), port(nullptr), viewer(false), lastModeRequest({}), txCompletedReported(0), txLimitReported(0), rxCreditEnabled(false), rxCredit(0), readStarted(false), jobProgressReported({}), triggerArmed(false), bridgeChannel(MessageEncoding::noPeerChannel), sniffChannel(MessageEncoding::noPeerChannel), sniffMerger(false), sniffTimes{} {}
+
+        uint8_t id;
+        Port *port;
+        // opened with MessageTypeOpenViewer, receives data but can not change the port
+        bool viewer;
+        MessageEncoding::ModeRequest lastModeRequest;
+        PortSubscription subscription;
+        // the port's tx completed total last sent in a write complete message
+        uint32_t txCompletedReported;
+        // the tx limit last sent, see Port::getTxLimit()
+        uint32_t txLimitReported;
+        // async data is only sent while the client has granted credit for it
+        bool rxCreditEnabled;
+        // can go below zero as a chunk is sent whole once there is any credit
+        int32_t rxCredit;
+        std::deque<QueuedResponse> queuedResponses;
+        bool readStarted;
+        // the job started on this channel, the port task holds its own reference while it runs
+        std::shared_ptr<PortJob> job;
+        PortJob::Progress jobProgressReported;
+        // a trigger was armed on this channel, its window is sent once it completes
+        bool triggerArmed;
+        // the channel whose port this one is bridged with, both channels point at each other
+        uint8_t bridgeChannel;
+        // the other side of a sniff, both channels point at each other
+        uint8_t sniffChannel;
+        // the sniff was started on this channel, the data of both sides goes out merged on it
+        bool sniffMerger;
+        // device time of the last data sent from each MessageEncoding::SniffSource
+        int64_t sniffTimes[2];
+    };
+    PortChannel channels[maxChannels];
+
+    MessageEncoding::ResponseHeader unsolicitedHeader(PortChannel &channel);
+    bool writeResponse(PortChannel &channel, const MessageEncoding::ResponseHeader &header, const char *payload, const int payloadSize);
+    bool writeErrorResponse(PortChannel &channel, MessageDecoder::MessageType msgType, const MessageEncoding::ResponseHeader &header, std::string &errorMessage);
+    bool sendError(MessageDecoder::MessageType msgType, const MessageEncoding::ResponseHeader &header, std::string &errorMessage);
+    void queueRead(PortChannel &channel, const MessageEncoding::ResponseHeader &header, MessageDecoder::ReadDataRequest &r);
+    void processPendingRead(PortChannel &channel);
+    void flushQueuedResponses(PortChannel &channel);
+    void abortPendingReads(PortChannel &channel);
+    // max number of async messages sent per call to process() so one busy port can not starve the server loop
+    static const int maxAsyncMessagesPerProcess = 4;
+
+    void processChannel(PortChannel &channel);
+    void processWriteCompletions(PortChannel &channel);
+    void processAsyncData(PortChannel &channel);
+    bool writeChunk(PortChannel &channel, const PortSubscription::Chunk &chunk);
+
+    bool startJob(PortChannel &channel, MessageDecoder::StartJobRequest &r, MessageEncoding::ErrorCode &errorCode, std::string &errorMessage);
+    void processJob(PortChannel &channel);
+    void processTrigger(PortChannel &channel);
+    bool startBridge(PortChannel &channel, MessageDecoder::BridgeRequest &r, MessageEncoding::ErrorCode &errorCode, std::string &errorMessage);
+    void stopBridge(PortChannel &channel);
+    bool startSniff(PortChannel &channel, MessageDecoder::SniffRequest &r, MessageEncoding::ErrorCode &errorCode, std::string &errorMessage);
+    void stopSniff(PortChannel &channel);
+    void processSniff(PortChannel &channel);
+    bool writeSniffChunk(PortChannel &channel, uint8_t source, const PortSubscription::Chunk &chunk);
+    bool openPort(PortChannel &channel, const char *portName, bool asViewer, MessageEncoding::ErrorCode &errorCode, std::string &errorMessage);
+    void closePort(PortChannel &channel);
 
+    virtual bool canWriteMessage() = 0;
     virtual bool writeMessage(const char *payload, const int payloadSize, bool block) = 0;
     virtual bool writeErrorMessage(MessageDecoder::MessageType msgType, std::string& erroMessage) = 0;
     bool applyMode(Port *port, MessageEncoding::ModeRequest mode);
-};
+};
\ No newline at end of file
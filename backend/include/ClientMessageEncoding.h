@@ -18,6 +18,8 @@
 #ifndef CLIENT_MESSAGE_ENCODING_H
 #define CLIENT_MESSAGE_ENCODING_H
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 class MessageEncoding
 {
@@ -37,20 +39,115 @@ public:
         uint8_t dataBits;          // Size of the character (must be 5, 6, 7 or 8)
         uint8_t parity;            // Parity (see Parity type for more info)
         uint8_t stopBits;          // Stop bits (see StopBits type for more info)
-        uint8_t initialStatusBits; // Initial output modem bits status (if nil defaults to DTR=true and RTS=true)
+        uint8_t initialStatusBits; // Port::ModemLines to assert, bit 0 DTR, bit 1 RTS
+        uint8_t profile;           // index into Port::profiles (optional, defaults to 0)
+        uint8_t frameMode;         // FrameDecoder::FrameMode (optional, defaults to none)
+        uint8_t frameCRC;          // FrameDecoder::CRCType (optional)
+        uint8_t frameParam;        // delimiter, length field format or idle gap (optional)
+        uint16_t maxFrameSize;     // (optional, defaults to 256)
+        uint8_t flowControl;       // Port::FlowControl (optional, defaults to none)
+        uint8_t streamFlags;       // Port::StreamFlags (optional, defaults to none)
+        uint32_t txByteGapUs;      // Port::TxPacing (optional, defaults to no pacing)
+        uint16_t txLineGapMs;      // (optional)
+        uint16_t txEchoTimeoutMs;  // (optional)
+        uint8_t rs485Mode;         // Port::Rs485Mode (optional, defaults to off)
+        uint32_t rs485TurnaroundUs; // (optional)
     };
     struct ReadDataRequest
     {
-        uint16_t length;
-        uint16_t timeout;
+        uint32_t length;
+        uint32_t timeout;
     };
 
     struct WriteDataRequest
     {
-        uint16_t length;
+        uint32_t length;
         char *payload;
     };
 
+    struct StartJobRequest
+    {
+        uint8_t jobType;  // PortJob::JobType
+        uint8_t flags;    // job specific options
+        uint32_t address; // job specific, the STM32 start address or ESP flash offset
+        uint32_t imageLength;
+        const char *params; // job specific extra settings (optional)
+        uint16_t paramsSize;
+    };
+
+    struct JobDataRequest
+    {
+        uint32_t length;
+        const char *payload;
+    };
+
+    struct RxCreditRequest
+    {
+        uint32_t bytes;
+        uint8_t mode; // CreditMode (optional, defaults to add)
+    };
+
+    struct SendBreakRequest
+    {
+        uint32_t durationMs;
+    };
+
+    struct ArmTriggerRequest
+    {
+        uint8_t triggers; // TriggerCapture::Trigger flags, 0 disarms
+        uint16_t preEntries;
+        uint16_t postEntries;
+        uint8_t patternLength;
+        const char *pattern;
+    };
+
+    struct WatchPatternsRequest
+    {
+        // replaces the patterns this channel watches for, none stops watching
+        std::vector<std::string> patterns;
+    };
+
+    enum BridgeDirection : uint8_t
+    {
+        // data received on the request's channel going out of the peer channel's port
+        BridgeDirectionToPeer = 0,
+        BridgeDirectionFromPeer
+    };
+
+    struct BridgeRule
+    {
+        uint8_t direction; // BridgeDirection
+        uint8_t matchLength;
+        const char *match;
+        uint8_t replaceLength;
+        const char *replace;
+    };
+
+    struct BridgeRequest
+    {
+        uint8_t peerChannel; // a port opened on the same connection, noPeerChannel stops the bridge
+        std::vector<BridgeRule> rules;
+    };
+
+    struct SniffRequest
+    {
+        uint8_t peerChannel; // a port opened on the same connection, noPeerChannel stops the sniff
+    };
+
+    static const uint8_t noPeerChannel = 0xFF;
+
+    /**
+     * the fields before the payload of a response, v1 only sends the message type
+     * v2 layout: [u8 messageType][u8 status][u16 requestId][u8 channel]
+     */
+    struct ResponseHeader
+    {
+        uint8_t version;
+        uint8_t status;     // ErrorCode
+        uint16_t requestId; // copied from the request, 0 for unsolicited messages
+        uint8_t channel;    // the port channel the message is about
+    };
+
     enum MessageType : uint8_t
     {
         MessageTypeAuthenticate = 0,
@@ -63,10 +160,81 @@ public:
         MessageTypeAsyncDataRead = 7,
         MessageTypeStopAsyncDataRead = 8,
         MessageTypeWriteData = 9,
-        MessageTypeGetPortList = 10
+        MessageTypeGetPortList = 10,
+        MessageTypeGetPortStats = 11,
+        MessageTypeWriteComplete = 12,
+        MessageTypeOpenViewer = 13,
+        MessageTypeAsyncDataLost = 14,
+        MessageTypeAsyncFrame = 15,
+        MessageTypeStartJob = 16,
+        MessageTypeJobData = 17,
+        MessageTypeJobProgress = 18,
+        MessageTypeCancelJob = 19,
+        MessageTypeRxCredit = 20,
+        MessageTypeSendBreak = 21,
+        // [u8 Port::LineEvent][u32 rx stream offset], sent in order with the async data
+        MessageTypeAsyncLineEvent = 22,
+        // [u64 first byte start][u32 duration] in device microseconds, then the data
+        MessageTypeAsyncTimedData = 23,
+        MessageTypeArmTrigger = 24,
+        // the window frozen by an armed trigger, see TriggerCapture::readResult()
+        MessageTypeAsyncTriggerCapture = 25,
+        MessageTypeWatchPatterns = 26,
+        // [u8 pattern index][u32 rx stream offset after the match][u64 device us] then the bytes up to the end of the match
+        MessageTypeAsyncPatternHit = 27,
+        MessageTypeBridge = 28,
+        MessageTypeSniff = 29,
+        // [u8 SniffSource][u8 message type] then the payload of that message, one of AsyncTimedData, AsyncLineEvent,
+        // AsyncFrame or AsyncDataLost from either side of a sniff, in device time order
+        MessageTypeAsyncSniffData = 30
+    };
+
+    enum SniffSource : uint8_t
+    {
+        // the port of the channel the sniff was started on
+        SniffSourcePort = 0,
+        SniffSourcePeer
+    };
+
+    // how MessageTypeRxCredit changes the async data the device may send before the client grants more
+    enum CreditMode : uint8_t
+    {
+        CreditModeAdd = 0,
+        // replaces the credit and turns flow control on
+        CreditModeSet,
+        // no limit, the default
+        CreditModeOff
+    };
+
+    // sent in the status field of v2 responses, v1 only gets the error text
+    enum ErrorCode : uint8_t
+    {
+        ErrorCodeNone = 0,
+        ErrorCodeDecode,
+        ErrorCodeAuthRequired,
+        ErrorCodeAuthFailed,
+        ErrorCodePortClosed,
+        ErrorCodeNotPermitted,
+        ErrorCodeBusy,
+        ErrorCodePortInUse,
+        ErrorCodeNotFound,
+        ErrorCodeFailed,
+        ErrorCodeBufferFull,
+        ErrorCodeUnknownMessage,
+        ErrorCodeTimeout,
+        ErrorCodeInvalidChannel
     };
 
+    static const uint8_t protocolVersion1 = 1;
+    // adds request ids, port channels, binary errors and 32 bit lengths
+    static const uint8_t protocolVersion2 = 2;
+
+    // [u8 messageType][u8 version]
     static const int messageHeaderSize = 2;
+    // [u8 messageType][u8 version][u16 requestId][u8 channel]
+    static const int messageHeaderSizeV2 = 5;
+    // response buffers reserve this much for the header whatever the version
+    static const int maxResponseHeaderSize = 5;
 };
 
 class MessageDecoder : public MessageEncoding
@@ -74,16 +242,41 @@ class MessageDecoder : public MessageEncoding
 public:
     MessageDecoder(const char *_payload, int _size);
     const MessageType messageType;
+    const uint8_t version;
+    // v2 only, 0 for v1 requests
+    uint16_t requestId;
+    uint8_t channel;
+
+    /**
+     * false if the header is too short for its version
+     */
+    bool isValid()
+    {
+        return payloadSize >= 0;
+    }
+
+    /**
+     * the header for the response to this request
+     */
+    ResponseHeader responseHeader(ErrorCode status = ErrorCodeNone) const;
 
     bool readOpenPortRequest(OpenPortRequest *);
     bool readSetModeRequest(ModeRequest *);
     bool readReadDataRequest(ReadDataRequest *);
     bool readWriteDataRequest(WriteDataRequest *);
     bool readAuthenticateRequest(AuthenticateRequest* );
+    bool readStartJobRequest(StartJobRequest *);
+    bool readJobDataRequest(JobDataRequest *);
+    bool readRxCreditRequest(RxCreditRequest *);
+    bool readSendBreakRequest(SendBreakRequest *);
+    bool readArmTriggerRequest(ArmTriggerRequest *);
+    bool readWatchPatternsRequest(WatchPatternsRequest *);
+    bool readBridgeRequest(BridgeRequest *);
+    bool readSniffRequest(SniffRequest *);
 
 private:
     const char *payload;
-    const int payloadSize;
+    int payloadSize;
 };
 
 class MessageEncoder : public MessageEncoding
@@ -93,7 +286,10 @@ public:
     char *payloadBase;
     int payloadSize;
     MessageEncoder(MessageType msgType, const char *_payload, int payloadSize);
+    MessageEncoder(MessageType msgType, const ResponseHeader &header, const char *_payload, int payloadSize);
     bool writePortListHeader(int portCount);
     bool writePortListEntry(const char *portName, const uint8_t portNameSize);
+    bool writeUint8(uint8_t value);
+    bool writeUint32(uint32_t value);
 };
 #endif
\ No newline at end of file
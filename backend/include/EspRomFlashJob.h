@@ -0,0 +1,95 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ESP_ROM_FLASH_JOB_H
+#define ESP_ROM_FLASH_JOB_H
+#include "PortJob.h"
+
+// writes a zlib compressed image to an ESP32 family target through its ROM loader (the esptool serial protocol)
+// the image is streamed in as compressed bytes, the target inflates and writes it
+class EspRomFlashJob : public PortJob
+{
+public:
+    enum Flags : uint8_t
+    {
+        // the target is already in download mode, do not toggle DTR / RTS
+        FlagNoReset = 1,
+        // compare the flash MD5 with the one given in the params
+        FlagVerify = 2,
+        // reset the target into its new firmware when done
+        FlagReboot = 4
+    };
+
+    enum Stage : uint8_t
+    {
+        StageReset = 0,
+        StageSync,
+        StageBaudRate,
+        StageErase,
+        StageWrite,
+        StageVerify,
+        StageReboot
+    };
+
+    // compressed bytes per FLASH_DEFL_DATA command, the ROM loader's write size
+    static const uint32_t blockSize = 0x400;
+    static const uint32_t inputBufferSize = 1024 * 4;
+    // [u32 uncompressed size][u8 md5[16]][u32 baud rate, 0 to stay at the current rate]
+    static const uint32_t paramsSize = 24;
+
+    /**
+     * @param flashOffset where the image is written
+     * @param compressedLength the number of input bytes
+     */
+    EspRomFlashJob(uint8_t flags, uint32_t flashOffset, uint32_t compressedLength);
+
+    /**
+     * @return false if the params are not valid
+     */
+    bool setParams(const uint8_t *params, uint32_t length);
+
+protected:
+    bool execute(PortIO &io) override;
+
+private:
+    const uint8_t flags;
+    const uint32_t flashOffset;
+    const uint32_t compressedLength;
+    uint32_t uncompressedLength;
+    uint8_t md5[16];
+    uint32_t baudRate;
+
+    // 4 on the ESP32 family ROMs, 2 on the ESP8266 ROM and the flasher stub
+    uint32_t statusLength;
+    // newer ROMs take an extra encryption field in FLASH_DEFL_BEGIN
+    bool hasSecurityInfo;
+
+    uint8_t body[16 + blockSize];
+    uint8_t response[64];
+    char errorMessage[96];
+
+    void enterDownloadMode(PortIO &io);
+    void hardReset(PortIO &io);
+    bool sync(PortIO &io);
+    bool writeEscaped(PortIO &io, const uint8_t *data, uint32_t length);
+    bool sendPacket(PortIO &io, uint8_t command, const uint8_t *data, uint32_t length, uint32_t checksum);
+    int receivePacket(PortIO &io, int64_t deadline);
+    bool command(PortIO &io, uint8_t command, const uint8_t *data, uint32_t length, uint32_t checksum, uint32_t timeoutMs, uint32_t *dataLength = nullptr);
+    bool flash(PortIO &io);
+    bool verify(PortIO &io);
+};
+#endif
@@ -0,0 +1,148 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_DECODER_H
+#define FRAME_DECODER_H
+#include <stdint.h>
+#include <functional>
+#include <atomic>
+
+// splits a received byte stream into protocol frames
+// runs on the port task so only whole frames are sent to the client
+class FrameDecoder
+{
+public:
+    enum FrameMode : uint8_t
+    {
+        // no framing, data is passed on as received
+        FrameModeNone = 0,
+        // frames end with the delimiter byte (default '\n'), the delimiter is removed
+        FrameModeDelimiter,
+        // RFC 1055 SLIP
+        FrameModeSLIP,
+        // consistent overhead byte stuffing, frames end with 0x00
+        FrameModeCOBS,
+        // a 1 or 2 byte length field followed by that many bytes
+        FrameModeLengthPrefixed,
+        // a frame ends when the line has been idle for the RX timeout
+        FrameModeIdleGap
+    };
+
+    enum CRCType : uint8_t
+    {
+        CRCNone = 0,
+        // poly 0x07, init 0x00
+        CRC8,
+        // CRC-16/CCITT-FALSE poly 0x1021, init 0xFFFF, sent big endian
+        CRC16CCITT,
+        // CRC-16/MODBUS poly 0x8005 reflected, init 0xFFFF, sent little endian
+        CRC16Modbus,
+        // CRC-32 (IEEE 802.3), sent little endian
+        CRC32
+    };
+
+    struct Config
+    {
+        uint8_t mode;
+        uint8_t crcType;
+        // FrameModeDelimiter: the delimiter byte
+        // FrameModeLengthPrefixed: bit 0 set for a 2 byte length, bit 1 set for big endian
+        // FrameModeIdleGap: idle time in symbols, 0 uses the profile's RX timeout
+        uint8_t param;
+        uint16_t maxFrameSize;
+    };
+
+    static const uint16_t maxSupportedFrameSize = 2048;
+
+    // called with the frame content, without framing bytes or CRC
+    typedef std::function<void(const uint8_t *frame, uint32_t length)> FrameHandler;
+
+    FrameDecoder();
+    ~FrameDecoder();
+
+    /**
+     * applies the config, any partly received frame is discarded
+     * @return false if the config is not valid
+     */
+    bool configure(const Config &config);
+
+    bool isEnabled()
+    {
+        return config.mode != FrameModeNone;
+    }
+
+    uint8_t getMode()
+    {
+        return config.mode;
+    }
+
+    uint8_t getIdleGapSymbols()
+    {
+        return config.mode == FrameModeIdleGap ? config.param : 0;
+    }
+
+    /**
+     * processes received bytes, onFrame is called for each complete frame that passes the CRC check
+     */
+    void feed(const uint8_t *data, uint32_t length, const FrameHandler &onFrame);
+
+    /**
+     * the line has gone idle, ends the current frame in idle gap mode
+     */
+    void idle(const FrameHandler &onFrame);
+
+    uint32_t getFrameCount()
+    {
+        return frameCount;
+    }
+
+    uint32_t getBadFrameCount()
+    {
+        return badFrameCount;
+    }
+
+    void resetStats();
+
+private:
+    Config config;
+    uint8_t *frame;
+    // includes room for the CRC
+    uint32_t frameCapacity;
+    uint32_t frameLength;
+    // SLIP: the previous byte was an escape
+    bool escaped;
+    // COBS: bytes left in the current code block and whether it ends with an implicit zero
+    uint8_t cobsRemaining;
+    bool cobsAppendZero;
+    // length prefixed: header bytes received and expected frame size, wide enough for a 0xFFFF length plus the CRC
+    uint8_t headerReceived;
+    uint32_t expectedLength;
+    // set when the current frame has already failed, bytes are ignored until the next frame boundary
+    bool discarding;
+
+    // read by the server task for the port stats
+    std::atomic<uint32_t> frameCount;
+    std::atomic<uint32_t> badFrameCount;
+
+    uint8_t crcSize();
+    static uint32_t calculateCRC(uint8_t crcType, const uint8_t *data, uint32_t length);
+    bool append(uint8_t value);
+    void endFrame(const FrameHandler &onFrame);
+    void reset();
+    void feedLengthPrefixed(uint8_t value, const FrameHandler &onFrame);
+};
+#endif
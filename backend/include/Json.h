@@ -42,6 +42,14 @@ public:
     bool writeJsonToResponse(Response *resp);
 
     char *getStringField(const char *key);
+    /**
+     * @return false if the field is missing or not a number
+     */
+    bool getNumberField(const char *key, double *value);
+    /**
+     * @return false if the field is missing or not a boolean
+     */
+    bool getBoolField(const char *key, bool *value);
     /*
      * add a string field
      */
@@ -50,6 +58,10 @@ public:
      * add an int field
      */
     void addField(const char *key, int value);
+    /**
+     * add a number field, for values that do not fit an int
+     */
+    void addField(const char *key, double value);
     /**
      * add a boolean field
      */
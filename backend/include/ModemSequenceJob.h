@@ -0,0 +1,76 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MODEM_SEQUENCE_JOB_H
+#define MODEM_SEQUENCE_JOB_H
+#include "PortJob.h"
+
+// runs a short script of modem line changes, delays and writes on the port task
+// used for reset / bootloader entry sequences that need tighter timing than a browser round trip
+// the script is given in the params as steps of [u8 op][u32 arg], OpWrite is followed by arg bytes of data
+class ModemSequenceJob : public PortJob
+{
+public:
+    enum Flags : uint8_t
+    {
+        // put the baud rate back once the script finishes
+        FlagRestoreBaudRate = 1
+    };
+
+    enum Op : uint8_t
+    {
+        // arg bit 0 DTR, bit 1 RTS, bit 2 change DTR, bit 3 change RTS, asserted when set
+        OpSetLines = 0,
+        // arg microseconds
+        OpDelay,
+        OpSetBaudRate,
+        // sends the arg bytes following the step and waits for them to go out
+        OpWrite,
+        // arg ignored, discards anything received so far
+        OpFlushInput
+    };
+
+    enum LineBits : uint32_t
+    {
+        LineDTR = 1,
+        LineRTS = 2,
+        LineChangeDTR = 4,
+        LineChangeRTS = 8
+    };
+
+    static const uint32_t stepSize = 5;
+    static const uint32_t maxScriptSize = 256;
+    // the job takes no streamed input
+    static const uint32_t inputBufferSize = 1;
+
+    ModemSequenceJob(uint8_t flags);
+
+    /**
+     * @return false if the script is empty, too large or has a bad step
+     */
+    bool setParams(const uint8_t *params, uint32_t length);
+
+protected:
+    bool execute(PortIO &io) override;
+
+private:
+    const uint8_t flags;
+    uint8_t script[maxScriptSize];
+    uint32_t scriptSize;
+    uint32_t stepCount;
+};
+#endif
@@ -0,0 +1,106 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PATTERN_WATCH_H
+#define PATTERN_WATCH_H
+#include <stdint.h>
+#include <functional>
+#include <atomic>
+
+// matches many byte patterns against the received data in one pass (Aho-Corasick)
+// runs on the port task so clients can be told about a pattern without taking the whole stream
+class PatternWatch
+{
+public:
+    static const uint8_t maxPatterns = 64;
+    static const uint8_t maxPatternLength = 32;
+    static const uint16_t maxTotalLength = 1024;
+    // received bytes kept for the context of a hit, the match is at the end of them
+    static const uint8_t contextSize = 32;
+
+    struct Config
+    {
+        // 0 turns the watch off
+        uint8_t count;
+        uint8_t lengths[maxPatterns];
+        // the patterns one after another
+        uint8_t patterns[maxTotalLength];
+    };
+
+    // called with the index of the pattern in the config and the index in data of its last byte
+    // patterns that end on the same byte are reported one after another
+    typedef std::function<void(uint8_t pattern, uint32_t end)> HitHandler;
+
+    PatternWatch();
+    ~PatternWatch();
+
+    /**
+     * builds the automaton, the match state and context start over
+     * @return false if the config is over the limits or the automaton could not be allocated
+     */
+    bool configure(const Config &config);
+
+    bool isActive()
+    {
+        return active;
+    }
+
+    /**
+     * processes received bytes, onHit is called for each pattern as soon as its last byte is seen
+     */
+    void feed(const uint8_t *data, uint32_t length, const HitHandler &onHit);
+
+    /**
+     * copies up to size of the most recent bytes, oldest first
+     * from onHit it is the bytes up to and including the end of the match
+     * @return the number of bytes copied
+     */
+    uint32_t copyContext(uint8_t *dst, uint32_t size);
+
+private:
+    // a trie node, children are a linked list through nextSibling except the root's which are in rootNext
+    struct Node
+    {
+        uint16_t firstChild;
+        uint16_t nextSibling;
+        // longest proper suffix that is also in the trie
+        uint16_t fail;
+        // nearest node on the fail chain where a pattern ends, 0 if none
+        uint16_t outputLink;
+        // the first pattern ending here, noPattern if none
+        uint8_t output;
+        uint8_t value;
+    };
+
+    static const uint8_t noPattern = 0xFF;
+
+    Node *nodes;
+    uint16_t nodeCount;
+    uint16_t rootNext[256];
+    // the next pattern with the same bytes, so duplicates from different clients are all reported
+    uint8_t samePattern[maxPatterns];
+    uint16_t state;
+    uint8_t context[contextSize];
+    uint8_t contextHead;
+    uint8_t contextLength;
+    std::atomic<bool> active;
+
+    uint16_t child(uint16_t node, uint8_t value);
+    uint16_t next(uint16_t node, uint8_t value);
+    void release();
+};
+
+#endif
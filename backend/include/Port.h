@@ -18,41 +18,549 @@
 #ifndef PORT_H
 #define PORT_H
 #include <stdint.h>
-#include <functional>
+#include <atomic>
+#include <memory>
+#include "ByteRingBuffer.h"
+#include "FrameDecoder.h"
+#include "TriggerCapture.h"
+#include "PatternWatch.h"
+#include "BridgeRewriter.h"
+#include "PortIO.h"
 extern "C"
 {
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "freertos/semphr.h"
 #include "driver/uart.h"
 }
+class PortJob;
 //ESP UART Port Wrapper
 class Port
 {
+public:
+    // latency / throughput trade off settings, selected with the mode request
+    struct Profile
+    {
+        const char *name;
+        // idle time in symbols before the driver reports buffered data (uart_set_rx_timeout)
+        uint8_t rxTimeoutSymbols;
+        // number of bytes in the hardware FIFO that triggers a transfer to the driver buffer
+        uint8_t rxFullThreshold;
+        uint32_t driverRxBufferSize;
+        // max size of each read from the driver, this is also the max async message size
+        uint32_t readChunkSize;
+        // bytes write() can queue before it reports the queue is full
+        uint32_t txQueueSize;
+    };
+
+    static constexpr const Profile profiles[] = {
+        {"default", 10, 120, 1024 * 2, 1024, 1024 * 4},
+        {"interactive", 1, 1, 1024, 256, 1024},
+        {"bulk", 100, 120, 1024 * 16, 1024 * 4, 1024 * 16}};
+
+    static const int profileCount = sizeof(profiles) / sizeof(Profile);
+
 private:
-    bool continuesReadEnabled;
+    std::atomic<bool> continuesReadEnabled;
+    // -1 when the pins are left as they are, UART 0 keeps the console's
+    const int txPin;
+    const int rtsPin;
+    const int ctsPin;
+    const int dtrPin;
+    // set from the server task, read by the port task
+    std::atomic<int> flowControl;
+    // the port task stopped draining the driver to hold off the sender, cleared once the consumer catches up
+    std::atomic<bool> rxThrottled;
+    // smallest read worth taking from the driver while flow control is on
+    static const uint32_t minFlowControlRead = 64;
+    // rx FIFO level at which the UART deasserts RTS or sends XOFF, and XON once it is back under
+    static const uint8_t flowControlRxThreshold = 100;
+    static const uint8_t flowControlXonThreshold = 32;
     TaskHandle_t readTask;
-    SemaphoreHandle_t readLock;
-    char readBuffer[1024];
+    // jobs run on the port task, the STM32 and ESP ones format messages and keep packets on the stack
+    static const uint32_t readTaskStackSize = 6 * 1024;
+    // stack left unused by a job below this is logged as a warning
+    static const uint32_t readTaskStackMargin = 512;
+    // UART driver events, also used to wake the port task
+    QueueHandle_t eventQueue;
+    static const int eventQueueSize = 20;
+    // held while posting and while the port task reinstalls the driver, which replaces eventQueue
+    SemaphoreHandle_t eventQueueLock;
+    char *readBuffer;
+    const Profile *activeProfile;
+    std::atomic<const Profile *> requestedProfile;
+    // each config change posted to the port task carries the next sequence number in the event's size
+    // the port task acknowledges it in reconfigureApplied, a late give can then not satisfy a later waiter
+    SemaphoreHandle_t reconfigureDone;
+    uint32_t reconfigureSequence;
+    std::atomic<uint32_t> reconfigureApplied;
+    static const uint32_t reconfigureTimeoutMs = 500;
+    // the reconfigure that replaces txBuffer, the server task leaves it alone until it is acknowledged
+    uint32_t txResizeSequence;
+    // only used on the port task, configured through the reconfigure event
+    FrameDecoder frameDecoder;
+    FrameDecoder::FrameHandler frameHandler;
+    // written by the server task before it posts the reconfigure event
+    FrameDecoder::Config requestedFraming;
+    std::atomic<bool> framingApplied;
+
+    // owned by the port task, the server task only reads the result once it is complete
+    TriggerCapture trigger;
+    TriggerCapture::Config requestedTrigger;
+    std::atomic<bool> triggerApplied;
+    // disarms are posted without waiting, the port task applies the config again while it is behind on them
+    std::atomic<uint32_t> triggerRequests;
+    std::atomic<uint32_t> triggerRequestsApplied;
+    // matched on the port task, hits are written to rxBuffer after the data they end in
+    PatternWatch watch;
+    PatternWatch::HitHandler watchHandler;
+    PatternWatch::Config requestedWatch;
+    uint8_t requestedWatchGeneration;
+    // tags the hits so ones from replaced patterns can be told apart
+    uint8_t watchGeneration;
+    std::atomic<bool> watchApplied;
+    int64_t watchTime;
+    // the port whose tx buffer the port task forwards received data to, port task only
+    Port *bridgePeer;
+    BridgeRewriter bridgeRewriter;
+    BridgeRewriter::OutputHandler bridgeHandler;
+    // written by the server task before it posts the bridge event
+    std::atomic<Port *> requestedBridgePeer;
+    BridgeRewriter::Config requestedRewrite;
+    std::atomic<bool> bridgeApplied;
+    // a peer whose tx the server task has handed over, the port task takes it or gives it back with endBridgedTx()
+    std::atomic<Port *> offeredBridgePeer;
+    // teardowns are posted without waiting, the port task applies the bridge again while it is behind on them
+    std::atomic<uint32_t> bridgeRequests;
+    std::atomic<uint32_t> bridgeRequestsApplied;
+    // the port whose port task fills txBuffer while it is bridged, write() then goes through injectBuffer
+    std::atomic<Port *> txBridgeSource;
+    // filled by write() on the server task, moved into txBuffer by the source's port task between the bridged data
+    ByteRingBuffer injectBuffer;
+    static const uint32_t injectBufferSize = 1024;
+    std::atomic<uint32_t> bridgeDroppedBytes;
+    // write() and breaks are refused and TX is not driven, so the port can listen on a line it does not own
+    std::atomic<bool> rxOnly;
+    // slack for the port task and server task to pass the data on, see getRxReportDelayUs()
+    static const uint32_t rxReportSlackUs = 20000;
+    // filled by the port task, drained by the server task
+    // holds records, each a RecordHeader followed by the payload
+    ByteRingBuffer rxBuffer;
+    static const uint32_t rxBufferSize = 1024 * 8;
+    // filled by write() on the server task, drained into the driver by the port task
+    ByteRingBuffer txBuffer;
+    // line format as last requested, kept together so mark / space parity can borrow a data bit
+    uint8_t dataBits;
+    uint8_t parity;
+    uint8_t stopBits;
+    // the data bit carrying emulated mark / space parity, 0 when the UART handles the parity
+    std::atomic<uint8_t> emulatedParityBit;
+    std::atomic<bool> emulatedParityMark;
+    // running total of bytes the continues read has taken from the driver, line events are placed with it
+    uint32_t rxStreamOffset;
+    // bits per character on the line, start and stop bits included
+    std::atomic<uint8_t> symbolBits;
+    std::atomic<bool> timestampsEnabled;
+    // port task only, the estimated start time of the byte at rxTimeOffset in the rx stream and the time per byte
+    int64_t rxTimeBase;
+    uint32_t rxTimeOffset;
+    uint32_t rxSymbolNs;
+    uint8_t rxTimeoutSymbols;
+    // a break waiting for the tx stream to reach breakTxPosition, set by the server task
+    std::atomic<bool> breakPending;
+    uint32_t breakTxPosition;
+    uint32_t breakDurationMs;
+    // the driver tx buffer, the port task only hands over a chunk once the previous one has gone out
+    static const uint32_t driverTxBufferSize = 1024;
+    char txChunk[driverTxBufferSize];
+    uint32_t txInFlight;
+    std::atomic<uint32_t> txQueuedTotal;
+    std::atomic<uint32_t> txCompletedTotal;
+    // tx pacing, set by the server task and applied by the port task as it hands data to the driver
+    std::atomic<uint32_t> txByteGapUs;
+    std::atomic<uint32_t> txLineGapMs;
+    std::atomic<uint32_t> txEchoTimeoutMs;
+    // port task only, the earliest time the next paced chunk may go to the driver
+    int64_t txPaceDue;
+    // a paced byte has gone, waiting for rxStreamOffset to move past txEchoOffset or for the deadline
+    bool txEchoWaiting;
+    uint32_t txEchoOffset;
+    int64_t txEchoDeadline;
+    uint32_t txEchoGapUs;
+    // the end of a pacing gap is spun rather than slept so the next byte goes on time
+    static const int64_t txPaceSpinUs = 2000;
+    // port task only, when the chunk handed to the driver finishes on the line
+    int64_t txChunkEnd;
+    // RS-485, set by the server task. the driver drives DE and the UART detects collisions, the port task holds TX for the turnaround
+    std::atomic<uint8_t> rs485Mode;
+    std::atomic<uint32_t> rs485TurnaroundUs;
+    // port task only, when the last byte from another node finished on the line
+    int64_t rs485RxEnd;
+    // received data ending this soon after our own chunk is taken as its echo
+    static const int64_t rs485EchoSlackUs = 1000;
+    std::atomic<uint32_t> rs485CollisionCount;
+
+    // a job owns the port while it runs on the port task
+    UartPortIO io;
+    // written by the server task while jobActive is clear, taken by the port task
+    std::shared_ptr<PortJob> job;
+    std::atomic<bool> jobActive;
+    std::atomic<bool> jobPending;
 
-    void resumeRead();
-    void suspendRead();
+    // event types posted by Port itself, placed after the driver's own types
+    static const int PortEventWake = UART_EVENT_MAX;
+    static const int PortEventReconfigure = UART_EVENT_MAX + 1;
+    static const int PortEventTxPending = UART_EVENT_MAX + 2;
+    static const int PortEventReadRequest = UART_EVENT_MAX + 3;
+    static const int PortEventJob = UART_EVENT_MAX + 4;
+    static const int PortEventTrigger = UART_EVENT_MAX + 5;
+    static const int PortEventWatch = UART_EVENT_MAX + 6;
+    static const int PortEventBridge = UART_EVENT_MAX + 7;
+    // posted to the peer of a bridge that ended, the size is how many injected bytes to drop
+    static const int PortEventBridgeEnd = UART_EVENT_MAX + 8;
+
+    // task draining the rx buffer, notified when new data is available
+    static TaskHandle_t consumerTask;
+
+    std::atomic<uint32_t> fifoOverflowCount;
+    std::atomic<uint32_t> driverBufferFullCount;
+    std::atomic<uint32_t> breakCount;
+    std::atomic<uint32_t> parityErrorCount;
+    std::atomic<uint32_t> frameErrorCount;
+
+    void postEvent(int eventType, uint32_t sequence = 0);
+    bool postConfig(int eventType);
+    void postConfigNoWait(int eventType, std::atomic<uint32_t> &requests);
+    void acknowledgeConfig(uint32_t sequence);
+    bool isTxResizing()
+    {
+        return (int32_t)(reconfigureApplied - txResizeSequence) < 0;
+    }
+    void applyTrigger();
+    void applyBridge();
+    void handleDataEvent(bool lineIdle);
+    void handleLineEvent(uint8_t event);
+    void writeLineEvent(uint8_t event);
+    void writePatternHit(uint8_t pattern, uint32_t offset);
+    // true while something needs the received data taken from the driver as it arrives
+    bool isRxWanted()
+    {
+        return continuesReadEnabled || trigger.isActive() || watch.isActive() || txEchoTimeoutMs != 0 || bridgePeer != nullptr;
+    }
+    bool isTxPaced()
+    {
+        return txByteGapUs != 0 || txLineGapMs != 0 || txEchoTimeoutMs != 0 || (rs485Mode != Rs485Off && rs485TurnaroundUs != 0);
+    }
+    void forwardData(uint8_t *data, uint32_t length);
+    void forwardToBridge(const uint8_t *data, uint32_t length);
+    // called on the source's port task
+    void writeBridged(const uint8_t *data, uint32_t length);
+    void moveInjected();
+    // called on the server task once the source's port task has stopped forwarding
+    void endBridgedTx();
+    void dropInjected(uint32_t length);
+    void forwardRecords(const uint8_t *data, uint32_t length);
+    void stripEmulatedParity(uint8_t *data, uint32_t length);
+    void applyEmulatedParity(uint8_t *data, uint32_t length);
+    bool applyLineFormat();
+    void transmitBreak();
+    void resumeIfThrottled();
+    bool writeRecord(uint8_t type, const uint8_t *payload, uint32_t length);
+    bool writeTimedRecord(const uint8_t *payload, uint32_t length);
+    void updateRxTime(bool lineIdle);
+    bool applyProfile(const Profile *profile);
+    bool applyRxTimeout();
+    void reconfigure();
+    void handleTx();
+    bool txPaceReady();
+    TickType_t txPaceWaitTime();
+    int64_t txDueTime();
+    void updateRs485RxEnd(bool lineIdle);
+    void checkRs485Collision();
+    bool applyRs485Mode();
+    uint32_t readPacedChunk(uint32_t limit, bool *lineEnd);
+    void schedulePacedChunk(uint32_t length, bool lineEnd);
+    bool waitTxDone();
+    TickType_t txDrainWaitTime();
+    void runJob();
+    void handlePendingRead();
+    TickType_t nextWakeTime();
 
     void readLoop();
     static void readLoop(void *arg);
     bool ready;
-    std::function<void(char *, uint16_t)> callback;
 public:
+    struct Stats
+    {
+        uint32_t rxBufferSize;
+        uint32_t rxBufferHighWaterMark;
+        uint32_t rxOverflowBytes;
+        uint32_t rxOverflowCount;
+        uint32_t fifoOverflowCount;
+        uint32_t driverBufferFullCount;
+        uint32_t breakCount;
+        uint32_t parityErrorCount;
+        uint32_t frameErrorCount;
+        uint32_t framesDecoded;
+        uint32_t badFrameCount;
+        // bridged data that did not fit in the tx buffer
+        uint32_t bridgeDroppedBytes;
+        uint32_t rs485CollisionCount;
+    };
+
+    // the kinds of record stored in the rx buffer
+    enum RecordType : uint8_t
+    {
+        // bytes as received
+        RecordTypeData = 0,
+        // one complete frame from the frame decoder
+        RecordTypeFrame,
+        // [u8 LineEvent][u32 rx stream offset], placed in the stream where the event happened
+        RecordTypeLineEvent,
+        // [u64 first byte start][u32 duration] in microseconds of esp_timer_get_time(), then the bytes
+        RecordTypeTimedData,
+        // [u8 watch generation][u8 pattern][u32 rx stream offset after the match][u64 time]
+        // then up to PatternWatch::contextSize bytes ending with the match
+        RecordTypePatternHit
+    };
+
+    static const uint32_t timedDataHeaderSize = 12;
+    static const uint32_t patternHitHeaderSize = 14;
+
+    enum LineEvent : uint8_t
+    {
+        LineEventParityError = 0,
+        LineEventFrameError,
+        LineEventBreak,
+        // received data was lost at this point
+        LineEventFifoOverflow,
+        // RS-485, what was sent did not match what was on the bus, the UART discards what it had received
+        LineEventCollision
+    };
 
+    enum ReadState
+    {
+        ReadStateIdle = 0,
+        // set by the server task, picked up by the port task
+        ReadStateRequested,
+        ReadStateActive,
+        ReadStateComplete,
+        ReadStateTimeout,
+        // the requester gave up, the port task returns to idle
+        ReadStateCancelled
+    };
+    static const uint32_t maxReadRequestSize = 512;
 
+private:
+    // a read requested by the server task and filled in by the port task
+    struct PendingRead
+    {
+        std::atomic<int> state;
+        uint32_t length;
+        uint32_t timeout;
+        uint32_t received;
+        int64_t deadline;
+        char buffer[maxReadRequestSize];
+    } pendingRead;
+
+    struct RecordHeader
+    {
+        uint8_t length[2];
+        uint8_t type;
+    };
+
+public:
     const uart_port_t portNum;
     const char *portName;
-    static const int reservedBufferHeadSpace = 1;
-    Port(const uart_port_t portNum, const char *name, int RXPin, int TXPin);
-    
-    int read(char *buf, uint32_t bufLen, int timeout);
-    
+    /**
+     * @param RTSPin -1 if not routed, hardware flow control is then not available
+     * @param DTRPin driven as a GPIO, -1 if not routed
+     */
+    Port(const uart_port_t portNum, const char *name, int RXPin, int TXPin, int RTSPin = -1, int CTSPin = -1, int DTRPin = -1);
+
+    /**
+     * ask the port task to read length bytes, the result is collected with getReadState()
+     * only one read can be in progress
+     * @param timeout max time in ms to wait for all the data
+     * @return false if a read is already in progress or length is too large
+     */
+    bool requestRead(uint32_t length, uint32_t timeout);
+
+    ReadState getReadState()
+    {
+        return (ReadState)pendingRead.state.load();
+    }
+
+    /**
+     * the data of a completed read, valid until finishRead() is called
+     */
+    const char *getReadData()
+    {
+        return pendingRead.buffer;
+    }
+
+    uint32_t getReadLength()
+    {
+        return pendingRead.received;
+    }
+
+    /**
+     * release a completed or timed out read so another can be requested
+     */
+    void finishRead();
+
+    /**
+     * abandon a read that may still be in progress
+     */
+    void cancelRead();
+
+    /**
+     * queues data for the port task to send, does not wait for it to be sent
+     * all of src is queued or none of it
+     * @return len or 0 if the tx queue does not have room
+     */
     int write(char *src, uint32_t len);
+
+    /**
+     * running total of bytes accepted by write()
+     */
+    uint32_t getTxQueuedTotal()
+    {
+        return txQueuedTotal;
+    }
+
+    /**
+     * running total of bytes that have left the UART
+     */
+    uint32_t getTxCompletedTotal()
+    {
+        return txCompletedTotal;
+    }
+
+    uint32_t getTxQueueFreeSpace()
+    {
+        if (txBridgeSource != nullptr)
+        {
+            return injectBuffer.freeSpace();
+        }
+        return isTxResizing() ? 0 : txBuffer.freeSpace();
+    }
+
+    /**
+     * the tx queued total write() can accept up to right now, the transmit credit advertised to the client
+     * compare with wrapped differences like the other running totals
+     */
+    uint32_t getTxLimit()
+    {
+        return txQueuedTotal + getTxQueueFreeSpace();
+    }
+
+    struct TxPacing
+    {
+        // idle time after each byte
+        uint32_t byteGapUs;
+        // idle time after each \r, \n or \r\n, in place of the byte gap
+        uint32_t lineGapMs;
+        // after each byte wait up to this long for a byte to be received before the gap starts, 0 to not wait
+        uint32_t echoTimeoutMs;
+    };
+
+    static const uint32_t maxTxByteGapUs = 1000000;
+    static const uint32_t maxTxLineGapMs = 10000;
+    static const uint32_t maxTxEchoTimeoutMs = 10000;
+
+    /**
+     * spaces out the data queued by write() on the port task, all 0 sends it at the line rate
+     * while the echo wait is on the port task takes RX data even when continues read is off
+     * @return false if a value is out of range
+     */
+    bool setTxPacing(const TxPacing &pacing);
+
+    /**
+     * for passive listening, TX is released to high impedance and write() and sendBreak() are refused
+     * a port without its own pins (UART 0) only refuses the writes
+     */
+    bool setRxOnly(bool enabled);
+
+    bool isRxOnly()
+    {
+        return rxOnly;
+    }
+
+    enum Rs485Mode : uint8_t
+    {
+        Rs485Off = 0,
+        // the transceiver's DE and /RE are wired to the RTS pin
+        Rs485DeOnRts,
+        // wired to the DTR pin instead, the UART's RTS signal is routed there
+        Rs485DeOnDtr
+    };
+
+    struct Rs485Config
+    {
+        uint8_t mode;
+        // idle time after the last byte from another node before this port transmits
+        uint32_t turnaroundUs;
+    };
+
+    static const uint32_t maxRs485TurnaroundUs = 1000000;
+
+    /**
+     * half duplex RS-485, the driver asserts DE for exactly as long as it is sending and the UART
+     * does not start a byte while it is receiving one. what is sent is checked against the bus when
+     * the receiver stays enabled, a mismatch is counted and reported as LineEventCollision
+     * the turnaround is kept by the port task for data from write(), jobs time their own writes
+     * @return false if the mode is unknown, the DE pin is not routed or RTS / CTS flow control is on
+     */
+    bool setRs485(const Rs485Config &config);
+
+    bool isRs485Enabled()
+    {
+        return rs485Mode != Rs485Off;
+    }
+
+    /**
+     * the longest received data can take to reach the rx buffer after it starts arriving
+     * it waits in the FIFO for the rx timeout or full threshold of the profile, plus time for the tasks to pass it on
+     * records from two ports can be put in time order once they are this old
+     */
+    uint32_t getRxReportDelayUs();
+
+    /**
+     * forwards everything received on this port to the TX of peer on the port task, without the server task
+     * call on both ports for a two way bridge, nullptr stops forwarding
+     * the received data still goes to subscribers and is still taken while continues read is off
+     * while data is forwarded to a port its write() is injected into the bridged stream, and
+     * its write completions count the bridged data too
+     * with flow control on the sender is held off while the peer's tx buffer is full, otherwise the excess is dropped
+     * waits for the port task to apply it, stopping with nullptr does not wait and always returns true
+     * @param rewrite rules applied to the forwarded data
+     * @return false if the peer is this port or not set up, either is running a job, the rules are over the limits,
+     * or the port task did not apply it in time, it is then undone once the port task is free
+     */
+    bool setBridge(Port *peer, const BridgeRewriter::Config &rewrite);
+
+    static const uint32_t maxBreakMs = 1000;
+
+    /**
+     * holds TX in the break (space) state for durationMs once the data already queued by write() has gone out
+     * data written after this waits for the break to finish
+     * @return false if a break is already waiting or the duration is out of range
+     */
+    bool sendBreak(uint32_t durationMs);
+
+    /**
+     * hands the port to the job, it runs on the port task until it finishes
+     * reads, writes and continues read are paused while it runs
+     * @return false if another job is already running
+     */
+    bool startJob(const std::shared_ptr<PortJob> &newJob);
+
+    bool isJobActive()
+    {
+        return jobActive;
+    }
     
     void startContinuesRead();
     
@@ -62,10 +570,112 @@ public:
     
     bool setBandRate(uint32_t value);
 
-    void setContinuesReadOnDataCallback(std::function<void(char *, uint16_t)>  cb)
+    /**
+     * switch to one of the entries in profiles
+     * the driver buffer is resized by the port task, this waits for that to finish
+     * while a job runs it is resized after the job and false is returned
+     */
+    bool setProfile(uint8_t profileIndex);
+
+    uint32_t getReadChunkSize()
+    {
+        return requestedProfile.load()->readChunkSize;
+    }
+
+    /**
+     * split received data into frames on the port task, see FrameDecoder
+     * waits for the port task to apply it, while a job runs it is applied after the job and false is returned
+     */
+    bool setFraming(const FrameDecoder::Config &config);
+
+    /**
+     * arms (or with config.triggers 0 disarms) a trigger capture, see TriggerCapture
+     * while armed the port task takes RX data even when continues read is off
+     * waits for the port task to apply it, while a job runs it is applied after the job and false is returned
+     */
+    bool setTrigger(const TriggerCapture::Config &config);
+
+    /**
+     * disarms the trigger capture without waiting, the port task applies it once it is free
+     */
+    void clearTrigger();
+
+    TriggerCapture::State getTriggerState()
     {
-        callback = cb;
+        return trigger.getState();
+    }
+
+    /**
+     * the size of the captured window once getTriggerState() is StateComplete
+     */
+    uint32_t getTriggerResultSize()
+    {
+        return trigger.getResultSize();
+    }
+
+    /**
+     * copies the captured window, see TriggerCapture::readResult()
+     */
+    uint32_t readTriggerResult(uint8_t *dst, uint32_t size)
+    {
+        return trigger.readResult(dst, size);
+    }
+
+    /**
+     * replaces the patterns matched against the received data, see PatternWatch
+     * while any are set the port task takes RX data even when continues read is off
+     * and hits are collected from the rx records
+     * @param generation copied into each RecordTypePatternHit
+     * waits for the port task to apply it, while a job runs it is applied after the job and false is returned
+     */
+    bool setPatternWatch(const PatternWatch::Config &config, uint8_t generation);
+
+    bool isWatchActive()
+    {
+        return watch.isActive();
+    }
+
+    /**
+     * the task to notify with xTaskNotifyGive when data is added to the rx buffer
+     */
+    static void setConsumerTask(TaskHandle_t task)
+    {
+        consumerTask = task;
+    }
+
+    /**
+     * wakes the consumer task so it picks up new data or state
+     */
+    static void notifyConsumer()
+    {
+        if (consumerTask != nullptr)
+        {
+            xTaskNotifyGive(consumerTask);
+        }
+    }
+
+    bool isContinuesReadEnabled()
+    {
+        return continuesReadEnabled;
     };
+
+    /**
+     * the type and payload length of the next record collected by the continues read task
+     * must only be called from a single task
+     * @return false if there are no records waiting
+     */
+    bool peekRecord(uint8_t *type, uint32_t *length);
+
+    /**
+     * removes the next record, copying up to bufLen bytes of its payload
+     * must only be called from the task calling peekRecord()
+     * @return the number of bytes copied
+     */
+    uint32_t readRecord(char *buf, uint32_t bufLen);
+
+    Stats getStats();
+    void resetStats();
+
     bool init();
 
     enum PortParity
@@ -77,6 +687,10 @@ public:
         ParitySpace
     };
 
+    /**
+     * the UART has no mark / space parity, below 8 data bits it is sent and checked as an extra data bit
+     * with 8 data bits mark parity is sent as an extra stop bit and space parity is not available
+     */
     bool setParity(PortParity parity);
 
     enum PortStopBits
@@ -86,5 +700,47 @@ public:
     };
 
     bool setStopBits(PortStopBits portStopBits);
+
+    enum FlowControl
+    {
+        FlowControlNone = 0,
+        // RTS is deasserted and CTS pauses tx
+        FlowControlRtsCts,
+        // XOFF / XON are sent and obeyed by the UART itself
+        FlowControlXonXoff
+    };
+
+    /**
+     * while flow control is on received data is never dropped, the port stops draining the driver when
+     * the rx buffer or a subscriber falls behind so the UART holds off the sender instead
+     * @return false if the mode is unknown or the port has no RTS / CTS pins for hardware flow control
+     * RTS / CTS is refused while RS-485 is on, both need RTS
+     */
+    bool setFlowControl(FlowControl mode);
+
+    bool isFlowControlEnabled()
+    {
+        return flowControl != FlowControlNone;
+    }
+
+    enum ModemLines : uint8_t
+    {
+        ModemLineDTR = 1,
+        ModemLineRTS = 2
+    };
+
+    /**
+     * sets the modem control outputs, a set bit asserts the line
+     * RTS is left alone while hardware flow control or RS-485 drives it, as is DTR while it is the RS-485 DE pin
+     */
+    bool setModemLines(uint8_t lines);
+
+    enum StreamFlags : uint8_t
+    {
+        // data is sent as RecordTypeTimedData, only while framing is off
+        StreamFlagTimestamps = 1
+    };
+
+    bool setStreamFlags(uint8_t flags);
 };
 #endif
\ No newline at end of file
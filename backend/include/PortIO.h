@@ -0,0 +1,130 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PORT_IO_H
+#define PORT_IO_H
+#include <stdint.h>
+extern "C"
+{
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "driver/gpio.h"
+#include "freertos/queue.h"
+}
+
+// blocking byte transport used by port jobs
+// jobs only talk to the line through this so they do not depend on the UART driver
+class PortIO
+{
+public:
+    virtual ~PortIO() {}
+
+    /**
+     * hands the data to the transport, returns once it has all been accepted
+     */
+    virtual bool write(const uint8_t *data, uint32_t length) = 0;
+
+    /**
+     * waits for everything written to leave the transport
+     */
+    virtual bool waitWriteDone(uint32_t timeoutMs) = 0;
+
+    /**
+     * waits up to timeoutMs for length bytes
+     * @return the number of bytes read, less than length on a timeout
+     */
+    virtual int read(uint8_t *dst, uint32_t length, uint32_t timeoutMs) = 0;
+
+    /**
+     * discards anything received that has not been read
+     */
+    virtual void flushInput() = 0;
+
+    virtual bool setBaudRate(uint32_t baudRate) = 0;
+    virtual uint32_t getBaudRate() = 0;
+
+    /**
+     * drives the modem control outputs, active means the line is asserted (low)
+     */
+    virtual bool setDTR(bool active) = 0;
+    virtual bool setRTS(bool active) = 0;
+
+    virtual void delay(uint32_t ms) = 0;
+
+    /**
+     * waits with microsecond accuracy, for timing between modem line edges
+     */
+    virtual void delayMicros(uint32_t us) = 0;
+
+    struct PulseTiming
+    {
+        // shortest low and high pulses seen on RX, in clockHz cycles
+        uint32_t lowCycles;
+        uint32_t highCycles;
+        uint32_t edges;
+        uint32_t clockHz;
+    };
+
+    /**
+     * times the pulses on RX until minEdges edges have been seen or timeoutMs passes
+     * @return false if the transport can not time its input
+     */
+    virtual bool measurePulses(uint32_t minEdges, uint32_t timeoutMs, PulseTiming *out) = 0;
+
+    /**
+     * @return the framing, parity and break errors seen on RX since the last call
+     */
+    virtual uint32_t takeLineErrors() = 0;
+};
+
+// PortIO on an installed UART driver, only used from the port task
+class UartPortIO : public PortIO
+{
+public:
+    /**
+     * @param dtrPin a GPIO driven as DTR, -1 to use the UART's own DTR signal
+     */
+    UartPortIO(uart_port_t portNum, int dtrPin = -1) : portNum(portNum), dtrPin(dtrPin), eventQueue(nullptr) {}
+
+    /**
+     * the driver's event queue, read for line errors while a job has the port
+     */
+    void setEventQueue(QueueHandle_t *queue)
+    {
+        eventQueue = queue;
+    }
+
+    bool write(const uint8_t *data, uint32_t length) override;
+    bool waitWriteDone(uint32_t timeoutMs) override;
+    int read(uint8_t *dst, uint32_t length, uint32_t timeoutMs) override;
+    void flushInput() override;
+    bool setBaudRate(uint32_t baudRate) override;
+    uint32_t getBaudRate() override;
+    bool setDTR(bool active) override;
+    bool setRTS(bool active) override;
+    void delay(uint32_t ms) override;
+    void delayMicros(uint32_t us) override;
+    bool measurePulses(uint32_t minEdges, uint32_t timeoutMs, PulseTiming *out) override;
+    uint32_t takeLineErrors() override;
+
+private:
+    const uart_port_t portNum;
+    const int dtrPin;
+    QueueHandle_t *eventQueue;
+};
+#endif
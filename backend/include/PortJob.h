@@ -0,0 +1,171 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PORT_JOB_H
+#define PORT_JOB_H
+#include <stdint.h>
+#include <atomic>
+#include "ByteRingBuffer.h"
+#include "PortIO.h"
+extern "C"
+{
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+}
+
+// a multi step operation run by the port task, such as flashing a device
+// while it runs the job has the port to itself and the server task only feeds it input and reports progress
+class PortJob
+{
+public:
+    enum JobType : uint8_t
+    {
+        JobTypeStm32Bootloader = 0,
+        JobTypeEspRomFlash,
+        JobTypeModemSequence,
+        JobTypeAutoBaud,
+        JobTypeScript,
+        JobTypeReplay
+    };
+
+    enum State : uint8_t
+    {
+        StateQueued = 0,
+        StateRunning,
+        StateComplete,
+        StateFailed,
+        StateCancelled
+    };
+
+    struct Progress
+    {
+        uint8_t state;
+        // job specific step
+        uint8_t stage;
+        uint32_t processed;
+        uint32_t total;
+        // running total of input bytes taken by the job, the client uses it to pace the input
+        uint32_t inputConsumed;
+    };
+
+    PortJob();
+    virtual ~PortJob();
+
+    /**
+     * sets up the input buffer, must be called before the job is started
+     */
+    bool init(uint32_t inputBufferSize);
+
+    /**
+     * port task: runs the job to completion
+     */
+    void run(PortIO &io);
+
+    /**
+     * server task: adds data for the job, all of it or nothing
+     */
+    bool writeInput(const uint8_t *data, uint32_t length);
+
+    uint32_t getInputBufferSize()
+    {
+        return input.size();
+    }
+
+    /**
+     * server task: asks the job to stop, it finishes as cancelled at its next check
+     */
+    void cancel();
+
+    bool isFinished()
+    {
+        return state >= StateComplete;
+    }
+
+    Progress getProgress();
+
+    /**
+     * the reason the job failed, only valid once the state is StateFailed
+     */
+    const char *getError()
+    {
+        return error;
+    }
+
+    /**
+     * copies out what the job found, only valid once the state is StateComplete
+     * @return the number of bytes written to dst
+     */
+    virtual uint32_t getResult(uint8_t *dst, uint32_t size)
+    {
+        return 0;
+    }
+
+    /**
+     * the most getResult() can write, jobs with a result under 64 bytes can leave this as 0
+     */
+    virtual uint32_t getResultSize()
+    {
+        return 0;
+    }
+
+protected:
+    /**
+     * the job itself, called on the port task
+     * @return false on failure, with the reason set by fail()
+     */
+    virtual bool execute(PortIO &io) = 0;
+
+    /**
+     * waits for the server task to supply len bytes of input
+     */
+    bool readInput(uint8_t *dst, uint32_t len, uint32_t timeoutMs);
+
+    /**
+     * reads from the line in short slices so a cancel is noticed during long waits
+     * @return the number of bytes read
+     */
+    int receive(PortIO &io, uint8_t *dst, uint32_t len, uint32_t timeoutMs);
+
+    bool fail(const char *reason)
+    {
+        error = reason;
+        return false;
+    }
+
+    bool isCancelled()
+    {
+        return cancelRequested;
+    }
+
+    void setStage(uint8_t stage);
+    void setProgress(uint32_t processed, uint32_t total);
+
+private:
+    // filled by the server task, drained by the port task
+    ByteRingBuffer input;
+    SemaphoreHandle_t inputReady;
+    std::atomic<uint8_t> state;
+    std::atomic<uint8_t> stage;
+    std::atomic<uint32_t> processed;
+    std::atomic<uint32_t> total;
+    std::atomic<uint32_t> inputConsumed;
+    std::atomic<bool> cancelRequested;
+    const char *error;
+    // how often waits check for a cancel
+    static const uint32_t cancelCheckIntervalMs = 100;
+};
+#endif
@@ -18,6 +18,8 @@
 #ifndef PORT_MANAGER_H
 #define PORT_MANAGER_H
 #include "Port.h"
+#include "PortSubscription.h"
+#include <list>
 //Manages the Port instances  
 class PortManager
 {
@@ -27,11 +29,61 @@ public:
     static const Port *requestOwnershipTakeover(const char *portName);
     static bool releaseOwnership(Port *port);
 
+    /**
+     * find a port by name without taking ownership
+     */
+    static Port *findPort(const char *portName);
+
+    /**
+     * adds a receiver of the port's data, any number of subscriptions can exist for a port
+     */
+    static bool subscribe(Port *port, PortSubscription *subscription);
+    static void unsubscribe(PortSubscription *subscription);
+    /**
+     * turns delivery on or off for the subscription
+     * the port reads continuously while any subscription is enabled
+     */
+    static void setSubscriptionEnabled(PortSubscription *subscription, bool enabled);
+
+    /**
+     * replaces the patterns the subscriber is sent MessageTypeAsyncPatternHit messages for, none stops watching
+     * the port matches the patterns of all its subscribers in one pass
+     * @return false if the port's patterns together would be over the PatternWatch limits or could not be applied
+     */
+    static bool setWatchPatterns(PortSubscription *subscription, const std::vector<std::string> &patterns);
+
+    /**
+     * call when the port starts or stops being recorded by CaptureLog
+     * a recorded port reads continuously even with no subscriptions
+     */
+    static void updateRecording(Port *port);
+
+    /**
+     * moves received data from each port into its subscriptions
+     * must be called from the server task
+     */
+    static void process();
+
     static void init();
 
 private:
     static int indexOfPort(const char *portName);
+    static void updateContinuesRead(int index);
+    // empties the port's rx buffer, still passing on the pattern hits in it
+    static void dropBuffered(int index);
+    static PortSubscription::Chunk readChunk(Port *port);
+    static void recordChunk(Port *port, const PortSubscription::Chunk &chunk);
+    static bool updateWatch(int index);
+    static void routePatternHit(int index, const PortSubscription::Chunk &chunk);
+    // true if an enabled subscriber of the port is too far behind to take more data
+    static bool isBackedUp(int index);
     static bool portLock[];
+    static std::list<PortSubscription *> subscriptions[];
+    static uint8_t watchGeneration[];
+    // built on the server task, too large for its stack
+    static PatternWatch::Config watchConfig;
+    // max number of chunks taken from a port per call to process()
+    static const int maxChunksPerProcess = 4;
 };
 
 #endif
\ No newline at end of file
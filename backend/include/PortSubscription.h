@@ -0,0 +1,95 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PORT_SUBSCRIPTION_H
+#define PORT_SUBSCRIPTION_H
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <deque>
+#include <vector>
+#include "ClientMessageEncoding.h"
+
+class Port;
+// a connection's view of the data received on a port
+// filled by PortManager::process() and drained by the connection, both on the server task
+class PortSubscription
+{
+public:
+    // one block of received data, shared by every subscriber
+    // it holds a complete async data message, the first byte is the message type
+    // the rest of the header is filled in by each connection just before it sends the chunk
+    typedef std::shared_ptr<std::string> Chunk;
+    // bytes at the start of each chunk reserved for the message header
+    static const uint32_t chunkHeaderSize = MessageEncoding::maxResponseHeaderSize;
+
+    PortSubscription() : port(nullptr), enabled(false), watchBase(0), queuedBytes(0), lostBytes(0) {}
+
+    Port *port;
+    // true when the subscriber wants the data
+    bool enabled;
+    // set with PortManager::setWatchPatterns(), hits are pushed even while the data is not enabled
+    std::vector<std::string> watchPatterns;
+    // the port's index for the first of watchPatterns
+    uint8_t watchBase;
+
+    /**
+     * adds the chunk, if the subscriber is too far behind the chunk is dropped and counted as lost
+     * @return false if the chunk was dropped
+     */
+    bool push(const Chunk &chunk);
+
+    bool empty()
+    {
+        return chunks.empty();
+    }
+
+    const Chunk &front()
+    {
+        return chunks.front();
+    }
+
+    void pop();
+
+    /**
+     * drops the front chunk, counted as lost the same as one push() could not take
+     */
+    void popLost();
+
+    /**
+     * true once the subscriber is far enough behind that flow control should hold off the sender
+     */
+    bool isBackedUp()
+    {
+        return queuedBytes >= maxQueuedBytes / 2;
+    }
+
+    void clear();
+
+    /**
+     * the number of received bytes dropped since the last call, dropped line events and pattern hits are not counted
+     */
+    uint32_t takeLostBytes();
+
+private:
+    std::deque<Chunk> chunks;
+    uint32_t queuedBytes;
+    uint32_t lostBytes;
+    // how far a subscriber can fall behind before its data is dropped
+    static const uint32_t maxQueuedBytes = 1024 * 16;
+};
+#endif
@@ -0,0 +1,94 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef REPLAY_JOB_H
+#define REPLAY_JOB_H
+#include "PortJob.h"
+#include "ByteRingBuffer.h"
+#include "CaptureLog.h"
+
+// plays a recording back into the port with its original timing, to reproduce a field failure on the bench
+//
+// the input is imageLength bytes of CaptureLog records in time order, as downloaded from the capture log
+// TX records are sent when they are due, RX records are what the device under test is expected to answer
+// and are compared byte for byte with what it actually sends back. other record types are skipped
+// the schedule runs off esp_timer, the bytes of one record go out back to back at the line rate
+class ReplayJob : public PortJob
+{
+public:
+    enum Stage : uint8_t
+    {
+        StageReplaying = 0,
+        // the last TX record has gone, collecting the rest of the answer
+        StageTail
+    };
+
+    // params [u32 time scale][u32 tail ms]
+    // the time scale is in 1/1000, 1000 plays at the recorded speed, 2000 takes twice as long
+    static const uint32_t paramsSize = 8;
+    static const uint32_t inputBufferSize = 16 * 1024;
+    static const uint8_t maxDivergences = 16;
+    // [u32 tx bytes][u32 rx bytes expected][u32 rx bytes received][u32 mismatched bytes][u32 latest send us][u8 divergence count]
+    // then [u32 rx offset][u8 expected][u8 received] for the first mismatches
+    // expected bytes the device had still not sent by the time the compare buffer filled count as mismatched
+    static const uint32_t resultHeaderSize = 21;
+    static const uint32_t divergenceSize = 6;
+
+    ReplayJob(uint32_t recordingSize);
+
+    /**
+     * @return false if the params are missing or the time scale is 0
+     */
+    bool setParams(const uint8_t *params, uint32_t length);
+
+    uint32_t getResult(uint8_t *dst, uint32_t size) override;
+    uint32_t getResultSize() override
+    {
+        return resultHeaderSize + maxDivergences * divergenceSize;
+    }
+
+protected:
+    bool execute(PortIO &io) override;
+
+private:
+    struct Divergence
+    {
+        uint32_t offset;
+        uint8_t expected;
+        uint8_t received;
+    };
+
+    const uint32_t recordingSize;
+    uint32_t timeScale;
+    uint32_t tailMs;
+    // RX from the recording and from the line, compared as both arrive
+    ByteRingBuffer expected;
+    ByteRingBuffer received;
+    uint32_t txBytes;
+    uint32_t rxExpected;
+    uint32_t rxReceived;
+    uint32_t rxCompared;
+    uint32_t mismatches;
+    uint32_t maxLateUs;
+    Divergence divergences[maxDivergences];
+    uint8_t divergenceCount;
+    uint8_t data[CaptureLog::maxRecordData];
+
+    void collect(PortIO &io, uint32_t timeoutMs);
+    void compare();
+    void waitUntil(PortIO &io, int64_t time);
+};
+#endif
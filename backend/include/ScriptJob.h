@@ -0,0 +1,136 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SCRIPT_JOB_H
+#define SCRIPT_JOB_H
+#include "PortJob.h"
+
+// runs a send / expect / delay script on the port task, for example modem provisioning
+// so each step costs line time rather than a round trip to the browser
+//
+// the script is the job input, imageLength bytes of steps. each step is a u8 Op followed by its
+// arguments, little endian. jump and loop targets are step numbers counting from 0
+// the whole script is checked before any of it runs
+class ScriptJob : public PortJob
+{
+public:
+    enum Flags : uint8_t
+    {
+        // put the baud rate back once the script finishes
+        FlagRestoreBaudRate = 1
+    };
+
+    enum Op : uint8_t
+    {
+        // [u16 length][data] sends the data and waits for it to go out
+        OpWrite = 0,
+        // [u16 timeoutMs][u8 ExpectFlags][u8 length][pattern] reads until the pattern is received
+        // with no pattern it reads until the timeout
+        OpExpect,
+        // [u32 us]
+        OpDelay,
+        // [u16 count] runs the steps up to the matching OpEndLoop count times
+        OpLoop,
+        OpEndLoop,
+        // [u32 periodUs][u16 count][u16 length][data] sends the data count times on a fixed schedule
+        OpWritePeriodic,
+        // [u8 ModemSequenceJob::LineBits]
+        OpSetLines,
+        // [u32 baud rate]
+        OpSetBaudRate,
+        // discards anything received so far
+        OpFlushInput,
+        // [u8 JumpCondition][u16 step] must stay inside the loop it is in
+        OpJump
+    };
+
+    enum ExpectFlags : uint8_t
+    {
+        // a timeout carries on to the next step instead of failing the script
+        ExpectOptional = 1
+    };
+
+    enum JumpCondition : uint8_t
+    {
+        JumpAlways = 0,
+        // the last OpExpect received its pattern
+        JumpIfMatched,
+        JumpIfTimedOut
+    };
+
+    enum Stage : uint8_t
+    {
+        StageLoading = 0,
+        StageRunning
+    };
+
+    static const uint32_t maxScriptSize = 8 * 1024;
+    static const uint32_t maxSteps = 1024;
+    static const uint8_t maxPatternLength = 32;
+    static const uint8_t maxLoopDepth = 4;
+    static const uint32_t inputBufferSize = 1024;
+    // bytes received by OpExpect steps kept for the result
+    static const uint32_t maxCapture = 1024;
+    // [u32 steps run][u32 received bytes that did not fit in the capture] then the captured bytes
+    static const uint32_t resultHeaderSize = 8;
+
+    ScriptJob(uint8_t flags, uint32_t scriptSize);
+    ~ScriptJob();
+
+    uint32_t getResult(uint8_t *dst, uint32_t size) override;
+    uint32_t getResultSize() override
+    {
+        return resultHeaderSize + maxCapture;
+    }
+
+protected:
+    bool execute(PortIO &io) override;
+
+private:
+    struct StepInfo
+    {
+        uint16_t offset;
+        // the step number of the innermost OpLoop around the step, noLoop if none
+        // an OpEndLoop is inside the loop it ends
+        uint16_t loop;
+    };
+
+    struct LoopState
+    {
+        uint16_t step;
+        uint16_t remaining;
+    };
+
+    static const uint16_t noLoop = 0xFFFF;
+
+    const uint8_t flags;
+    const uint32_t scriptSize;
+    uint8_t *script;
+    StepInfo *steps;
+    uint32_t stepCount;
+    uint32_t stepsRun;
+    uint8_t *capture;
+    uint32_t captureLength;
+    uint32_t captureDropped;
+
+    bool load();
+    bool validate();
+    bool run(PortIO &io);
+    bool expect(PortIO &io, const uint8_t *pattern, uint8_t length, uint32_t timeoutMs);
+    bool write(PortIO &io, const uint8_t *data, uint32_t length);
+    void waitUntil(PortIO &io, int64_t time);
+};
+#endif
@@ -28,6 +28,7 @@ class SimpleHTTPWebSocketClient : public ClientConnection
 private:
     const ServerConnection *conn;
 
+    bool canWriteMessage();
     bool writeMessage(const char *payload, const int payloadSize,bool block);
     bool writeErrorMessage(MessageDecoder::MessageType msgType, std::string& erroMessage);
 
@@ -0,0 +1,79 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STM32_BOOTLOADER_JOB_H
+#define STM32_BOOTLOADER_JOB_H
+#include "PortJob.h"
+
+// programs an STM32 through its ROM bootloader (ST AN3155)
+// the port must already be set to 8 data bits and even parity
+// the image is streamed in as blocks of [u32 address][u16 length][data], length up to maxBlockSize
+class Stm32BootloaderJob : public PortJob
+{
+public:
+    enum Flags : uint8_t
+    {
+        FlagErase = 1,
+        FlagWrite = 2,
+        // read back each block and compare it, after writing it if FlagWrite is also set
+        FlagVerify = 4,
+        FlagGo = 8
+    };
+
+    enum Stage : uint8_t
+    {
+        StageSync = 0,
+        StageErase,
+        StageWrite,
+        StageVerify,
+        StageGo
+    };
+
+    static const uint32_t maxBlockSize = 256;
+    static const uint32_t blockHeaderSize = 6;
+    static const uint32_t inputBufferSize = 1024 * 4;
+
+    /**
+     * @param goAddress where execution starts when FlagGo is set
+     * @param imageLength total data bytes in the streamed blocks, not counting block headers
+     */
+    Stm32BootloaderJob(uint8_t flags, uint32_t goAddress, uint32_t imageLength);
+
+protected:
+    bool execute(PortIO &io) override;
+
+private:
+    const uint8_t flags;
+    const uint32_t goAddress;
+    const uint32_t imageLength;
+    bool extendedErase;
+    uint8_t block[maxBlockSize];
+    uint8_t readBack[maxBlockSize];
+    char errorMessage[64];
+
+    bool sync(PortIO &io);
+    bool waitAck(PortIO &io, uint32_t timeoutMs);
+    bool sendWithChecksum(PortIO &io, const uint8_t *data, uint32_t length, uint8_t initial, uint32_t ackTimeoutMs);
+    bool sendCommand(PortIO &io, uint8_t command);
+    bool sendAddress(PortIO &io, uint32_t address);
+    bool getCommands(PortIO &io);
+    bool eraseAll(PortIO &io);
+    bool writeMemory(PortIO &io, uint32_t address, const uint8_t *data, uint32_t length);
+    bool readMemory(PortIO &io, uint32_t address, uint8_t *dst, uint32_t length);
+    bool go(PortIO &io, uint32_t address);
+};
+#endif
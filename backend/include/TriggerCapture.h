@@ -0,0 +1,136 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef TRIGGER_CAPTURE_H
+#define TRIGGER_CAPTURE_H
+#include <stdint.h>
+#include <atomic>
+
+// keeps the recent RX / TX traffic of a port and freezes a window around a trigger, like a logic analyser
+// runs on the port task, only the finished window is sent to the client
+class TriggerCapture
+{
+public:
+    enum Trigger : uint8_t
+    {
+        // the pattern is seen in the received data
+        TriggerPattern = 1,
+        // parity, framing or FIFO overflow error
+        TriggerLineError = 2,
+        TriggerBreak = 4
+    };
+
+    enum State : uint8_t
+    {
+        StateIdle = 0,
+        // recording the pre trigger window and watching for the trigger
+        StateArmed,
+        // filling the post trigger window
+        StateTriggered,
+        // the window is ready for readResult()
+        StateComplete
+    };
+
+    // the first byte of each captured entry, the second is the data byte or the Port::LineEvent
+    enum EntryFlag : uint8_t
+    {
+        EntryFlagTx = 1,
+        EntryFlagLineEvent = 2
+    };
+
+    static const uint8_t maxPatternLength = 16;
+    // max entries before and after the trigger together
+    static const uint16_t maxWindow = 4096;
+    // [u8 Trigger that fired][u64 trigger time us][u16 entries before][u16 entries after]
+    static const uint32_t resultHeaderSize = 13;
+
+    struct Config
+    {
+        // Trigger flags, 0 disarms
+        uint8_t triggers;
+        // entries kept from before the trigger, the triggering entry is the last of them
+        uint16_t preEntries;
+        uint16_t postEntries;
+        uint8_t patternLength;
+        uint8_t pattern[maxPatternLength];
+    };
+
+    TriggerCapture();
+    ~TriggerCapture();
+
+    /**
+     * arms with the config, or disarms and frees the window if config.triggers is 0
+     * @return false if the config is not valid or the window could not be allocated
+     */
+    bool configure(const Config &config);
+
+    State getState()
+    {
+        return (State)state.load();
+    }
+
+    /**
+     * true while traffic needs to be fed in
+     */
+    bool isActive()
+    {
+        auto current = state.load();
+        return current == StateArmed || current == StateTriggered;
+    }
+
+    /**
+     * adds data sent or received at time
+     * @return true if this completed the window
+     */
+    bool feed(const uint8_t *data, uint32_t length, bool tx, int64_t time);
+
+    /**
+     * adds a line event at its place in the received data
+     * @return true if this completed the window
+     */
+    bool lineEvent(uint8_t event, bool isBreak, int64_t time);
+
+    /**
+     * size of the result, only valid in StateComplete
+     */
+    uint32_t getResultSize();
+
+    /**
+     * copies the header then the entries oldest first, only valid in StateComplete
+     * @return the number of bytes copied
+     */
+    uint32_t readResult(uint8_t *dst, uint32_t size);
+
+private:
+    Config config;
+    // preEntries ring then postEntries, 2 bytes per entry
+    uint8_t *window;
+    uint16_t preHead;
+    uint16_t preCount;
+    uint16_t postCount;
+    // pattern bytes matched so far and the KMP fallback for each length
+    uint8_t matched;
+    uint8_t fallback[maxPatternLength];
+    uint8_t firedTrigger;
+    int64_t triggerTime;
+    std::atomic<uint8_t> state;
+
+    bool add(uint8_t flags, uint8_t value);
+    bool fire(uint8_t trigger, int64_t time);
+    void release();
+};
+
+#endif
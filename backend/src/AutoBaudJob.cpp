@@ -0,0 +1,159 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "AutoBaudJob.h"
+#include "esp_log.h"
+
+static const uint32_t standardBaudRates[] = {1200, 2400, 4800, 9600, 14400, 19200, 28800, 38400, 57600, 74880, 115200, 230400, 250000, 460800, 500000, 921600, 1000000, 1500000, 2000000};
+// enough edges for a few characters, so at least one single bit pulse is likely to be seen
+static const uint32_t measureEdges = 48;
+static const uint32_t measureTimeoutMs = 300;
+// with fewer edges than this there was no real traffic to time
+static const uint32_t minEdges = 6;
+// how far the pulse may be from a standard rate and still count as it, a UART tolerates a few percent each side
+static const uint32_t tolerancePercent = 6;
+// the data may have no lone bits, so the shortest pulse is also tried as two and three bits
+static const uint32_t maxBitsPerPulse = 3;
+// time listened at each candidate, all of them together stay well under a second
+static const uint32_t scoreWindowMs = 100;
+static const uint32_t scoreWindowBytes = 64;
+
+static void writeUint32(uint8_t *dst, uint32_t value)
+{
+    dst[0] = value;
+    dst[1] = value >> 8;
+    dst[2] = value >> 16;
+    dst[3] = value >> 24;
+}
+
+AutoBaudJob::AutoBaudJob(uint8_t _flags) : flags(_flags), measuredBaudRate(0), chosenBaudRate(0), measuredBitTime(0), achievedBitTime(0), edges(0), errors(0)
+{
+}
+
+uint32_t AutoBaudJob::findCandidates(uint32_t measured, uint32_t *candidates)
+{
+    uint32_t count = 0;
+    // a pulse of one bit is the most likely, so those rates are tried first
+    for (uint32_t bits = 1; bits <= maxBitsPerPulse && count < maxCandidates; bits++)
+    {
+        auto rate = measured * bits;
+        for (auto standard : standardBaudRates)
+        {
+            auto difference = standard > rate ? standard - rate : rate - standard;
+            if ((uint64_t)difference * 100 <= (uint64_t)standard * tolerancePercent && count < maxCandidates)
+            {
+                candidates[count++] = standard;
+            }
+        }
+    }
+    return count;
+}
+
+bool AutoBaudJob::execute(PortIO &io)
+{
+    auto originalBaudRate = io.getBaudRate();
+
+    setStage(StageMeasure);
+    PortIO::PulseTiming timing = {};
+    if (!io.measurePulses(measureEdges, measureTimeoutMs, &timing))
+    {
+        return fail("baud rate detection not supported on this port");
+    }
+
+    edges = timing.edges;
+    if (timing.edges < minEdges)
+    {
+        return fail("no traffic on RX to measure");
+    }
+
+    // the shorter of the two is the closest to a single bit, the other may never have been a lone bit
+    auto cycles = timing.lowCycles < timing.highCycles ? timing.lowCycles : timing.highCycles;
+    cycles = cycles == 0 ? 1 : cycles;
+    measuredBitTime = cycles * 16;
+    measuredBaudRate = timing.clockHz / cycles;
+    ESP_LOGI(__FUNCTION__, "low %lu high %lu cycles, %lu edges, about %lu baud", (unsigned long)timing.lowCycles, (unsigned long)timing.highCycles, (unsigned long)timing.edges, (unsigned long)measuredBaudRate);
+
+    if (flags & FlagMeasureOnly)
+    {
+        return true;
+    }
+
+    uint32_t candidates[maxCandidates];
+    auto candidateCount = findCandidates(measuredBaudRate, candidates);
+    if (candidateCount == 0)
+    {
+        return fail("measured rate is not near a standard baud rate");
+    }
+
+    setStage(StageScore);
+    uint8_t data[scoreWindowBytes];
+    uint32_t bestErrors = UINT32_MAX;
+    uint32_t bestBytes = 0;
+    for (uint32_t i = 0; i < candidateCount && !isCancelled(); i++)
+    {
+        setProgress(i, candidateCount);
+        if (!io.setBaudRate(candidates[i]))
+        {
+            continue;
+        }
+        io.flushInput();
+        io.takeLineErrors();
+
+        auto received = receive(io, data, sizeof(data), scoreWindowMs);
+        auto lineErrors = io.takeLineErrors();
+        ESP_LOGD(__FUNCTION__, "%lu baud, %d bytes %lu errors", (unsigned long)candidates[i], received, (unsigned long)lineErrors);
+
+        // the fewest errors wins, then the most data, ties go to the closer rate which was tried first
+        if (lineErrors < bestErrors || (lineErrors == bestErrors && (uint32_t)received > bestBytes))
+        {
+            bestErrors = lineErrors;
+            bestBytes = received;
+            chosenBaudRate = candidates[i];
+        }
+    }
+    setProgress(candidateCount, candidateCount);
+
+    if (isCancelled() || chosenBaudRate == 0 || !io.setBaudRate(chosenBaudRate))
+    {
+        io.setBaudRate(originalBaudRate);
+        chosenBaudRate = 0;
+        return isCancelled() || fail("failed to set the baud rate");
+    }
+
+    errors = bestErrors;
+    // the driver reports the rate its divisor actually gives, which can be off from the one asked for
+    auto achieved = io.getBaudRate();
+    achievedBitTime = achieved == 0 ? 0 : (uint32_t)(((uint64_t)timing.clockHz * 16) / achieved);
+    ESP_LOGI(__FUNCTION__, "chose %lu baud, achieved %lu, %lu errors", (unsigned long)chosenBaudRate, (unsigned long)achieved, (unsigned long)errors);
+    return true;
+}
+
+uint32_t AutoBaudJob::getResult(uint8_t *dst, uint32_t size)
+{
+    if (size < resultSize)
+    {
+        return 0;
+    }
+
+    writeUint32(dst, measuredBaudRate);
+    writeUint32(dst + 4, chosenBaudRate);
+    writeUint32(dst + 8, measuredBitTime);
+    writeUint32(dst + 12, achievedBitTime);
+    writeUint32(dst + 16, edges);
+    writeUint32(dst + 20, errors);
+    return resultSize;
+}
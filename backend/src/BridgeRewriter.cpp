@@ -0,0 +1,133 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "BridgeRewriter.h"
+#include <string.h>
+
+BridgeRewriter::BridgeRewriter() : heldLength(0)
+{
+    config.count = 0;
+    memset(firstBytes, 0, sizeof(firstBytes));
+}
+
+bool BridgeRewriter::configure(const Config &newConfig)
+{
+    config.count = 0;
+    heldLength = 0;
+    memset(firstBytes, 0, sizeof(firstBytes));
+    if (newConfig.count > maxRules)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < newConfig.count; i++)
+    {
+        auto &rule = newConfig.rules[i];
+        if (rule.matchLength == 0 || rule.matchLength > maxMatchLength || rule.replaceLength > maxReplaceLength)
+        {
+            return false;
+        }
+    }
+
+    config = newConfig;
+    for (int i = 0; i < config.count; i++)
+    {
+        firstBytes[config.rules[i].match[0]] = true;
+    }
+    return true;
+}
+
+void BridgeRewriter::feed(const uint8_t *data, uint32_t length, const OutputHandler &out)
+{
+    // runs of bytes that can not start a match are passed on as they are
+    uint32_t runStart = 0;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        if (heldLength == 0 && !firstBytes[data[i]])
+        {
+            continue;
+        }
+
+        if (i > runStart)
+        {
+            out(data + runStart, i - runStart);
+        }
+        runStart = i + 1;
+        held[heldLength++] = data[i];
+        resolve(out, false);
+    }
+
+    if (length > runStart)
+    {
+        out(data + runStart, length - runStart);
+    }
+}
+
+void BridgeRewriter::flush(const OutputHandler &out)
+{
+    resolve(out, true);
+}
+
+void BridgeRewriter::resolve(const OutputHandler &out, bool final)
+{
+    while (heldLength > 0)
+    {
+        auto partial = false;
+        auto matched = false;
+        for (int i = 0; i < config.count; i++)
+        {
+            auto &rule = config.rules[i];
+            if (rule.matchLength <= heldLength)
+            {
+                if (memcmp(held, rule.match, rule.matchLength) == 0)
+                {
+                    if (rule.replaceLength > 0)
+                    {
+                        out(rule.replace, rule.replaceLength);
+                    }
+                    dropHeld(rule.matchLength);
+                    matched = true;
+                    break;
+                }
+            }
+            else if (!final && memcmp(held, rule.match, heldLength) == 0)
+            {
+                partial = true;
+            }
+        }
+
+        if (matched)
+        {
+            continue;
+        }
+
+        if (partial)
+        {
+            // wait for the rest
+            return;
+        }
+
+        // no match can start with the first held byte
+        out(held, 1);
+        dropHeld(1);
+    }
+}
+
+void BridgeRewriter::dropHeld(uint8_t length)
+{
+    memmove(held, held + length, heldLength - length);
+    heldLength -= length;
+}
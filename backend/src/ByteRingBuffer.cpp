@@ -0,0 +1,209 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "ByteRingBuffer.h"
+#include "memory.h"
+#include <new>
+
+ByteRingBuffer::ByteRingBuffer() : buffer(nullptr), capacity(0), mask(0), head(0), tail(0), highWaterMark(0), overflowBytes(0), overflowCount(0)
+{
+}
+
+ByteRingBuffer::~ByteRingBuffer()
+{
+    release();
+}
+
+bool ByteRingBuffer::allocate(uint32_t size)
+{
+    uint32_t roundedSize = 1;
+    while (roundedSize < size)
+    {
+        roundedSize <<= 1;
+    }
+
+    if (buffer != nullptr && capacity == roundedSize)
+    {
+        clear();
+        return true;
+    }
+
+    release();
+    buffer = new (std::nothrow) uint8_t[roundedSize];
+    if (buffer == nullptr)
+    {
+        return false;
+    }
+
+    capacity = roundedSize;
+    mask = roundedSize - 1;
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+    resetStats();
+    return true;
+}
+
+void ByteRingBuffer::release()
+{
+    delete[] buffer;
+    buffer = nullptr;
+    capacity = 0;
+    mask = 0;
+}
+
+void ByteRingBuffer::copyIn(uint32_t position, const uint8_t *src, uint32_t len)
+{
+    auto offset = position & mask;
+    auto firstPart = capacity - offset;
+    if (firstPart > len)
+    {
+        firstPart = len;
+    }
+    memcpy(buffer + offset, src, firstPart);
+    memcpy(buffer, src + firstPart, len - firstPart);
+}
+
+void ByteRingBuffer::copyOut(uint32_t position, uint8_t *dst, uint32_t len)
+{
+    auto offset = position & mask;
+    auto firstPart = capacity - offset;
+    if (firstPart > len)
+    {
+        firstPart = len;
+    }
+    memcpy(dst, buffer + offset, firstPart);
+    memcpy(dst + firstPart, buffer, len - firstPart);
+}
+
+void ByteRingBuffer::updateHighWaterMark(uint32_t used)
+{
+    if (used > highWaterMark.load(std::memory_order_relaxed))
+    {
+        highWaterMark.store(used, std::memory_order_relaxed);
+    }
+}
+
+uint32_t ByteRingBuffer::freeSpace()
+{
+    return capacity - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+}
+
+uint32_t ByteRingBuffer::write(const uint8_t *src, uint32_t len)
+{
+    if (buffer == nullptr)
+    {
+        return 0;
+    }
+
+    auto currentHead = head.load(std::memory_order_relaxed);
+    auto used = currentHead - tail.load(std::memory_order_acquire);
+    auto space = capacity - used;
+
+    uint32_t toWrite = len;
+    if (toWrite > space)
+    {
+        overflowBytes.fetch_add(toWrite - space, std::memory_order_relaxed);
+        overflowCount.fetch_add(1, std::memory_order_relaxed);
+        toWrite = space;
+    }
+
+    copyIn(currentHead, src, toWrite);
+    head.store(currentHead + toWrite, std::memory_order_release);
+    updateHighWaterMark(used + toWrite);
+
+    return toWrite;
+}
+
+bool ByteRingBuffer::writeAll(const uint8_t *header, uint32_t headerLen, const uint8_t *payload, uint32_t payloadLen)
+{
+    if (buffer == nullptr)
+    {
+        return false;
+    }
+
+    auto currentHead = head.load(std::memory_order_relaxed);
+    auto used = currentHead - tail.load(std::memory_order_acquire);
+    auto len = headerLen + payloadLen;
+    if (len > capacity - used)
+    {
+        overflowBytes.fetch_add(payloadLen, std::memory_order_relaxed);
+        overflowCount.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    copyIn(currentHead, header, headerLen);
+    copyIn(currentHead + headerLen, payload, payloadLen);
+    head.store(currentHead + len, std::memory_order_release);
+    updateHighWaterMark(used + len);
+
+    return true;
+}
+
+uint32_t ByteRingBuffer::available()
+{
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+}
+
+uint32_t ByteRingBuffer::peek(uint8_t *dst, uint32_t len)
+{
+    if (buffer == nullptr)
+    {
+        return 0;
+    }
+
+    auto currentTail = tail.load(std::memory_order_relaxed);
+    auto toRead = head.load(std::memory_order_acquire) - currentTail;
+    if (toRead > len)
+    {
+        toRead = len;
+    }
+
+    copyOut(currentTail, dst, toRead);
+    return toRead;
+}
+
+void ByteRingBuffer::skip(uint32_t len)
+{
+    auto currentTail = tail.load(std::memory_order_relaxed);
+    auto used = head.load(std::memory_order_acquire) - currentTail;
+    if (len > used)
+    {
+        len = used;
+    }
+
+    tail.store(currentTail + len, std::memory_order_release);
+}
+
+uint32_t ByteRingBuffer::read(uint8_t *dst, uint32_t len)
+{
+    auto toRead = peek(dst, len);
+    skip(toRead);
+
+    return toRead;
+}
+
+void ByteRingBuffer::clear()
+{
+    tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+void ByteRingBuffer::resetStats()
+{
+    highWaterMark.store(0, std::memory_order_relaxed);
+    overflowBytes.store(0, std::memory_order_relaxed);
+    overflowCount.store(0, std::memory_order_relaxed);
+}
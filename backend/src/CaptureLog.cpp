@@ -0,0 +1,863 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "CaptureLog.h"
+#include "Port.h"
+#include "PortManager.h"
+#include "UserAuthSessionManager.h"
+#include "Json.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <nvs_flash.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+const esp_partition_t *CaptureLog::partition = nullptr;
+CaptureLog::Segment *CaptureLog::segments = nullptr;
+uint32_t CaptureLog::segmentCount = 0;
+SemaphoreHandle_t CaptureLog::lock = nullptr;
+TaskHandle_t CaptureLog::task = nullptr;
+ByteRingBuffer CaptureLog::ring;
+std::atomic<Port *> CaptureLog::recordPort(nullptr);
+int64_t CaptureLog::clockBase = 0;
+uint32_t CaptureLog::pendingLost = 0;
+std::atomic<uint32_t> CaptureLog::lostBytes(0);
+bool CaptureLog::hasSegment = false;
+uint32_t CaptureLog::currentSequence = 0;
+uint32_t CaptureLog::writeOffset = CaptureLog::segmentDataSize;
+uint16_t CaptureLog::indexedBlocks = 0;
+CaptureLog::IndexEntry CaptureLog::pendingIndex[CaptureLog::indexEntries];
+uint32_t CaptureLog::erasedAhead = 0;
+uint8_t *CaptureLog::batch = nullptr;
+uint32_t CaptureLog::batchUsed = 0;
+
+// the server has no names for these
+static const auto StatusPartialContent = static_cast<decltype(Response::Ok)>(206);
+static const auto StatusRangeNotSatisfiable = static_cast<decltype(Response::Ok)>(416);
+
+static uint32_t recordLength(const CaptureLog::RecordHeader &header)
+{
+    return header.length[0] | (header.length[1] << 8);
+}
+
+static uint64_t recordTime(const CaptureLog::RecordHeader &header)
+{
+    uint64_t time = 0;
+    for (int i = 7; i >= 0; i--)
+    {
+        time = (time << 8) | header.time[i];
+    }
+    return time;
+}
+
+static void fillRecordHeader(CaptureLog::RecordHeader *header, uint8_t type, uint8_t port, uint32_t length, uint64_t time)
+{
+    header->type = type;
+    header->port = port;
+    header->length[0] = length & 0xFF;
+    header->length[1] = length >> 8;
+    for (int i = 0; i < 8; i++)
+    {
+        header->time[i] = time >> (i * 8);
+    }
+}
+
+bool CaptureLog::init()
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "capture");
+    if (partition == nullptr)
+    {
+        ESP_LOGI(__FUNCTION__, "no capture partition, recording is not available");
+        return false;
+    }
+
+    segmentCount = partition->size / segmentSize;
+    if (segmentCount < 2)
+    {
+        ESP_LOGE(__FUNCTION__, "capture partition too small");
+        partition = nullptr;
+        return false;
+    }
+
+    segments = new Segment[segmentCount]();
+    batch = new uint8_t[batchBufferSize];
+    memset(pendingIndex, 0xFF, sizeof(pendingIndex));
+    lock = xSemaphoreCreateMutex();
+    if (!ring.allocate(ringSize))
+    {
+        ESP_LOGE(__FUNCTION__, "failed to allocate capture buffer");
+        partition = nullptr;
+        return false;
+    }
+
+    recover();
+
+    // below the server task so flash writes only use time it is not using
+    if (xTaskCreate(captureTask, "CaptureLog", configMINIMAL_STACK_SIZE * 4, nullptr, 1, &task) != pdPASS)
+    {
+        ESP_LOGE(__FUNCTION__, "failed to start capture task");
+        partition = nullptr;
+        return false;
+    }
+
+    bool enabled = false;
+    char portName[16] = "";
+    uint32_t baudRate = 0;
+    if (loadConfig(&enabled, portName, sizeof(portName), &baudRate) && !applyConfig(enabled, portName, baudRate))
+    {
+        ESP_LOGE(__FUNCTION__, "failed to start recording %s", portName);
+    }
+
+    return true;
+}
+
+int64_t CaptureLog::now()
+{
+    return clockBase + esp_timer_get_time();
+}
+
+void CaptureLog::record(Port *port, uint8_t type, const uint8_t *data, uint32_t length)
+{
+    if (port == nullptr || recordPort != port)
+    {
+        return;
+    }
+
+    RecordHeader header;
+    auto time = now();
+    if (pendingLost > 0)
+    {
+        // the drop is noted in the log ahead of the next record that fits
+        uint8_t count[4] = {(uint8_t)pendingLost, (uint8_t)(pendingLost >> 8), (uint8_t)(pendingLost >> 16), (uint8_t)(pendingLost >> 24)};
+        fillRecordHeader(&header, RecordTypeLost, port->portNum, sizeof(count), time);
+        if (ring.writeAll((uint8_t *)&header, sizeof(header), count, sizeof(count)))
+        {
+            pendingLost = 0;
+        }
+    }
+
+    while (length > 0)
+    {
+        auto part = length > maxRecordData ? maxRecordData : length;
+        fillRecordHeader(&header, type, port->portNum, part, time);
+        // never wait on flash, if the capture task has fallen behind the data is counted as lost
+        if (!ring.writeAll((uint8_t *)&header, sizeof(header), data, part))
+        {
+            pendingLost += part;
+            lostBytes += part;
+        }
+        data += part;
+        length -= part;
+    }
+
+    if (ring.size() - ring.freeSpace() >= batchSize)
+    {
+        xTaskNotifyGive(task);
+    }
+}
+
+void CaptureLog::captureTask(void *arg)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, flushIntervalMs / portTICK_PERIOD_MS);
+        flush();
+
+        // erase the next segment a sector at a time while there is nothing to write
+        while (eraseAhead())
+        {
+            if (ulTaskNotifyTake(pdTRUE, 1) > 0)
+            {
+                flush();
+            }
+        }
+    }
+}
+
+void CaptureLog::flush()
+{
+    RecordHeader header;
+    while (ring.peek((uint8_t *)&header, sizeof(header)) == sizeof(header))
+    {
+        auto length = sizeof(header) + recordLength(header);
+        if (batchUsed + length > batchBufferSize)
+        {
+            writeBatch();
+        }
+
+        if (writeOffset + batchUsed + length > segmentDataSize)
+        {
+            // records never span segments, the rest of this one stays erased which reads as RecordTypeEnd
+            writeBatch();
+            if (!openNextSegment(recordTime(header)))
+            {
+                ring.skip(length);
+                lostBytes += length;
+                continue;
+            }
+        }
+
+        auto offset = writeOffset + batchUsed;
+        auto block = offset / blockSize;
+        if (!(indexedBlocks & (1 << block)))
+        {
+            indexedBlocks |= 1 << block;
+            pendingIndex[block] = {offset, (uint32_t)((recordTime(header) - segments[currentSequence % segmentCount].startTime) / 1000)};
+        }
+
+        ring.read(batch + batchUsed, length);
+        batchUsed += length;
+    }
+
+    writeBatch();
+}
+
+bool CaptureLog::writeBatch()
+{
+    if (batchUsed == 0)
+    {
+        return true;
+    }
+
+    auto address = segmentAddress(currentSequence);
+    auto result = esp_partition_write(partition, address + headerAreaSize + writeOffset, batch, batchUsed);
+
+    // the index is written after the records it points at
+    for (uint32_t i = 0; i < indexEntries && result == ESP_OK; i++)
+    {
+        if (pendingIndex[i].offset != 0xFFFFFFFF)
+        {
+            result = esp_partition_write(partition, address + indexOffset + i * sizeof(IndexEntry), &pendingIndex[i], sizeof(IndexEntry));
+        }
+    }
+    memset(pendingIndex, 0xFF, sizeof(pendingIndex));
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    // a failed write closes the segment so nothing is written over what is there
+    writeOffset = result == ESP_OK ? writeOffset + batchUsed : segmentDataSize;
+    xSemaphoreGive(lock);
+    batchUsed = 0;
+
+    if (result != ESP_OK)
+    {
+        ESP_LOGE(__FUNCTION__, "flash write failed %s", esp_err_to_name(result));
+        return false;
+    }
+    return true;
+}
+
+bool CaptureLog::openNextSegment(uint64_t startTime)
+{
+    auto sequence = hasSegment ? currentSequence + 1 : 0;
+    auto index = sequence % segmentCount;
+    auto address = segmentAddress(sequence);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    segments[index].valid = false;
+    xSemaphoreGive(lock);
+
+    // finish what eraseAhead() has not done, the header sector goes last so the erase count survives a reboot until here
+    esp_err_t result = ESP_OK;
+    for (uint32_t sector = 1 + erasedAhead; sector < segmentSize / blockSize && result == ESP_OK; sector++)
+    {
+        result = esp_partition_erase_range(partition, address + sector * blockSize, blockSize);
+    }
+    if (result == ESP_OK)
+    {
+        result = esp_partition_erase_range(partition, address, blockSize);
+    }
+
+    SegmentHeader header = {magic, sequence, segments[index].eraseCount + 1, 0, startTime};
+    if (result == ESP_OK)
+    {
+        result = esp_partition_write(partition, address, &header, sizeof(header));
+    }
+    erasedAhead = 0;
+
+    if (result != ESP_OK)
+    {
+        ESP_LOGE(__FUNCTION__, "failed to start segment %u %s", (unsigned)sequence, esp_err_to_name(result));
+        return false;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    segments[index] = {true, sequence, header.eraseCount, startTime};
+    hasSegment = true;
+    currentSequence = sequence;
+    writeOffset = 0;
+    xSemaphoreGive(lock);
+    indexedBlocks = 0;
+    return true;
+}
+
+bool CaptureLog::eraseAhead()
+{
+    auto sectors = segmentSize / blockSize;
+    if (!hasSegment || erasedAhead >= sectors - 1)
+    {
+        return false;
+    }
+
+    // the next segment holds the oldest data, it stops being readable once any of it is gone
+    auto index = (currentSequence + 1) % segmentCount;
+    if (erasedAhead == 0)
+    {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        segments[index].valid = false;
+        xSemaphoreGive(lock);
+    }
+
+    auto result = esp_partition_erase_range(partition, segmentAddress(currentSequence + 1) + (1 + erasedAhead) * blockSize, blockSize);
+    if (result != ESP_OK)
+    {
+        ESP_LOGE(__FUNCTION__, "erase failed %s", esp_err_to_name(result));
+        return false;
+    }
+
+    erasedAhead++;
+    return erasedAhead < sectors - 1;
+}
+
+bool CaptureLog::recover()
+{
+    for (uint32_t i = 0; i < segmentCount; i++)
+    {
+        SegmentHeader header;
+        if (esp_partition_read(partition, i * segmentSize, &header, sizeof(header)) != ESP_OK || header.magic != magic)
+        {
+            segments[i] = {};
+            continue;
+        }
+
+        segments[i] = {header.sequence % segmentCount == i, header.sequence, header.eraseCount, header.startTime};
+        if (segments[i].valid && (!hasSegment || header.sequence > currentSequence))
+        {
+            hasSegment = true;
+            currentSequence = header.sequence;
+        }
+    }
+
+    if (!hasSegment)
+    {
+        ESP_LOGI(__FUNCTION__, "capture log is empty");
+        return false;
+    }
+
+    for (uint32_t i = 0; i < segmentCount; i++)
+    {
+        // left over from an earlier pass around the partition
+        if (segments[i].valid && currentSequence - segments[i].sequence >= segmentCount)
+        {
+            segments[i].valid = false;
+        }
+    }
+
+    // walk the newest segment to find where the last write stopped
+    auto address = segmentAddress(currentSequence) + headerAreaSize;
+    uint64_t lastTime = segments[currentSequence % segmentCount].startTime;
+    uint32_t offset = 0;
+    while (offset + sizeof(RecordHeader) <= segmentDataSize)
+    {
+        RecordHeader header;
+        if (esp_partition_read(partition, address + offset, &header, sizeof(header)) != ESP_OK)
+        {
+            offset = segmentDataSize;
+            break;
+        }
+
+        auto length = recordLength(header);
+        if (header.type == RecordTypeEnd && length == 0xFFFF && recordTime(header) == UINT64_MAX)
+        {
+            break;
+        }
+
+        if (header.type == RecordTypeEnd || length > maxRecordData || offset + sizeof(header) + length > segmentDataSize)
+        {
+            // cut off part way through a write, start a new segment rather than write over it
+            offset = segmentDataSize;
+            break;
+        }
+
+        lastTime = recordTime(header);
+        offset += sizeof(header) + length;
+    }
+    writeOffset = offset;
+
+    IndexEntry index[indexEntries];
+    if (esp_partition_read(partition, segmentAddress(currentSequence) + indexOffset, index, sizeof(index)) == ESP_OK)
+    {
+        for (uint32_t i = 0; i < indexEntries; i++)
+        {
+            if (index[i].offset != 0xFFFFFFFF)
+            {
+                indexedBlocks |= 1 << i;
+            }
+        }
+    }
+
+    // the log clock carries on from the last record so times keep going up across reboots
+    clockBase = lastTime + 1 - esp_timer_get_time();
+    ESP_LOGI(__FUNCTION__, "capture log at segment %u offset %u", (unsigned)currentSequence, (unsigned)writeOffset);
+    return true;
+}
+
+uint64_t CaptureLog::segmentAddress(uint32_t sequence)
+{
+    return (uint64_t)(sequence % segmentCount) * segmentSize;
+}
+
+uint64_t CaptureLog::startPosition()
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    auto oldest = currentSequence;
+    for (uint32_t i = 0; i < segmentCount; i++)
+    {
+        if (segments[i].valid && segments[i].sequence < oldest)
+        {
+            oldest = segments[i].sequence;
+        }
+    }
+    auto position = hasSegment ? (uint64_t)oldest * segmentDataSize : 0;
+    xSemaphoreGive(lock);
+    return position;
+}
+
+uint64_t CaptureLog::endPosition()
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    auto position = hasSegment ? (uint64_t)currentSequence * segmentDataSize + writeOffset : 0;
+    xSemaphoreGive(lock);
+    return position;
+}
+
+void CaptureLog::readLog(uint64_t position, uint8_t *dst, uint32_t length)
+{
+    while (length > 0)
+    {
+        uint32_t sequence = position / segmentDataSize;
+        uint32_t offset = position % segmentDataSize;
+        auto part = segmentDataSize - offset;
+        if (part > length)
+        {
+            part = length;
+        }
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        auto &segment = segments[sequence % segmentCount];
+        bool live = segment.valid && segment.sequence == sequence;
+        xSemaphoreGive(lock);
+
+        // anything no longer in the log reads as unused space
+        if (!live || esp_partition_read(partition, segmentAddress(sequence) + headerAreaSize + offset, dst, part) != ESP_OK)
+        {
+            memset(dst, 0xFF, part);
+        }
+
+        position += part;
+        dst += part;
+        length -= part;
+    }
+}
+
+uint64_t CaptureLog::findPosition(uint64_t time)
+{
+    // the newest segment that starts at or before the time
+    bool found = false;
+    Segment segment = {};
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (uint32_t i = 0; i < segmentCount; i++)
+    {
+        if (segments[i].valid && segments[i].startTime <= time && (!found || segments[i].sequence > segment.sequence))
+        {
+            found = true;
+            segment = segments[i];
+        }
+    }
+    xSemaphoreGive(lock);
+
+    if (!found)
+    {
+        return startPosition();
+    }
+
+    // start from the last indexed block that is known to be before the time, index times are rounded down to ms
+    auto address = segmentAddress(segment.sequence);
+    IndexEntry index[indexEntries];
+    uint32_t offset = 0;
+    if (esp_partition_read(partition, address + indexOffset, index, sizeof(index)) == ESP_OK)
+    {
+        for (uint32_t i = 0; i < indexEntries; i++)
+        {
+            if (index[i].offset < segmentDataSize && segment.startTime + (uint64_t)index[i].timeMs * 1000 + 1000 <= time)
+            {
+                offset = index[i].offset;
+            }
+        }
+    }
+
+    auto end = endPosition();
+    while (offset + sizeof(RecordHeader) <= segmentDataSize)
+    {
+        RecordHeader header;
+        if (esp_partition_read(partition, address + headerAreaSize + offset, &header, sizeof(header)) != ESP_OK || header.type == RecordTypeEnd)
+        {
+            break;
+        }
+
+        if (recordTime(header) >= time)
+        {
+            auto position = (uint64_t)segment.sequence * segmentDataSize + offset;
+            return position < end ? position : end;
+        }
+        offset += sizeof(header) + recordLength(header);
+    }
+
+    // everything in the segment is earlier
+    auto position = (uint64_t)(segment.sequence + 1) * segmentDataSize;
+    return position < end ? position : end;
+}
+
+bool CaptureLog::parseRange(const char *value, uint64_t size, uint64_t *first, uint64_t *last)
+{
+    // a single range, last is made exclusive
+    if (strncmp(value, "bytes=", 6) != 0)
+    {
+        return false;
+    }
+    value += 6;
+
+    char *end;
+    if (*value == '-')
+    {
+        auto suffix = strtoull(value + 1, &end, 10);
+        if (end == value + 1 || *end != 0 || suffix == 0)
+        {
+            return false;
+        }
+        *first = suffix < size ? size - suffix : 0;
+        *last = size;
+        return *first < *last;
+    }
+
+    *first = strtoull(value, &end, 10);
+    if (end == value || *end != '-')
+    {
+        return false;
+    }
+    value = end + 1;
+
+    *last = size;
+    if (*value != 0)
+    {
+        auto lastByte = strtoull(value, &end, 10);
+        if (end == value || *end != 0 || lastByte < *first)
+        {
+            return false;
+        }
+        if (lastByte + 1 < size)
+        {
+            *last = lastByte + 1;
+        }
+    }
+
+    return *first < size;
+}
+
+void CaptureLog::captureRequest(Request *req, Response *resp)
+{
+    if (!UserAuthSessionManager::checkTokenValid(req, resp))
+    {
+        return;
+    }
+
+    if (req->method == Request::PUT)
+    {
+        auto jsonInput = Json::loadJsonFromRequest(req, resp);
+        if (jsonInput.isNull())
+        {
+            resp->writeHeader(Response::BadRequest);
+            resp->write("Unable to parse Json");
+            return;
+        }
+
+        bool enabled = false;
+        double baudRate = 0;
+        auto portName = jsonInput.getStringField("port");
+        if (!jsonInput.getBoolField("enabled", &enabled) || (enabled && portName == nullptr))
+        {
+            resp->writeHeader(Response::BadRequest);
+            resp->write("missing fields");
+            return;
+        }
+        jsonInput.getNumberField("baudRate", &baudRate);
+
+        if (partition == nullptr)
+        {
+            resp->writeHeader(Response::NotFound);
+            resp->write("no capture partition");
+            return;
+        }
+
+        if (!applyConfig(enabled, portName != nullptr ? portName : "", (uint32_t)baudRate))
+        {
+            resp->writeHeader(Response::BadRequest);
+            resp->write("unable to record port");
+            return;
+        }
+
+        if (!saveConfig(enabled, portName != nullptr ? portName : "", (uint32_t)baudRate))
+        {
+            resp->writeHeader(Response::InternalServerError);
+            resp->write("failed to save capture settings");
+            return;
+        }
+
+        Json j;
+        j.addField("success", true);
+        j.writeJsonToResponse(resp);
+        return;
+    }
+
+    if (req->method != Request::GET)
+    {
+        resp->writeHeader(Response::BadRequest);
+        resp->write("Unsupported Method");
+        return;
+    }
+
+    bool enabled = false;
+    char portName[16] = "";
+    uint32_t baudRate = 0;
+    loadConfig(&enabled, portName, sizeof(portName), &baudRate);
+
+    Json j;
+    j.addField("available", partition != nullptr);
+    j.addField("enabled", enabled);
+    j.addField("port", portName);
+    j.addField("baudRate", (int)baudRate);
+    if (partition != nullptr)
+    {
+        uint32_t maxEraseCount = 0;
+        for (uint32_t i = 0; i < segmentCount; i++)
+        {
+            if (segments[i].eraseCount > maxEraseCount)
+            {
+                maxEraseCount = segments[i].eraseCount;
+            }
+        }
+
+        j.addField("start", (double)startPosition());
+        j.addField("end", (double)endPosition());
+        j.addField("now", (double)now());
+        j.addField("segmentSize", (int)segmentDataSize);
+        j.addField("segmentCount", (int)segmentCount);
+        j.addField("maxEraseCount", (int)maxEraseCount);
+        j.addField("lostBytes", (double)lostBytes.load());
+    }
+    j.writeJsonToResponse(resp);
+}
+
+void CaptureLog::captureDataRequest(Request *req, Response *resp)
+{
+    if (!UserAuthSessionManager::checkTokenValid(req, resp))
+    {
+        return;
+    }
+
+    if (req->method != Request::GET)
+    {
+        resp->writeHeader(Response::BadRequest);
+        resp->write("Unsupported Method");
+        return;
+    }
+
+    if (partition == nullptr)
+    {
+        resp->writeHeader(Response::NotFound);
+        resp->write("no capture partition");
+        return;
+    }
+
+    auto start = startPosition();
+    auto end = endPosition();
+    uint64_t first = start;
+    uint64_t last = end;
+    char contentRange[64] = "";
+
+    auto range = req->headers["RANGE"];
+    if (!range.empty() && (!parseRange(range.c_str(), end, &first, &last) || first < start))
+    {
+        resp->writeHeader(StatusRangeNotSatisfiable);
+        snprintf(contentRange, sizeof(contentRange), "bytes */%llu", (unsigned long long)end);
+        resp->writeHeaderLine("Content-Range", contentRange);
+        return;
+    }
+
+    // each request is sent in one go on the server task while the port buffers wait to be drained
+    // so large requests, with or without a range, are cut short and the client asks for the rest
+    auto partial = !range.empty() || last - first > maxRangeResponse;
+    if (last - first > maxRangeResponse)
+    {
+        last = first + maxRangeResponse;
+    }
+
+    if (partial)
+    {
+        resp->writeHeader(StatusPartialContent);
+        snprintf(contentRange, sizeof(contentRange), "bytes %llu-%llu/%llu", (unsigned long long)first, (unsigned long long)(last - 1), (unsigned long long)end);
+        resp->writeHeaderLine("Content-Range", contentRange);
+    }
+
+    resp->writeHeaderLine("Content-Type", "application/octet-stream");
+    resp->writeHeaderLine("Accept-Ranges", "bytes");
+
+    uint8_t buffer[1024];
+    while (first < last)
+    {
+        uint32_t length = last - first > sizeof(buffer) ? sizeof(buffer) : last - first;
+        readLog(first, buffer, length);
+        resp->write((const char *)buffer, length);
+        first += length;
+    }
+}
+
+void CaptureLog::captureFindRequest(Request *req, Response *resp)
+{
+    if (!UserAuthSessionManager::checkTokenValid(req, resp))
+    {
+        return;
+    }
+
+    if (partition == nullptr)
+    {
+        resp->writeHeader(Response::NotFound);
+        resp->write("no capture partition");
+        return;
+    }
+
+    auto jsonInput = Json::loadJsonFromRequest(req, resp);
+    if (jsonInput.isNull())
+    {
+        resp->writeHeader(Response::BadRequest);
+        resp->write("Unable to parse Json");
+        return;
+    }
+
+    double from = 0;
+    double to = 0;
+    if (!jsonInput.getNumberField("from", &from) || !jsonInput.getNumberField("to", &to) || from < 0 || to < from)
+    {
+        resp->writeHeader(Response::BadRequest);
+        resp->write("missing fields");
+        return;
+    }
+
+    Json j;
+    j.addField("start", (double)findPosition((uint64_t)from));
+    j.addField("end", (double)findPosition((uint64_t)to));
+    j.writeJsonToResponse(resp);
+}
+
+bool CaptureLog::applyConfig(bool enabled, const char *portName, uint32_t baudRate)
+{
+    if (partition == nullptr)
+    {
+        return false;
+    }
+
+    Port *port = nullptr;
+    if (enabled)
+    {
+        port = PortManager::findPort(portName);
+        if (port == nullptr || !port->init() || (baudRate > 0 && !port->setBandRate(baudRate)))
+        {
+            return false;
+        }
+    }
+
+    auto previous = recordPort.exchange(port);
+    if (previous != nullptr && previous != port)
+    {
+        PortManager::updateRecording(previous);
+    }
+    if (port != nullptr)
+    {
+        PortManager::updateRecording(port);
+    }
+    ESP_LOGI(__FUNCTION__, "recording %s", port != nullptr ? port->portName : "off");
+    return true;
+}
+
+bool CaptureLog::loadConfig(bool *enabled, char *portName, uint32_t portNameSize, uint32_t *baudRate)
+{
+    nvs_handle_t nvsHandle = 0;
+    auto result = nvs_open("capture", NVS_READONLY, &nvsHandle);
+    if (result != ESP_OK)
+    {
+        // nothing saved yet
+        return false;
+    }
+
+    uint8_t value = 0;
+    size_t length = portNameSize;
+    result = nvs_get_u8(nvsHandle, "enabled", &value);
+    if (result == ESP_OK)
+    {
+        result = nvs_get_str(nvsHandle, "port", portName, &length);
+    }
+    if (result == ESP_OK)
+    {
+        result = nvs_get_u32(nvsHandle, "baud", baudRate);
+    }
+    nvs_close(nvsHandle);
+
+    *enabled = value != 0;
+    return result == ESP_OK;
+}
+
+bool CaptureLog::saveConfig(bool enabled, const char *portName, uint32_t baudRate)
+{
+    nvs_handle_t nvsHandle = 0;
+    auto result = nvs_open("capture", NVS_READWRITE, &nvsHandle);
+    if (result != ESP_OK)
+    {
+        ESP_LOGE(__FUNCTION__, "nvs_open failed error %d", (int)result);
+        return false;
+    }
+
+    result = nvs_set_u8(nvsHandle, "enabled", enabled);
+    if (result == ESP_OK)
+    {
+        result = nvs_set_str(nvsHandle, "port", portName);
+    }
+    if (result == ESP_OK)
+    {
+        result = nvs_set_u32(nvsHandle, "baud", baudRate);
+    }
+    if (result == ESP_OK)
+    {
+        result = nvs_commit(nvsHandle);
+    }
+    nvs_close(nvsHandle);
+
+    if (result != ESP_OK)
+    {
+        ESP_LOGE(__FUNCTION__, "nvs save failed error %d", (int)result);
+        return false;
+    }
+    return true;
+}
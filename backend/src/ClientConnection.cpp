@@ -17,10 +17,18 @@
 
 #include "PortManager.h"
 #include "ClientConnection.h"
+#include "Stm32BootloaderJob.h"
+#include "EspRomFlashJob.h"
+#include "ModemSequenceJob.h"
+#include "AutoBaudJob.h"
+#include "ScriptJob.h"
+#include "ReplayJob.h"
+#include "CaptureLog.h"
 #include "UserAuthSessionManager.h"
 #include "string.h"
 #include "memory.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include <string>
 
 bool ClientConnection::applyMode(Port *port, MessageEncoding::ModeRequest r)
@@ -39,7 +47,7 @@ bool ClientConnection::applyMode(Port *port, MessageEncoding::ModeRequest r)
         successful = false;
     }
 
-    if (port->setParity((Port::PortParity)r.parity))
+    if (!port->setParity((Port::PortParity)r.parity))
     {
         ESP_LOGI(__FUNCTION__, "setParity failed");
         successful = false;
@@ -51,6 +59,58 @@ bool ClientConnection::applyMode(Port *port, MessageEncoding::ModeRequest r)
         successful = false;
     }
 
+    if (!port->setProfile(r.profile))
+    {
+        ESP_LOGI(__FUNCTION__, "setProfile failed");
+        successful = false;
+    }
+
+    FrameDecoder::Config framing = {r.frameMode, r.frameCRC, r.frameParam, r.maxFrameSize};
+    if (!port->setFraming(framing))
+    {
+        ESP_LOGI(__FUNCTION__, "setFraming failed");
+        successful = false;
+    }
+
+    // RS-485 and RTS / CTS flow control both need RTS, the one being turned off goes first
+    Port::Rs485Config rs485 = {r.rs485Mode, r.rs485TurnaroundUs};
+    if (r.rs485Mode == Port::Rs485Off && !port->setRs485(rs485))
+    {
+        ESP_LOGI(__FUNCTION__, "setRs485 failed");
+        successful = false;
+    }
+
+    if (!port->setFlowControl((Port::FlowControl)r.flowControl))
+    {
+        ESP_LOGI(__FUNCTION__, "setFlowControl failed");
+        successful = false;
+    }
+
+    if (r.rs485Mode != Port::Rs485Off && !port->setRs485(rs485))
+    {
+        ESP_LOGI(__FUNCTION__, "setRs485 failed");
+        successful = false;
+    }
+
+    if (!port->setStreamFlags(r.streamFlags))
+    {
+        ESP_LOGI(__FUNCTION__, "setStreamFlags failed");
+        successful = false;
+    }
+
+    Port::TxPacing pacing = {r.txByteGapUs, r.txLineGapMs, r.txEchoTimeoutMs};
+    if (!port->setTxPacing(pacing))
+    {
+        ESP_LOGI(__FUNCTION__, "setTxPacing failed");
+        successful = false;
+    }
+
+    if (!port->setModemLines(r.initialStatusBits))
+    {
+        ESP_LOGI(__FUNCTION__, "setModemLines failed");
+        successful = false;
+    }
+
     return successful;
 }
 
@@ -65,20 +125,68 @@ void ClientConnection::handleMessage(char *payload, int size)
 
     const char *failedToDecode = "MessageDecodeError";
     std::string errorMessage;
+    auto errorCode = MessageDecoder::ErrorCodeNone;
 
-    ESP_LOGD(__FUNCTION__, "GOT MSG %d", messageDecoder.messageType);
+    ESP_LOGD(__FUNCTION__, "GOT MSG %d v%d id %d", messageDecoder.messageType, messageDecoder.version, messageDecoder.requestId);
+
+    if (!messageDecoder.isValid())
+    {
+        errorMessage = failedToDecode;
+        sendError(messageDecoder.messageType, messageDecoder.responseHeader(MessageDecoder::ErrorCodeDecode), errorMessage);
+        return;
+    }
+    protocolVersion = messageDecoder.version;
+
+    if (messageDecoder.channel >= maxChannels)
+    {
+        errorMessage = "Invalid channel";
+        sendError(messageDecoder.messageType, messageDecoder.responseHeader(MessageDecoder::ErrorCodeInvalidChannel), errorMessage);
+        return;
+    }
+    auto &channel = channels[messageDecoder.channel];
+    auto port = channel.port;
 
     if (!authenticated && messageDecoder.messageType != MessageDecoder::MessageTypeAuthenticate)
     {
         errorMessage = "Authentication required";
-        writeErrorMessage(messageDecoder.messageType, errorMessage);
+        writeErrorResponse(channel, messageDecoder.messageType, messageDecoder.responseHeader(MessageDecoder::ErrorCodeAuthRequired), errorMessage);
         return;
     }
 
-    if (port == nullptr && (messageDecoder.messageType != MessageDecoder::MessageTypeAuthenticate && messageDecoder.messageType != MessageDecoder::MessageTypeSetMode && messageDecoder.messageType != MessageDecoder::MessageTypeOpen && messageDecoder.messageType != MessageDecoder::MessageTypeGetPortList))
+    if (port == nullptr && (messageDecoder.messageType != MessageDecoder::MessageTypeAuthenticate && messageDecoder.messageType != MessageDecoder::MessageTypeSetMode && messageDecoder.messageType != MessageDecoder::MessageTypeOpen && messageDecoder.messageType != MessageDecoder::MessageTypeOpenViewer && messageDecoder.messageType != MessageDecoder::MessageTypeGetPortList))
     {
         errorMessage = "Operation not allowed when port is closed";
-        writeErrorMessage(messageDecoder.messageType, errorMessage);
+        writeErrorResponse(channel, messageDecoder.messageType, messageDecoder.responseHeader(MessageDecoder::ErrorCodePortClosed), errorMessage);
+        return;
+    }
+
+    if (channel.viewer && (messageDecoder.messageType == MessageDecoder::MessageTypeSetMode || messageDecoder.messageType == MessageDecoder::MessageTypeReadData || messageDecoder.messageType == MessageDecoder::MessageTypeWriteData || messageDecoder.messageType == MessageDecoder::MessageTypeStartJob || messageDecoder.messageType == MessageDecoder::MessageTypeJobData || messageDecoder.messageType == MessageDecoder::MessageTypeCancelJob || messageDecoder.messageType == MessageDecoder::MessageTypeSendBreak || messageDecoder.messageType == MessageDecoder::MessageTypeArmTrigger || messageDecoder.messageType == MessageDecoder::MessageTypeBridge || messageDecoder.messageType == MessageDecoder::MessageTypeSniff))
+    {
+        errorMessage = "Operation not permitted for viewers";
+        writeErrorResponse(channel, messageDecoder.messageType, messageDecoder.responseHeader(MessageDecoder::ErrorCodeNotPermitted), errorMessage);
+        return;
+    }
+
+    if (port != nullptr && port->isJobActive() && (messageDecoder.messageType == MessageDecoder::MessageTypeSetMode || messageDecoder.messageType == MessageDecoder::MessageTypeReadData || messageDecoder.messageType == MessageDecoder::MessageTypeWriteData || messageDecoder.messageType == MessageDecoder::MessageTypeSendBreak || messageDecoder.messageType == MessageDecoder::MessageTypeArmTrigger || messageDecoder.messageType == MessageDecoder::MessageTypeWatchPatterns || messageDecoder.messageType == MessageDecoder::MessageTypeBridge || messageDecoder.messageType == MessageDecoder::MessageTypeSniff))
+    {
+        errorMessage = "Port busy, a job is running";
+        writeErrorResponse(channel, messageDecoder.messageType, messageDecoder.responseHeader(MessageDecoder::ErrorCodeBusy), errorMessage);
+        return;
+    }
+
+    // a read or job would take the data the bridge forwards
+    if (channel.bridgeChannel != MessageEncoding::noPeerChannel && (messageDecoder.messageType == MessageDecoder::MessageTypeReadData || messageDecoder.messageType == MessageDecoder::MessageTypeStartJob))
+    {
+        errorMessage = "Port busy, it is bridged";
+        writeErrorResponse(channel, messageDecoder.messageType, messageDecoder.responseHeader(MessageDecoder::ErrorCodeBusy), errorMessage);
+        return;
+    }
+
+    // sniffed ports only listen, and a read would take data out of the merged stream
+    if (channel.sniffChannel != MessageEncoding::noPeerChannel && (messageDecoder.messageType == MessageDecoder::MessageTypeReadData || messageDecoder.messageType == MessageDecoder::MessageTypeWriteData || messageDecoder.messageType == MessageDecoder::MessageTypeSendBreak || messageDecoder.messageType == MessageDecoder::MessageTypeStartJob || messageDecoder.messageType == MessageDecoder::MessageTypeBridge))
+    {
+        errorMessage = "Port busy, it is sniffing";
+        writeErrorResponse(channel, messageDecoder.messageType, messageDecoder.responseHeader(MessageDecoder::ErrorCodeBusy), errorMessage);
         return;
     }
 
@@ -89,6 +197,7 @@ void ClientConnection::handleMessage(char *payload, int size)
         MessageDecoder::AuthenticateRequest r;
         if (!messageDecoder.readAuthenticateRequest(&r))
         {
+            errorCode = MessageDecoder::ErrorCodeDecode;
             errorMessage = failedToDecode;
             break;
         }
@@ -98,6 +207,7 @@ void ClientConnection::handleMessage(char *payload, int size)
         //TODO the token should not expire while the socket is in use
         if (!UserAuthSessionManager::checkTokenValid(token))
         {
+            errorCode = MessageDecoder::ErrorCodeAuthFailed;
             errorMessage = "Authentication failed";
             break;
         }
@@ -105,10 +215,12 @@ void ClientConnection::handleMessage(char *payload, int size)
         break;
     }
     case MessageDecoder::MessageTypeOpen:
+    case MessageDecoder::MessageTypeOpenViewer:
     {
         MessageDecoder::OpenPortRequest r = {};
         if (!messageDecoder.readOpenPortRequest(&r))
         {
+            errorCode = MessageDecoder::ErrorCodeDecode;
             errorMessage = failedToDecode;
             break;
         }
@@ -116,52 +228,43 @@ void ClientConnection::handleMessage(char *payload, int size)
         char portName[256] = "";
         mempcpy(portName, r.portName, r.nameSize);
 
-        auto p = PortManager::requestOwnershipTakeover(portName);
-        if (p == nullptr)
+        if (!openPort(channel, portName, messageDecoder.messageType == MessageDecoder::MessageTypeOpenViewer, errorCode, errorMessage))
         {
-            errorMessage = "Port already inuse";
             break;
         }
 
-        auto asyncSendDataCallback = [this](char *data, uint16_t length)
-        {
-            MessageEncoder response(MessageEncoder::MessageTypeAsyncDataRead, (char *)data, length);
-            writeMessage(response.payloadBase, length + 1, true);
-        };
-
-        port = (Port *)p;
-        port->setContinuesReadOnDataCallback(asyncSendDataCallback);
-        if (!port->init())
-        {
-            PortManager::releaseOwnership(port);
-            errorMessage = "Port setup failed";
-            break;
-        }
-
-        applyMode(port, lastModeRequest);
-        break;
+        // the starting point for the client's tx credit, it may queue up to the limit
+        char buff[MessageEncoding::maxResponseHeaderSize + sizeof(uint32_t) * 2] = "";
+        auto header = messageDecoder.responseHeader();
+        MessageEncoder response(messageDecoder.messageType, header, buff, sizeof(buff));
+        response.writeUint32(channel.port->getTxQueuedTotal());
+        response.writeUint32(channel.txLimitReported);
+        writeResponse(channel, header, response.payloadBase, response.payload - response.payloadBase);
+        return;
     }
     case MessageDecoder::MessageTypeClose:
-        if (!PortManager::releaseOwnership(port))
-        {
-            errorMessage = "Failed to release port";
-        }
-
-        port->stopContinuesRead();
-        port = nullptr;
+        abortPendingReads(channel);
+        closePort(channel);
         break;
     case MessageDecoder::MessageTypeSetMode:
     {
         MessageDecoder::ModeRequest r;
         if (!messageDecoder.readSetModeRequest(&r))
         {
+            errorCode = MessageDecoder::ErrorCodeDecode;
             errorMessage = failedToDecode;
             break;
         }
-        lastModeRequest = r;
+        channel.lastModeRequest = r;
+        if (channel.sniffChannel != MessageEncoding::noPeerChannel)
+        {
+            // the merged stream is ordered by the timestamps
+            r.streamFlags |= Port::StreamFlagTimestamps;
+        }
 
         if (port != nullptr && !applyMode(port, r))
         {
+            errorCode = MessageDecoder::ErrorCodeFailed;
             errorMessage = "Failed to change mode";
         }
         break;
@@ -174,54 +277,250 @@ void ClientConnection::handleMessage(char *payload, int size)
         MessageDecoder::ReadDataRequest r = {};
         if (!messageDecoder.readReadDataRequest(&r))
         {
+            errorCode = MessageDecoder::ErrorCodeDecode;
             errorMessage = failedToDecode;
             break;
         }
-        char buff[512] = "";
-        buff[0] = messageDecoder.messageType;
 
-        if (r.length >= sizeof(buff) - 1)
+        if (r.length > Port::maxReadRequestSize)
         {
+            errorCode = MessageDecoder::ErrorCodeBufferFull;
             errorMessage = "Port read request too large";
             break;
         }
-        if (!port->read((char *)buff + 1, r.length, r.timeout))
-        {
-            errorMessage = "Port read failed";
-            break;
-        }
 
-        writeMessage(buff, r.length + 1, false);
+        // the response is sent from process() once the port task has the data
+        queueRead(channel, messageDecoder.responseHeader(), r);
         return;
     }
     case MessageDecoder::MessageTypeStartAsyncDataRead:
-        port->startContinuesRead();
+        PortManager::setSubscriptionEnabled(&channel.subscription, true);
         break;
     case MessageDecoder::MessageTypeAsyncDataRead:
         /* not applicable to server */
         break;
     case MessageDecoder::MessageTypeStopAsyncDataRead:
-        port->stopContinuesRead();
+        PortManager::setSubscriptionEnabled(&channel.subscription, false);
+        break;
+    case MessageDecoder::MessageTypeRxCredit:
+    {
+        MessageDecoder::RxCreditRequest r = {};
+        if (!messageDecoder.readRxCreditRequest(&r))
+        {
+            errorCode = MessageDecoder::ErrorCodeDecode;
+            errorMessage = failedToDecode;
+            break;
+        }
+
+        // the grant comes from the client, held at INT32_MAX so repeated grants can not wrap the credit negative
+        int64_t credit = r.bytes;
+        if (r.mode == MessageDecoder::CreditModeAdd)
+        {
+            credit += channel.rxCredit;
+        }
+        channel.rxCredit = credit > INT32_MAX ? INT32_MAX : (int32_t)credit;
+        channel.rxCreditEnabled = r.mode != MessageDecoder::CreditModeOff;
         break;
+    }
     case MessageDecoder::MessageTypeWriteData:
     {
         MessageDecoder::WriteDataRequest r = {};
         if (!messageDecoder.readWriteDataRequest(&r))
         {
+            errorCode = MessageDecoder::ErrorCodeDecode;
             errorMessage = failedToDecode;
             break;
         }
         int lenSent = port->write(r.payload, r.length);
         if (lenSent != r.length)
         {
-            errorMessage = "Port write failed";
+            errorCode = MessageDecoder::ErrorCodeBufferFull;
+            errorMessage = "Port TX queue full";
+            break;
+        }
+        CaptureLog::record(port, CaptureLog::RecordTypeTx, (uint8_t *)r.payload, r.length);
+
+        // the client waits for a write complete message with a total >= this to know the data has gone out
+        char buff[MessageEncoding::maxResponseHeaderSize + sizeof(uint32_t) * 2] = "";
+        auto header = messageDecoder.responseHeader();
+        MessageEncoder response(messageDecoder.messageType, header, buff, sizeof(buff));
+        response.writeUint32(port->getTxQueuedTotal());
+        channel.txLimitReported = port->getTxLimit();
+        response.writeUint32(channel.txLimitReported);
+        writeResponse(channel, header, response.payloadBase, response.payload - response.payloadBase);
+        return;
+    }
+    case MessageDecoder::MessageTypeSendBreak:
+    {
+        MessageDecoder::SendBreakRequest r = {};
+        if (!messageDecoder.readSendBreakRequest(&r))
+        {
+            errorCode = MessageDecoder::ErrorCodeDecode;
+            errorMessage = failedToDecode;
+            break;
+        }
+
+        if (r.durationMs == 0 || r.durationMs > Port::maxBreakMs)
+        {
+            errorCode = MessageDecoder::ErrorCodeDecode;
+            errorMessage = "Invalid break duration";
+            break;
+        }
+
+        // the break follows the data already written, it is not waited for
+        if (!port->sendBreak(r.durationMs))
+        {
+            errorCode = MessageDecoder::ErrorCodeBusy;
+            errorMessage = "Break already pending";
+        }
+        break;
+    }
+    case MessageDecoder::MessageTypeArmTrigger:
+    {
+        MessageDecoder::ArmTriggerRequest r = {};
+        if (!messageDecoder.readArmTriggerRequest(&r) || r.patternLength > TriggerCapture::maxPatternLength)
+        {
+            errorCode = MessageDecoder::ErrorCodeDecode;
+            errorMessage = failedToDecode;
+            break;
+        }
+
+        TriggerCapture::Config config = {r.triggers, r.preEntries, r.postEntries, r.patternLength};
+        memcpy(config.pattern, r.pattern, r.patternLength);
+        // replaces any trigger already armed, including a window that has not been sent yet
+        channel.triggerArmed = false;
+        if (!port->setTrigger(config))
+        {
+            errorCode = MessageDecoder::ErrorCodeFailed;
+            errorMessage = "Invalid trigger or not enough memory";
+            break;
+        }
+        channel.triggerArmed = r.triggers != 0;
+        break;
+    }
+    case MessageDecoder::MessageTypeWatchPatterns:
+    {
+        // viewers can watch too, a dashboard only needs the hits
+        MessageDecoder::WatchPatternsRequest r;
+        if (!messageDecoder.readWatchPatternsRequest(&r))
+        {
+            errorCode = MessageDecoder::ErrorCodeDecode;
+            errorMessage = failedToDecode;
+            break;
+        }
+
+        if (!PortManager::setWatchPatterns(&channel.subscription, r.patterns))
+        {
+            errorCode = MessageDecoder::ErrorCodeFailed;
+            errorMessage = "Too many patterns for the port";
         }
         break;
     }
+    case MessageDecoder::MessageTypeBridge:
+    {
+        MessageDecoder::BridgeRequest r;
+        if (!messageDecoder.readBridgeRequest(&r))
+        {
+            errorCode = MessageDecoder::ErrorCodeDecode;
+            errorMessage = failedToDecode;
+            break;
+        }
+
+        startBridge(channel, r, errorCode, errorMessage);
+        break;
+    }
+    case MessageDecoder::MessageTypeSniff:
+    {
+        MessageDecoder::SniffRequest r;
+        if (!messageDecoder.readSniffRequest(&r))
+        {
+            errorCode = MessageDecoder::ErrorCodeDecode;
+            errorMessage = failedToDecode;
+            break;
+        }
+
+        startSniff(channel, r, errorCode, errorMessage);
+        break;
+    }
+    case MessageDecoder::MessageTypeGetPortStats:
+    {
+        char buff[MessageEncoding::maxResponseHeaderSize + sizeof(uint32_t) * 13] = "";
+        auto stats = port->getStats();
+        auto header = messageDecoder.responseHeader();
+        MessageEncoder response(messageDecoder.messageType, header, buff, sizeof(buff));
+        response.writeUint32(stats.rxBufferSize);
+        response.writeUint32(stats.rxBufferHighWaterMark);
+        response.writeUint32(stats.rxOverflowBytes);
+        response.writeUint32(stats.rxOverflowCount);
+        response.writeUint32(stats.fifoOverflowCount);
+        response.writeUint32(stats.driverBufferFullCount);
+        response.writeUint32(stats.breakCount);
+        response.writeUint32(stats.parityErrorCount);
+        response.writeUint32(stats.frameErrorCount);
+        response.writeUint32(stats.framesDecoded);
+        response.writeUint32(stats.badFrameCount);
+        response.writeUint32(stats.bridgeDroppedBytes);
+        response.writeUint32(stats.rs485CollisionCount);
+
+        writeResponse(channel, header, response.payloadBase, response.payload - response.payloadBase);
+        return;
+    }
+    case MessageDecoder::MessageTypeStartJob:
+    {
+        MessageDecoder::StartJobRequest r = {};
+        if (!messageDecoder.readStartJobRequest(&r))
+        {
+            errorCode = MessageDecoder::ErrorCodeDecode;
+            errorMessage = failedToDecode;
+            break;
+        }
+
+        if (!startJob(channel, r, errorCode, errorMessage))
+        {
+            break;
+        }
+
+        // the client keeps no more than this much job data unconsumed
+        char buff[MessageEncoding::maxResponseHeaderSize + sizeof(uint32_t)] = "";
+        auto header = messageDecoder.responseHeader();
+        MessageEncoder response(messageDecoder.messageType, header, buff, sizeof(buff));
+        response.writeUint32(channel.job->getInputBufferSize());
+        writeResponse(channel, header, response.payloadBase, response.payload - response.payloadBase);
+        return;
+    }
+    case MessageDecoder::MessageTypeJobData:
+    {
+        MessageDecoder::JobDataRequest r = {};
+        if (!messageDecoder.readJobDataRequest(&r))
+        {
+            errorCode = MessageDecoder::ErrorCodeDecode;
+            errorMessage = failedToDecode;
+            break;
+        }
+
+        if (channel.job == nullptr || channel.job->isFinished())
+        {
+            errorCode = MessageDecoder::ErrorCodeNotFound;
+            errorMessage = "No job running";
+        }
+        else if (!channel.job->writeInput((const uint8_t *)r.payload, r.length))
+        {
+            errorCode = MessageDecoder::ErrorCodeBufferFull;
+            errorMessage = "Job input full";
+        }
+        break;
+    }
+    case MessageDecoder::MessageTypeCancelJob:
+        if (channel.job != nullptr)
+        {
+            channel.job->cancel();
+        }
+        break;
     case MessageDecoder::MessageTypeGetPortList:
     {
         char buff[255] = "";
-        MessageEncoder response(messageDecoder.messageType, buff, sizeof(buff));
+        auto header = messageDecoder.responseHeader();
+        MessageEncoder response(messageDecoder.messageType, header, buff, sizeof(buff));
         response.writePortListHeader(PortManager::portCount);
         for (int i = 0; i < PortManager::portCount; i++)
         {
@@ -229,30 +528,796 @@ void ClientConnection::handleMessage(char *payload, int size)
             response.writePortListEntry(p->portName, strlen(p->portName));
         }
 
-        writeMessage(response.payloadBase, response.payload - response.payloadBase, false);
+        writeResponse(channel, header, response.payloadBase, response.payload - response.payloadBase);
         return;
     }
     default:
+        errorCode = MessageDecoder::ErrorCodeUnknownMessage;
         errorMessage = "unknown message";
         break;
     }
 
     if (!errorMessage.empty())
     {
-        writeErrorMessage(messageDecoder.messageType, errorMessage);
+        writeErrorResponse(channel, messageDecoder.messageType, messageDecoder.responseHeader(errorCode), errorMessage);
     }
     else
     {
-        char buff[1] = "";
-        MessageEncoder response(messageDecoder.messageType, buff, sizeof(buff));
+        char buff[MessageEncoding::maxResponseHeaderSize] = "";
+        auto header = messageDecoder.responseHeader();
+        MessageEncoder response(messageDecoder.messageType, header, buff, sizeof(buff));
+        writeResponse(channel, header, response.payloadBase, response.payload - response.payloadBase);
+    }
+}
+
+MessageEncoding::ResponseHeader ClientConnection::unsolicitedHeader(PortChannel &channel)
+{
+    return {protocolVersion, MessageEncoding::ErrorCodeNone, 0, channel.id};
+}
+
+bool ClientConnection::writeResponse(PortChannel &channel, const MessageEncoding::ResponseHeader &header, const char *payload, const int payloadSize)
+{
+    // v2 clients match responses by request id so only v1 needs to wait behind a read
+    if (channel.queuedResponses.empty() || header.version >= MessageEncoding::protocolVersion2)
+    {
+        return writeMessage(payload, payloadSize, false);
+    }
+
+    QueuedResponse queued = {};
+    queued.kind = QueuedResponse::KindMessage;
+    queued.header = header;
+    queued.payload.assign(payload, payloadSize);
+    channel.queuedResponses.push_back(queued);
+    return true;
+}
+
+bool ClientConnection::writeErrorResponse(PortChannel &channel, MessageDecoder::MessageType msgType, const MessageEncoding::ResponseHeader &header, std::string &errorMessage)
+{
+    if (channel.queuedResponses.empty() || header.version >= MessageEncoding::protocolVersion2)
+    {
+        return sendError(msgType, header, errorMessage);
+    }
+
+    QueuedResponse queued = {};
+    queued.kind = QueuedResponse::KindError;
+    queued.msgType = msgType;
+    queued.header = header;
+    queued.payload = errorMessage;
+    channel.queuedResponses.push_back(queued);
+    return true;
+}
+
+bool ClientConnection::sendError(MessageDecoder::MessageType msgType, const MessageEncoding::ResponseHeader &header, std::string &errorMessage)
+{
+    if (header.version < MessageEncoding::protocolVersion2)
+    {
+        return writeErrorMessage(msgType, errorMessage);
+    }
+
+    // v2 errors are binary, the status holds the code and the text follows the header
+    std::string buff(MessageEncoding::maxResponseHeaderSize + errorMessage.size(), 0);
+    MessageEncoder response(msgType, header, buff.data(), buff.size());
+    memcpy(response.payload, errorMessage.data(), errorMessage.size());
+    return writeMessage(response.payloadBase, (response.payload - response.payloadBase) + errorMessage.size(), false);
+}
+
+void ClientConnection::queueRead(PortChannel &channel, const MessageEncoding::ResponseHeader &header, MessageDecoder::ReadDataRequest &r)
+{
+    QueuedResponse queued = {};
+    queued.kind = QueuedResponse::KindRead;
+    queued.msgType = MessageDecoder::MessageTypeReadData;
+    queued.header = header;
+    queued.readRequest = r;
+    channel.queuedResponses.push_back(queued);
+
+    processPendingRead(channel);
+}
+
+void ClientConnection::processPendingRead(PortChannel &channel)
+{
+    auto port = channel.port;
+    if (channel.queuedResponses.empty() || port == nullptr)
+    {
+        return;
+    }
+
+    auto &head = channel.queuedResponses.front();
+    if (!channel.readStarted)
+    {
+        if (!port->requestRead(head.readRequest.length, head.readRequest.timeout))
+        {
+            // still releasing a cancelled read, try again on the next process()
+            return;
+        }
+        channel.readStarted = true;
+        return;
+    }
+
+    auto state = port->getReadState();
+    if (state == Port::ReadStateComplete)
+    {
+        char buff[MessageEncoding::maxResponseHeaderSize + Port::maxReadRequestSize];
+        MessageEncoder response(head.msgType, head.header, buff, sizeof(buff));
+        memcpy(response.payload, port->getReadData(), port->getReadLength());
+        writeMessage(response.payloadBase, (response.payload - response.payloadBase) + port->getReadLength(), false);
+    }
+    else if (state == Port::ReadStateTimeout)
+    {
+        std::string errorMessage = "Port read failed";
+        auto header = head.header;
+        header.status = MessageEncoding::ErrorCodeTimeout;
+        sendError(head.msgType, header, errorMessage);
+    }
+    else
+    {
+        return;
+    }
+
+    port->finishRead();
+    channel.readStarted = false;
+    channel.queuedResponses.pop_front();
+    flushQueuedResponses(channel);
+}
+
+void ClientConnection::flushQueuedResponses(PortChannel &channel)
+{
+    while (!channel.queuedResponses.empty())
+    {
+        auto &head = channel.queuedResponses.front();
+        if (head.kind == QueuedResponse::KindRead)
+        {
+            processPendingRead(channel);
+            return;
+        }
+
+        if (head.kind == QueuedResponse::KindError)
+        {
+            sendError(head.msgType, head.header, head.payload);
+        }
+        else
+        {
+            writeMessage(head.payload.data(), head.payload.size(), false);
+        }
+        channel.queuedResponses.pop_front();
+    }
+}
+
+void ClientConnection::abortPendingReads(PortChannel &channel)
+{
+    if (channel.port != nullptr && channel.readStarted)
+    {
+        channel.port->cancelRead();
+    }
+    channel.readStarted = false;
+
+    std::string errorMessage = "Port closed";
+    for (auto &queued : channel.queuedResponses)
+    {
+        if (queued.kind == QueuedResponse::KindRead)
+        {
+            queued.kind = QueuedResponse::KindError;
+            queued.header.status = MessageEncoding::ErrorCodePortClosed;
+            queued.payload = errorMessage;
+        }
+    }
+    flushQueuedResponses(channel);
+}
+
+void ClientConnection::process()
+{
+    for (auto &channel : channels)
+    {
+        processChannel(channel);
+    }
+}
+
+void ClientConnection::processChannel(PortChannel &channel)
+{
+    if (channel.port == nullptr)
+    {
+        return;
+    }
+
+    processPendingRead(channel);
+    processWriteCompletions(channel);
+    if (channel.sniffChannel == MessageEncoding::noPeerChannel)
+    {
+        processAsyncData(channel);
+    }
+    else if (channel.sniffMerger)
+    {
+        // takes the data of both sides
+        processSniff(channel);
+    }
+    processJob(channel);
+    processTrigger(channel);
+}
+
+void ClientConnection::processTrigger(PortChannel &channel)
+{
+    auto port = channel.port;
+    if (!channel.triggerArmed || port->getTriggerState() != TriggerCapture::StateComplete || !canWriteMessage())
+    {
+        return;
+    }
+
+    std::string buff(MessageEncoding::maxResponseHeaderSize + port->getTriggerResultSize(), 0);
+    MessageEncoder response(MessageEncoder::MessageTypeAsyncTriggerCapture, unsolicitedHeader(channel), &buff[0], buff.size());
+    auto length = port->readTriggerResult((uint8_t *)response.payload, &buff[0] + buff.size() - response.payload);
+    if (writeMessage(response.payloadBase, response.payload - response.payloadBase + length, false))
+    {
+        // one shot, the client arms again for the next window
+        channel.triggerArmed = false;
+        port->clearTrigger();
+    }
+}
+
+bool ClientConnection::startJob(PortChannel &channel, MessageDecoder::StartJobRequest &r, MessageEncoding::ErrorCode &errorCode, std::string &errorMessage)
+{
+    if (channel.job != nullptr)
+    {
+        errorCode = MessageEncoding::ErrorCodeBusy;
+        errorMessage = "Job already running";
+        return false;
+    }
+
+    std::shared_ptr<PortJob> newJob;
+    uint32_t inputBufferSize = 0;
+    switch (r.jobType)
+    {
+    case PortJob::JobTypeStm32Bootloader:
+        newJob = std::make_shared<Stm32BootloaderJob>(r.flags, r.address, r.imageLength);
+        inputBufferSize = Stm32BootloaderJob::inputBufferSize;
+        break;
+    case PortJob::JobTypeEspRomFlash:
+    {
+        auto espJob = std::make_shared<EspRomFlashJob>(r.flags, r.address, r.imageLength);
+        if (!espJob->setParams((const uint8_t *)r.params, r.paramsSize))
+        {
+            errorCode = MessageEncoding::ErrorCodeDecode;
+            errorMessage = "Invalid job settings";
+            return false;
+        }
+        newJob = espJob;
+        inputBufferSize = EspRomFlashJob::inputBufferSize;
+        break;
+    }
+    case PortJob::JobTypeModemSequence:
+    {
+        auto sequenceJob = std::make_shared<ModemSequenceJob>(r.flags);
+        if (!sequenceJob->setParams((const uint8_t *)r.params, r.paramsSize))
+        {
+            errorCode = MessageEncoding::ErrorCodeDecode;
+            errorMessage = "Invalid job settings";
+            return false;
+        }
+        newJob = sequenceJob;
+        inputBufferSize = ModemSequenceJob::inputBufferSize;
+        break;
+    }
+    case PortJob::JobTypeAutoBaud:
+        newJob = std::make_shared<AutoBaudJob>(r.flags);
+        inputBufferSize = AutoBaudJob::inputBufferSize;
+        break;
+    case PortJob::JobTypeScript:
+        if (r.imageLength == 0 || r.imageLength > ScriptJob::maxScriptSize)
+        {
+            errorCode = MessageEncoding::ErrorCodeDecode;
+            errorMessage = "Invalid job settings";
+            return false;
+        }
+        newJob = std::make_shared<ScriptJob>(r.flags, r.imageLength);
+        inputBufferSize = ScriptJob::inputBufferSize;
+        break;
+    case PortJob::JobTypeReplay:
+    {
+        auto replayJob = std::make_shared<ReplayJob>(r.imageLength);
+        if (!replayJob->setParams((const uint8_t *)r.params, r.paramsSize))
+        {
+            errorCode = MessageEncoding::ErrorCodeDecode;
+            errorMessage = "Invalid job settings";
+            return false;
+        }
+        newJob = replayJob;
+        inputBufferSize = ReplayJob::inputBufferSize;
+        break;
+    }
+    default:
+        errorCode = MessageEncoding::ErrorCodeNotFound;
+        errorMessage = "Unknown job type";
+        return false;
+    }
+
+    if (!newJob->init(inputBufferSize))
+    {
+        errorCode = MessageEncoding::ErrorCodeFailed;
+        errorMessage = "Job setup failed";
+        return false;
+    }
+
+    if (!channel.port->startJob(newJob))
+    {
+        errorCode = MessageEncoding::ErrorCodeBusy;
+        errorMessage = "Port busy";
+        return false;
+    }
+
+    channel.job = newJob;
+    channel.jobProgressReported = {};
+    // make sure the first progress message is sent
+    channel.jobProgressReported.state = 0xFF;
+    return true;
+}
+
+void ClientConnection::processJob(PortChannel &channel)
+{
+    auto &job = channel.job;
+    if (job == nullptr)
+    {
+        return;
+    }
+
+    auto progress = job->getProgress();
+    auto &reported = channel.jobProgressReported;
+    auto changed = progress.state != reported.state || progress.stage != reported.stage || progress.processed != reported.processed || progress.total != reported.total || progress.inputConsumed != reported.inputConsumed;
+    if (changed && canWriteMessage())
+    {
+        // room for the error text or a small result, larger results are sized by the job
+        auto resultSize = job->getResultSize() > 64 ? job->getResultSize() : 64;
+        std::string message(MessageEncoding::maxResponseHeaderSize + 2 + sizeof(uint32_t) * 3 + resultSize, 0);
+        auto buff = &message[0];
+        MessageEncoder response(MessageEncoder::MessageTypeJobProgress, unsolicitedHeader(channel), buff, message.size());
+        response.writeUint8(progress.state);
+        response.writeUint8(progress.stage);
+        response.writeUint32(progress.processed);
+        response.writeUint32(progress.total);
+        response.writeUint32(progress.inputConsumed);
+        int length = response.payload - response.payloadBase;
+        if (progress.state == PortJob::StateFailed)
+        {
+            // the reason follows as text
+            auto reason = job->getError();
+            auto reasonLength = strnlen(reason, message.size() - length);
+            memcpy(response.payload, reason, reasonLength);
+            length += reasonLength;
+        }
+        else if (progress.state == PortJob::StateComplete)
+        {
+            // followed by the job specific result if it has one
+            length += job->getResult((uint8_t *)response.payload, buff + message.size() - response.payload);
+        }
+
+        if (writeMessage(response.payloadBase, length, false))
+        {
+            reported = progress;
+        }
+        return;
+    }
+
+    // keep the job until the port task has let go of the port so a new job can start straight away
+    if (!changed && job->isFinished() && !channel.port->isJobActive())
+    {
+        job.reset();
+    }
+}
+
+void ClientConnection::processWriteCompletions(PortChannel &channel)
+{
+    auto port = channel.port;
+    auto completed = port->getTxCompletedTotal();
+    // the limit also moves without a completion when a profile change resizes the queue
+    auto limit = port->getTxLimit();
+    if ((completed == channel.txCompletedReported && limit == channel.txLimitReported) || !canWriteMessage())
+    {
+        return;
+    }
+
+    char buff[MessageEncoding::maxResponseHeaderSize + sizeof(uint32_t) * 3] = "";
+    MessageEncoder response(MessageEncoder::MessageTypeWriteComplete, unsolicitedHeader(channel), buff, sizeof(buff));
+    response.writeUint32(completed);
+    response.writeUint32(port->getTxQueueFreeSpace());
+    response.writeUint32(limit);
+    if (writeMessage(response.payloadBase, response.payload - response.payloadBase, false))
+    {
+        channel.txCompletedReported = completed;
+        channel.txLimitReported = limit;
+    }
+}
+
+void ClientConnection::processAsyncData(PortChannel &channel)
+{
+    // only pattern hits are queued while the data is not enabled
+    auto &subscription = channel.subscription;
+    auto lostBytes = subscription.takeLostBytes();
+    if (lostBytes > 0 && subscription.enabled)
+    {
+        // this connection fell behind, tell the client where the gap is
+        char buff[MessageEncoding::maxResponseHeaderSize + sizeof(uint32_t)] = "";
+        MessageEncoder response(MessageEncoder::MessageTypeAsyncDataLost, unsolicitedHeader(channel), buff, sizeof(buff));
+        response.writeUint32(lostBytes);
         writeMessage(response.payloadBase, response.payload - response.payloadBase, false);
     }
+
+    // with flow control on, data waits in the subscription for credit and is dropped as lost if the client falls too far behind
+    for (int i = 0; i < maxAsyncMessagesPerProcess && !subscription.empty() && canWriteMessage() && (!channel.rxCreditEnabled || channel.rxCredit > 0); i++)
+    {
+        auto &chunk = subscription.front();
+        if (!writeChunk(channel, chunk))
+        {
+            if (!canWriteMessage())
+            {
+                // the socket filled up, the chunk goes on a later pass
+                break;
+            }
+
+            // it can not be sent at all, the client is told it as lost data
+            subscription.popLost();
+            continue;
+        }
+
+        channel.rxCredit -= chunk->size() - PortSubscription::chunkHeaderSize;
+        subscription.pop();
+    }
+}
+
+bool ClientConnection::writeChunk(PortChannel &channel, const PortSubscription::Chunk &chunk)
+{
+    // the chunk is shared, each connection writes its own header into the reserved space just before sending
+    // all subscribers run on the server task and writeMessage copies the data out so this does not race
+    auto msgType = (MessageEncoding::MessageType)(*chunk)[0];
+    int headerSize = protocolVersion >= MessageEncoding::protocolVersion2 ? MessageEncoding::maxResponseHeaderSize : 1;
+    auto start = &(*chunk)[PortSubscription::chunkHeaderSize - headerSize];
+    MessageEncoder header(msgType, unsolicitedHeader(channel), start, headerSize);
+
+    return writeMessage(start, chunk->size() - (PortSubscription::chunkHeaderSize - headerSize), false);
+}
+
+bool ClientConnection::openPort(PortChannel &channel, const char *portName, bool asViewer, MessageEncoding::ErrorCode &errorCode, std::string &errorMessage)
+{
+    if (channel.port != nullptr)
+    {
+        errorCode = MessageEncoding::ErrorCodePortInUse;
+        errorMessage = "Port already open";
+        return false;
+    }
+
+    Port *p = asViewer ? PortManager::findPort(portName) : (Port *)PortManager::requestOwnershipTakeover(portName);
+    if (p == nullptr)
+    {
+        errorCode = asViewer ? MessageEncoding::ErrorCodeNotFound : MessageEncoding::ErrorCodePortInUse;
+        errorMessage = asViewer ? "Port not found" : "Port already inuse";
+        return false;
+    }
+
+    if (!p->init())
+    {
+        if (!asViewer)
+        {
+            PortManager::releaseOwnership(p);
+        }
+        errorCode = MessageEncoding::ErrorCodeFailed;
+        errorMessage = "Port setup failed";
+        return false;
+    }
+
+    channel.port = p;
+    channel.viewer = asViewer;
+    channel.txCompletedReported = p->getTxCompletedTotal();
+    channel.txLimitReported = p->getTxLimit();
+    PortManager::subscribe(p, &channel.subscription);
+
+    if (asViewer)
+    {
+        // viewers only exist to watch the data so start it straight away
+        PortManager::setSubscriptionEnabled(&channel.subscription, true);
+    }
+    else
+    {
+        applyMode(p, channel.lastModeRequest);
+    }
+
+    return true;
+}
+
+bool ClientConnection::startBridge(PortChannel &channel, MessageDecoder::BridgeRequest &r, MessageEncoding::ErrorCode &errorCode, std::string &errorMessage)
+{
+    // a new bridge replaces the old one, the request with no peer just stops it
+    stopBridge(channel);
+    if (r.peerChannel == MessageEncoding::noPeerChannel)
+    {
+        return true;
+    }
+
+    if (r.peerChannel >= maxChannels || r.peerChannel == channel.id)
+    {
+        errorCode = MessageEncoding::ErrorCodeInvalidChannel;
+        errorMessage = "Invalid bridge channel";
+        return false;
+    }
+
+    auto &peer = channels[r.peerChannel];
+    if (peer.port == nullptr || peer.viewer)
+    {
+        errorCode = MessageEncoding::ErrorCodeNotPermitted;
+        errorMessage = "The bridge peer must be a port opened on this connection";
+        return false;
+    }
+
+    if (peer.port->isJobActive() || peer.job != nullptr || channel.job != nullptr)
+    {
+        errorCode = MessageEncoding::ErrorCodeBusy;
+        errorMessage = "Port busy, a job is running";
+        return false;
+    }
+
+    if (peer.sniffChannel != MessageEncoding::noPeerChannel)
+    {
+        errorCode = MessageEncoding::ErrorCodeBusy;
+        errorMessage = "Port busy, it is sniffing";
+        return false;
+    }
+
+    // rules for the data received on each side
+    BridgeRewriter::Config toPeer = {};
+    BridgeRewriter::Config fromPeer = {};
+    for (auto &rule : r.rules)
+    {
+        auto &config = rule.direction == MessageEncoding::BridgeDirectionToPeer ? toPeer : fromPeer;
+        if (rule.direction > MessageEncoding::BridgeDirectionFromPeer || config.count == BridgeRewriter::maxRules || rule.matchLength == 0 || rule.matchLength > BridgeRewriter::maxMatchLength || rule.replaceLength > BridgeRewriter::maxReplaceLength)
+        {
+            errorCode = MessageEncoding::ErrorCodeDecode;
+            errorMessage = "Invalid bridge rule";
+            return false;
+        }
+
+        auto &out = config.rules[config.count++];
+        out.matchLength = rule.matchLength;
+        memcpy(out.match, rule.match, rule.matchLength);
+        out.replaceLength = rule.replaceLength;
+        memcpy(out.replace, rule.replace, rule.replaceLength);
+    }
+
+    stopBridge(peer);
+    if (!channel.port->setBridge(peer.port, toPeer) || !peer.port->setBridge(channel.port, fromPeer))
+    {
+        channel.port->setBridge(nullptr, {});
+        peer.port->setBridge(nullptr, {});
+        errorCode = MessageEncoding::ErrorCodeFailed;
+        errorMessage = "Bridge setup failed";
+        return false;
+    }
+
+    channel.bridgeChannel = peer.id;
+    peer.bridgeChannel = channel.id;
+    return true;
+}
+
+void ClientConnection::stopBridge(PortChannel &channel)
+{
+    if (channel.bridgeChannel == MessageEncoding::noPeerChannel)
+    {
+        return;
+    }
+
+    auto &peer = channels[channel.bridgeChannel];
+    channel.port->setBridge(nullptr, {});
+    peer.port->setBridge(nullptr, {});
+    channel.bridgeChannel = MessageEncoding::noPeerChannel;
+    peer.bridgeChannel = MessageEncoding::noPeerChannel;
+}
+
+bool ClientConnection::startSniff(PortChannel &channel, MessageDecoder::SniffRequest &r, MessageEncoding::ErrorCode &errorCode, std::string &errorMessage)
+{
+    stopSniff(channel);
+    if (r.peerChannel == MessageEncoding::noPeerChannel)
+    {
+        return true;
+    }
+
+    if (r.peerChannel >= maxChannels || r.peerChannel == channel.id)
+    {
+        errorCode = MessageEncoding::ErrorCodeInvalidChannel;
+        errorMessage = "Invalid sniff channel";
+        return false;
+    }
+
+    auto &peer = channels[r.peerChannel];
+    if (peer.port == nullptr || peer.viewer)
+    {
+        errorCode = MessageEncoding::ErrorCodeNotPermitted;
+        errorMessage = "The sniff peer must be a port opened on this connection";
+        return false;
+    }
+
+    if (peer.port->isJobActive() || peer.job != nullptr || channel.job != nullptr || channel.bridgeChannel != MessageEncoding::noPeerChannel || peer.bridgeChannel != MessageEncoding::noPeerChannel)
+    {
+        errorCode = MessageEncoding::ErrorCodeBusy;
+        errorMessage = "Port busy, a job or bridge is running";
+        return false;
+    }
+
+    stopSniff(peer);
+    for (auto side : {&channel, &peer})
+    {
+        // both sides stamped from the same esp_timer clock so they can be merged
+        if (!side->port->setRxOnly(true) || !side->port->setStreamFlags(side->lastModeRequest.streamFlags | Port::StreamFlagTimestamps))
+        {
+            channel.port->setRxOnly(false);
+            peer.port->setRxOnly(false);
+            errorCode = MessageEncoding::ErrorCodeFailed;
+            errorMessage = "Sniff setup failed";
+            return false;
+        }
+        PortManager::setSubscriptionEnabled(&side->subscription, true);
+        side->sniffChannel = side == &channel ? peer.id : channel.id;
+        side->sniffMerger = side == &channel;
+    }
+
+    channel.sniffTimes[MessageEncoding::SniffSourcePort] = 0;
+    channel.sniffTimes[MessageEncoding::SniffSourcePeer] = 0;
+    return true;
 }
 
+void ClientConnection::stopSniff(PortChannel &channel)
+{
+    if (channel.sniffChannel == MessageEncoding::noPeerChannel)
+    {
+        return;
+    }
+
+    // async read is left off on both, the client starts it again if it wants the separate streams
+    for (auto side : {&channel, &channels[channel.sniffChannel]})
+    {
+        side->port->setRxOnly(false);
+        side->port->setStreamFlags(side->lastModeRequest.streamFlags);
+        PortManager::setSubscriptionEnabled(&side->subscription, false);
+        side->sniffChannel = MessageEncoding::noPeerChannel;
+        side->sniffMerger = false;
+    }
+}
+
+void ClientConnection::processSniff(PortChannel &channel)
+{
+    PortChannel *sides[2] = {&channel, &channels[channel.sniffChannel]};
+    for (uint8_t source = 0; source < 2; source++)
+    {
+        auto lostBytes = sides[source]->subscription.takeLostBytes();
+        if (lostBytes > 0)
+        {
+            char buff[MessageEncoding::maxResponseHeaderSize + 2 + sizeof(uint32_t)] = "";
+            MessageEncoder response(MessageEncoder::MessageTypeAsyncSniffData, unsolicitedHeader(channel), buff, sizeof(buff));
+            response.writeUint8(source);
+            response.writeUint8(MessageEncoding::MessageTypeAsyncDataLost);
+            response.writeUint32(lostBytes);
+            writeMessage(response.payloadBase, response.payload - response.payloadBase, false);
+        }
+    }
+
+    // an empty side may still have older data on its way from the port, the other side is held back that long
+    auto holdUs = sides[0]->port->getRxReportDelayUs();
+    auto peerHoldUs = sides[1]->port->getRxReportDelayUs();
+    holdUs = peerHoldUs > holdUs ? peerHoldUs : holdUs;
+    auto now = esp_timer_get_time();
+    for (int i = 0; i < maxAsyncMessagesPerProcess && canWriteMessage() && (!channel.rxCreditEnabled || channel.rxCredit > 0); i++)
+    {
+        int next = -1;
+        int64_t nextTime = 0;
+        for (int source = 0; source < 2; source++)
+        {
+            auto &subscription = sides[source]->subscription;
+            if (subscription.empty())
+            {
+                continue;
+            }
+
+            // untimed records (line events, frames) stay where they are in their own side's stream
+            auto &chunk = subscription.front();
+            auto time = channel.sniffTimes[source];
+            if ((uint8_t)(*chunk)[0] == MessageEncoding::MessageTypeAsyncTimedData && chunk->size() >= PortSubscription::chunkHeaderSize + Port::timedDataHeaderSize)
+            {
+                time = 0;
+                for (int b = 0; b < 8; b++)
+                {
+                    time |= (int64_t)(uint8_t)(*chunk)[PortSubscription::chunkHeaderSize + b] << (b * 8);
+                }
+            }
+
+            if (next == -1 || time < nextTime)
+            {
+                next = source;
+                nextTime = time;
+            }
+        }
+
+        if (next == -1 || (sides[1 - next]->subscription.empty() && now - nextTime < holdUs))
+        {
+            break;
+        }
+
+        auto &subscription = sides[next]->subscription;
+        auto &chunk = subscription.front();
+        channel.sniffTimes[next] = nextTime;
+        if (!writeSniffChunk(channel, next, chunk))
+        {
+            if (!canWriteMessage())
+            {
+                // the socket filled up, the chunk goes on a later pass
+                break;
+            }
+
+            // it can not be sent at all, reported with the side's lost data
+            subscription.popLost();
+            continue;
+        }
+
+        channel.rxCredit -= chunk->size() - PortSubscription::chunkHeaderSize;
+        subscription.pop();
+    }
+}
+
+bool ClientConnection::writeSniffChunk(PortChannel &channel, uint8_t source, const PortSubscription::Chunk &chunk)
+{
+    // the chunk is shared with other subscribers so the tags go in a copy
+    auto length = chunk->size() - PortSubscription::chunkHeaderSize;
+    std::string buff(MessageEncoding::maxResponseHeaderSize + 2 + length, 0);
+    MessageEncoder response(MessageEncoder::MessageTypeAsyncSniffData, unsolicitedHeader(channel), &buff[0], buff.size());
+    response.writeUint8(source);
+    response.writeUint8((*chunk)[0]);
+    memcpy(response.payload, chunk->data() + PortSubscription::chunkHeaderSize, length);
+    return writeMessage(response.payloadBase, response.payload - response.payloadBase + length, false);
+}
+
+void ClientConnection::closePort(PortChannel &channel)
+{
+    if (channel.port == nullptr)
+    {
+        return;
+    }
+
+    stopBridge(channel);
+    stopSniff(channel);
+
+    PortManager::unsubscribe(&channel.subscription);
+    if (channel.triggerArmed)
+    {
+        channel.port->clearTrigger();
+        channel.triggerArmed = false;
+    }
+
+    if (channel.job != nullptr)
+    {
+        // the port task finishes with it
+        channel.job->cancel();
+        channel.job.reset();
+    }
+
+    if (!channel.viewer)
+    {
+        channel.port->cancelRead();
+        PortManager::releaseOwnership(channel.port);
+    }
+
+    channel.port = nullptr;
+    channel.viewer = false;
+    channel.rxCreditEnabled = false;
+    channel.rxCredit = 0;
+}
+
+void ClientConnection::processAll()
+{
+    for (auto connection : activeConnections)
+    {
+        connection->process();
+    }
+}
+
+std::list<ClientConnection *> ClientConnection::activeConnections;
+
 ClientConnection::~ClientConnection()
 {
-    if (port != nullptr)
+    activeConnections.remove(this);
+    for (auto &channel : channels)
     {
-        PortManager::releaseOwnership(port);
+        closePort(channel);
     }
-}
\ No newline at end of file
+}
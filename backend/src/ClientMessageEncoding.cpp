@@ -18,12 +18,45 @@
 #include "ClientMessageEncoding.h"
 #include "memory.h"
 
-MessageDecoder::MessageDecoder(const char *_payload, int _size) : messageType((MessageType)_payload[0]), payload(_payload + messageHeaderSize), payloadSize(_size - messageHeaderSize)
+MessageDecoder::MessageDecoder(const char *_payload, int _size) : messageType((MessageType)_payload[0]), version(_size > 1 ? (uint8_t)_payload[1] : protocolVersion1), requestId(0), channel(0), payload(_payload + messageHeaderSize), payloadSize(_size - messageHeaderSize)
 {
+    if (version < protocolVersion2)
+    {
+        if (payloadSize < 0)
+        {
+            // v1 requests with no payload can leave out the version byte
+            payload = _payload + _size;
+            payloadSize = 0;
+        }
+        return;
+    }
+
+    /*
+        uint8_t messageType;
+        uint8_t version;
+        uint16_t requestId;
+        uint8_t channel;
+    */
+    payload = _payload + messageHeaderSizeV2;
+    payloadSize = _size - messageHeaderSizeV2;
+    if (isValid())
+    {
+        requestId = (uint8_t)_payload[2] | ((uint8_t)_payload[3] << 8);
+        channel = _payload[4];
+    }
+}
+
+MessageEncoding::ResponseHeader MessageDecoder::responseHeader(ErrorCode status) const
+{
+    return {version, status, requestId, channel};
 }
 
 bool MessageDecoder::readAuthenticateRequest(AuthenticateRequest *out)
 {
+    if (payloadSize < 1)
+    {
+        return false;
+    }
     out->length = (uint8_t)payload[0];
     if (out->length >= payloadSize)
     {
@@ -35,6 +68,10 @@ bool MessageDecoder::readAuthenticateRequest(AuthenticateRequest *out)
 
 bool MessageDecoder::readOpenPortRequest(OpenPortRequest *out)
 {
+    if (payloadSize < 1)
+    {
+        return false;
+    }
     out->nameSize = (uint8_t)payload[0];
     if (out->nameSize >= payloadSize)
     {
@@ -58,12 +95,37 @@ bool MessageDecoder::readSetModeRequest(ModeRequest *out)
         uint8_t parity;
         uint8_t stopBits;
         uint8_t initialStatusBits;
+        uint8_t profile; (optional)
+        uint8_t frameMode; (optional)
+        uint8_t frameCRC; (optional)
+        uint8_t frameParam; (optional)
+        uint16_t maxFrameSize; (optional)
+        uint8_t flowControl; (optional)
+        uint8_t streamFlags; (optional)
+        uint32_t txByteGapUs; (optional)
+        uint16_t txLineGapMs; (optional)
+        uint16_t txEchoTimeoutMs; (optional)
+        uint8_t rs485Mode; (optional)
+        uint32_t rs485TurnaroundUs; (optional)
     */
-    out->baudRate = payload[0] | (payload[1] << 8) | (payload[2] << 16) | (payload[3] << 24);
+    auto data = (const uint8_t *)payload;
+    out->baudRate = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
     out->dataBits = payload[4];
     out->parity = payload[5];
     out->stopBits = payload[6];
     out->initialStatusBits = payload[7];
+    out->profile = payloadSize > 8 ? payload[8] : 0;
+    out->frameMode = payloadSize > 9 ? payload[9] : 0;
+    out->frameCRC = payloadSize > 10 ? payload[10] : 0;
+    out->frameParam = payloadSize > 11 ? payload[11] : 0;
+    out->maxFrameSize = payloadSize > 13 ? (uint8_t)payload[12] | ((uint8_t)payload[13] << 8) : 256;
+    out->flowControl = payloadSize > 14 ? payload[14] : 0;
+    out->streamFlags = payloadSize > 15 ? payload[15] : 0;
+    out->txByteGapUs = payloadSize > 19 ? data[16] | (data[17] << 8) | (data[18] << 16) | ((uint32_t)data[19] << 24) : 0;
+    out->txLineGapMs = payloadSize > 21 ? data[20] | (data[21] << 8) : 0;
+    out->txEchoTimeoutMs = payloadSize > 23 ? data[22] | (data[23] << 8) : 0;
+    out->rs485Mode = payloadSize > 24 ? data[24] : 0;
+    out->rs485TurnaroundUs = payloadSize > 28 ? data[25] | (data[26] << 8) | (data[27] << 16) | ((uint32_t)data[28] << 24) : 0;
 
     return true;
 }
@@ -71,35 +133,247 @@ bool MessageDecoder::readSetModeRequest(ModeRequest *out)
 bool MessageDecoder::readReadDataRequest(ReadDataRequest *out)
 {
     /**
+     v1
      uint16_t length
      uint16_t timeout
+     v2
+     uint32_t length
+     uint32_t timeout
     */
+    auto data = (const uint8_t *)payload;
+    if (version >= protocolVersion2)
+    {
+        if (payloadSize < sizeof(uint32_t) + sizeof(uint32_t))
+        {
+            return false;
+        }
+        out->length = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+        out->timeout = data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t)data[7] << 24);
+        return true;
+    }
+
     if (payloadSize < sizeof(uint16_t) + sizeof(uint16_t))
     {
         return false;
     }
-    out->length = payload[0] | (payload[1] << 8);
-    out->timeout = payload[2] | (payload[3] << 8);
+    out->length = data[0] | (data[1] << 8);
+    out->timeout = data[2] | (data[3] << 8);
 
     return true;
 }
 
 bool MessageDecoder::readWriteDataRequest(WriteDataRequest *out)
 {
-    if (payloadSize < sizeof(uint16_t))
+    // the length field is 16 bits in v1 and 32 bits in v2
+    auto data = (const uint8_t *)payload;
+    int lengthSize = version >= protocolVersion2 ? sizeof(uint32_t) : sizeof(uint16_t);
+    if (payloadSize < lengthSize)
+    {
+        return false;
+    }
+    out->length = data[0] | (data[1] << 8);
+    if (lengthSize == sizeof(uint32_t))
+    {
+        out->length |= (data[2] << 16) | ((uint32_t)data[3] << 24);
+    }
+    if (out->length > (uint32_t)(payloadSize - lengthSize))
+    {
+        return false;
+    }
+    out->payload = (char *)payload + lengthSize;
+
+    return true;
+}
+
+bool MessageDecoder::readStartJobRequest(StartJobRequest *out)
+{
+    /*
+        uint8_t jobType;
+        uint8_t flags;
+        uint32_t address;
+        uint32_t imageLength;
+        uint8_t params[]; (optional)
+    */
+    if (payloadSize < 10)
+    {
+        return false;
+    }
+
+    auto data = (const uint8_t *)payload;
+    out->jobType = data[0];
+    out->flags = data[1];
+    out->address = data[2] | (data[3] << 8) | (data[4] << 16) | ((uint32_t)data[5] << 24);
+    out->imageLength = data[6] | (data[7] << 8) | (data[8] << 16) | ((uint32_t)data[9] << 24);
+    out->params = payload + 10;
+    out->paramsSize = payloadSize - 10;
+
+    return true;
+}
+
+bool MessageDecoder::readJobDataRequest(JobDataRequest *out)
+{
+    if (payloadSize <= 0)
+    {
+        return false;
+    }
+    out->length = payloadSize;
+    out->payload = payload;
+
+    return true;
+}
+
+bool MessageDecoder::readRxCreditRequest(RxCreditRequest *out)
+{
+    /*
+        uint32_t bytes;
+        uint8_t mode; (optional)
+    */
+    if (payloadSize < sizeof(uint32_t))
+    {
+        return false;
+    }
+
+    auto data = (const uint8_t *)payload;
+    out->bytes = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+    out->mode = payloadSize > 4 ? data[4] : CreditModeAdd;
+
+    return true;
+}
+
+bool MessageDecoder::readSendBreakRequest(SendBreakRequest *out)
+{
+    /*
+        uint32_t durationMs;
+    */
+    if (payloadSize < sizeof(uint32_t))
+    {
+        return false;
+    }
+
+    auto data = (const uint8_t *)payload;
+    out->durationMs = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+
+    return true;
+}
+
+bool MessageDecoder::readArmTriggerRequest(ArmTriggerRequest *out)
+{
+    /*
+        uint8_t triggers;
+        uint16_t preEntries;
+        uint16_t postEntries;
+        uint8_t patternLength;
+        pattern[patternLength]
+    */
+    if (payloadSize < 6)
     {
         return false;
     }
-    out->length = payload[0] | (payload[1] << 8);
-    if (out->length + sizeof(uint16_t) < payloadSize)
+
+    auto data = (const uint8_t *)payload;
+    out->triggers = data[0];
+    out->preEntries = data[1] | (data[2] << 8);
+    out->postEntries = data[3] | (data[4] << 8);
+    out->patternLength = data[5];
+    out->pattern = payload + 6;
+
+    return payloadSize >= 6 + out->patternLength;
+}
+
+bool MessageDecoder::readWatchPatternsRequest(WatchPatternsRequest *out)
+{
+    /*
+        uint8_t count;
+        count times:
+            uint8_t length;
+            pattern[length]
+    */
+    if (payloadSize < 1)
     {
         return false;
     }
-    out->payload = (char *)payload + 2;
+
+    auto data = (const uint8_t *)payload;
+    int offset = 1;
+    out->patterns.clear();
+    for (int i = 0; i < data[0]; i++)
+    {
+        if (offset >= payloadSize || offset + 1 + data[offset] > payloadSize)
+        {
+            return false;
+        }
+        out->patterns.emplace_back(payload + offset + 1, data[offset]);
+        offset += 1 + data[offset];
+    }
 
     return true;
 }
 
+bool MessageDecoder::readBridgeRequest(BridgeRequest *out)
+{
+    /*
+        uint8_t peerChannel;
+        uint8_t ruleCount;
+        ruleCount times:
+            uint8_t direction;
+            uint8_t matchLength;
+            match[matchLength]
+            uint8_t replaceLength;
+            replace[replaceLength]
+    */
+    if (payloadSize < 2)
+    {
+        return false;
+    }
+
+    auto data = (const uint8_t *)payload;
+    out->peerChannel = data[0];
+    int offset = 2;
+    out->rules.clear();
+    for (int i = 0; i < data[1]; i++)
+    {
+        BridgeRule rule;
+        if (offset + 2 > payloadSize)
+        {
+            return false;
+        }
+        rule.direction = data[offset];
+        rule.matchLength = data[offset + 1];
+        rule.match = payload + offset + 2;
+        offset += 2 + rule.matchLength;
+
+        if (offset + 1 > payloadSize)
+        {
+            return false;
+        }
+        rule.replaceLength = data[offset];
+        rule.replace = payload + offset + 1;
+        offset += 1 + rule.replaceLength;
+
+        if (offset > payloadSize)
+        {
+            return false;
+        }
+        out->rules.push_back(rule);
+    }
+
+    return true;
+}
+
+bool MessageDecoder::readSniffRequest(SniffRequest *out)
+{
+    /*
+        uint8_t peerChannel;
+    */
+    if (payloadSize < 1)
+    {
+        return false;
+    }
+
+    out->peerChannel = payload[0];
+    return true;
+}
+
 MessageEncoder::MessageEncoder(MessageType msgType, const char *_payload, int payloadSize)
 {
     payloadBase = (char *)_payload;
@@ -108,6 +382,19 @@ MessageEncoder::MessageEncoder(MessageType msgType, const char *_payload, int pa
     payload++;
 }
 
+MessageEncoder::MessageEncoder(MessageType msgType, const ResponseHeader &header, const char *_payload, int payloadSize) : MessageEncoder(msgType, _payload, payloadSize)
+{
+    if (header.version < protocolVersion2)
+    {
+        return;
+    }
+
+    writeUint8(header.status);
+    writeUint8(header.requestId & 0xFF);
+    writeUint8(header.requestId >> 8);
+    writeUint8(header.channel);
+}
+
 bool MessageEncoder::writePortListHeader(int portCount)
 {
     (*payload) = portCount;
@@ -121,5 +408,22 @@ bool MessageEncoder::writePortListEntry(const char *portName, const uint8_t port
     memcpy(payload, portName, portNameSize);
     payload += portNameSize;
 
+    return true;
+}
+
+bool MessageEncoder::writeUint8(uint8_t value)
+{
+    *(payload++) = value;
+
+    return true;
+}
+
+bool MessageEncoder::writeUint32(uint32_t value)
+{
+    *(payload++) = value & 0xFF;
+    *(payload++) = (value >> 8) & 0xFF;
+    *(payload++) = (value >> 16) & 0xFF;
+    *(payload++) = (value >> 24) & 0xFF;
+
     return true;
 }
\ No newline at end of file
@@ -0,0 +1,430 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "EspRomFlashJob.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <stdio.h>
+#include <string.h>
+
+static const uint8_t SLIPEnd = 0xC0;
+static const uint8_t SLIPEsc = 0xDB;
+static const uint8_t SLIPEscEnd = 0xDC;
+static const uint8_t SLIPEscEsc = 0xDD;
+
+static const uint8_t CommandFlashDeflBegin = 0x10;
+static const uint8_t CommandFlashDeflData = 0x11;
+static const uint8_t CommandSync = 0x08;
+static const uint8_t CommandSpiAttach = 0x0D;
+static const uint8_t CommandChangeBaudRate = 0x0F;
+static const uint8_t CommandSpiFlashMD5 = 0x13;
+static const uint8_t CommandGetSecurityInfo = 0x14;
+
+static const uint8_t DirectionRequest = 0x00;
+static const uint8_t DirectionResponse = 0x01;
+static const uint32_t packetHeaderSize = 8;
+static const uint8_t ChecksumSeed = 0xEF;
+
+static const uint32_t commandTimeoutMs = 3000;
+static const uint32_t syncTimeoutMs = 100;
+static const int syncAttempts = 10;
+// the ROM erases the whole region in FLASH_DEFL_BEGIN
+static const uint32_t eraseTimeoutPerMbMs = 30000;
+static const uint32_t md5TimeoutPerMbMs = 8000;
+static const uint32_t writeTimeoutMs = 10000;
+static const uint32_t inputTimeoutMs = 10000;
+
+static void putUint32(uint8_t *dst, uint32_t value)
+{
+    dst[0] = value & 0xFF;
+    dst[1] = (value >> 8) & 0xFF;
+    dst[2] = (value >> 16) & 0xFF;
+    dst[3] = (value >> 24) & 0xFF;
+}
+
+static uint32_t timeoutForSize(uint32_t perMbMs, uint32_t size)
+{
+    auto timeout = (uint32_t)(((uint64_t)perMbMs * size) / (1024 * 1024));
+    return timeout < commandTimeoutMs ? commandTimeoutMs : timeout;
+}
+
+EspRomFlashJob::EspRomFlashJob(uint8_t _flags, uint32_t _flashOffset, uint32_t _compressedLength) : flags(_flags), flashOffset(_flashOffset), compressedLength(_compressedLength), uncompressedLength(0), baudRate(0), statusLength(4), hasSecurityInfo(false)
+{
+    memset(md5, 0, sizeof(md5));
+    errorMessage[0] = 0;
+}
+
+bool EspRomFlashJob::setParams(const uint8_t *params, uint32_t length)
+{
+    if (length < paramsSize)
+    {
+        return false;
+    }
+
+    uncompressedLength = params[0] | (params[1] << 8) | (params[2] << 16) | ((uint32_t)params[3] << 24);
+    memcpy(md5, params + 4, sizeof(md5));
+    baudRate = params[20] | (params[21] << 8) | (params[22] << 16) | ((uint32_t)params[23] << 24);
+
+    return uncompressedLength > 0 && compressedLength > 0;
+}
+
+void EspRomFlashJob::enterDownloadMode(PortIO &io)
+{
+    // the usual auto program circuit, DTR drives IO0 and RTS drives EN
+    io.setDTR(false);
+    io.setRTS(true);
+    io.delay(100);
+    io.setDTR(true);
+    io.setRTS(false);
+    io.delay(50);
+    io.setDTR(false);
+}
+
+void EspRomFlashJob::hardReset(PortIO &io)
+{
+    io.setDTR(false);
+    io.setRTS(true);
+    io.delay(100);
+    io.setRTS(false);
+}
+
+bool EspRomFlashJob::writeEscaped(PortIO &io, const uint8_t *data, uint32_t length)
+{
+    uint8_t encoded[128];
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        if (used + 2 > sizeof(encoded))
+        {
+            if (!io.write(encoded, used))
+            {
+                return false;
+            }
+            used = 0;
+        }
+
+        if (data[i] == SLIPEnd)
+        {
+            encoded[used++] = SLIPEsc;
+            encoded[used++] = SLIPEscEnd;
+        }
+        else if (data[i] == SLIPEsc)
+        {
+            encoded[used++] = SLIPEsc;
+            encoded[used++] = SLIPEscEsc;
+        }
+        else
+        {
+            encoded[used++] = data[i];
+        }
+    }
+
+    return used == 0 || io.write(encoded, used);
+}
+
+bool EspRomFlashJob::sendPacket(PortIO &io, uint8_t command, const uint8_t *data, uint32_t length, uint32_t checksum)
+{
+    uint8_t header[packetHeaderSize] = {DirectionRequest, command, (uint8_t)(length & 0xFF), (uint8_t)(length >> 8)};
+    putUint32(header + 4, checksum);
+
+    return io.write(&SLIPEnd, 1) && writeEscaped(io, header, sizeof(header)) && writeEscaped(io, data, length) && io.write(&SLIPEnd, 1);
+}
+
+int EspRomFlashJob::receivePacket(PortIO &io, int64_t deadline)
+{
+    bool started = false;
+    bool escaped = false;
+    uint32_t length = 0;
+    while (!isCancelled())
+    {
+        auto remaining = (deadline - esp_timer_get_time()) / 1000;
+        uint8_t value;
+        if (remaining <= 0 || receive(io, &value, 1, remaining) != 1)
+        {
+            return -1;
+        }
+
+        if (value == SLIPEnd)
+        {
+            // back to back delimiters, the second one starts the packet
+            if (started && length > 0)
+            {
+                return length;
+            }
+            started = true;
+            length = 0;
+            continue;
+        }
+
+        if (!started)
+        {
+            // boot messages from the target
+            continue;
+        }
+
+        if (escaped)
+        {
+            escaped = false;
+            value = value == SLIPEscEnd ? SLIPEnd : SLIPEsc;
+        }
+        else if (value == SLIPEsc)
+        {
+            escaped = true;
+            continue;
+        }
+
+        // anything larger than a response we use is read to the end and dropped
+        if (length < sizeof(response))
+        {
+            response[length] = value;
+        }
+        length++;
+    }
+
+    return -1;
+}
+
+bool EspRomFlashJob::command(PortIO &io, uint8_t command, const uint8_t *data, uint32_t length, uint32_t checksum, uint32_t timeoutMs, uint32_t *dataLength)
+{
+    if (!sendPacket(io, command, data, length, checksum))
+    {
+        return fail("port write failed");
+    }
+
+    auto deadline = esp_timer_get_time() + (int64_t)timeoutMs * 1000;
+    while (true)
+    {
+        int received = receivePacket(io, deadline);
+        if (received < 0)
+        {
+            snprintf(errorMessage, sizeof(errorMessage), "no response to command 0x%02x", command);
+            return fail(errorMessage);
+        }
+
+        // extra sync replies and other stray packets are skipped
+        if (received < (int)packetHeaderSize || received > (int)sizeof(response) || response[0] != DirectionResponse || response[1] != command)
+        {
+            continue;
+        }
+
+        uint32_t size = response[2] | (response[3] << 8);
+        if (packetHeaderSize + size > (uint32_t)received || size < statusLength)
+        {
+            continue;
+        }
+
+        auto status = response + packetHeaderSize + size - statusLength;
+        if (status[0] != 0)
+        {
+            snprintf(errorMessage, sizeof(errorMessage), "command 0x%02x failed, error 0x%02x", command, status[1]);
+            return fail(errorMessage);
+        }
+
+        if (dataLength != nullptr)
+        {
+            *dataLength = size - statusLength;
+        }
+        return true;
+    }
+}
+
+bool EspRomFlashJob::sync(PortIO &io)
+{
+    uint8_t data[36] = {0x07, 0x07, 0x12, 0x20};
+    memset(data + 4, 0x55, sizeof(data) - 4);
+
+    for (int attempt = 0; attempt < syncAttempts && !isCancelled(); attempt++)
+    {
+        if (attempt % 5 == 0 && !(flags & FlagNoReset))
+        {
+            setStage(StageReset);
+            enterDownloadMode(io);
+            setStage(StageSync);
+        }
+
+        io.flushInput();
+        if (!sendPacket(io, CommandSync, data, sizeof(data), 0))
+        {
+            return fail("port write failed");
+        }
+
+        auto deadline = esp_timer_get_time() + (int64_t)syncTimeoutMs * 1000;
+        int received;
+        while ((received = receivePacket(io, deadline)) >= 0)
+        {
+            if (received >= (int)packetHeaderSize + 2 && response[0] == DirectionResponse && response[1] == CommandSync)
+            {
+                // the size of the status tells the ESP8266 ROM apart from the ESP32 family
+                statusLength = (response[2] | (response[3] << 8)) == 2 ? 2 : 4;
+                // the ROM answers a sync several times, let the rest arrive and throw them away
+                io.delay(50);
+                io.flushInput();
+                return true;
+            }
+        }
+    }
+
+    return fail("no response to sync, check the boot and reset wiring");
+}
+
+bool EspRomFlashJob::verify(PortIO &io)
+{
+    setStage(StageVerify);
+    uint8_t data[16] = {};
+    putUint32(data, flashOffset);
+    putUint32(data + 4, uncompressedLength);
+
+    uint32_t length = 0;
+    if (!command(io, CommandSpiFlashMD5, data, sizeof(data), 0, timeoutForSize(md5TimeoutPerMbMs, uncompressedLength), &length))
+    {
+        return false;
+    }
+
+    auto digest = response + packetHeaderSize;
+    bool match;
+    if (length == 32)
+    {
+        // the ROM sends the digest as hex text
+        char expected[33];
+        for (int i = 0; i < 16; i++)
+        {
+            snprintf(expected + i * 2, 3, "%02x", md5[i]);
+        }
+        match = strncasecmp((const char *)digest, expected, 32) == 0;
+    }
+    else
+    {
+        match = length == 16 && memcmp(digest, md5, 16) == 0;
+    }
+
+    return match || fail("MD5 mismatch, the flash does not hold the image");
+}
+
+bool EspRomFlashJob::flash(PortIO &io)
+{
+    if (!sync(io))
+    {
+        return false;
+    }
+
+    if (statusLength == 2)
+    {
+        // the ESP8266 ROM can not inflate, it needs the flasher stub
+        return fail("compressed writes are not supported by this ROM loader");
+    }
+
+    // only newer ROMs know this command, an error just means an ESP32
+    hasSecurityInfo = command(io, CommandGetSecurityInfo, nullptr, 0, 0, commandTimeoutMs);
+    if (isCancelled())
+    {
+        return false;
+    }
+
+    uint8_t attach[8] = {};
+    if (!command(io, CommandSpiAttach, attach, sizeof(attach), 0, commandTimeoutMs))
+    {
+        return false;
+    }
+
+    if (baudRate != 0 && baudRate != io.getBaudRate())
+    {
+        setStage(StageBaudRate);
+        uint8_t data[8] = {};
+        putUint32(data, baudRate);
+        if (!command(io, CommandChangeBaudRate, data, sizeof(data), 0, commandTimeoutMs))
+        {
+            return false;
+        }
+        io.waitWriteDone(commandTimeoutMs);
+        io.setBaudRate(baudRate);
+        io.delay(50);
+        io.flushInput();
+    }
+
+    setStage(StageErase);
+    uint32_t blockCount = (compressedLength + blockSize - 1) / blockSize;
+    uint8_t begin[20] = {};
+    putUint32(begin, uncompressedLength);
+    putUint32(begin + 4, blockCount);
+    putUint32(begin + 8, blockSize);
+    putUint32(begin + 12, flashOffset);
+    if (!command(io, CommandFlashDeflBegin, begin, hasSecurityInfo ? 20 : 16, 0, timeoutForSize(eraseTimeoutPerMbMs, uncompressedLength)))
+    {
+        return false;
+    }
+
+    setStage(StageWrite);
+    uint32_t written = 0;
+    setProgress(written, compressedLength);
+    for (uint32_t sequence = 0; sequence < blockCount; sequence++)
+    {
+        auto length = compressedLength - written < blockSize ? compressedLength - written : blockSize;
+        memset(body, 0, 16);
+        putUint32(body, length);
+        putUint32(body + 4, sequence);
+        if (!readInput(body + 16, length, inputTimeoutMs))
+        {
+            return false;
+        }
+
+        uint32_t checksum = ChecksumSeed;
+        for (uint32_t i = 0; i < length; i++)
+        {
+            checksum ^= body[16 + i];
+        }
+
+        if (!command(io, CommandFlashDeflData, body, 16 + length, checksum, writeTimeoutMs))
+        {
+            // the reason can be in errorMessage already, copy it out before formatting over it
+            // sized for what fits after the longest prefix, the rest would be cut off anyway
+            char reason[sizeof(errorMessage) - sizeof("write failed at block 4294967295, ") + 1];
+            snprintf(reason, sizeof(reason), "%s", getError());
+            snprintf(errorMessage, sizeof(errorMessage), "write failed at block %u, %s", (unsigned)sequence, reason);
+            return fail(errorMessage);
+        }
+
+        written += length;
+        setProgress(written, compressedLength);
+    }
+
+    if ((flags & FlagVerify) && !verify(io))
+    {
+        return false;
+    }
+
+    if (flags & FlagReboot)
+    {
+        setStage(StageReboot);
+        hardReset(io);
+    }
+
+    return true;
+}
+
+bool EspRomFlashJob::execute(PortIO &io)
+{
+    auto originalBaudRate = io.getBaudRate();
+    auto result = flash(io);
+
+    // leave the port as the client configured it
+    io.setBaudRate(originalBaudRate);
+    io.setDTR(false);
+    io.setRTS(false);
+
+    ESP_LOGI(__FUNCTION__, "flash %s", result ? "complete" : "failed");
+    return result;
+}
@@ -0,0 +1,382 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "FrameDecoder.h"
+#include <new>
+
+static const uint8_t SLIPEnd = 0xC0;
+static const uint8_t SLIPEsc = 0xDB;
+static const uint8_t SLIPEscEnd = 0xDC;
+static const uint8_t SLIPEscEsc = 0xDD;
+
+FrameDecoder::FrameDecoder() : config({}), frame(nullptr), frameCapacity(0), frameCount(0), badFrameCount(0)
+{
+    reset();
+}
+
+FrameDecoder::~FrameDecoder()
+{
+    delete[] frame;
+}
+
+bool FrameDecoder::configure(const Config &newConfig)
+{
+    if (newConfig.mode > FrameModeIdleGap || newConfig.crcType > CRC32 || newConfig.maxFrameSize > maxSupportedFrameSize)
+    {
+        return false;
+    }
+
+    if (newConfig.mode != FrameModeNone && newConfig.maxFrameSize == 0)
+    {
+        return false;
+    }
+
+    config = newConfig;
+
+    auto requiredCapacity = config.mode == FrameModeNone ? 0 : config.maxFrameSize + crcSize();
+    if (requiredCapacity != frameCapacity)
+    {
+        delete[] frame;
+        frame = nullptr;
+        frameCapacity = 0;
+        if (requiredCapacity > 0)
+        {
+            frame = new (std::nothrow) uint8_t[requiredCapacity];
+            if (frame == nullptr)
+            {
+                config.mode = FrameModeNone;
+                return false;
+            }
+            frameCapacity = requiredCapacity;
+        }
+    }
+
+    reset();
+    return true;
+}
+
+void FrameDecoder::reset()
+{
+    frameLength = 0;
+    escaped = false;
+    cobsRemaining = 0;
+    cobsAppendZero = false;
+    headerReceived = 0;
+    expectedLength = 0;
+    discarding = false;
+}
+
+void FrameDecoder::resetStats()
+{
+    frameCount = 0;
+    badFrameCount = 0;
+}
+
+uint8_t FrameDecoder::crcSize()
+{
+    switch (config.crcType)
+    {
+    case CRC8:
+        return 1;
+    case CRC16CCITT:
+    case CRC16Modbus:
+        return 2;
+    case CRC32:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+uint32_t FrameDecoder::calculateCRC(uint8_t crcType, const uint8_t *data, uint32_t length)
+{
+    uint32_t crc;
+    switch (crcType)
+    {
+    case CRC8:
+        crc = 0;
+        for (uint32_t i = 0; i < length; i++)
+        {
+            crc ^= data[i];
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) & 0xFF : (crc << 1) & 0xFF;
+            }
+        }
+        return crc;
+    case CRC16CCITT:
+        crc = 0xFFFF;
+        for (uint32_t i = 0; i < length; i++)
+        {
+            crc ^= (uint32_t)data[i] << 8;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) & 0xFFFF : (crc << 1) & 0xFFFF;
+            }
+        }
+        return crc;
+    case CRC16Modbus:
+        crc = 0xFFFF;
+        for (uint32_t i = 0; i < length; i++)
+        {
+            crc ^= data[i];
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+            }
+        }
+        return crc;
+    case CRC32:
+        crc = 0xFFFFFFFF;
+        for (uint32_t i = 0; i < length; i++)
+        {
+            crc ^= data[i];
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+            }
+        }
+        return ~crc;
+    default:
+        return 0;
+    }
+}
+
+bool FrameDecoder::append(uint8_t value)
+{
+    if (discarding)
+    {
+        return false;
+    }
+
+    if (frameLength >= frameCapacity)
+    {
+        // too long, drop the rest of it
+        badFrameCount++;
+        discarding = true;
+        return false;
+    }
+
+    frame[frameLength++] = value;
+    return true;
+}
+
+void FrameDecoder::endFrame(const FrameHandler &onFrame)
+{
+    if (discarding)
+    {
+        reset();
+        return;
+    }
+
+    auto crcLength = crcSize();
+    if (frameLength == 0 || frameLength < crcLength)
+    {
+        // SLIP and COBS senders often send back to back delimiters, they are not errors
+        if (frameLength > 0)
+        {
+            badFrameCount++;
+        }
+        reset();
+        return;
+    }
+
+    auto length = frameLength - crcLength;
+    if (crcLength > 0)
+    {
+        auto crcField = frame + length;
+        uint32_t received = 0;
+        if (config.crcType == CRC16CCITT)
+        {
+            received = (crcField[0] << 8) | crcField[1];
+        }
+        else
+        {
+            for (int i = crcLength - 1; i >= 0; i--)
+            {
+                received = (received << 8) | crcField[i];
+            }
+        }
+
+        if (received != calculateCRC(config.crcType, frame, length))
+        {
+            badFrameCount++;
+            reset();
+            return;
+        }
+    }
+
+    frameCount++;
+    onFrame(frame, length);
+    reset();
+}
+
+void FrameDecoder::feedLengthPrefixed(uint8_t value, const FrameHandler &onFrame)
+{
+    bool twoByteLength = config.param & 0x01;
+    bool bigEndian = config.param & 0x02;
+    uint8_t headerSize = twoByteLength ? 2 : 1;
+
+    if (headerReceived < headerSize)
+    {
+        if (!twoByteLength)
+        {
+            expectedLength = value;
+        }
+        else if (bigEndian)
+        {
+            expectedLength = (expectedLength << 8) | value;
+        }
+        else
+        {
+            expectedLength |= value << (8 * headerReceived);
+        }
+        headerReceived++;
+
+        if (headerReceived == headerSize)
+        {
+            expectedLength += crcSize();
+            if (expectedLength > frameCapacity)
+            {
+                // can not be trusted, there is no way to find the next frame other than to carry on
+                badFrameCount++;
+                discarding = true;
+            }
+            else if (expectedLength == 0)
+            {
+                endFrame(onFrame);
+            }
+        }
+        return;
+    }
+
+    if (discarding)
+    {
+        if (--expectedLength == 0)
+        {
+            reset();
+        }
+        return;
+    }
+
+    append(value);
+    if (frameLength == expectedLength)
+    {
+        endFrame(onFrame);
+    }
+}
+
+void FrameDecoder::feed(const uint8_t *data, uint32_t length, const FrameHandler &onFrame)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        auto value = data[i];
+        switch (config.mode)
+        {
+        case FrameModeDelimiter:
+            if (value == config.param)
+            {
+                endFrame(onFrame);
+            }
+            else
+            {
+                append(value);
+            }
+            break;
+        case FrameModeSLIP:
+            if (value == SLIPEnd)
+            {
+                endFrame(onFrame);
+            }
+            else if (escaped)
+            {
+                escaped = false;
+                if (value == SLIPEscEnd)
+                {
+                    append(SLIPEnd);
+                }
+                else if (value == SLIPEscEsc)
+                {
+                    append(SLIPEsc);
+                }
+                else if (!discarding)
+                {
+                    badFrameCount++;
+                    discarding = true;
+                }
+            }
+            else if (value == SLIPEsc)
+            {
+                escaped = true;
+            }
+            else
+            {
+                append(value);
+            }
+            break;
+        case FrameModeCOBS:
+            if (value == 0)
+            {
+                if (cobsRemaining != 0 && !discarding)
+                {
+                    // the frame ended inside a code block
+                    badFrameCount++;
+                    discarding = true;
+                }
+                endFrame(onFrame);
+            }
+            else if (cobsRemaining == 0)
+            {
+                // start of a code block, the zero from the previous block is only added if more data follows
+                if (cobsAppendZero)
+                {
+                    append(0);
+                }
+                cobsRemaining = value - 1;
+                cobsAppendZero = value != 0xFF;
+            }
+            else
+            {
+                append(value);
+                cobsRemaining--;
+            }
+            break;
+        case FrameModeLengthPrefixed:
+            feedLengthPrefixed(value, onFrame);
+            break;
+        case FrameModeIdleGap:
+            append(value);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void FrameDecoder::idle(const FrameHandler &onFrame)
+{
+    if (config.mode == FrameModeIdleGap)
+    {
+        endFrame(onFrame);
+    }
+    else if (config.mode == FrameModeLengthPrefixed && (headerReceived > 0 || frameLength > 0))
+    {
+        // a length prefixed frame can not span an idle period, resync on the next byte
+        badFrameCount++;
+        reset();
+    }
+}
@@ -27,6 +27,30 @@ char *Json::getStringField(const char *key)
     return cJSON_GetStringValue(obj);
 }
 
+bool Json::getNumberField(const char *key, double *value)
+{
+    auto obj = cJSON_GetObjectItemCaseSensitive(json, key);
+    if (!cJSON_IsNumber(obj))
+    {
+        return false;
+    }
+
+    *value = cJSON_GetNumberValue(obj);
+    return true;
+}
+
+bool Json::getBoolField(const char *key, bool *value)
+{
+    auto obj = cJSON_GetObjectItemCaseSensitive(json, key);
+    if (!cJSON_IsBool(obj))
+    {
+        return false;
+    }
+
+    *value = cJSON_IsTrue(obj);
+    return true;
+}
+
 void Json::addField(const char *key, const char *value)
 {
     auto tmp = cJSON_CreateStringReference(value);
@@ -38,6 +62,11 @@ void Json::addField(const char *key, int value)
     cJSON_AddNumberToObject(json, key, value);
 }
 
+void Json::addField(const char *key, double value)
+{
+    cJSON_AddNumberToObject(json, key, value);
+}
+
 void Json::addField(const char *key, bool value)
 {
     cJSON_AddBoolToObject(json, key, value);
@@ -0,0 +1,120 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "ModemSequenceJob.h"
+#include "esp_log.h"
+#include <string.h>
+
+// longest a write step may take to leave the UART
+static const uint32_t writeTimeoutMs = 1000;
+
+static uint32_t readArg(const uint8_t *step)
+{
+    return step[1] | (step[2] << 8) | (step[3] << 16) | ((uint32_t)step[4] << 24);
+}
+
+ModemSequenceJob::ModemSequenceJob(uint8_t _flags) : flags(_flags), scriptSize(0), stepCount(0)
+{
+}
+
+bool ModemSequenceJob::setParams(const uint8_t *params, uint32_t length)
+{
+    if (length == 0 || length > maxScriptSize)
+    {
+        return false;
+    }
+
+    // check the whole script up front so a bad step can not leave the lines half way through a sequence
+    uint32_t offset = 0;
+    stepCount = 0;
+    while (offset < length)
+    {
+        if (length - offset < stepSize || params[offset] > OpFlushInput)
+        {
+            return false;
+        }
+
+        auto dataLength = params[offset] == OpWrite ? readArg(params + offset) : 0;
+        if (dataLength > length - offset - stepSize)
+        {
+            return false;
+        }
+        offset += stepSize + dataLength;
+        stepCount++;
+    }
+
+    memcpy(script, params, length);
+    scriptSize = length;
+    return true;
+}
+
+bool ModemSequenceJob::execute(PortIO &io)
+{
+    auto baudRate = io.getBaudRate();
+    auto result = true;
+    uint32_t offset = 0;
+
+    // progress is only reported at the ends, each report wakes the server task which would add jitter between steps
+    setProgress(0, stepCount);
+    uint32_t step = 0;
+    for (; offset < scriptSize && result && !isCancelled(); step++)
+    {
+        auto op = script[offset];
+        auto arg = readArg(script + offset);
+        offset += stepSize;
+
+        switch (op)
+        {
+        case OpSetLines:
+            // both lines are changed back to back so their edges are as close together as possible
+            if (arg & LineChangeDTR)
+            {
+                result = io.setDTR(arg & LineDTR);
+            }
+            if (arg & LineChangeRTS)
+            {
+                result = io.setRTS(arg & LineRTS) && result;
+            }
+            if (!result)
+            {
+                fail("failed to set the modem lines");
+            }
+            break;
+        case OpDelay:
+            io.delayMicros(arg);
+            break;
+        case OpSetBaudRate:
+            result = io.setBaudRate(arg) || fail("failed to set the baud rate");
+            break;
+        case OpWrite:
+            result = (io.write(script + offset, arg) && io.waitWriteDone(writeTimeoutMs)) || fail("port write failed");
+            offset += arg;
+            break;
+        case OpFlushInput:
+            io.flushInput();
+            break;
+        }
+    }
+    setProgress(step, stepCount);
+
+    if (flags & FlagRestoreBaudRate)
+    {
+        io.setBaudRate(baudRate);
+    }
+
+    return result;
+}
@@ -0,0 +1,210 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "PatternWatch.h"
+#include <stdlib.h>
+#include <string.h>
+
+PatternWatch::PatternWatch() : nodes(nullptr), nodeCount(0), state(0), contextHead(0), contextLength(0), active(false)
+{
+}
+
+PatternWatch::~PatternWatch()
+{
+    release();
+}
+
+void PatternWatch::release()
+{
+    active = false;
+    if (nodes != nullptr)
+    {
+        free(nodes);
+        nodes = nullptr;
+    }
+    nodeCount = 0;
+    state = 0;
+    contextHead = 0;
+    contextLength = 0;
+}
+
+bool PatternWatch::configure(const Config &config)
+{
+    release();
+    if (config.count == 0)
+    {
+        return true;
+    }
+
+    if (config.count > maxPatterns)
+    {
+        return false;
+    }
+
+    uint32_t total = 0;
+    for (int i = 0; i < config.count; i++)
+    {
+        if (config.lengths[i] == 0 || config.lengths[i] > maxPatternLength)
+        {
+            return false;
+        }
+        total += config.lengths[i];
+    }
+
+    if (total > maxTotalLength)
+    {
+        return false;
+    }
+
+    // one node per pattern byte at most, plus the root
+    nodes = (Node *)malloc((total + 1) * sizeof(Node));
+    auto queue = (uint16_t *)malloc((total + 1) * sizeof(uint16_t));
+    if (nodes == nullptr || queue == nullptr)
+    {
+        free(queue);
+        release();
+        return false;
+    }
+
+    memset(rootNext, 0, sizeof(rootNext));
+    memset(samePattern, noPattern, sizeof(samePattern));
+    nodes[0] = {0, 0, 0, 0, noPattern, 0};
+    nodeCount = 1;
+
+    auto pattern = config.patterns;
+    for (int i = 0; i < config.count; i++)
+    {
+        uint16_t node = 0;
+        for (int j = 0; j < config.lengths[i]; j++)
+        {
+            auto value = pattern[j];
+            auto found = child(node, value);
+            if (found == 0)
+            {
+                found = nodeCount++;
+                nodes[found] = {0, 0, 0, 0, noPattern, value};
+                if (node == 0)
+                {
+                    rootNext[value] = found;
+                }
+                else
+                {
+                    nodes[found].nextSibling = nodes[node].firstChild;
+                    nodes[node].firstChild = found;
+                }
+            }
+            node = found;
+        }
+        samePattern[i] = nodes[node].output;
+        nodes[node].output = i;
+        pattern += config.lengths[i];
+    }
+
+    // fail links breadth first, so the links of every shorter node are already set
+    uint16_t head = 0, tail = 0;
+    for (int value = 0; value < 256; value++)
+    {
+        if (rootNext[value] != 0)
+        {
+            queue[tail++] = rootNext[value];
+        }
+    }
+
+    while (head < tail)
+    {
+        auto node = queue[head++];
+        for (auto c = nodes[node].firstChild; c != 0; c = nodes[c].nextSibling)
+        {
+            auto fail = next(nodes[node].fail, nodes[c].value);
+            nodes[c].fail = fail;
+            nodes[c].outputLink = nodes[fail].output != noPattern ? fail : nodes[fail].outputLink;
+            queue[tail++] = c;
+        }
+    }
+    free(queue);
+
+    active = true;
+    return true;
+}
+
+uint16_t PatternWatch::child(uint16_t node, uint8_t value)
+{
+    if (node == 0)
+    {
+        return rootNext[value];
+    }
+
+    for (auto c = nodes[node].firstChild; c != 0; c = nodes[c].nextSibling)
+    {
+        if (nodes[c].value == value)
+        {
+            return c;
+        }
+    }
+    return 0;
+}
+
+uint16_t PatternWatch::next(uint16_t node, uint8_t value)
+{
+    while (true)
+    {
+        auto found = child(node, value);
+        if (found != 0 || node == 0)
+        {
+            return found;
+        }
+        node = nodes[node].fail;
+    }
+}
+
+void PatternWatch::feed(const uint8_t *data, uint32_t length, const HitHandler &onHit)
+{
+    if (!active)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        state = next(state, data[i]);
+        context[contextHead] = data[i];
+        contextHead = (contextHead + 1) % contextSize;
+        if (contextLength < contextSize)
+        {
+            contextLength++;
+        }
+
+        // every pattern that is a suffix of what has been matched ends on this byte
+        for (auto node = nodes[state].output != noPattern ? state : nodes[state].outputLink; node != 0; node = nodes[node].outputLink)
+        {
+            for (auto pattern = nodes[node].output; pattern != noPattern; pattern = samePattern[pattern])
+            {
+                onHit(pattern, i);
+            }
+        }
+    }
+}
+
+uint32_t PatternWatch::copyContext(uint8_t *dst, uint32_t size)
+{
+    auto length = size < contextLength ? size : contextLength;
+    auto start = (contextHead + contextSize - length) % contextSize;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        dst[i] = context[(start + i) % contextSize];
+    }
+    return length;
+}
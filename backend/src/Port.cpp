@@ -16,158 +16,1490 @@
  */
 
 #include "Port.h"
+#include "PortJob.h"
 #include "esp_log.h"
-Port::Port(uart_port_t _portNum, const char *_name, int RXPin, int TXPin) : portNum(_portNum), portName(_name)
+#include "esp_timer.h"
+Port::Port(uart_port_t _portNum, const char *_name, int RXPin, int TXPin, int RTSPin, int CTSPin, int DTRPin) : txPin(_portNum ? TXPin : -1), rtsPin(RTSPin), ctsPin(CTSPin), dtrPin(DTRPin), io(_portNum, DTRPin), portNum(_portNum), portName(_name)
 {
     ready = false;
-    readLock = xSemaphoreCreateMutex();
+    continuesReadEnabled = false;
+    flowControl = FlowControlNone;
+    rxThrottled = false;
+    eventQueue = nullptr;
+    eventQueueLock = xSemaphoreCreateMutex();
+    io.setEventQueue(&eventQueue);
+    readBuffer = nullptr;
+    activeProfile = nullptr;
+    requestedProfile = &profiles[0];
+    requestedFraming = {FrameDecoder::FrameModeNone, FrameDecoder::CRCNone, 0, 0};
+    framingApplied = true;
+    triggerApplied = false;
+    triggerRequests = 0;
+    triggerRequestsApplied = 0;
+    requestedWatch.count = 0;
+    requestedWatchGeneration = 0;
+    watchGeneration = 0;
+    watchApplied = false;
+    watchTime = 0;
+    watchHandler = [this](uint8_t pattern, uint32_t end)
+    {
+        writePatternHit(pattern, rxStreamOffset + end + 1);
+    };
+    bridgePeer = nullptr;
+    requestedBridgePeer = nullptr;
+    requestedRewrite.count = 0;
+    bridgeApplied = false;
+    offeredBridgePeer = nullptr;
+    bridgeRequests = 0;
+    bridgeRequestsApplied = 0;
+    txBridgeSource = nullptr;
+    bridgeDroppedBytes = 0;
+    rxOnly = false;
+    bridgeHandler = [this](const uint8_t *data, uint32_t length)
+    {
+        bridgePeer->writeBridged(data, length);
+    };
+    frameHandler = [this](const uint8_t *frame, uint32_t length)
+    {
+        writeRecord(RecordTypeFrame, frame, length);
+    };
+    reconfigureDone = xSemaphoreCreateBinary();
+    reconfigureSequence = 0;
+    reconfigureApplied = 0;
+    txResizeSequence = 0;
+    txInFlight = 0;
+    pendingRead.state = ReadStateIdle;
+    txQueuedTotal = 0;
+    txCompletedTotal = 0;
+    txByteGapUs = 0;
+    txLineGapMs = 0;
+    txEchoTimeoutMs = 0;
+    txPaceDue = 0;
+    txEchoWaiting = false;
+    txEchoOffset = 0;
+    txEchoDeadline = 0;
+    txEchoGapUs = 0;
+    txChunkEnd = 0;
+    rs485Mode = Rs485Off;
+    rs485TurnaroundUs = 0;
+    rs485RxEnd = 0;
+    dataBits = 8;
+    parity = ParityNone;
+    stopBits = PortStopBitsOne;
+    emulatedParityBit = 0;
+    emulatedParityMark = false;
+    rxStreamOffset = 0;
+    symbolBits = 10;
+    timestampsEnabled = false;
+    rxTimeBase = 0;
+    rxTimeOffset = 0;
+    rxSymbolNs = 0;
+    rxTimeoutSymbols = 0;
+    breakPending = false;
+    breakTxPosition = 0;
+    breakDurationMs = 0;
+    jobActive = false;
+    jobPending = false;
+    resetStats();
     if (_portNum)
     {
-        uart_set_pin(_portNum, TXPin, RXPin, -1, -1);
+        uart_set_pin(_portNum, TXPin, RXPin, RTSPin, CTSPin);
+    }
+
+    if (DTRPin >= 0)
+    {
+        // uart_set_pin can not route DTR so it is a plain output, idle high (not asserted)
+        gpio_reset_pin((gpio_num_t)DTRPin);
+        gpio_set_direction((gpio_num_t)DTRPin, GPIO_MODE_OUTPUT);
+        gpio_set_level((gpio_num_t)DTRPin, 1);
+    }
+}
+
+bool Port::init()
+{
+    if (!ready)
+    {
+        if (uart_is_driver_installed(portNum))
+        {
+            // installed by someone else without our event queue
+            uart_driver_delete(portNum);
+        }
+
+        auto result = applyProfile(requestedProfile);
+        ESP_LOGI("SETUP","result %d",(int)result);
+
+        if (result && !rxBuffer.allocate(rxBufferSize))
+        {
+            ESP_LOGE(__FUNCTION__, "failed to allocate rx buffer");
+            return false;
+        }
+
+        if (result && xTaskCreate(Port::readLoop, "Port::loop()", readTaskStackSize, this, 2, &readTask) == pdPASS)
+        {
+            ready = true;
+            return true;
+        }
+        return false;
+    }
+    return true;
+}
+
+bool Port::requestRead(uint32_t length, uint32_t timeout)
+{
+    if (length > maxReadRequestSize || pendingRead.state != ReadStateIdle)
+    {
+        return false;
+    }
+
+    pendingRead.length = length;
+    pendingRead.timeout = timeout;
+    pendingRead.received = 0;
+    pendingRead.state = ReadStateRequested;
+    postEvent(PortEventReadRequest);
+
+    return true;
+}
+
+void Port::finishRead()
+{
+    int state = pendingRead.state;
+    if (state == ReadStateComplete || state == ReadStateTimeout)
+    {
+        pendingRead.state = ReadStateIdle;
+    }
+}
+
+void Port::cancelRead()
+{
+    int state = pendingRead.state;
+    while (state == ReadStateRequested || state == ReadStateActive)
+    {
+        if (pendingRead.state.compare_exchange_weak(state, ReadStateCancelled))
+        {
+            postEvent(PortEventReadRequest);
+            return;
+        }
+    }
+
+    finishRead();
+}
+
+void Port::handlePendingRead()
+{
+    int state = pendingRead.state;
+    if (state == ReadStateCancelled)
+    {
+        pendingRead.state = ReadStateIdle;
+        return;
+    }
+
+    if (state == ReadStateRequested)
+    {
+        pendingRead.deadline = esp_timer_get_time() + (int64_t)pendingRead.timeout * 1000;
+        if (!pendingRead.state.compare_exchange_strong(state, ReadStateActive))
+        {
+            // cancelled before it started
+            pendingRead.state = ReadStateIdle;
+            return;
+        }
+        state = ReadStateActive;
+    }
+
+    if (state != ReadStateActive)
+    {
+        return;
+    }
+
+    auto remaining = pendingRead.length - pendingRead.received;
+    if (remaining > 0)
+    {
+        int readLength = uart_read_bytes(portNum, pendingRead.buffer + pendingRead.received, remaining, 0);
+        if (readLength > 0)
+        {
+            stripEmulatedParity((uint8_t *)pendingRead.buffer + pendingRead.received, readLength);
+            pendingRead.received += readLength;
+        }
+    }
+
+    int newState = ReadStateActive;
+    if (pendingRead.received == pendingRead.length)
+    {
+        newState = ReadStateComplete;
+    }
+    else if (esp_timer_get_time() >= pendingRead.deadline)
+    {
+        newState = ReadStateTimeout;
+    }
+    else
+    {
+        return;
+    }
+
+    if (!pendingRead.state.compare_exchange_strong(state, newState))
+    {
+        pendingRead.state = ReadStateIdle;
+        return;
+    }
+
+    notifyConsumer();
+}
+
+int Port::write(char *src, uint32_t len)
+{
+    if (rxOnly)
+    {
+        return 0;
+    }
+
+    auto source = txBridgeSource.load();
+    if (source != nullptr)
+    {
+        // the source's port task owns the tx buffer while bridged
+        if (injectBuffer.freeSpace() < len)
+        {
+            return 0;
+        }
+
+        injectBuffer.write((uint8_t *)src, len);
+        txQueuedTotal += len;
+        source->postEvent(PortEventWake);
+        return len;
+    }
+
+    // the port task is replacing the buffer, the caller sees it as full
+    if (isTxResizing() || txBuffer.freeSpace() < len)
+    {
+        return 0;
+    }
+
+    txBuffer.write((uint8_t *)src, len);
+    txQueuedTotal += len;
+    postEvent(PortEventTxPending);
+
+    return len;
+}
+
+void Port::handleTx()
+{
+    if (txInFlight > 0)
+    {
+        // paced data is due as the chunk before it finishes, give the driver a tick to report that rather than a whole wake up
+        TickType_t waitTime = isTxPaced() && esp_timer_get_time() >= txPaceDue ? 1 : 0;
+        if (uart_wait_tx_done(portNum, waitTime) != ESP_OK)
+        {
+            return;
+        }
+
+        txCompletedTotal += txInFlight;
+        txInFlight = 0;
+        notifyConsumer();
+        if (rs485Mode != Rs485Off)
+        {
+            checkRs485Collision();
+        }
+
+        // the source may be holding off its sender or injected data until there is room here
+        auto source = txBridgeSource.load();
+        if (source != nullptr)
+        {
+            source->resumeIfThrottled();
+            if (injectBuffer.available() > 0)
+            {
+                source->postEvent(PortEventWake);
+            }
+        }
+    }
+
+    uint32_t chunkLimit = sizeof(txChunk);
+    if (breakPending)
+    {
+        // only the data queued before the break goes ahead of it
+        int32_t before = breakTxPosition - txCompletedTotal;
+        if (before <= 0)
+        {
+            transmitBreak();
+        }
+        else if ((uint32_t)before < chunkLimit)
+        {
+            chunkLimit = before;
+        }
+    }
+
+    auto paced = isTxPaced();
+    if (paced && (txBuffer.available() == 0 || !txPaceReady()))
+    {
+        return;
+    }
+
+    auto lineEnd = false;
+    auto length = paced ? readPacedChunk(chunkLimit, &lineEnd) : txBuffer.read((uint8_t *)txChunk, chunkLimit);
+    if (length > 0)
+    {
+        if (trigger.isActive() && trigger.feed((uint8_t *)txChunk, length, true, esp_timer_get_time()))
+        {
+            notifyConsumer();
+        }
+        applyEmulatedParity((uint8_t *)txChunk, length);
+        // the driver buffer is empty and large enough for the chunk so this does not block
+        uart_write_bytes(portNum, txChunk, length);
+        txInFlight = length;
+        if (paced)
+        {
+            schedulePacedChunk(length, lineEnd);
+        }
+    }
+}
+
+bool Port::txPaceReady()
+{
+    if (txEchoWaiting)
+    {
+        if (rxStreamOffset == txEchoOffset && esp_timer_get_time() < txEchoDeadline)
+        {
+            return false;
+        }
+
+        // the gap is timed from the echo
+        txEchoWaiting = false;
+        txPaceDue = esp_timer_get_time() + txEchoGapUs;
+    }
+
+    if (txPaceWaitTime() > 0)
+    {
+        return false;
+    }
+
+    auto remaining = txDueTime() - esp_timer_get_time();
+    if (remaining > 0)
+    {
+        io.delayMicros(remaining);
+    }
+    return true;
+}
+
+TickType_t Port::txPaceWaitTime()
+{
+    if (!isTxPaced() || txBuffer.available() == 0)
+    {
+        return portMAX_DELAY;
+    }
+
+    auto now = esp_timer_get_time();
+    if (txEchoWaiting)
+    {
+        auto remaining = txEchoDeadline - now;
+        return remaining <= 0 ? 0 : (remaining / 1000 / portTICK_PERIOD_MS) + 1;
+    }
+
+    // wake early enough to spin the rest
+    auto sleep = txDueTime() - now - txPaceSpinUs;
+    return sleep <= 0 ? 0 : sleep / 1000 / portTICK_PERIOD_MS;
+}
+
+int64_t Port::txDueTime()
+{
+    if (rs485Mode == Rs485Off)
+    {
+        return txPaceDue;
+    }
+
+    // give the node that last spoke time to release the bus
+    auto turnaroundEnd = rs485RxEnd + rs485TurnaroundUs;
+    return turnaroundEnd > txPaceDue ? turnaroundEnd : txPaceDue;
+}
+
+uint32_t Port::readPacedChunk(uint32_t limit, bool *lineEnd)
+{
+    // gapped or echoed bytes go one at a time, the one after is looked at to keep \r\n together
+    auto byteAtATime = txByteGapUs != 0 || txEchoTimeoutMs != 0;
+    if (byteAtATime && limit > 2)
+    {
+        limit = 2;
+    }
+
+    auto peeked = txBuffer.peek((uint8_t *)txChunk, limit);
+    auto length = byteAtATime && peeked > 1 ? 1 : peeked;
+    *lineEnd = false;
+    for (uint32_t i = 0; txLineGapMs != 0 && i < length; i++)
+    {
+        auto value = txChunk[i];
+        if (value == '\r' && i + 1 == peeked && peeked == limit && i > 0)
+        {
+            // the \n may be next, send the \r with it
+            length = i;
+            break;
+        }
+
+        if (value == '\n' || (value == '\r' && (i + 1 == peeked || txChunk[i + 1] != '\n')))
+        {
+            length = i + 1;
+            *lineEnd = true;
+            break;
+        }
+    }
+
+    txBuffer.skip(length);
+    return length;
+}
+
+void Port::schedulePacedChunk(uint32_t length, bool lineEnd)
+{
+    // the driver buffer was empty so the chunk starts on the line now
+    uint32_t baudRate = 0;
+    auto end = esp_timer_get_time();
+    if (uart_get_baudrate(portNum, &baudRate) == ESP_OK && baudRate != 0)
+    {
+        end += ((int64_t)length * symbolBits * 1000000) / baudRate;
+    }
+
+    uint32_t gapUs = lineEnd ? txLineGapMs * 1000 : txByteGapUs.load();
+    txChunkEnd = end;
+    txPaceDue = end + gapUs;
+    if (txEchoTimeoutMs != 0)
+    {
+        txEchoWaiting = true;
+        txEchoOffset = rxStreamOffset;
+        txEchoDeadline = end + (int64_t)txEchoTimeoutMs * 1000;
+        txEchoGapUs = gapUs;
+        txPaceDue = end;
+    }
+}
+
+bool Port::setTxPacing(const TxPacing &pacing)
+{
+    if (pacing.byteGapUs > maxTxByteGapUs || pacing.lineGapMs > maxTxLineGapMs || pacing.echoTimeoutMs > maxTxEchoTimeoutMs)
+    {
+        return false;
+    }
+
+    txByteGapUs = pacing.byteGapUs;
+    txLineGapMs = pacing.lineGapMs;
+    txEchoTimeoutMs = pacing.echoTimeoutMs;
+    // data already queued picks up the new pacing
+    postEvent(PortEventTxPending);
+    return true;
+}
+
+bool Port::sendBreak(uint32_t durationMs)
+{
+    if (!ready || durationMs == 0 || durationMs > maxBreakMs || breakPending || rxOnly)
+    {
+        return false;
+    }
+
+    breakDurationMs = durationMs;
+    breakTxPosition = txQueuedTotal;
+    breakPending = true;
+    postEvent(PortEventTxPending);
+    return true;
+}
+
+void Port::transmitBreak()
+{
+    // uart_write_bytes_with_break only adds a short break after data, inverting TX gives one of any length
+    uart_set_line_inverse(portNum, UART_SIGNAL_TXD_INV);
+    io.delayMicros(breakDurationMs * 1000);
+    uart_set_line_inverse(portNum, UART_SIGNAL_INV_DISABLE);
+    breakPending = false;
+}
+
+bool Port::waitTxDone()
+{
+    if (txInFlight == 0)
+    {
+        return true;
+    }
+
+    // the peer can hold it up with flow control, then handleTx credits it once it has gone
+    if (uart_wait_tx_done(portNum, txDrainWaitTime()) != ESP_OK)
+    {
+        return false;
+    }
+
+    txCompletedTotal += txInFlight;
+    txInFlight = 0;
+    return true;
+}
+
+bool Port::startJob(const std::shared_ptr<PortJob> &newJob)
+{
+    if (!ready || jobActive.exchange(true))
+    {
+        return false;
+    }
+
+    job = newJob;
+    jobPending = true;
+    postEvent(PortEventJob);
+    return true;
+}
+
+void Port::runJob()
+{
+    auto current = std::move(job);
+    job = nullptr;
+
+    // finish what was already handed to the driver, the job starts with an empty line
+    if (!waitTxDone())
+    {
+        ESP_LOGW(__FUNCTION__, "%s %u bytes still sending as the job starts", portName, (unsigned)txInFlight);
+    }
+    io.flushInput();
+
+    current->run(io);
+
+    auto stackFree = uxTaskGetStackHighWaterMark(nullptr);
+    if (stackFree < readTaskStackMargin)
+    {
+        ESP_LOGW(__FUNCTION__, "%s job left %u bytes of stack", portName, (unsigned)stackFree);
+    }
+    else
+    {
+        ESP_LOGD(__FUNCTION__, "%s job left %u bytes of stack", portName, (unsigned)stackFree);
+    }
+
+    // what the device sent during the job is not stream data
+    io.flushInput();
+    current.reset();
+    jobActive = false;
+    // continues read was paused, take what has arrived since the flush
+    postEvent(PortEventWake);
+    notifyConsumer();
+}
+
+TickType_t Port::nextWakeTime()
+{
+    auto waitTime = txDrainWaitTime();
+    auto paceWaitTime = txPaceWaitTime();
+    waitTime = paceWaitTime < waitTime ? paceWaitTime : waitTime;
+    if (pendingRead.state != ReadStateActive)
+    {
+        return waitTime;
+    }
+
+    auto remaining = pendingRead.deadline - esp_timer_get_time();
+    TickType_t readWaitTime = remaining <= 0 ? 0 : (remaining / 1000 / portTICK_PERIOD_MS) + 1;
+
+    return readWaitTime < waitTime ? readWaitTime : waitTime;
+}
+
+TickType_t Port::txDrainWaitTime()
+{
+    if (txInFlight == 0)
+    {
+        return portMAX_DELAY;
+    }
+
+    uint32_t baudRate = 0;
+    if (uart_get_baudrate(portNum, &baudRate) != ESP_OK || baudRate == 0)
+    {
+        return 1;
+    }
+
+    // symbolBits covers the start, data, parity and stop bits of the current line format
+    auto ms = (txInFlight * symbolBits * 1000) / baudRate;
+    return (ms / portTICK_PERIOD_MS) + 1;
+}
+
+void Port::postEvent(int eventType, uint32_t sequence)
+{
+    uart_event_t event = {};
+    event.type = (uart_event_type_t)eventType;
+    event.size = sequence;
+    xSemaphoreTake(eventQueueLock, portMAX_DELAY);
+    if (eventQueue != nullptr)
+    {
+        // if the queue is full the port task is already going to wake up
+        xQueueSend(eventQueue, &event, 0);
+    }
+    xSemaphoreGive(eventQueueLock);
+}
+
+bool Port::postConfig(int eventType)
+{
+    // only the server task changes config, so the sequence needs no lock
+    auto sequence = ++reconfigureSequence;
+    postEvent(eventType, sequence);
+
+    if (jobActive)
+    {
+        // the port task is inside the job, the change is applied once it finishes
+        return false;
+    }
+
+    auto start = xTaskGetTickCount();
+    auto timeout = reconfigureTimeoutMs / portTICK_PERIOD_MS;
+    while ((int32_t)(reconfigureApplied - sequence) < 0)
+    {
+        auto elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout || xSemaphoreTake(reconfigureDone, timeout - elapsed) != pdTRUE)
+        {
+            return (int32_t)(reconfigureApplied - sequence) >= 0;
+        }
+    }
+    return true;
+}
+
+void Port::postConfigNoWait(int eventType, std::atomic<uint32_t> &requests)
+{
+    // the port task compares the count with what it has applied after every event, so the change is not lost if the queue is full
+    requests++;
+    postEvent(eventType, ++reconfigureSequence);
+}
+
+void Port::acknowledgeConfig(uint32_t sequence)
+{
+    reconfigureApplied = sequence;
+    xSemaphoreGive(reconfigureDone);
+}
+
+bool Port::applyProfile(const Profile *profile)
+{
+    if (activeProfile == nullptr || activeProfile->driverRxBufferSize != profile->driverRxBufferSize)
+    {
+        if (uart_is_driver_installed(portNum))
+        {
+            // let the chunk in the driver go out before it is discarded
+            if (!waitTxDone())
+            {
+                // dropped with the driver, count it as done so completion totals still line up
+                ESP_LOGW(__FUNCTION__, "%s dropped %u bytes still in the driver", portName, (unsigned)txInFlight);
+                txCompletedTotal += txInFlight;
+                txInFlight = 0;
+            }
+        }
+
+        // the server task posts to eventQueue, it waits while the queue is replaced
+        // the events Port posted for itself are carried over, the driver's own go with the old queue
+        uart_event_t pending[eventQueueSize];
+        int pendingCount = 0;
+        xSemaphoreTake(eventQueueLock, portMAX_DELAY);
+        if (uart_is_driver_installed(portNum))
+        {
+            while (pendingCount < eventQueueSize && xQueueReceive(eventQueue, &pending[pendingCount], 0) == pdTRUE)
+            {
+                if (pending[pendingCount].type >= UART_EVENT_MAX)
+                {
+                    pendingCount++;
+                }
+            }
+
+            uart_driver_delete(portNum);
+            eventQueue = nullptr;
+        }
+
+        auto installed = uart_driver_install(portNum, profile->driverRxBufferSize, driverTxBufferSize, eventQueueSize, &eventQueue, 0) == ESP_OK;
+        for (int i = 0; installed && i < pendingCount; i++)
+        {
+            xQueueSend(eventQueue, &pending[i], 0);
+        }
+        xSemaphoreGive(eventQueueLock);
+
+        if (!installed)
+        {
+            ESP_LOGE(__FUNCTION__, "uart_driver_install failed");
+            activeProfile = nullptr;
+            return false;
+        }
+    }
+
+    if (activeProfile == nullptr || activeProfile->readChunkSize != profile->readChunkSize)
+    {
+        delete[] readBuffer;
+        readBuffer = new char[profile->readChunkSize];
+    }
+
+    if (txBuffer.size() != profile->txQueueSize)
+    {
+        // anything still queued is dropped, count it as done so completion totals still line up
+        txCompletedTotal += txBuffer.available();
+    }
+
+    if (txBuffer.size() != profile->txQueueSize && !txBuffer.allocate(profile->txQueueSize))
+    {
+        ESP_LOGE(__FUNCTION__, "failed to allocate tx buffer");
+        activeProfile = nullptr;
+        return false;
+    }
+
+    activeProfile = profile;
+
+    // uart_driver_install resets these to the driver defaults so always apply them
+    auto result = applyRxTimeout();
+    result = uart_set_rx_full_threshold(portNum, profile->rxFullThreshold) == ESP_OK && result;
+    result = applyRs485Mode() && result;
+
+    ESP_LOGI(__FUNCTION__, "profile %s applied", profile->name);
+
+    return result;
+}
+
+bool Port::applyRxTimeout()
+{
+    // idle gap framing needs the timeout event to fire after its gap rather than the profile's
+    auto symbols = frameDecoder.getIdleGapSymbols();
+    if (symbols == 0)
+    {
+        symbols = activeProfile->rxTimeoutSymbols;
+    }
+
+    // the timed data records need to know how long the line was idle before the event
+    rxTimeoutSymbols = symbols;
+    return uart_set_rx_timeout(portNum, symbols) == ESP_OK;
+}
+
+void Port::reconfigure()
+{
+    if (!applyProfile(requestedProfile))
+    {
+        // fall back to what was working so the task still has a driver and buffer
+        applyProfile(&profiles[0]);
+    }
+
+    auto framing = requestedFraming;
+    auto result = frameDecoder.configure(framing);
+    if (!result)
+    {
+        frameDecoder.configure({FrameDecoder::FrameModeNone, FrameDecoder::CRCNone, 0, 0});
+    }
+
+    if (activeProfile != nullptr)
+    {
+        result = applyRxTimeout() && result;
+    }
+    framingApplied = result;
+}
+
+bool Port::setProfile(uint8_t profileIndex)
+{
+    if (profileIndex >= profileCount)
+    {
+        return false;
+    }
+
+    auto profile = &profiles[profileIndex];
+    if (txBridgeSource != nullptr && profile->txQueueSize != requestedProfile.load()->txQueueSize)
+    {
+        // the tx buffer can not be replaced while the source's port task is writing to it
+        return false;
+    }
+
+    if (requestedProfile.exchange(profile) == profile || !ready)
+    {
+        // init() applies the requested profile
+        return true;
+    }
+
+    // the port task can replace txBuffer, falling back to the default profile if this one fails
+    // write() leaves it alone until the change is acknowledged, even if the wait below gives up
+    txResizeSequence = reconfigureSequence + 1;
+
+    // the port task owns the driver, so it does the reinstall
+    return postConfig(PortEventReconfigure) && activeProfile == profile;
+}
+
+bool Port::setTrigger(const TriggerCapture::Config &config)
+{
+    if (!ready)
+    {
+        return false;
+    }
+
+    requestedTrigger = config;
+    return postConfig(PortEventTrigger) && triggerApplied;
+}
+
+void Port::clearTrigger()
+{
+    // the port task can be busy with a break or a job, the server task does not wait for it
+    requestedTrigger = {};
+    postConfigNoWait(PortEventTrigger, triggerRequests);
+}
+
+void Port::applyTrigger()
+{
+    // whatever was requested last, an arm posted after a disarm replaces it
+    auto requests = triggerRequests.load();
+    triggerApplied = trigger.configure(requestedTrigger);
+    triggerRequestsApplied = requests;
+}
+
+bool Port::setPatternWatch(const PatternWatch::Config &config, uint8_t generation)
+{
+    if (!ready)
+    {
+        return false;
+    }
+
+    requestedWatch = config;
+    requestedWatchGeneration = generation;
+    return postConfig(PortEventWatch) && watchApplied;
+}
+
+bool Port::setFraming(const FrameDecoder::Config &config)
+{
+    if (!ready)
+    {
+        // init() has not run yet so the decoder can be set up directly
+        requestedFraming = config;
+        framingApplied = frameDecoder.configure(config);
+        return framingApplied;
+    }
+
+    requestedFraming = config;
+    return postConfig(PortEventReconfigure) && framingApplied;
+}
+
+void Port::readLoop(void *arg)
+{
+    static_cast<Port *>(arg)->readLoop();
+}
+
+bool Port::writeRecord(uint8_t type, const uint8_t *payload, uint32_t length)
+{
+    RecordHeader header = {{(uint8_t)(length & 0xFF), (uint8_t)(length >> 8)}, type};
+    // never wait on the consumer, if it has fallen behind the record is dropped and counted
+    if (!rxBuffer.writeAll((uint8_t *)&header, sizeof(header), payload, length))
+    {
+        ESP_LOGD(__FUNCTION__, "rx buffer overflow");
+        return false;
+    }
+    return true;
+}
+
+void Port::handleDataEvent(bool lineIdle)
+{
+    // a requested read takes data before the continues read
+    handlePendingRead();
+
+    // while continues read is off the data is left in the driver buffer for requestRead(), unless a trigger or watch needs it
+    if (!isRxWanted())
+    {
+        return;
+    }
+
+    if (timestampsEnabled && continuesReadEnabled)
+    {
+        updateRxTime(lineIdle);
+    }
+
+    auto chunkSize = activeProfile->readChunkSize;
+    size_t buffered = 0;
+    while (uart_get_buffered_data_len(portNum, &buffered) == ESP_OK && buffered > 0)
+    {
+        uint32_t readSize = buffered < chunkSize ? buffered : chunkSize;
+        if (flowControl != FlowControlNone && (continuesReadEnabled || bridgePeer != nullptr))
+        {
+            // decoded frames can need twice the room of the raw bytes, keep a margin so nothing is dropped
+            auto room = continuesReadEnabled ? rxBuffer.freeSpace() / 4 : UINT32_MAX;
+            if (bridgePeer != nullptr)
+            {
+                // the bridged data has to fit in the peer's tx buffer too, with room for the rewrites
+                auto txRoom = bridgePeer->txBuffer.freeSpace() / 2;
+                room = txRoom < room ? txRoom : room;
+            }
+
+            if (room < minFlowControlRead)
+            {
+                // the driver buffer fills up behind this and the UART holds off the sender
+                rxThrottled = true;
+                break;
+            }
+            readSize = readSize < room ? readSize : room;
+        }
+
+        int readLength = uart_read_bytes(portNum, readBuffer, readSize, 0);
+        if (readLength <= 0)
+        {
+            break;
+        }
+
+        forwardData((uint8_t *)readBuffer, readLength);
+    }
+
+    if (lineIdle)
+    {
+        frameDecoder.idle(frameHandler);
+        if (bridgePeer != nullptr && bridgeRewriter.isActive())
+        {
+            // a match can not complete across the gap, release what was held back for one
+            bridgeRewriter.flush(bridgeHandler);
+            bridgePeer->postEvent(PortEventTxPending);
+        }
+    }
+
+    notifyConsumer();
+}
+
+void Port::forwardData(uint8_t *data, uint32_t length)
+{
+    uint8_t parityBit = emulatedParityBit;
+    bool mark = emulatedParityMark;
+    uint32_t start = 0;
+    for (uint32_t i = 0; parityBit != 0 && i < length; i++)
+    {
+        auto received = (data[i] & parityBit) != 0;
+        data[i] &= parityBit - 1;
+        if (received != mark)
+        {
+            // the bytes before it go first so the marker sits at the offset of the bad byte
+            forwardRecords(data + start, i - start);
+            start = i;
+            parityErrorCount++;
+            writeLineEvent(LineEventParityError);
+        }
+    }
+
+    forwardRecords(data + start, length - start);
+}
+
+void Port::forwardRecords(const uint8_t *data, uint32_t length)
+{
+    if (length == 0)
+    {
+        return;
+    }
+
+    // first so the bridged path waits on nothing else
+    if (bridgePeer != nullptr)
+    {
+        forwardToBridge(data, length);
+    }
+
+    if (trigger.isActive() && trigger.feed(data, length, false, esp_timer_get_time()))
+    {
+        notifyConsumer();
+    }
+
+    // otherwise only taken for the trigger or watch
+    if (continuesReadEnabled)
+    {
+        if (frameDecoder.isEnabled())
+        {
+            frameDecoder.feed(data, length, frameHandler);
+        }
+        else if (timestampsEnabled)
+        {
+            writeTimedRecord(data, length);
+        }
+        else
+        {
+            writeRecord(RecordTypeData, data, length);
+        }
+    }
+
+    if (watch.isActive())
+    {
+        watchTime = esp_timer_get_time();
+        watch.feed(data, length, watchHandler);
+    }
+    rxStreamOffset += length;
+}
+
+void Port::forwardToBridge(const uint8_t *data, uint32_t length)
+{
+    if (bridgeRewriter.isActive())
+    {
+        bridgeRewriter.feed(data, length, bridgeHandler);
+    }
+    else
+    {
+        bridgePeer->writeBridged(data, length);
+    }
+    bridgePeer->postEvent(PortEventTxPending);
+}
+
+void Port::writeBridged(const uint8_t *data, uint32_t length)
+{
+    // the source's port task is the only writer to txBuffer while bridged
+    auto written = txBuffer.write(data, length);
+    txQueuedTotal += written;
+    bridgeDroppedBytes += length - written;
+}
+
+void Port::moveInjected()
+{
+    uint8_t buff[64];
+    while (injectBuffer.available() > 0 && txBuffer.freeSpace() > 0)
+    {
+        auto room = txBuffer.freeSpace();
+        auto length = injectBuffer.read(buff, room < sizeof(buff) ? room : sizeof(buff));
+        // already counted in txQueuedTotal by write()
+        txBuffer.write(buff, length);
+        postEvent(PortEventTxPending);
     }
 }
 
-bool Port::init()
+bool Port::setRxOnly(bool enabled)
 {
-    if (!ready)
+    if (rxOnly == enabled)
     {
-        auto result = uart_is_driver_installed(portNum) || uart_driver_install(portNum, 1024 * 2, 0, 20, 0, 0) == ESP_OK;
-        ESP_LOGI("SETUP","result %d",(int)result);
+        return true;
+    }
 
-        if (result && xTaskCreate(Port::readLoop, "Port::loop()", configMINIMAL_STACK_SIZE * 5, this, 2, &readTask) == pdPASS)
-        {
-            ready = true;
-            return true;
-        }
-        return false;
+    rxOnly = enabled;
+    if (txPin < 0)
+    {
+        return true;
     }
-    return true;
+
+    if (enabled)
+    {
+        // the UART still drives the pin's signal, turning off the output driver leaves the line to the devices on it
+        return gpio_set_direction((gpio_num_t)txPin, GPIO_MODE_INPUT) == ESP_OK;
+    }
+    return uart_set_pin(portNum, txPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) == ESP_OK;
+}
+
+uint32_t Port::getRxReportDelayUs()
+{
+    uint32_t baudRate = 0;
+    if (uart_get_baudrate(portNum, &baudRate) != ESP_OK || baudRate == 0)
+    {
+        return rxReportSlackUs;
+    }
+
+    // a record covers at most the full threshold, and the last of it waits for the rx timeout
+    auto profile = requestedProfile.load();
+    uint32_t symbols = profile->rxTimeoutSymbols + profile->rxFullThreshold;
+    return ((uint64_t)symbols * symbolBits * 1000000) / baudRate + rxReportSlackUs;
 }
 
-int Port::read(char *buf, uint32_t bufLen, int timeout)
+bool Port::setBridge(Port *peer, const BridgeRewriter::Config &rewrite)
 {
-    /*if (xSemaphoreTake(readLock, 20 / portTICK_PERIOD_MS) != pdTRUE)
+    if (peer == nullptr)
+    {
+        // the port task can be busy with a break or a job, teardown does not wait for it
+        requestedBridgePeer = nullptr;
+        requestedRewrite = rewrite;
+        postConfigNoWait(PortEventBridge, bridgeRequests);
+        return true;
+    }
+
+    if (!ready || peer == this || !peer->ready)
     {
         return false;
-    }*/
+    }
 
-    int bytesToRead = bufLen;
-    while (bytesToRead > 0)
+    if (jobActive || peer->jobActive)
     {
-        ESP_LOGD(__FUNCTION__, "read %d bytes", (int)bytesToRead);
-        int read = uart_read_bytes(portNum, buf, bytesToRead, timeout / portTICK_PERIOD_MS);
-        if (read <= 0)
-        {
-            ESP_LOGD(__FUNCTION__, "read returned %d", (int)(read));
-            // xSemaphoreGive(readLock);
-            return 0;
-        }
-        bytesToRead -= read;
-        buf += read;
+        // the job owns the port's tx, and its port task could not apply the bridge until it finishes
+        return false;
+    }
+
+    if (peer->isTxResizing())
+    {
+        // the peer's port task has yet to replace the tx buffer this port's task would fill
+        return false;
     }
 
-    auto result = bufLen - bytesToRead;
+    if (bridgeRequestsApplied != bridgeRequests && !postConfig(PortEventBridge))
+    {
+        // the last teardown has to be applied before a peer's tx is handed over again
+        return false;
+    }
 
-    // xSemaphoreGive(readLock);
-    return result;
+    auto source = peer->txBridgeSource.load();
+    if (source != nullptr && source != this && (source->bridgeRequestsApplied == source->bridgeRequests || !source->postConfig(PortEventBridge)))
+    {
+        // another port forwards to the peer, or it is still taking its bridge down
+        return false;
+    }
+
+    if (!peer->injectBuffer.isAllocated() && !peer->injectBuffer.allocate(injectBufferSize))
+    {
+        return false;
+    }
+
+    // from here the server task stops writing to the peer's tx buffer
+    peer->txBridgeSource = this;
+    offeredBridgePeer = peer;
+    requestedBridgePeer = peer;
+    requestedRewrite = rewrite;
+    if (postConfig(PortEventBridge))
+    {
+        return bridgeApplied;
+    }
+
+    // not applied in time, the port task takes it down again when it gets to it
+    setBridge(nullptr, {});
+    return false;
 }
 
-int Port::write(char *src, uint32_t len)
+void Port::applyBridge()
 {
-    auto sent = uart_write_bytes(portNum, src, len);
-    if (sent)
+    auto requests = bridgeRequests.load();
+    auto previous = bridgePeer;
+    if (previous != nullptr)
+    {
+        // what was held back for the old rules goes out first
+        bridgeRewriter.flush(bridgeHandler);
+        previous->postEvent(PortEventTxPending);
+    }
+
+    auto offered = offeredBridgePeer.exchange(nullptr);
+    auto requested = requestedBridgePeer.load();
+    bridgeApplied = bridgeRewriter.configure(requestedRewrite);
+    bridgePeer = bridgeApplied ? requested : nullptr;
+
+    // this task has stopped writing to them, their tx buffers go back to their own write()
+    if (previous != nullptr && previous != bridgePeer)
+    {
+        previous->endBridgedTx();
+    }
+
+    if (offered != nullptr && offered != bridgePeer && offered != previous)
     {
-        // uart_wait_tx_done(portNum, 1000 / portTICK_PERIOD_MS);
+        offered->endBridgedTx();
     }
-    return sent;
+    bridgeRequestsApplied = requests;
 }
 
-void Port::resumeRead()
+void Port::endBridgedTx()
 {
-    // vTaskResume(readTask);
+    // write() goes straight to txBuffer from here, so nothing more is added to injectBuffer
+    // it is read by the port tasks, this port's own task drops what is left
+    txBridgeSource = nullptr;
+    postEvent(PortEventBridgeEnd, injectBuffer.available());
 }
 
-void Port::suspendRead()
+void Port::dropInjected(uint32_t length)
 {
-    // vTaskSuspend(readTask);
+    // injected data that never went, count it as done so completion totals still line up
+    auto available = injectBuffer.available();
+    length = length < available ? length : available;
+    injectBuffer.skip(length);
+    txCompletedTotal += length;
+    notifyConsumer();
 }
 
-void Port::readLoop(void *arg)
+void Port::writePatternHit(uint8_t pattern, uint32_t offset)
 {
-    static_cast<Port *>(arg)->readLoop();
+    uint8_t payload[patternHitHeaderSize + PatternWatch::contextSize] = {watchGeneration, pattern, (uint8_t)offset, (uint8_t)(offset >> 8), (uint8_t)(offset >> 16), (uint8_t)(offset >> 24)};
+    for (int i = 0; i < 8; i++)
+    {
+        payload[6 + i] = (uint64_t)watchTime >> (i * 8);
+    }
+
+    auto contextLength = watch.copyContext(payload + patternHitHeaderSize, PatternWatch::contextSize);
+    writeRecord(RecordTypePatternHit, payload, patternHitHeaderSize + contextLength);
+}
+
+void Port::updateRxTime(bool lineIdle)
+{
+    uint32_t baudRate = 0;
+    size_t buffered = 0;
+    if (uart_get_baudrate(portNum, &baudRate) != ESP_OK || baudRate == 0 || uart_get_buffered_data_len(portNum, &buffered) != ESP_OK)
+    {
+        return;
+    }
+
+    // the driver does not time its events, so work back from now
+    // the newest byte finished just before the event, or the rx timeout before it when the line went idle
+    auto now = esp_timer_get_time();
+    rxSymbolNs = ((uint64_t)symbolBits * 1000000000) / baudRate;
+    auto lastByteEnd = now - (lineIdle ? ((int64_t)rxTimeoutSymbols * rxSymbolNs) / 1000 : 0);
+    rxTimeBase = lastByteEnd - ((int64_t)buffered * rxSymbolNs) / 1000;
+    rxTimeOffset = rxStreamOffset;
+}
+
+bool Port::writeTimedRecord(const uint8_t *payload, uint32_t length)
+{
+    auto start = rxTimeBase + ((int64_t)(rxStreamOffset - rxTimeOffset) * rxSymbolNs) / 1000;
+    uint32_t duration = ((uint64_t)length * rxSymbolNs) / 1000;
+    auto recordLength = length + timedDataHeaderSize;
+
+    // the times go in with the record header so the bytes are still copied straight from the read buffer
+    uint8_t header[sizeof(RecordHeader) + timedDataHeaderSize] = {(uint8_t)(recordLength & 0xFF), (uint8_t)(recordLength >> 8), RecordTypeTimedData};
+    for (int i = 0; i < 8; i++)
+    {
+        header[sizeof(RecordHeader) + i] = (uint64_t)start >> (i * 8);
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        header[sizeof(RecordHeader) + 8 + i] = duration >> (i * 8);
+    }
+
+    if (!rxBuffer.writeAll(header, sizeof(header), payload, length))
+    {
+        ESP_LOGD(__FUNCTION__, "rx buffer overflow");
+        return false;
+    }
+    return true;
+}
+
+bool Port::setStreamFlags(uint8_t flags)
+{
+    if (flags & ~StreamFlagTimestamps)
+    {
+        return false;
+    }
+
+    timestampsEnabled = flags & StreamFlagTimestamps;
+    return true;
+}
+
+void Port::handleLineEvent(uint8_t event)
+{
+    if (!isRxWanted())
+    {
+        return;
+    }
+
+    // take what the driver already has first, the UART reports the error once the byte is in its FIFO
+    handleDataEvent(false);
+    writeLineEvent(event);
+    notifyConsumer();
+}
+
+void Port::writeLineEvent(uint8_t event)
+{
+    if (trigger.isActive() && trigger.lineEvent(event, event == LineEventBreak, esp_timer_get_time()))
+    {
+        notifyConsumer();
+    }
+
+    if (!continuesReadEnabled)
+    {
+        return;
+    }
+
+    auto offset = rxStreamOffset;
+    uint8_t payload[] = {event, (uint8_t)offset, (uint8_t)(offset >> 8), (uint8_t)(offset >> 16), (uint8_t)(offset >> 24)};
+    writeRecord(RecordTypeLineEvent, payload, sizeof(payload));
+}
+
+void Port::stripEmulatedParity(uint8_t *data, uint32_t length)
+{
+    uint8_t parityBit = emulatedParityBit;
+    for (uint32_t i = 0; parityBit != 0 && i < length; i++)
+    {
+        data[i] &= parityBit - 1;
+    }
+}
+
+void Port::applyEmulatedParity(uint8_t *data, uint32_t length)
+{
+    uint8_t parityBit = emulatedParityBit;
+    if (parityBit == 0)
+    {
+        return;
+    }
+
+    auto mark = emulatedParityMark.load();
+    for (uint32_t i = 0; i < length; i++)
+    {
+        data[i] = mark ? (data[i] | parityBit) : (data[i] & (parityBit - 1));
+    }
 }
 
 void Port::readLoop()
 {
     ESP_LOGD(__FUNCTION__, "starting");
 
+    uart_event_t event;
     while (1)
     {
-        if (continuesReadEnabled && xSemaphoreTake(readLock, 20 / portTICK_PERIOD_MS) == pdTRUE)
+        // only wake on a timeout while a tx chunk is going out or a read is waiting for data
+        if (xQueueReceive(eventQueue, &event, nextWakeTime()) != pdTRUE)
         {
+            handlePendingRead();
+            handleTx();
+            continue;
+        }
 
-            int readLength = uart_read_bytes(portNum, readBuffer + reservedBufferHeadSpace, sizeof(readBuffer) - reservedBufferHeadSpace, 10 / portTICK_PERIOD_MS);
-
-            if (readLength > 0)
+        switch ((int)event.type)
+        {
+        case UART_DATA:
+            if (rs485Mode != Rs485Off)
             {
-                ESP_LOGD(__FUNCTION__, "read returned %d bytes", (int)readLength);
-                callback(readBuffer, readLength);
+                updateRs485RxEnd(event.timeout_flag);
             }
+            // the timeout flag is set when the line went idle after the data
+            handleDataEvent(event.timeout_flag);
+            break;
+        case PortEventWake:
+        case PortEventReadRequest:
+            handleDataEvent(false);
+            break;
+        case UART_FIFO_OVF:
+            fifoOverflowCount++;
+            handleLineEvent(LineEventFifoOverflow);
+            break;
+        case UART_BUFFER_FULL:
+            driverBufferFullCount++;
+            handleDataEvent(false);
+            break;
+        case UART_BREAK:
+            breakCount++;
+            handleLineEvent(LineEventBreak);
+            break;
+        case UART_PARITY_ERR:
+            parityErrorCount++;
+            handleLineEvent(LineEventParityError);
+            break;
+        case UART_FRAME_ERR:
+            frameErrorCount++;
+            handleLineEvent(LineEventFrameError);
+            break;
+        case PortEventReconfigure:
+            reconfigure();
+            // anything in the old driver buffer has been discarded along with it
+            acknowledgeConfig(event.size);
+            break;
+        case PortEventTrigger:
+            applyTrigger();
+            acknowledgeConfig(event.size);
+            // start on what is already waiting in the driver
+            handleDataEvent(false);
+            break;
+        case PortEventWatch:
+            watchApplied = watch.configure(requestedWatch);
+            watchGeneration = requestedWatchGeneration;
+            acknowledgeConfig(event.size);
+            handleDataEvent(false);
+            break;
+        case PortEventBridgeEnd:
+            dropInjected(event.size);
+            break;
+        case PortEventBridge:
+            applyBridge();
+            acknowledgeConfig(event.size);
+            handleDataEvent(false);
+            break;
+        case PortEventJob:
+            // started below
+            break;
+        default:
+            break;
+        }
+
+        // teardowns are posted without waiting, picked up here if their event did not fit in the queue
+        if (triggerRequestsApplied != triggerRequests)
+        {
+            applyTrigger();
+        }
+
+        if (bridgeRequestsApplied != bridgeRequests)
+        {
+            applyBridge();
+        }
 
-            xSemaphoreGive(readLock);
+        // checked on every event in case the job event did not fit in the queue
+        if (jobPending.exchange(false))
+        {
+            runJob();
         }
-        else if (!continuesReadEnabled)
+
+        if (bridgePeer != nullptr)
         {
-            vTaskDelay(100 / portTICK_PERIOD_MS);
+            bridgePeer->moveInjected();
         }
+        handleTx();
     }
 }
 
 void Port::startContinuesRead()
 {
-    if (!continuesReadEnabled)
+    if (!continuesReadEnabled.exchange(true))
     {
-        resumeRead();
+        // pick up anything that arrived while continues read was off
+        postEvent(PortEventWake);
     }
-    continuesReadEnabled = true;
 }
 
 void Port::stopContinuesRead()
 {
-    if (!continuesReadEnabled)
+    // the port task checks the flag before each read, anything already in flight lands in rxBuffer
+    continuesReadEnabled = false;
+}
+
+TaskHandle_t Port::consumerTask = nullptr;
+constexpr const Port::Profile Port::profiles[];
+
+bool Port::peekRecord(uint8_t *type, uint32_t *length)
+{
+    RecordHeader header;
+    // records are written whole so a partial header is never seen
+    if (rxBuffer.peek((uint8_t *)&header, sizeof(header)) != sizeof(header))
     {
-        return;
+        return false;
     }
 
-    continuesReadEnabled = false;
-    if (xSemaphoreTake(readLock, 1000 / portTICK_PERIOD_MS) == pdTRUE)
+    *type = header.type;
+    *length = header.length[0] | (header.length[1] << 8);
+    return true;
+}
+
+uint32_t Port::readRecord(char *buf, uint32_t bufLen)
+{
+    uint8_t type;
+    uint32_t length;
+    if (!peekRecord(&type, &length))
+    {
+        return 0;
+    }
+
+    rxBuffer.skip(sizeof(RecordHeader));
+    auto copyLength = length < bufLen ? length : bufLen;
+    rxBuffer.read((uint8_t *)buf, copyLength);
+    rxBuffer.skip(length - copyLength);
+    resumeIfThrottled();
+
+    return copyLength;
+}
+
+void Port::resumeIfThrottled()
+{
+    // wait for half the buffer so the sender is not toggled on and off for every record
+    if (rxThrottled && rxBuffer.freeSpace() >= rxBuffer.size() / 2 && rxThrottled.exchange(false))
     {
-        xSemaphoreGive(readLock);
+        postEvent(PortEventWake);
     }
 }
 
+Port::Stats Port::getStats()
+{
+    Stats stats = {
+        rxBuffer.size(),
+        rxBuffer.getHighWaterMark(),
+        rxBuffer.getOverflowBytes(),
+        rxBuffer.getOverflowCount(),
+        fifoOverflowCount,
+        driverBufferFullCount,
+        breakCount,
+        parityErrorCount,
+        frameErrorCount,
+        frameDecoder.getFrameCount(),
+        frameDecoder.getBadFrameCount(),
+        bridgeDroppedBytes,
+        rs485CollisionCount};
+
+    return stats;
+}
+
+void Port::resetStats()
+{
+    rxBuffer.resetStats();
+    fifoOverflowCount = 0;
+    driverBufferFullCount = 0;
+    breakCount = 0;
+    parityErrorCount = 0;
+    frameErrorCount = 0;
+    bridgeDroppedBytes = 0;
+    rs485CollisionCount = 0;
+    frameDecoder.resetStats();
+}
+
 bool Port::setDataBitsLength(uint8_t size)
 {
-    uart_word_length_t wl;
-    switch (size)
+    if (size < 5 || size > 8)
     {
-    case 8:
-        wl = UART_DATA_8_BITS;
-        break;
-    case 7:
-        wl = UART_DATA_7_BITS;
-        break;
-    case 6:
-        wl = UART_DATA_6_BITS;
-        break;
-    case 5:
-        wl = UART_DATA_5_BITS;
-        break;
-    default:
         return false;
     }
 
-    return uart_set_word_length(portNum, wl) == ESP_OK;
+    dataBits = size;
+    return applyLineFormat();
 }
 
 bool Port::setBandRate(uint32_t value)
@@ -175,28 +1507,203 @@ bool Port::setBandRate(uint32_t value)
     return uart_set_baudrate(portNum, value) == ESP_OK;
 }
 
-bool Port::setParity(PortParity parity)
+bool Port::setParity(PortParity value)
 {
-    uart_parity_t upp;
+    if (value > ParitySpace || (value == ParitySpace && dataBits == 8))
+    {
+        return false;
+    }
+
+    parity = value;
+    return applyLineFormat();
+}
+
+bool Port::applyLineFormat()
+{
+    auto bits = dataBits;
+    auto uartParity = UART_PARITY_DISABLE;
+    auto uartStopBits = stopBits == PortStopBitsOne ? UART_STOP_BITS_1 : UART_STOP_BITS_2;
+    uint8_t parityBit = 0;
     switch (parity)
     {
-    case ParityNone:
-        upp = UART_PARITY_DISABLE;
-        break;
     case ParityEven:
-        upp = UART_PARITY_EVEN;
+        uartParity = UART_PARITY_EVEN;
         break;
     case ParityOdd:
-        upp = UART_PARITY_ODD;
+        uartParity = UART_PARITY_ODD;
+        break;
+    case ParityMark:
+    case ParitySpace:
+        if (bits < 8)
+        {
+            // sent and checked as one more data bit
+            parityBit = 1 << bits;
+            bits++;
+        }
+        else if (parity == ParityMark)
+        {
+            // a mark bit looks like an extra stop bit, one received as space fails the stop bit check as a framing error
+            uartStopBits = UART_STOP_BITS_2;
+        }
+        break;
+    default:
+        break;
+    }
+
+    static const uart_word_length_t wordLengths[] = {UART_DATA_5_BITS, UART_DATA_6_BITS, UART_DATA_7_BITS, UART_DATA_8_BITS};
+    auto result = uart_set_word_length(portNum, wordLengths[bits - 5]) == ESP_OK;
+    result = uart_set_parity(portNum, uartParity) == ESP_OK && result;
+    result = uart_set_stop_bits(portNum, uartStopBits) == ESP_OK && result;
+
+    emulatedParityMark = parity == ParityMark;
+    emulatedParityBit = parityBit;
+    symbolBits = 1 + bits + (uartParity != UART_PARITY_DISABLE ? 1 : 0) + (uartStopBits == UART_STOP_BITS_1 ? 1 : 2);
+    return result;
+}
+
+bool Port::setFlowControl(FlowControl mode)
+{
+    auto result = false;
+    switch (mode)
+    {
+    case FlowControlNone:
+        result = uart_set_hw_flow_ctrl(portNum, UART_HW_FLOWCTRL_DISABLE, 0) == ESP_OK;
+        result = uart_set_sw_flow_ctrl(portNum, false, 0, 0) == ESP_OK && result;
+        break;
+    case FlowControlRtsCts:
+        if (rtsPin < 0 || ctsPin < 0 || rs485Mode != Rs485Off)
+        {
+            return false;
+        }
+        result = uart_set_sw_flow_ctrl(portNum, false, 0, 0) == ESP_OK;
+        result = uart_set_hw_flow_ctrl(portNum, UART_HW_FLOWCTRL_CTS_RTS, flowControlRxThreshold) == ESP_OK && result;
+        break;
+    case FlowControlXonXoff:
+        result = uart_set_hw_flow_ctrl(portNum, UART_HW_FLOWCTRL_DISABLE, 0) == ESP_OK;
+        result = uart_set_sw_flow_ctrl(portNum, true, flowControlXonThreshold, flowControlRxThreshold) == ESP_OK && result;
         break;
     default:
         return false;
     }
 
-    return uart_set_parity(portNum, upp) == ESP_OK;
+    flowControl = result ? mode : FlowControlNone;
+    if (!isFlowControlEnabled() && rxThrottled.exchange(false))
+    {
+        // back to dropping on overflow, drain what was held in the driver
+        postEvent(PortEventWake);
+    }
+
+    return result;
+}
+
+bool Port::setRs485(const Rs485Config &config)
+{
+    if (config.mode > Rs485DeOnDtr || config.turnaroundUs > maxRs485TurnaroundUs)
+    {
+        return false;
+    }
+
+    auto dePin = config.mode == Rs485DeOnDtr ? dtrPin : rtsPin;
+    if (config.mode != Rs485Off && (dePin < 0 || flowControl == FlowControlRtsCts))
+    {
+        return false;
+    }
+
+    uint8_t previous = rs485Mode;
+    rs485TurnaroundUs = config.turnaroundUs;
+    rs485Mode = config.mode;
+    if (!applyRs485Mode())
+    {
+        rs485Mode = previous;
+        applyRs485Mode();
+        return false;
+    }
+
+    if (previous == Rs485DeOnDtr && config.mode != Rs485DeOnDtr)
+    {
+        // DTR goes back to a plain output, idle high, and RTS back to its own pin
+        gpio_reset_pin((gpio_num_t)dtrPin);
+        gpio_set_direction((gpio_num_t)dtrPin, GPIO_MODE_OUTPUT);
+        gpio_set_level((gpio_num_t)dtrPin, 1);
+        if (rtsPin >= 0)
+        {
+            uart_set_pin(portNum, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, rtsPin, UART_PIN_NO_CHANGE);
+        }
+    }
+    else if (config.mode == Rs485DeOnDtr && previous != Rs485DeOnDtr)
+    {
+        // the RTS pin is released so DE only shows on DTR
+        if (rtsPin >= 0)
+        {
+            gpio_reset_pin((gpio_num_t)rtsPin);
+        }
+        uart_set_pin(portNum, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, dtrPin, UART_PIN_NO_CHANGE);
+    }
+
+    // queued data may now be held for the turnaround, or released from it
+    postEvent(PortEventTxPending);
+    return true;
+}
+
+bool Port::applyRs485Mode()
+{
+    if (!uart_is_driver_installed(portNum))
+    {
+        // applied with the profile once the driver is installed
+        return true;
+    }
+
+    return uart_set_mode(portNum, rs485Mode != Rs485Off ? UART_MODE_RS485_HALF_DUPLEX : UART_MODE_UART) == ESP_OK;
+}
+
+void Port::updateRs485RxEnd(bool lineIdle)
+{
+    uint32_t baudRate = 0;
+    if (uart_get_baudrate(portNum, &baudRate) != ESP_OK || baudRate == 0)
+    {
+        return;
+    }
+
+    // as in updateRxTime(), the newest byte finished just before the event or the rx timeout before it
+    auto symbolUs = ((int64_t)symbolBits * 1000000) / baudRate;
+    auto end = esp_timer_get_time() - (lineIdle ? rxTimeoutSymbols * symbolUs : 0);
+
+    // with /RE held low our own chunk is received too, that is not another node speaking
+    if (txInFlight > 0 || end <= txChunkEnd + symbolUs + rs485EchoSlackUs)
+    {
+        return;
+    }
+    rs485RxEnd = end;
+}
+
+void Port::checkRs485Collision()
+{
+    // the driver clears the flag as it starts each write, so it covers the chunk that just finished
+    bool collision = false;
+    if (uart_get_collision_flag(portNum, &collision) != ESP_OK || !collision)
+    {
+        return;
+    }
+
+    rs485CollisionCount++;
+    handleLineEvent(LineEventCollision);
+}
+
+bool Port::setModemLines(uint8_t lines)
+{
+    // both are single register or GPIO writes so this is safe alongside the port task
+    // RS-485 routes the UART's RTS signal to the DE pin, the driver drives it in every mode
+    auto result = rs485Mode == Rs485DeOnDtr || io.setDTR(lines & ModemLineDTR);
+    if (flowControl != FlowControlRtsCts && rs485Mode == Rs485Off)
+    {
+        result = io.setRTS(lines & ModemLineRTS) && result;
+    }
+
+    return result;
 }
 
 bool Port::setStopBits(PortStopBits portStopBits)
 {
-    return uart_set_stop_bits(portNum, portStopBits == PortStopBitsOne ? UART_STOP_BITS_1 : UART_STOP_BITS_2) == ESP_OK;
+    stopBits = portStopBits;
+    return applyLineFormat();
 }
\ No newline at end of file
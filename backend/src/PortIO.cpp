@@ -0,0 +1,149 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "PortIO.h"
+#include "esp_timer.h"
+#include "hal/uart_ll.h"
+
+static TickType_t msToTicks(uint32_t ms)
+{
+    return ms == 0 ? 0 : (ms / portTICK_PERIOD_MS) + 1;
+}
+
+bool UartPortIO::write(const uint8_t *data, uint32_t length)
+{
+    // blocks until the driver tx buffer has room for all of it
+    return uart_write_bytes(portNum, (const char *)data, length) == (int)length;
+}
+
+bool UartPortIO::waitWriteDone(uint32_t timeoutMs)
+{
+    return uart_wait_tx_done(portNum, msToTicks(timeoutMs)) == ESP_OK;
+}
+
+int UartPortIO::read(uint8_t *dst, uint32_t length, uint32_t timeoutMs)
+{
+    auto result = uart_read_bytes(portNum, dst, length, msToTicks(timeoutMs));
+    return result < 0 ? 0 : result;
+}
+
+void UartPortIO::flushInput()
+{
+    uart_flush_input(portNum);
+}
+
+bool UartPortIO::setBaudRate(uint32_t baudRate)
+{
+    return uart_set_baudrate(portNum, baudRate) == ESP_OK;
+}
+
+uint32_t UartPortIO::getBaudRate()
+{
+    uint32_t baudRate = 0;
+    uart_get_baudrate(portNum, &baudRate);
+    return baudRate;
+}
+
+bool UartPortIO::setDTR(bool active)
+{
+    if (dtrPin >= 0)
+    {
+        // asserted is low, as on a USB serial adaptor
+        return gpio_set_level((gpio_num_t)dtrPin, active ? 0 : 1) == ESP_OK;
+    }
+
+    // the driver takes the same sense as the modem signal, 1 drives the pin low
+    return uart_set_dtr(portNum, active ? 1 : 0) == ESP_OK;
+}
+
+bool UartPortIO::setRTS(bool active)
+{
+    return uart_set_rts(portNum, active ? 1 : 0) == ESP_OK;
+}
+
+void UartPortIO::delay(uint32_t ms)
+{
+    vTaskDelay(msToTicks(ms));
+}
+
+void UartPortIO::delayMicros(uint32_t us)
+{
+    auto deadline = esp_timer_get_time() + us;
+    // sleep through most of a long wait and spin the rest so the next edge lands on time
+    auto sleepTicks = us / 1000 / portTICK_PERIOD_MS;
+    if (sleepTicks > 1)
+    {
+        vTaskDelay(sleepTicks - 1);
+    }
+
+    while (esp_timer_get_time() < deadline)
+    {
+    }
+}
+
+bool UartPortIO::measurePulses(uint32_t minEdges, uint32_t timeoutMs, PulseTiming *out)
+{
+    uint32_t clockHz = 0;
+    if (uart_get_sclk_freq(UART_SCLK_DEFAULT, &clockHz) != ESP_OK)
+    {
+        return false;
+    }
+
+    // the UART's baud rate detection keeps the shortest low and high pulse, restarting it clears them
+    auto hw = UART_LL_GET_HW(portNum);
+    uart_ll_set_autobaud_en(hw, false);
+    uart_ll_set_autobaud_en(hw, true);
+
+    auto deadline = esp_timer_get_time() + (int64_t)timeoutMs * 1000;
+    while (uart_ll_get_rxd_edge_cnt(hw) < minEdges && esp_timer_get_time() < deadline)
+    {
+        vTaskDelay(1);
+    }
+
+    out->lowCycles = uart_ll_get_low_pulse_cnt(hw);
+    out->highCycles = uart_ll_get_high_pulse_cnt(hw);
+    out->edges = uart_ll_get_rxd_edge_cnt(hw);
+    out->clockHz = clockHz;
+    uart_ll_set_autobaud_en(hw, false);
+    return true;
+}
+
+uint32_t UartPortIO::takeLineErrors()
+{
+    if (eventQueue == nullptr || *eventQueue == nullptr)
+    {
+        return 0;
+    }
+
+    // the port task is inside the job so nothing else is reading the queue
+    // each event is looked at once, the ones Port posts for itself go back on the end for after the job
+    // the driver's data events are dropped, the job reads the data itself and keeping them would fill the queue
+    uint32_t errors = 0;
+    uart_event_t event;
+    for (auto waiting = uxQueueMessagesWaiting(*eventQueue); waiting > 0 && xQueueReceive(*eventQueue, &event, 0) == pdTRUE; waiting--)
+    {
+        if (event.type == UART_FRAME_ERR || event.type == UART_PARITY_ERR || event.type == UART_BREAK)
+        {
+            errors++;
+        }
+        else if (event.type >= UART_EVENT_MAX)
+        {
+            xQueueSend(*eventQueue, &event, 0);
+        }
+    }
+    return errors;
+}
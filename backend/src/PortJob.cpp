@@ -0,0 +1,138 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "PortJob.h"
+#include "Port.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+PortJob::PortJob() : state(StateQueued), stage(0), processed(0), total(0), inputConsumed(0), cancelRequested(false), error("")
+{
+    inputReady = xSemaphoreCreateBinary();
+}
+
+PortJob::~PortJob()
+{
+    if (inputReady != nullptr)
+    {
+        vSemaphoreDelete(inputReady);
+    }
+}
+
+bool PortJob::init(uint32_t inputBufferSize)
+{
+    return inputReady != nullptr && input.allocate(inputBufferSize);
+}
+
+void PortJob::run(PortIO &io)
+{
+    state = StateRunning;
+    Port::notifyConsumer();
+
+    auto result = execute(io);
+    if (cancelRequested)
+    {
+        state = StateCancelled;
+    }
+    else
+    {
+        state = result ? StateComplete : StateFailed;
+    }
+
+    ESP_LOGI(__FUNCTION__, "job finished, state %d %s", (int)state, result ? "" : error);
+    Port::notifyConsumer();
+}
+
+bool PortJob::writeInput(const uint8_t *data, uint32_t length)
+{
+    if (input.freeSpace() < length)
+    {
+        return false;
+    }
+
+    input.write(data, length);
+    xSemaphoreGive(inputReady);
+    return true;
+}
+
+void PortJob::cancel()
+{
+    cancelRequested = true;
+    // wake a job waiting for input
+    xSemaphoreGive(inputReady);
+}
+
+bool PortJob::readInput(uint8_t *dst, uint32_t len, uint32_t timeoutMs)
+{
+    auto deadline = esp_timer_get_time() + (int64_t)timeoutMs * 1000;
+    while (input.available() < len)
+    {
+        if (cancelRequested)
+        {
+            return fail("cancelled");
+        }
+
+        if (esp_timer_get_time() >= deadline)
+        {
+            return fail("timed out waiting for data from the client");
+        }
+        xSemaphoreTake(inputReady, cancelCheckIntervalMs / portTICK_PERIOD_MS);
+    }
+
+    input.read(dst, len);
+    inputConsumed += len;
+    Port::notifyConsumer();
+    return true;
+}
+
+int PortJob::receive(PortIO &io, uint8_t *dst, uint32_t len, uint32_t timeoutMs)
+{
+    uint32_t received = 0;
+    auto deadline = esp_timer_get_time() + (int64_t)timeoutMs * 1000;
+    while (received < len && !cancelRequested)
+    {
+        auto remaining = (deadline - esp_timer_get_time()) / 1000;
+        if (remaining <= 0)
+        {
+            break;
+        }
+
+        auto slice = remaining < cancelCheckIntervalMs ? (uint32_t)remaining : cancelCheckIntervalMs;
+        received += io.read(dst + received, len - received, slice);
+    }
+
+    return received;
+}
+
+void PortJob::setStage(uint8_t value)
+{
+    stage = value;
+    Port::notifyConsumer();
+}
+
+void PortJob::setProgress(uint32_t processedValue, uint32_t totalValue)
+{
+    processed = processedValue;
+    total = totalValue;
+    Port::notifyConsumer();
+}
+
+PortJob::Progress PortJob::getProgress()
+{
+    Progress progress = {state, stage, processed, total, inputConsumed};
+    return progress;
+}
@@ -16,6 +16,8 @@
  */
 
 #include "PortManager.h"
+#include "ClientMessageEncoding.h"
+#include "CaptureLog.h"
 #include "memory.h"
 #include "driver/uart.h"
 
@@ -25,11 +27,14 @@ const Port PortManager::ports[] = {
     , Port(UART_NUM_1, "UART 1", 9, 10)
 #endif
 #if (SOC_UART_HP_NUM > 2)
-    , Port(UART_NUM_2, "UART 2", 16, 17)
+    , Port(UART_NUM_2, "UART 2", 16, 17, 18, 19, 4)
 #endif
 };
 const int PortManager::portCount = (sizeof(PortManager::ports) / sizeof(Port));
 bool PortManager::portLock[(sizeof(PortManager::ports) / sizeof(Port))] = {};
+std::list<PortSubscription *> PortManager::subscriptions[(sizeof(PortManager::ports) / sizeof(Port))];
+uint8_t PortManager::watchGeneration[(sizeof(PortManager::ports) / sizeof(Port))] = {};
+PatternWatch::Config PortManager::watchConfig;
 
 void PortManager::init()
 {
@@ -64,12 +69,331 @@ bool PortManager::releaseOwnership(Port *port)
     {
         return false;
     }
-    port->stopContinuesRead();
-    port->setContinuesReadOnDataCallback(nullptr);
     portLock[index] = false;
+    updateContinuesRead(index);
     return true; // xSemaphoreGive(portLock[index]) == pdTRUE;
 }
 
+Port *PortManager::findPort(const char *portName)
+{
+    int index = indexOfPort(portName);
+    if (index == -1)
+    {
+        return nullptr;
+    }
+
+    return (Port *)&ports[index];
+}
+
+bool PortManager::subscribe(Port *port, PortSubscription *subscription)
+{
+    int index = indexOfPort(port->portName);
+    if (index == -1)
+    {
+        return false;
+    }
+
+    subscription->port = port;
+    subscription->clear();
+    subscriptions[index].push_back(subscription);
+    updateContinuesRead(index);
+    return true;
+}
+
+void PortManager::unsubscribe(PortSubscription *subscription)
+{
+    if (subscription->port == nullptr)
+    {
+        return;
+    }
+
+    int index = indexOfPort(subscription->port->portName);
+    subscriptions[index].remove(subscription);
+    subscription->port = nullptr;
+    subscription->enabled = false;
+    subscription->clear();
+    if (!subscription->watchPatterns.empty())
+    {
+        subscription->watchPatterns.clear();
+        updateWatch(index);
+    }
+    updateContinuesRead(index);
+}
+
+bool PortManager::setWatchPatterns(PortSubscription *subscription, const std::vector<std::string> &patterns)
+{
+    if (subscription->port == nullptr)
+    {
+        return false;
+    }
+
+    int index = indexOfPort(subscription->port->portName);
+    auto previous = subscription->watchPatterns;
+    subscription->watchPatterns = patterns;
+    if (!updateWatch(index))
+    {
+        subscription->watchPatterns = previous;
+        updateWatch(index);
+        return false;
+    }
+    return true;
+}
+
+bool PortManager::updateWatch(int index)
+{
+    // the subscribers' patterns one after another, each remembers where its own start
+    uint32_t used = 0;
+    watchConfig.count = 0;
+    for (auto subscription : subscriptions[index])
+    {
+        subscription->watchBase = watchConfig.count;
+        for (auto &pattern : subscription->watchPatterns)
+        {
+            if (watchConfig.count == PatternWatch::maxPatterns || pattern.empty() || pattern.size() > PatternWatch::maxPatternLength || used + pattern.size() > PatternWatch::maxTotalLength)
+            {
+                return false;
+            }
+            watchConfig.lengths[watchConfig.count++] = pattern.size();
+            memcpy(watchConfig.patterns + used, pattern.data(), pattern.size());
+            used += pattern.size();
+        }
+    }
+
+    // hits already in the rx buffer use the old numbering
+    watchGeneration[index]++;
+    return ((Port *)&ports[index])->setPatternWatch(watchConfig, watchGeneration[index]);
+}
+
+void PortManager::setSubscriptionEnabled(PortSubscription *subscription, bool enabled)
+{
+    if (subscription->port == nullptr)
+    {
+        return;
+    }
+
+    subscription->enabled = enabled;
+    if (!enabled)
+    {
+        subscription->clear();
+    }
+    updateContinuesRead(indexOfPort(subscription->port->portName));
+}
+
+void PortManager::updateRecording(Port *port)
+{
+    int index = indexOfPort(port->portName);
+    if (index != -1)
+    {
+        updateContinuesRead(index);
+    }
+}
+
+void PortManager::updateContinuesRead(int index)
+{
+    auto port = (Port *)&ports[index];
+    if (CaptureLog::isRecording(port))
+    {
+        port->startContinuesRead();
+        return;
+    }
+
+    for (auto subscription : subscriptions[index])
+    {
+        if (subscription->enabled)
+        {
+            port->startContinuesRead();
+            return;
+        }
+    }
+
+    port->stopContinuesRead();
+    dropBuffered(index);
+}
+
+void PortManager::dropBuffered(int index)
+{
+    // the data is no longer wanted, but a pattern hit may be for a watch that matched before the last viewer left
+    auto port = (Port *)&ports[index];
+    uint8_t type;
+    uint32_t length;
+    while (port->peekRecord(&type, &length))
+    {
+        if (type == Port::RecordTypePatternHit)
+        {
+            routePatternHit(index, readChunk(port));
+        }
+        else
+        {
+            port->readRecord(nullptr, 0);
+        }
+    }
+}
+
+void PortManager::process()
+{
+    for (int i = 0; i < portCount; i++)
+    {
+        auto port = (Port *)&ports[i];
+        if ((subscriptions[i].empty() && !CaptureLog::isRecording(port)) || (!port->isContinuesReadEnabled() && !port->isWatchActive()))
+        {
+            continue;
+        }
+
+        if (port->isFlowControlEnabled() && isBackedUp(i))
+        {
+            // leave the data with the port so it holds off the sender rather than dropping it here
+            continue;
+        }
+
+        for (int n = 0; n < maxChunksPerProcess; n++)
+        {
+            auto chunk = readChunk(port);
+            if (!chunk)
+            {
+                break;
+            }
+
+            if ((uint8_t)(*chunk)[0] == MessageEncoding::MessageTypeAsyncPatternHit)
+            {
+                routePatternHit(i, chunk);
+                continue;
+            }
+
+            if (CaptureLog::isRecording(port))
+            {
+                recordChunk(port, chunk);
+            }
+
+            for (auto subscription : subscriptions[i])
+            {
+                if (subscription->enabled)
+                {
+                    subscription->push(chunk);
+                }
+            }
+        }
+    }
+}
+
+PortSubscription::Chunk PortManager::readChunk(Port *port)
+{
+    uint8_t type;
+    uint32_t length;
+    if (!port->peekRecord(&type, &length))
+    {
+        return nullptr;
+    }
+
+    // the chunk is a complete async message so every subscriber sends the same buffer
+    auto header = PortSubscription::chunkHeaderSize;
+    if (type == Port::RecordTypeFrame)
+    {
+        // one message per frame
+        auto data = std::make_shared<std::string>(header + length, 0);
+        (*data)[0] = MessageEncoding::MessageTypeAsyncFrame;
+        port->readRecord(&(*data)[header], length);
+        return data;
+    }
+
+    if (type == Port::RecordTypePatternHit)
+    {
+        // passed on by routePatternHit()
+        auto data = std::make_shared<std::string>(header + length, 0);
+        (*data)[0] = MessageEncoding::MessageTypeAsyncPatternHit;
+        port->readRecord(&(*data)[header], length);
+        return data;
+    }
+
+    if (type == Port::RecordTypeLineEvent || type == Port::RecordTypeTimedData)
+    {
+        // each keeps its own message, timed data is not joined so every burst keeps its time
+        auto data = std::make_shared<std::string>(header + length, 0);
+        (*data)[0] = type == Port::RecordTypeLineEvent ? MessageEncoding::MessageTypeAsyncLineEvent : MessageEncoding::MessageTypeAsyncTimedData;
+        port->readRecord(&(*data)[header], length);
+        return data;
+    }
+
+    if (type != Port::RecordTypeData)
+    {
+        // not something subscribers are sent
+        port->readRecord(nullptr, 0);
+        return readChunk(port);
+    }
+
+    // join up data records, a record larger than the chunk size after a profile change is sent on its own
+    auto chunkSize = port->getReadChunkSize();
+    auto data = std::make_shared<std::string>(header + (length > chunkSize ? length : chunkSize), 0);
+    (*data)[0] = MessageEncoding::MessageTypeAsyncDataRead;
+    uint32_t used = 0;
+    do
+    {
+        used += port->readRecord(&(*data)[header + used], length);
+    } while (port->peekRecord(&type, &length) && type == Port::RecordTypeData && used + length <= chunkSize);
+
+    data->resize(header + used);
+    return data;
+}
+
+void PortManager::recordChunk(Port *port, const PortSubscription::Chunk &chunk)
+{
+    auto payload = (const uint8_t *)chunk->data() + PortSubscription::chunkHeaderSize;
+    uint32_t length = chunk->size() - PortSubscription::chunkHeaderSize;
+    switch ((uint8_t)(*chunk)[0])
+    {
+    case MessageEncoding::MessageTypeAsyncLineEvent:
+        // the stream offset is not needed, the event sits between the data records
+        CaptureLog::record(port, CaptureLog::RecordTypeLineEvent, payload, 1);
+        break;
+    case MessageEncoding::MessageTypeAsyncTimedData:
+        CaptureLog::record(port, CaptureLog::RecordTypeRx, payload + Port::timedDataHeaderSize, length - Port::timedDataHeaderSize);
+        break;
+    default:
+        CaptureLog::record(port, CaptureLog::RecordTypeRx, payload, length);
+        break;
+    }
+}
+
+void PortManager::routePatternHit(int index, const PortSubscription::Chunk &chunk)
+{
+    auto header = PortSubscription::chunkHeaderSize;
+    auto payload = (const uint8_t *)chunk->data() + header;
+    if (chunk->size() < header + Port::patternHitHeaderSize || payload[0] != watchGeneration[index])
+    {
+        // from patterns that have since been replaced
+        return;
+    }
+
+    uint8_t pattern = payload[1];
+    for (auto subscription : subscriptions[index])
+    {
+        if (pattern < subscription->watchBase || pattern >= subscription->watchBase + subscription->watchPatterns.size())
+        {
+            continue;
+        }
+
+        // the message drops the generation and numbers the pattern as the subscriber sent it
+        auto hit = std::make_shared<std::string>(chunk->size() - 1, 0);
+        (*hit)[0] = MessageEncoding::MessageTypeAsyncPatternHit;
+        (*hit)[header] = pattern - subscription->watchBase;
+        memcpy(&(*hit)[header + 1], payload + 2, chunk->size() - header - 2);
+        subscription->push(hit);
+        return;
+    }
+}
+
+bool PortManager::isBackedUp(int index)
+{
+    for (auto subscription : subscriptions[index])
+    {
+        if (subscription->enabled && subscription->isBackedUp())
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 int PortManager::indexOfPort(const char *portName)
 {
     for (int i = 0; i < portCount; i++)
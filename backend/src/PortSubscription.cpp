@@ -0,0 +1,74 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "PortSubscription.h"
+#include "Port.h"
+
+// the received bytes a chunk carries, line events and pattern hits are reports rather than data
+static uint32_t dataBytes(const PortSubscription::Chunk &chunk)
+{
+    auto length = chunk->size() - PortSubscription::chunkHeaderSize;
+    switch ((uint8_t)(*chunk)[0])
+    {
+    case MessageEncoding::MessageTypeAsyncDataRead:
+    case MessageEncoding::MessageTypeAsyncFrame:
+        return length;
+    case MessageEncoding::MessageTypeAsyncTimedData:
+        return length > Port::timedDataHeaderSize ? length - Port::timedDataHeaderSize : 0;
+    default:
+        return 0;
+    }
+}
+
+bool PortSubscription::push(const Chunk &chunk)
+{
+    if (queuedBytes + chunk->size() > maxQueuedBytes)
+    {
+        lostBytes += dataBytes(chunk);
+        return false;
+    }
+
+    chunks.push_back(chunk);
+    queuedBytes += chunk->size();
+    return true;
+}
+
+void PortSubscription::pop()
+{
+    queuedBytes -= chunks.front()->size();
+    chunks.pop_front();
+}
+
+void PortSubscription::popLost()
+{
+    lostBytes += dataBytes(chunks.front());
+    pop();
+}
+
+void PortSubscription::clear()
+{
+    chunks.clear();
+    queuedBytes = 0;
+    lostBytes = 0;
+}
+
+uint32_t PortSubscription::takeLostBytes()
+{
+    auto lost = lostBytes;
+    lostBytes = 0;
+    return lost;
+}
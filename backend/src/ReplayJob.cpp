@@ -0,0 +1,242 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "ReplayJob.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <string.h>
+
+static const uint32_t inputTimeoutMs = 10000;
+static const uint32_t compareBufferSize = 8 * 1024;
+// the first record is due this long after the job starts so the input can get ahead of it
+static const int64_t startDelayUs = 20000;
+// the end of a wait is spun rather than slept so sends land on time
+static const int64_t spinUs = 2000;
+// longest slice of a wait spent reading the line, so the schedule is checked often
+static const uint32_t collectSliceMs = 10;
+
+static uint32_t readUint32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void writeUint32(uint8_t *p, uint32_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = (value >> 24) & 0xFF;
+}
+
+ReplayJob::ReplayJob(uint32_t _recordingSize) : recordingSize(_recordingSize), timeScale(1000), tailMs(500), txBytes(0), rxExpected(0), rxReceived(0), rxCompared(0), mismatches(0), maxLateUs(0), divergenceCount(0)
+{
+}
+
+bool ReplayJob::setParams(const uint8_t *params, uint32_t length)
+{
+    if (length < paramsSize)
+    {
+        return false;
+    }
+
+    timeScale = readUint32(params);
+    tailMs = readUint32(params + 4);
+    return timeScale > 0;
+}
+
+bool ReplayJob::execute(PortIO &io)
+{
+    if (!expected.allocate(compareBufferSize) || !received.allocate(compareBufferSize))
+    {
+        return fail("out of memory");
+    }
+
+    // only the answers to the replay are compared
+    io.flushInput();
+    setStage(StageReplaying);
+
+    uint32_t consumed = 0;
+    uint64_t firstTime = 0;
+    int64_t start = 0;
+    while (consumed < recordingSize && !isCancelled())
+    {
+        CaptureLog::RecordHeader header;
+        if (recordingSize - consumed < sizeof(header))
+        {
+            return fail("recording ends part way through a record");
+        }
+
+        if (!readInput((uint8_t *)&header, sizeof(header), inputTimeoutMs))
+        {
+            return false;
+        }
+
+        uint32_t length = header.length[0] | (header.length[1] << 8);
+        consumed += sizeof(header) + length;
+        if (length > sizeof(data) || consumed > recordingSize)
+        {
+            return fail("invalid recording");
+        }
+
+        if (!readInput(data, length, inputTimeoutMs))
+        {
+            return false;
+        }
+        setProgress(consumed, recordingSize);
+
+        if (header.type != CaptureLog::RecordTypeRx && header.type != CaptureLog::RecordTypeTx)
+        {
+            continue;
+        }
+
+        uint64_t time = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            time |= (uint64_t)header.time[i] << (i * 8);
+        }
+
+        if (start == 0)
+        {
+            firstTime = time;
+            start = esp_timer_get_time() + startDelayUs;
+        }
+
+        // the line is read while waiting, RX records wait too so the expected data keeps pace with the answers
+        auto due = start + (int64_t)((time > firstTime ? time - firstTime : 0) * timeScale / 1000);
+        waitUntil(io, due);
+
+        if (header.type == CaptureLog::RecordTypeRx)
+        {
+            auto room = expected.freeSpace();
+            if (room < length)
+            {
+                // the device under test is this far behind, the oldest expected bytes are treated as never sent
+                expected.skip(length - room);
+                mismatches += length - room;
+                rxCompared += length - room;
+            }
+            expected.write(data, length);
+            rxExpected += length;
+            compare();
+            continue;
+        }
+
+        auto late = esp_timer_get_time() - due;
+        if (late > (int64_t)maxLateUs)
+        {
+            maxLateUs = late;
+        }
+
+        if (!io.write(data, length))
+        {
+            return fail("port write failed");
+        }
+        txBytes += length;
+    }
+
+    setStage(StageTail);
+    io.waitWriteDone(1000);
+    waitUntil(io, esp_timer_get_time() + (int64_t)tailMs * 1000);
+    collect(io, 0);
+    compare();
+    return true;
+}
+
+void ReplayJob::waitUntil(PortIO &io, int64_t time)
+{
+    while (!isCancelled())
+    {
+        auto remaining = time - esp_timer_get_time();
+        if (remaining <= spinUs)
+        {
+            if (remaining > 0)
+            {
+                io.delayMicros(remaining);
+            }
+            return;
+        }
+
+        auto sliceMs = (remaining - spinUs) / 1000;
+        collect(io, sliceMs < collectSliceMs ? sliceMs : collectSliceMs);
+        compare();
+    }
+}
+
+void ReplayJob::collect(PortIO &io, uint32_t timeoutMs)
+{
+    uint8_t buff[128];
+    auto room = received.freeSpace();
+    if (room == 0)
+    {
+        // nothing expected to compare it with, wait for the recording to catch up
+        io.delay(timeoutMs);
+        return;
+    }
+
+    auto length = io.read(buff, room < sizeof(buff) ? room : sizeof(buff), timeoutMs);
+    received.write(buff, length);
+    rxReceived += length;
+}
+
+void ReplayJob::compare()
+{
+    uint8_t want[64];
+    uint8_t got[64];
+    while (expected.available() > 0 && received.available() > 0)
+    {
+        auto length = expected.available() < received.available() ? expected.available() : received.available();
+        length = length < sizeof(want) ? length : sizeof(want);
+        expected.read(want, length);
+        received.read(got, length);
+        for (uint32_t i = 0; i < length; i++)
+        {
+            if (want[i] != got[i])
+            {
+                mismatches++;
+                if (divergenceCount < maxDivergences)
+                {
+                    divergences[divergenceCount++] = {rxCompared + i, want[i], got[i]};
+                }
+            }
+        }
+        rxCompared += length;
+    }
+}
+
+uint32_t ReplayJob::getResult(uint8_t *dst, uint32_t size)
+{
+    auto resultSize = resultHeaderSize + divergenceCount * divergenceSize;
+    if (size < resultSize)
+    {
+        return 0;
+    }
+
+    writeUint32(dst, txBytes);
+    writeUint32(dst + 4, rxExpected);
+    writeUint32(dst + 8, rxReceived);
+    writeUint32(dst + 12, mismatches);
+    writeUint32(dst + 16, maxLateUs);
+    dst[20] = divergenceCount;
+    auto out = dst + resultHeaderSize;
+    for (int i = 0; i < divergenceCount; i++)
+    {
+        writeUint32(out, divergences[i].offset);
+        out[4] = divergences[i].expected;
+        out[5] = divergences[i].received;
+        out += divergenceSize;
+    }
+    return resultSize;
+}
@@ -0,0 +1,401 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "ScriptJob.h"
+#include "ModemSequenceJob.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const uint32_t inputTimeoutMs = 10000;
+// longest a write step may take to leave the UART
+static const uint32_t writeTimeoutMs = 1000;
+// long waits are slept in slices this long so a cancel is noticed
+static const uint32_t waitSliceMs = 100;
+
+static uint16_t readUint16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t readUint32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void writeUint32(uint8_t *p, uint32_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = (value >> 24) & 0xFF;
+}
+
+ScriptJob::ScriptJob(uint8_t _flags, uint32_t _scriptSize) : flags(_flags), scriptSize(_scriptSize), script(nullptr), steps(nullptr), stepCount(0), stepsRun(0), capture(nullptr), captureLength(0), captureDropped(0)
+{
+}
+
+ScriptJob::~ScriptJob()
+{
+    free(script);
+    free(steps);
+    free(capture);
+}
+
+bool ScriptJob::execute(PortIO &io)
+{
+    auto baudRate = io.getBaudRate();
+    if (!load() || !validate())
+    {
+        return false;
+    }
+
+    setStage(StageRunning);
+    auto result = run(io);
+    // progress is only reported at the ends, each report wakes the server task which would add jitter between steps
+    setProgress(stepsRun, stepCount);
+
+    if (flags & FlagRestoreBaudRate)
+    {
+        io.setBaudRate(baudRate);
+    }
+
+    return result;
+}
+
+bool ScriptJob::load()
+{
+    setStage(StageLoading);
+    if (scriptSize == 0 || scriptSize > maxScriptSize)
+    {
+        return fail("invalid script size");
+    }
+
+    script = (uint8_t *)malloc(scriptSize);
+    steps = (StepInfo *)malloc(maxSteps * sizeof(StepInfo));
+    capture = (uint8_t *)malloc(maxCapture);
+    if (script == nullptr || steps == nullptr || capture == nullptr)
+    {
+        return fail("out of memory");
+    }
+
+    // the whole script is on the device before it starts so the steps are not paced by the network
+    uint32_t loaded = 0;
+    while (loaded < scriptSize)
+    {
+        auto length = scriptSize - loaded < inputBufferSize ? scriptSize - loaded : inputBufferSize;
+        if (!readInput(script + loaded, length, inputTimeoutMs))
+        {
+            return false;
+        }
+        loaded += length;
+        setProgress(loaded, scriptSize);
+    }
+    return true;
+}
+
+bool ScriptJob::validate()
+{
+    // check the whole script up front so a bad step can not leave the device half way through a sequence
+    uint16_t loops[maxLoopDepth];
+    uint8_t depth = 0;
+    uint32_t offset = 0;
+    stepCount = 0;
+    while (offset < scriptSize)
+    {
+        if (stepCount == maxSteps)
+        {
+            return fail("too many steps");
+        }
+
+        auto p = script + offset;
+        auto remaining = scriptSize - offset - 1;
+        uint32_t size = 0;
+        auto &step = steps[stepCount];
+        step.offset = offset;
+        step.loop = depth > 0 ? loops[depth - 1] : noLoop;
+        switch (p[0])
+        {
+        case OpWrite:
+            size = remaining < 2 ? 2 : 2 + readUint16(p + 1);
+            break;
+        case OpExpect:
+            size = remaining < 4 ? 4 : 4 + p[4];
+            if (remaining >= 4 && p[4] > maxPatternLength)
+            {
+                return fail("expect pattern too long");
+            }
+            break;
+        case OpDelay:
+        case OpSetBaudRate:
+            size = 4;
+            break;
+        case OpLoop:
+            size = 2;
+            if (remaining >= 2 && readUint16(p + 1) == 0)
+            {
+                return fail("loop count of 0");
+            }
+            if (depth == maxLoopDepth)
+            {
+                return fail("loops nested too deep");
+            }
+            loops[depth++] = stepCount;
+            break;
+        case OpEndLoop:
+            if (depth == 0)
+            {
+                return fail("end of loop without a loop");
+            }
+            depth--;
+            break;
+        case OpWritePeriodic:
+            size = remaining < 8 ? 8 : 8 + readUint16(p + 7);
+            break;
+        case OpSetLines:
+            size = 1;
+            break;
+        case OpFlushInput:
+            break;
+        case OpJump:
+            size = 3;
+            if (remaining >= 3 && p[1] > JumpIfTimedOut)
+            {
+                return fail("unknown jump condition");
+            }
+            break;
+        default:
+            return fail("unknown script step");
+        }
+
+        if (size > remaining)
+        {
+            return fail("script ends part way through a step");
+        }
+        offset += 1 + size;
+        stepCount++;
+    }
+
+    if (depth != 0)
+    {
+        return fail("loop without an end");
+    }
+
+    // jumps in or out of a loop would leave its count behind
+    for (uint32_t i = 0; i < stepCount; i++)
+    {
+        auto p = script + steps[i].offset;
+        if (p[0] != OpJump)
+        {
+            continue;
+        }
+
+        auto target = readUint16(p + 2);
+        if (target >= stepCount || steps[target].loop != steps[i].loop)
+        {
+            return fail("jump target outside the loop");
+        }
+    }
+    return true;
+}
+
+bool ScriptJob::run(PortIO &io)
+{
+    LoopState loops[maxLoopDepth];
+    uint8_t depth = 0;
+    auto matched = false;
+    uint32_t step = 0;
+    while (step < stepCount && !isCancelled())
+    {
+        auto p = script + steps[step].offset;
+        auto next = step + 1;
+        stepsRun++;
+        switch (p[0])
+        {
+        case OpWrite:
+            if (!write(io, p + 3, readUint16(p + 1)))
+            {
+                return false;
+            }
+            break;
+        case OpExpect:
+            matched = expect(io, p + 5, p[4], readUint16(p + 1));
+            if (!matched && !isCancelled() && !(p[3] & ExpectOptional))
+            {
+                return fail("expect timed out");
+            }
+            break;
+        case OpDelay:
+            waitUntil(io, esp_timer_get_time() + readUint32(p + 1));
+            break;
+        case OpLoop:
+            loops[depth++] = {(uint16_t)step, readUint16(p + 1)};
+            break;
+        case OpEndLoop:
+            // always the innermost loop, jumps can not leave one part way through
+            if (--loops[depth - 1].remaining > 0)
+            {
+                next = loops[depth - 1].step + 1;
+            }
+            else
+            {
+                depth--;
+            }
+            break;
+        case OpWritePeriodic:
+        {
+            // each send is timed from the first so the period does not drift with the write time
+            auto period = readUint32(p + 1);
+            auto count = readUint16(p + 5);
+            auto length = readUint16(p + 7);
+            auto start = esp_timer_get_time();
+            for (uint32_t i = 0; i < count && !isCancelled(); i++)
+            {
+                waitUntil(io, start + (int64_t)i * period);
+                if (!write(io, p + 9, length))
+                {
+                    return false;
+                }
+            }
+            break;
+        }
+        case OpSetLines:
+        {
+            auto lines = p[1];
+            auto result = true;
+            if (lines & ModemSequenceJob::LineChangeDTR)
+            {
+                result = io.setDTR(lines & ModemSequenceJob::LineDTR);
+            }
+            if (lines & ModemSequenceJob::LineChangeRTS)
+            {
+                result = io.setRTS(lines & ModemSequenceJob::LineRTS) && result;
+            }
+            if (!result)
+            {
+                return fail("failed to set the modem lines");
+            }
+            break;
+        }
+        case OpSetBaudRate:
+            if (!io.setBaudRate(readUint32(p + 1)))
+            {
+                return fail("failed to set the baud rate");
+            }
+            break;
+        case OpFlushInput:
+            io.flushInput();
+            break;
+        case OpJump:
+            if (p[1] == JumpAlways || (p[1] == JumpIfMatched && matched) || (p[1] == JumpIfTimedOut && !matched))
+            {
+                next = readUint16(p + 2);
+            }
+            break;
+        }
+        step = next;
+    }
+    return true;
+}
+
+bool ScriptJob::expect(PortIO &io, const uint8_t *pattern, uint8_t length, uint32_t timeoutMs)
+{
+    // the last length bytes received, compared after each one
+    uint8_t recent[maxPatternLength];
+    uint8_t recentLength = 0;
+    auto deadline = esp_timer_get_time() + (int64_t)timeoutMs * 1000;
+    while (!isCancelled())
+    {
+        auto remaining = (deadline - esp_timer_get_time()) / 1000;
+        if (remaining <= 0)
+        {
+            // an empty pattern just collects what arrives in the time
+            return length == 0;
+        }
+
+        uint8_t value;
+        if (receive(io, &value, 1, remaining) != 1)
+        {
+            continue;
+        }
+
+        if (captureLength < maxCapture)
+        {
+            capture[captureLength++] = value;
+        }
+        else
+        {
+            captureDropped++;
+        }
+
+        if (length == 0)
+        {
+            continue;
+        }
+
+        if (recentLength == length)
+        {
+            memmove(recent, recent + 1, length - 1);
+            recentLength--;
+        }
+        recent[recentLength++] = value;
+        if (recentLength == length && memcmp(recent, pattern, length) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ScriptJob::write(PortIO &io, const uint8_t *data, uint32_t length)
+{
+    return (io.write(data, length) && io.waitWriteDone(writeTimeoutMs)) || fail("port write failed");
+}
+
+void ScriptJob::waitUntil(PortIO &io, int64_t time)
+{
+    while (!isCancelled())
+    {
+        auto remaining = time - esp_timer_get_time();
+        if (remaining <= 0)
+        {
+            return;
+        }
+
+        if (remaining > waitSliceMs * 1000)
+        {
+            io.delay(waitSliceMs);
+            continue;
+        }
+
+        io.delayMicros(remaining);
+        return;
+    }
+}
+
+uint32_t ScriptJob::getResult(uint8_t *dst, uint32_t size)
+{
+    if (size < resultHeaderSize + captureLength)
+    {
+        return 0;
+    }
+
+    writeUint32(dst, stepsRun);
+    writeUint32(dst + 4, captureDropped);
+    memcpy(dst + resultHeaderSize, capture, captureLength);
+    return resultHeaderSize + captureLength;
+}
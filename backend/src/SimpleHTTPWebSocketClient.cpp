@@ -22,9 +22,21 @@
 using SimpleHTTP::Result;
 using SimpleHTTP::Websocket;
 
+bool SimpleHTTPWebSocketClient::canWriteMessage()
+{
+    return ((SimpleHTTP::ServerConnection *)conn)->hasAvailableSendBuffer();
+}
+
 bool SimpleHTTPWebSocketClient::writeMessage(const char *msgPayload, const int payloadSize,bool block)
 {
     auto c = (SimpleHTTP::ServerConnection *)conn;
+    if (payloadSize > UINT16_MAX)
+    {
+        // the frame length field of the websocket lib is 16 bits, larger payloads must be split by the caller
+        ESP_LOGE(__FUNCTION__, "writeMessage:payload too large %d", payloadSize);
+        return false;
+    }
+
     if(block){
         
         while(!c->hasAvailableSendBuffer()){
@@ -0,0 +1,268 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Stm32BootloaderJob.h"
+#include "esp_log.h"
+#include <stdio.h>
+#include <string.h>
+
+static const uint8_t ACK = 0x79;
+static const uint8_t NACK = 0x1F;
+static const uint8_t SyncByte = 0x7F;
+
+static const uint8_t CommandGet = 0x00;
+static const uint8_t CommandReadMemory = 0x11;
+static const uint8_t CommandGo = 0x21;
+static const uint8_t CommandWriteMemory = 0x31;
+static const uint8_t CommandErase = 0x43;
+static const uint8_t CommandExtendedErase = 0x44;
+
+static const uint32_t ackTimeoutMs = 1000;
+// a mass erase of a large part can take tens of seconds
+static const uint32_t eraseTimeoutMs = 40000;
+static const uint32_t inputTimeoutMs = 10000;
+static const int syncAttempts = 5;
+
+Stm32BootloaderJob::Stm32BootloaderJob(uint8_t _flags, uint32_t _goAddress, uint32_t _imageLength) : flags(_flags), goAddress(_goAddress), imageLength(_imageLength), extendedErase(false)
+{
+    errorMessage[0] = 0;
+}
+
+bool Stm32BootloaderJob::waitAck(PortIO &io, uint32_t timeoutMs)
+{
+    uint8_t response = 0;
+    if (receive(io, &response, 1, timeoutMs) != 1)
+    {
+        return fail("no response from the bootloader");
+    }
+
+    if (response == NACK)
+    {
+        return fail("bootloader sent NACK");
+    }
+
+    if (response != ACK)
+    {
+        return fail("unexpected response from the bootloader");
+    }
+
+    return true;
+}
+
+bool Stm32BootloaderJob::sendWithChecksum(PortIO &io, const uint8_t *data, uint32_t length, uint8_t initial, uint32_t ackTimeoutMs)
+{
+    uint8_t checksum = initial;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        checksum ^= data[i];
+    }
+
+    if (!io.write(data, length) || !io.write(&checksum, 1))
+    {
+        return fail("port write failed");
+    }
+
+    return waitAck(io, ackTimeoutMs);
+}
+
+bool Stm32BootloaderJob::sendCommand(PortIO &io, uint8_t command)
+{
+    // commands are sent with their complement
+    return sendWithChecksum(io, &command, 1, 0xFF, ackTimeoutMs);
+}
+
+bool Stm32BootloaderJob::sendAddress(PortIO &io, uint32_t address)
+{
+    uint8_t data[] = {(uint8_t)(address >> 24), (uint8_t)(address >> 16), (uint8_t)(address >> 8), (uint8_t)address};
+    return sendWithChecksum(io, data, sizeof(data), 0, ackTimeoutMs);
+}
+
+bool Stm32BootloaderJob::sync(PortIO &io)
+{
+    for (int i = 0; i < syncAttempts && !isCancelled(); i++)
+    {
+        io.flushInput();
+        io.write(&SyncByte, 1);
+
+        uint8_t response = 0;
+        // a NACK means the bootloader was already synced by an earlier session
+        if (receive(io, &response, 1, ackTimeoutMs / 2) == 1 && (response == ACK || response == NACK))
+        {
+            return true;
+        }
+    }
+
+    return fail("no response to sync, is the device in bootloader mode");
+}
+
+bool Stm32BootloaderJob::getCommands(PortIO &io)
+{
+    if (!sendCommand(io, CommandGet))
+    {
+        return false;
+    }
+
+    // number of bytes to follow - 1, bootloader version then the supported commands
+    uint8_t count = 0;
+    if (receive(io, &count, 1, ackTimeoutMs) != 1)
+    {
+        return fail("no response to get");
+    }
+
+    uint8_t commands[256];
+    uint32_t length = (uint32_t)count + 1;
+    if ((uint32_t)receive(io, commands, length, ackTimeoutMs) != length)
+    {
+        return fail("no response to get");
+    }
+
+    extendedErase = memchr(commands + 1, CommandExtendedErase, length - 1) != nullptr;
+    ESP_LOGI(__FUNCTION__, "bootloader version %x, %s erase", commands[0], extendedErase ? "extended" : "standard");
+
+    return waitAck(io, ackTimeoutMs);
+}
+
+bool Stm32BootloaderJob::eraseAll(PortIO &io)
+{
+    if (extendedErase)
+    {
+        uint8_t massErase[] = {0xFF, 0xFF};
+        return sendCommand(io, CommandExtendedErase) && sendWithChecksum(io, massErase, sizeof(massErase), 0, eraseTimeoutMs);
+    }
+
+    uint8_t globalErase = 0xFF;
+    return sendCommand(io, CommandErase) && sendWithChecksum(io, &globalErase, 1, 0, eraseTimeoutMs);
+}
+
+bool Stm32BootloaderJob::writeMemory(PortIO &io, uint32_t address, const uint8_t *data, uint32_t length)
+{
+    if (!sendCommand(io, CommandWriteMemory) || !sendAddress(io, address))
+    {
+        return false;
+    }
+
+    // the bootloader writes whole words, pad the block with erased flash
+    uint8_t padded[1 + maxBlockSize];
+    auto paddedLength = (length + 3) & ~3u;
+    padded[0] = paddedLength - 1;
+    memcpy(padded + 1, data, length);
+    memset(padded + 1 + length, 0xFF, paddedLength - length);
+
+    return sendWithChecksum(io, padded, 1 + paddedLength, 0, ackTimeoutMs);
+}
+
+bool Stm32BootloaderJob::readMemory(PortIO &io, uint32_t address, uint8_t *dst, uint32_t length)
+{
+    if (!sendCommand(io, CommandReadMemory) || !sendAddress(io, address) || !sendCommand(io, length - 1))
+    {
+        return false;
+    }
+
+    if ((uint32_t)receive(io, dst, length, ackTimeoutMs) != length)
+    {
+        return fail("read memory timed out");
+    }
+
+    return true;
+}
+
+bool Stm32BootloaderJob::go(PortIO &io, uint32_t address)
+{
+    return sendCommand(io, CommandGo) && sendAddress(io, address);
+}
+
+bool Stm32BootloaderJob::execute(PortIO &io)
+{
+    setStage(StageSync);
+    if (!sync(io) || !getCommands(io))
+    {
+        return false;
+    }
+
+    if (flags & FlagErase)
+    {
+        setStage(StageErase);
+        if (!eraseAll(io))
+        {
+            return false;
+        }
+    }
+
+    if (flags & (FlagWrite | FlagVerify))
+    {
+        setStage((flags & FlagWrite) ? StageWrite : StageVerify);
+        uint32_t processed = 0;
+        setProgress(processed, imageLength);
+
+        // each block is verified straight after it is written so the image only has to be sent once
+        while (processed < imageLength)
+        {
+            uint8_t header[blockHeaderSize];
+            if (!readInput(header, sizeof(header), inputTimeoutMs))
+            {
+                return false;
+            }
+
+            uint32_t address = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24);
+            uint32_t length = header[4] | (header[5] << 8);
+            if (length == 0 || length > maxBlockSize || processed + length > imageLength)
+            {
+                return fail("invalid image block");
+            }
+
+            if (!readInput(block, length, inputTimeoutMs))
+            {
+                return false;
+            }
+
+            if ((flags & FlagWrite) && !writeMemory(io, address, block, length))
+            {
+                snprintf(errorMessage, sizeof(errorMessage), "write failed at 0x%08lx, %s", (unsigned long)address, getError());
+                return fail(errorMessage);
+            }
+
+            if (flags & FlagVerify)
+            {
+                if (!readMemory(io, address, readBack, length))
+                {
+                    snprintf(errorMessage, sizeof(errorMessage), "read failed at 0x%08lx, %s", (unsigned long)address, getError());
+                    return fail(errorMessage);
+                }
+
+                if (memcmp(block, readBack, length) != 0)
+                {
+                    snprintf(errorMessage, sizeof(errorMessage), "verify mismatch at 0x%08lx", (unsigned long)address);
+                    return fail(errorMessage);
+                }
+            }
+
+            processed += length;
+            setProgress(processed, imageLength);
+        }
+    }
+
+    if (flags & FlagGo)
+    {
+        setStage(StageGo);
+        if (!go(io, goAddress))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
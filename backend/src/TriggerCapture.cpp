@@ -0,0 +1,212 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "TriggerCapture.h"
+#include "esp_heap_caps.h"
+#include <string.h>
+
+TriggerCapture::TriggerCapture() : config({}), window(nullptr), preHead(0), preCount(0), postCount(0), matched(0), firedTrigger(0), triggerTime(0), state(StateIdle)
+{
+}
+
+TriggerCapture::~TriggerCapture()
+{
+    release();
+}
+
+void TriggerCapture::release()
+{
+    state = StateIdle;
+    if (window != nullptr)
+    {
+        heap_caps_free(window);
+        window = nullptr;
+    }
+}
+
+bool TriggerCapture::configure(const Config &newConfig)
+{
+    release();
+    config = newConfig;
+    if (config.triggers == 0)
+    {
+        return true;
+    }
+
+    if (config.triggers > (TriggerPattern | TriggerLineError | TriggerBreak) || config.preEntries + config.postEntries == 0 || config.preEntries + config.postEntries > maxWindow)
+    {
+        return false;
+    }
+
+    if ((config.triggers & TriggerPattern) && (config.patternLength == 0 || config.patternLength > maxPatternLength))
+    {
+        return false;
+    }
+
+    // the window can be large so use PSRAM when the board has it
+    window = (uint8_t *)heap_caps_malloc_prefer((config.preEntries + config.postEntries) * 2, 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_8BIT);
+    if (window == nullptr)
+    {
+        return false;
+    }
+
+    // KMP fallback so a partial match that fails can resume without going back over the data
+    fallback[0] = 0;
+    for (uint8_t i = 1, length = 0; i < config.patternLength; i++)
+    {
+        while (length > 0 && config.pattern[i] != config.pattern[length])
+        {
+            length = fallback[length - 1];
+        }
+        if (config.pattern[i] == config.pattern[length])
+        {
+            length++;
+        }
+        fallback[i] = length;
+    }
+
+    preHead = 0;
+    preCount = 0;
+    postCount = 0;
+    matched = 0;
+    firedTrigger = 0;
+    triggerTime = 0;
+    state = StateArmed;
+    return true;
+}
+
+bool TriggerCapture::add(uint8_t flags, uint8_t value)
+{
+    if (state == StateArmed)
+    {
+        if (config.preEntries > 0)
+        {
+            window[preHead * 2] = flags;
+            window[preHead * 2 + 1] = value;
+            preHead = (preHead + 1) % config.preEntries;
+            if (preCount < config.preEntries)
+            {
+                preCount++;
+            }
+        }
+        return false;
+    }
+
+    auto index = config.preEntries + postCount;
+    window[index * 2] = flags;
+    window[index * 2 + 1] = value;
+    postCount++;
+    if (postCount == config.postEntries)
+    {
+        state = StateComplete;
+        return true;
+    }
+    return false;
+}
+
+bool TriggerCapture::fire(uint8_t trigger, int64_t time)
+{
+    firedTrigger = trigger;
+    triggerTime = time;
+    if (config.postEntries == 0)
+    {
+        state = StateComplete;
+        return true;
+    }
+    state = StateTriggered;
+    return false;
+}
+
+bool TriggerCapture::feed(const uint8_t *data, uint32_t length, bool tx, int64_t time)
+{
+    for (uint32_t i = 0; i < length && isActive(); i++)
+    {
+        auto armed = state == StateArmed;
+        if (add(tx ? EntryFlagTx : 0, data[i]))
+        {
+            return true;
+        }
+
+        if (!armed || tx || !(config.triggers & TriggerPattern))
+        {
+            continue;
+        }
+
+        while (matched > 0 && data[i] != config.pattern[matched])
+        {
+            matched = fallback[matched - 1];
+        }
+        if (data[i] == config.pattern[matched])
+        {
+            matched++;
+        }
+        if (matched == config.patternLength && fire(TriggerPattern, time))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TriggerCapture::lineEvent(uint8_t event, bool isBreak, int64_t time)
+{
+    if (!isActive())
+    {
+        return false;
+    }
+
+    auto armed = state == StateArmed;
+    if (add(EntryFlagLineEvent, event))
+    {
+        return true;
+    }
+
+    auto trigger = isBreak ? TriggerBreak : TriggerLineError;
+    return armed && (config.triggers & trigger) && fire(trigger, time);
+}
+
+uint32_t TriggerCapture::getResultSize()
+{
+    return state == StateComplete ? resultHeaderSize + (preCount + postCount) * 2 : 0;
+}
+
+uint32_t TriggerCapture::readResult(uint8_t *dst, uint32_t size)
+{
+    if (state != StateComplete || size < getResultSize())
+    {
+        return 0;
+    }
+
+    dst[0] = firedTrigger;
+    for (int i = 0; i < 8; i++)
+    {
+        dst[1 + i] = (uint64_t)triggerTime >> (i * 8);
+    }
+    dst[9] = preCount & 0xFF;
+    dst[10] = preCount >> 8;
+    dst[11] = postCount & 0xFF;
+    dst[12] = postCount >> 8;
+
+    // the ring starts at preHead once it has wrapped
+    auto out = dst + resultHeaderSize;
+    auto oldest = preCount < config.preEntries ? 0 : preHead;
+    auto firstPart = (uint32_t)(config.preEntries - oldest) < preCount ? config.preEntries - oldest : preCount;
+    memcpy(out, window + oldest * 2, firstPart * 2);
+    memcpy(out + firstPart * 2, window, (preCount - firstPart) * 2);
+    memcpy(out + preCount * 2, window + config.preEntries * 2, postCount * 2);
+
+    return getResultSize();
+}
@@ -33,6 +33,7 @@ extern "C"
 }
 
 #include "PortManager.h"
+#include "CaptureLog.h"
 #include "Server.h"
 #include "SecureServer.h"
 //#include "tls.h"
@@ -63,13 +64,17 @@ uint32_t os_getUnixTime()
 
 void http_server_thread(void *arg)
 {
+    // wake early when a port has data to forward
+    Port::setConsumerTask(xTaskGetCurrentTaskHandle());
 
     while (1)
     {
         SimpleHTTP::Router::process();
         SimpleHTTP::WebsocketManager::process();
+        PortManager::process();
+        ClientConnection::processAll();
         UserAuthSessionManager::removeExpiredSessions();
-        vTaskDelay(1);
+        ulTaskNotifyTake(pdTRUE, 1);
     }
 }
 
@@ -146,6 +151,8 @@ void app_main(void)
     ESP_ERROR_CHECK(esp_wifi_start());
 
 
+    CaptureLog::init();
+
     xTaskCreate(http_server_thread, "Server::loop()", configMINIMAL_STACK_SIZE * 20, nullptr, 2, nullptr);
 
     SimpleHTTP::EmbeddedFilesHandler::addFiles((SimpleHTTP::EmbeddedFile *)files,
@@ -159,6 +166,9 @@ void app_main(void)
     SimpleHTTP::Router::addHandler("/tls",CertManager::certGETConfigRequest);
     SimpleHTTP::Router::addHandler("/auth",UserAuthManager::getTokenloginPOSTRequest);
     SimpleHTTP::Router::addHandler("/auth/update",UserAuthManager::updateLoginPOSTRequest);
+    SimpleHTTP::Router::addHandler("/capture", CaptureLog::captureRequest);
+    SimpleHTTP::Router::addHandler("/capture/data", CaptureLog::captureDataRequest);
+    SimpleHTTP::Router::addHandler("/capture/find", CaptureLog::captureFindRequest);
 
     SimpleHTTP::Router::addHandler("/ws", [](SimpleHTTP::Request *req, SimpleHTTP::Response *resp)
                                    {
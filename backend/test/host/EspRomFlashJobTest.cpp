@@ -0,0 +1,218 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+// runs EspRomFlashJob against the scripted ROM loader in ScriptedPortIO
+#include "EspRomFlashJob.h"
+#include "ScriptedPortIO.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(condition)                                                    \
+    do                                                                      \
+    {                                                                       \
+        if (!(condition))                                                   \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static const uint32_t flashOffset = 0x10000;
+static const uint32_t uncompressedLength = 0x2000;
+static const uint8_t md5[16] = {0x9e, 0x10, 0x7d, 0x9d, 0x37, 0x2b, 0xb6, 0x82, 0x6b, 0xd8, 0x1d, 0x35, 0x42, 0xa4, 0x19, 0xd6};
+static const char md5Hex[] = "9e107d9d372bb6826bd81d3542a419d6";
+
+// stands in for the deflate stream, the fake ROM does not inflate it
+// it holds the SLIP delimiter and escape bytes so the escaping is covered
+static std::vector<uint8_t> makeImage(uint32_t length)
+{
+    std::vector<uint8_t> image(length);
+    for (uint32_t i = 0; i < length; i++)
+    {
+        image[i] = (uint8_t)(i * 37 + (i >> 8));
+    }
+    image[0] = 0xC0;
+    image[1] = 0xDB;
+    image[2] = 0xDB;
+    image[3] = 0xC0;
+    image[length - 1] = 0xC0;
+    return image;
+}
+
+static uint32_t getUint32(const uint8_t *src)
+{
+    return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static void putUint32(uint8_t *dst, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        dst[i] = (value >> (i * 8)) & 0xFF;
+    }
+}
+
+/**
+ * runs a job with the whole image already in its input buffer
+ * @return the final job state
+ */
+static uint8_t runJob(ScriptedPortIO &io, uint8_t flags, const std::vector<uint8_t> &image, uint32_t baudRate, std::string *error)
+{
+    EspRomFlashJob job(flags, flashOffset, image.size());
+    uint8_t params[EspRomFlashJob::paramsSize];
+    putUint32(params, uncompressedLength);
+    memcpy(params + 4, md5, sizeof(md5));
+    putUint32(params + 20, baudRate);
+
+    if (!job.init(EspRomFlashJob::inputBufferSize) || !job.setParams(params, sizeof(params)) || !job.writeInput(image.data(), image.size()))
+    {
+        return PortJob::StateQueued;
+    }
+
+    job.run(io);
+    *error = job.getError();
+    return job.getProgress().state;
+}
+
+static void testFlashVerifyReboot()
+{
+    ScriptedPortIO io;
+    io.md5Hex = md5Hex;
+    io.bootNoise = "ets Jun  8 2016 00:22:57\r\nwaiting for download\r\n";
+    auto image = makeImage(2500);
+    std::string error;
+
+    auto state = runJob(io, EspRomFlashJob::FlagVerify | EspRomFlashJob::FlagReboot, image, 921600, &error);
+    CHECK(state == PortJob::StateComplete);
+    CHECK(error.empty());
+    CHECK(io.syncs == 1);
+    CHECK(io.baudChanges.size() == 1 && io.baudChanges[0] == 921600);
+    CHECK(io.getBaudRate() == 115200);
+
+    CHECK(io.beginParams.size() == 20);
+    if (io.beginParams.size() >= 16)
+    {
+        CHECK(getUint32(&io.beginParams[0]) == uncompressedLength);
+        CHECK(getUint32(&io.beginParams[4]) == 3);
+        CHECK(getUint32(&io.beginParams[8]) == EspRomFlashJob::blockSize);
+        CHECK(getUint32(&io.beginParams[12]) == flashOffset);
+    }
+
+    CHECK(io.flashed == image);
+    CHECK(io.checksumErrors == 0);
+    CHECK(io.sequenceErrors == 0);
+    CHECK(io.md5Requested);
+    // into download mode at the start and out of it at the end
+    CHECK(io.resets == 2);
+}
+
+static void testOriginalRomAndSyncRetries()
+{
+    ScriptedPortIO io;
+    io.ignoredSyncs = 6;
+    io.securityInfo = false;
+    auto image = makeImage(EspRomFlashJob::blockSize);
+    std::string error;
+
+    auto state = runJob(io, 0, image, 0, &error);
+    CHECK(state == PortJob::StateComplete);
+    CHECK(io.syncs == 7);
+    // reset again after every 5 unanswered syncs
+    CHECK(io.resets == 2);
+    CHECK(io.baudChanges.empty());
+    // the original ESP32 ROM takes FLASH_DEFL_BEGIN without the encryption field
+    CHECK(io.beginParams.size() == 16);
+    CHECK(io.flashed == image);
+    CHECK(!io.md5Requested);
+}
+
+static void testNoReset()
+{
+    ScriptedPortIO io;
+    auto image = makeImage(100);
+    std::string error;
+
+    auto state = runJob(io, EspRomFlashJob::FlagNoReset, image, 0, &error);
+    CHECK(state == PortJob::StateComplete);
+    CHECK(io.resets == 0);
+    CHECK(io.flashed == image);
+}
+
+static void testMd5Mismatch()
+{
+    ScriptedPortIO io;
+    io.md5Hex = "00000000000000000000000000000000";
+    auto image = makeImage(1500);
+    std::string error;
+
+    auto state = runJob(io, EspRomFlashJob::FlagVerify | EspRomFlashJob::FlagReboot, image, 0, &error);
+    CHECK(state == PortJob::StateFailed);
+    CHECK(error == "MD5 mismatch, the flash does not hold the image");
+    CHECK(io.flashed == image);
+    // a target holding a bad image is not restarted into it
+    CHECK(io.resets == 1);
+}
+
+static void testWriteFailure()
+{
+    ScriptedPortIO io;
+    io.failBlock = 1;
+    auto image = makeImage(2500);
+    std::string error;
+
+    auto state = runJob(io, EspRomFlashJob::FlagVerify, image, 921600, &error);
+    CHECK(state == PortJob::StateFailed);
+    CHECK(error == "write failed at block 1, command 0x11 failed, error 0x08");
+    CHECK(io.flashed.size() == EspRomFlashJob::blockSize);
+    CHECK(!io.md5Requested);
+    CHECK(io.getBaudRate() == 115200);
+}
+
+static void testNoTarget()
+{
+    ScriptedPortIO io;
+    io.ignoredSyncs = -1;
+    auto image = makeImage(100);
+    std::string error;
+
+    auto state = runJob(io, 0, image, 0, &error);
+    CHECK(state == PortJob::StateFailed);
+    CHECK(error == "no response to sync, check the boot and reset wiring");
+    CHECK(io.syncs == 10);
+    CHECK(io.flashed.empty());
+}
+
+int main()
+{
+    testFlashVerifyReboot();
+    testOriginalRomAndSyncRetries();
+    testNoReset();
+    testMd5Mismatch();
+    testWriteFailure();
+    testNoTarget();
+
+    if (failures > 0)
+    {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
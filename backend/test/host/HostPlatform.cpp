@@ -0,0 +1,77 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "HostPlatform.h"
+#include "Port.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+static int64_t hostTimeUs = 0;
+
+void hostAdvanceUs(int64_t us)
+{
+    hostTimeUs += us;
+}
+
+int64_t esp_timer_get_time()
+{
+    return hostTimeUs;
+}
+
+TickType_t xTaskGetTickCount()
+{
+    return hostTimeUs / 1000 / portTICK_PERIOD_MS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    hostAdvanceUs((int64_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+    return new bool(false);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    auto given = (bool *)semaphore;
+    if (*given)
+    {
+        *given = false;
+        return pdTRUE;
+    }
+
+    // nothing else runs to give it, so the whole timeout passes
+    vTaskDelay(ticks);
+    return pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    *(bool *)semaphore = true;
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    delete (bool *)semaphore;
+}
+
+void Port::notifyConsumer()
+{
+}
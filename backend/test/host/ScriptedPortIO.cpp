@@ -0,0 +1,293 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "ScriptedPortIO.h"
+#include "HostPlatform.h"
+#include <string.h>
+
+static const uint8_t SLIPEnd = 0xC0;
+static const uint8_t SLIPEsc = 0xDB;
+static const uint8_t SLIPEscEnd = 0xDC;
+static const uint8_t SLIPEscEsc = 0xDD;
+
+static const uint8_t CommandFlashDeflBegin = 0x10;
+static const uint8_t CommandFlashDeflData = 0x11;
+static const uint8_t CommandSync = 0x08;
+static const uint8_t CommandSpiAttach = 0x0D;
+static const uint8_t CommandChangeBaudRate = 0x0F;
+static const uint8_t CommandSpiFlashMD5 = 0x13;
+static const uint8_t CommandGetSecurityInfo = 0x14;
+
+// ROM loader error codes
+static const uint8_t ErrorInvalidMessage = 0x05;
+static const uint8_t ErrorFlashWrite = 0x08;
+
+static uint32_t getUint32(const uint8_t *src)
+{
+    return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+ScriptedPortIO::ScriptedPortIO() : ignoredSyncs(0), securityInfo(true), failBlock(-1), syncs(0), resets(0), checksumErrors(0), sequenceErrors(0), md5Requested(false), baudRate(115200), rts(false), inPacket(false), escaped(false), nextSequence(0)
+{
+}
+
+bool ScriptedPortIO::write(const uint8_t *data, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        auto value = data[i];
+        if (value == SLIPEnd)
+        {
+            if (inPacket && !packet.empty())
+            {
+                handle(packet);
+                inPacket = false;
+            }
+            else
+            {
+                inPacket = true;
+            }
+            packet.clear();
+            continue;
+        }
+
+        if (!inPacket)
+        {
+            continue;
+        }
+
+        if (escaped)
+        {
+            escaped = false;
+            packet.push_back(value == SLIPEscEnd ? SLIPEnd : SLIPEsc);
+        }
+        else if (value == SLIPEsc)
+        {
+            escaped = true;
+        }
+        else
+        {
+            packet.push_back(value);
+        }
+    }
+
+    return true;
+}
+
+void ScriptedPortIO::handle(const std::vector<uint8_t> &request)
+{
+    if (request.size() < 8 || request[0] != 0x00)
+    {
+        return;
+    }
+
+    auto command = request[1];
+    uint32_t length = request[2] | (request[3] << 8);
+    auto checksum = getUint32(&request[4]);
+    auto data = request.data() + 8;
+    if (request.size() != 8 + length)
+    {
+        return;
+    }
+
+    uint8_t reply[32];
+    switch (command)
+    {
+    case CommandSync:
+        syncs++;
+        if (ignoredSyncs < 0 || syncs <= ignoredSyncs)
+        {
+            return;
+        }
+        rx.insert(rx.end(), bootNoise.begin(), bootNoise.end());
+        bootNoise.clear();
+        // the ROM answers every sync more than once
+        respond(command, nullptr, 0);
+        respond(command, nullptr, 0);
+        break;
+    case CommandGetSecurityInfo:
+        if (!securityInfo)
+        {
+            respond(command, nullptr, 0, ErrorInvalidMessage);
+            break;
+        }
+        memset(reply, 0, 12);
+        respond(command, reply, 12);
+        break;
+    case CommandSpiAttach:
+        respond(command, nullptr, 0);
+        break;
+    case CommandChangeBaudRate:
+        // the reply still goes out at the old rate
+        baudChanges.push_back(getUint32(data));
+        respond(command, nullptr, 0);
+        break;
+    case CommandFlashDeflBegin:
+        beginParams.assign(data, data + length);
+        nextSequence = 0;
+        respond(command, nullptr, 0);
+        break;
+    case CommandFlashDeflData:
+    {
+        auto size = getUint32(data);
+        auto sequence = (int)getUint32(data + 4);
+        uint32_t sum = 0xEF;
+        for (uint32_t i = 0; i < size; i++)
+        {
+            sum ^= data[16 + i];
+        }
+        if (sum != checksum || size != length - 16)
+        {
+            checksumErrors++;
+        }
+        if (sequence != nextSequence)
+        {
+            sequenceErrors++;
+        }
+        nextSequence = sequence + 1;
+
+        if (sequence == failBlock)
+        {
+            respond(command, nullptr, 0, ErrorFlashWrite);
+            break;
+        }
+        flashed.insert(flashed.end(), data + 16, data + 16 + size);
+        respond(command, nullptr, 0);
+        break;
+    }
+    case CommandSpiFlashMD5:
+        md5Requested = true;
+        respond(command, (const uint8_t *)md5Hex.data(), md5Hex.size());
+        break;
+    default:
+        respond(command, nullptr, 0, ErrorInvalidMessage);
+        break;
+    }
+}
+
+void ScriptedPortIO::respond(uint8_t command, const uint8_t *data, uint32_t length, uint8_t error)
+{
+    uint32_t size = length + 4;
+    uint8_t header[8] = {0x01, command, (uint8_t)(size & 0xFF), (uint8_t)(size >> 8)};
+    uint8_t status[4] = {(uint8_t)(error != 0), error};
+
+    rx.push_back(SLIPEnd);
+    for (auto value : header)
+    {
+        sendEscaped(value);
+    }
+    for (uint32_t i = 0; i < length; i++)
+    {
+        sendEscaped(data[i]);
+    }
+    for (auto value : status)
+    {
+        sendEscaped(value);
+    }
+    rx.push_back(SLIPEnd);
+}
+
+void ScriptedPortIO::sendEscaped(uint8_t value)
+{
+    if (value == SLIPEnd)
+    {
+        rx.push_back(SLIPEsc);
+        rx.push_back(SLIPEscEnd);
+    }
+    else if (value == SLIPEsc)
+    {
+        rx.push_back(SLIPEsc);
+        rx.push_back(SLIPEscEsc);
+    }
+    else
+    {
+        rx.push_back(value);
+    }
+}
+
+bool ScriptedPortIO::waitWriteDone(uint32_t timeoutMs)
+{
+    return true;
+}
+
+int ScriptedPortIO::read(uint8_t *dst, uint32_t length, uint32_t timeoutMs)
+{
+    if (rx.empty())
+    {
+        hostAdvanceUs((int64_t)timeoutMs * 1000);
+        return 0;
+    }
+
+    uint32_t count = 0;
+    while (count < length && !rx.empty())
+    {
+        dst[count++] = rx.front();
+        rx.pop_front();
+    }
+    return count;
+}
+
+void ScriptedPortIO::flushInput()
+{
+    rx.clear();
+}
+
+bool ScriptedPortIO::setBaudRate(uint32_t value)
+{
+    baudRate = value;
+    return true;
+}
+
+uint32_t ScriptedPortIO::getBaudRate()
+{
+    return baudRate;
+}
+
+bool ScriptedPortIO::setDTR(bool active)
+{
+    return true;
+}
+
+bool ScriptedPortIO::setRTS(bool active)
+{
+    // RTS drives EN, releasing it restarts the target
+    if (rts && !active)
+    {
+        resets++;
+    }
+    rts = active;
+    return true;
+}
+
+void ScriptedPortIO::delay(uint32_t ms)
+{
+    hostAdvanceUs((int64_t)ms * 1000);
+}
+
+void ScriptedPortIO::delayMicros(uint32_t us)
+{
+    hostAdvanceUs(us);
+}
+
+bool ScriptedPortIO::measurePulses(uint32_t minEdges, uint32_t timeoutMs, PulseTiming *out)
+{
+    return false;
+}
+
+uint32_t ScriptedPortIO::takeLineErrors()
+{
+    return 0;
+}
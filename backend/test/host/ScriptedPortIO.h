@@ -0,0 +1,80 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SCRIPTED_PORT_IO_H
+#define SCRIPTED_PORT_IO_H
+#include "PortIO.h"
+#include <deque>
+#include <string>
+#include <vector>
+
+// stands in for an ESP32 ROM loader on the far end of the line
+// the SLIP requests a job writes are decoded and answered as the ROM would, time only passes on the virtual clock
+class ScriptedPortIO : public PortIO
+{
+public:
+    ScriptedPortIO();
+
+    // the script, set before the job runs
+    // sync requests left unanswered before the ROM replies, -1 for a target that never answers
+    int ignoredSyncs;
+    // GET_SECURITY_INFO is answered, otherwise it fails as it does on the original ESP32 ROM
+    bool securityInfo;
+    // FLASH_DEFL_DATA sequence number that fails, -1 for none
+    int failBlock;
+    // the digest SPI_FLASH_MD5 sends back, as hex text
+    std::string md5Hex;
+    // text the target prints when it boots, sent before the first sync reply
+    std::string bootNoise;
+
+    // what the ROM saw
+    int syncs;
+    int resets;
+    int checksumErrors;
+    int sequenceErrors;
+    std::vector<uint32_t> baudChanges;
+    std::vector<uint8_t> beginParams;
+    std::vector<uint8_t> flashed;
+    bool md5Requested;
+
+    bool write(const uint8_t *data, uint32_t length) override;
+    bool waitWriteDone(uint32_t timeoutMs) override;
+    int read(uint8_t *dst, uint32_t length, uint32_t timeoutMs) override;
+    void flushInput() override;
+    bool setBaudRate(uint32_t baudRate) override;
+    uint32_t getBaudRate() override;
+    bool setDTR(bool active) override;
+    bool setRTS(bool active) override;
+    void delay(uint32_t ms) override;
+    void delayMicros(uint32_t us) override;
+    bool measurePulses(uint32_t minEdges, uint32_t timeoutMs, PulseTiming *out) override;
+    uint32_t takeLineErrors() override;
+
+private:
+    uint32_t baudRate;
+    bool rts;
+    // one decoded request, filled as the SLIP bytes arrive
+    std::vector<uint8_t> packet;
+    bool inPacket;
+    bool escaped;
+    int nextSequence;
+    std::deque<uint8_t> rx;
+
+    void handle(const std::vector<uint8_t> &request);
+    void respond(uint8_t command, const uint8_t *data, uint32_t length, uint8_t error = 0);
+    void sendEscaped(uint8_t value);
+};
+#endif
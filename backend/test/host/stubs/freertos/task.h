@@ -0,0 +1,32 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef HOST_TASK_H
+#define HOST_TASK_H
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+TickType_t xTaskGetTickCount();
+void vTaskDelay(TickType_t ticks);
+#ifdef __cplusplus
+}
+#endif
+#endif
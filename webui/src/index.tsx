@@ -18,7 +18,7 @@ import { Component, render } from 'preact';
 import { Tab, TabContainer } from './tab'
 
 import { PortTab } from './tabs/portTab';
-import { SerialClient } from './lib/serialClient';
+import { SerialClient, LineEvent, TimedData } from './lib/serialClient';
 import './style.css';
 import UploadTab from './tabs/uploadTab';
 import TermTab from './tabs/termTab';
@@ -51,6 +51,8 @@ export class App extends Component<{}, AppState> {
 	#builtInTabs: any
 	#tabs: TabDef[] = [];
 	#tabASyncDataCallback: ((buffer: ArrayBuffer) => void)[] = {};
+	#tabLineEventCallback: { [tabName: string]: (event: LineEvent) => void } = {};
+	#tabTimedDataCallback: { [tabName: string]: (data: TimedData) => void } = {};
 
 	#postStatusUpdate(type: string, message: string) {
 		switch (type) {
@@ -76,7 +78,7 @@ export class App extends Component<{}, AppState> {
 			aSyncData: false
 		});
 		tabs.push({
-			tab: <TermTab auth={auth} dataUpdateFunc={(f) => this.#setAsyncDataHandler("Terminal", f)} postStatusUpdate={this.#postStatusUpdate.bind(this)} serialClient={this.state.serialClient} />,
+			tab: <TermTab auth={auth} dataUpdateFunc={(f) => this.#setAsyncDataHandler("Terminal", f)} lineEventFunc={(f) => this.#tabLineEventCallback["Terminal"] = f} postStatusUpdate={this.#postStatusUpdate.bind(this)} serialClient={this.state.serialClient} />,
 			title: "Terminal",
 			aSyncData: true
 		});
@@ -86,7 +88,7 @@ export class App extends Component<{}, AppState> {
 			aSyncData: false
 		});
 		tabs.push({
-			tab: <DisplayTab auth={auth} dataUpdateFunc={(f) => this.#setAsyncDataHandler("Display", f)} postStatusUpdate={this.#postStatusUpdate.bind(this)} serialClient={this.state.serialClient} />,
+			tab: <DisplayTab auth={auth} dataUpdateFunc={(f) => this.#setAsyncDataHandler("Display", f)} timedDataFunc={(f) => this.#tabTimedDataCallback["Display"] = f} postStatusUpdate={this.#postStatusUpdate.bind(this)} serialClient={this.state.serialClient} />,
 			title: "Display",
 			aSyncData: true
 		});
@@ -127,6 +129,8 @@ export class App extends Component<{}, AppState> {
 		client.onConnected(() => {
 			this.setState({ serverStatus: "Connected" });
 			client.onAsyncData(this.#onAsyncData.bind(this));
+			client.onLineEvent(this.#onLineEvent.bind(this));
+			client.onAsyncTimedData(this.#onAsyncTimedData.bind(this));
 		})
 
 		client.onSocketClose = (message) => {
@@ -176,6 +180,20 @@ export class App extends Component<{}, AppState> {
 		}
 	}
 
+	#onLineEvent(event: LineEvent) {
+		const lineEventCallback = this.#tabLineEventCallback[this.state.tabs[this.state.activeTabIndex].title];
+		if (lineEventCallback != undefined) {
+			lineEventCallback(event);
+		}
+	}
+
+	#onAsyncTimedData(data: TimedData) {
+		const timedDataCallback = this.#tabTimedDataCallback[this.state.tabs[this.state.activeTabIndex].title];
+		if (timedDataCallback != undefined) {
+			timedDataCallback(data);
+		}
+	}
+
 	#onTabChange(index: number) {
 		const { tabs } = this.state;
 
@@ -66,7 +66,7 @@ export default class SerialAPICompatibly {
             },
             write(chunk) {
                 return new Promise((resolve, reject) => {
-                        sc.write(chunk).then(()=> resolve())
+                        sc.writeAndWait(chunk).then(()=> resolve())
                         .catch(reason => reject(reason));
                 });
             }
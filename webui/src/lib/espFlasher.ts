@@ -0,0 +1,133 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+import { SerialClient, JobProgress, JobTypeEspRomFlash } from './serialClient.js'
+
+export interface EspFlashOptions {
+    // flash address to write the image to
+    offset: number
+    // baud rate to switch to while flashing, 0 to stay at the current rate
+    baudRate: number
+    verify: boolean
+    reboot: boolean
+    // the target is already in download mode
+    noReset: boolean
+}
+
+const md5Shifts = [7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21];
+const md5Constants = Array.from({ length: 64 }, (_, i) => Math.floor(Math.abs(Math.sin(i + 1)) * 0x100000000) | 0);
+
+/**
+ * MD5 of the data, WebCrypto does not provide it and the ROM loader only reports MD5
+ */
+export function md5(data: Uint8Array): Uint8Array {
+    const paddedLength = (((data.length + 8) >> 6) + 1) << 6;
+    const buffer = new Uint8Array(paddedLength);
+    buffer.set(data);
+    buffer[data.length] = 0x80;
+    const dv = new DataView(buffer.buffer);
+    dv.setUint32(paddedLength - 8, (data.length * 8) >>> 0, true);
+    dv.setUint32(paddedLength - 4, Math.floor(data.length / 0x20000000), true);
+
+    let a0 = 0x67452301, b0 = 0xefcdab89 | 0, c0 = 0x98badcfe | 0, d0 = 0x10325476;
+    for (let offset = 0; offset < paddedLength; offset += 64) {
+        let a = a0, b = b0, c = c0, d = d0;
+        for (let i = 0; i < 64; i++) {
+            let f: number, g: number;
+            if (i < 16) {
+                f = (b & c) | (~b & d);
+                g = i;
+            } else if (i < 32) {
+                f = (d & b) | (~d & c);
+                g = (5 * i + 1) % 16;
+            } else if (i < 48) {
+                f = b ^ c ^ d;
+                g = (3 * i + 5) % 16;
+            } else {
+                f = c ^ (b | ~d);
+                g = (7 * i) % 16;
+            }
+            const shift = md5Shifts[(i >> 4) * 4 + (i % 4)];
+            const sum = (a + f + md5Constants[i] + dv.getUint32(offset + g * 4, true)) | 0;
+            a = d;
+            d = c;
+            c = b;
+            b = (b + ((sum << shift) | (sum >>> (32 - shift)))) | 0;
+        }
+        a0 = (a0 + a) | 0;
+        b0 = (b0 + b) | 0;
+        c0 = (c0 + c) | 0;
+        d0 = (d0 + d) | 0;
+    }
+
+    const digest = new Uint8Array(16);
+    const digestView = new DataView(digest.buffer);
+    [a0, b0, c0, d0].forEach((value, index) => digestView.setUint32(index * 4, value, true));
+    return digest;
+}
+
+/**
+ * zlib compresses the data, the format the ROM loader inflates
+ */
+async function deflate(data: Uint8Array): Promise<Uint8Array> {
+    const stream = new Blob([data]).stream().pipeThrough(new CompressionStream("deflate"));
+    return new Uint8Array(await new Response(stream).arrayBuffer());
+}
+
+/**
+ * flashes an ESP32 family target using the ROM loader job on the device
+ * the image is compressed here and sent once, the device handles reset, sync and every loader command
+ */
+export class EspFlasher {
+    static StageNames = ["reset", "sync", "baud rate change", "erase", "write", "verify", "reboot"];
+
+    #FlagNoReset = 1;
+    #FlagVerify = 2;
+    #FlagReboot = 4;
+
+    #client: SerialClient
+
+    constructor(client: SerialClient) {
+        this.#client = client;
+    }
+
+    /**
+     * writes a raw binary image
+     * @param buffer the image, for example an app .bin from the build
+     * @param progressCallback called with the current step and percent complete, return true to cancel
+     */
+    async flash(buffer: ArrayBuffer, options: EspFlashOptions, progressCallback: (stage: string, percent: number) => boolean) {
+        const image = new Uint8Array(buffer);
+        const compressed = await deflate(image);
+
+        // [u32 uncompressed size][u8 md5[16]][u32 baud rate]
+        const params = new Uint8Array(24);
+        const dv = new DataView(params.buffer);
+        dv.setUint32(0, image.length, true);
+        params.set(md5(image), 4);
+        dv.setUint32(20, options.baudRate, true);
+
+        let flags = 0;
+        flags |= options.noReset ? this.#FlagNoReset : 0;
+        flags |= options.verify ? this.#FlagVerify : 0;
+        flags |= options.reboot ? this.#FlagReboot : 0;
+
+        return this.#client.runJob(JobTypeEspRomFlash, flags, options.offset, compressed.length, compressed, (progress: JobProgress) => {
+            const percent = progress.Total > 0 ? (progress.Processed * 100) / progress.Total : 0;
+            return progressCallback(EspFlasher.StageNames[progress.Stage] ?? "", percent);
+        }, params);
+    }
+}
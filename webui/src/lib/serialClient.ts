@@ -20,12 +20,465 @@ export const SerialModeEvenParity = 2
 export const SerialModeMarkParity = 3
 export const SerialModeSpaceParity = 4
 
+export const PortProfileDefault = 0
+export const PortProfileInteractive = 1
+export const PortProfileBulk = 2
+
+// the device holds off the target when it or this client falls behind
+export const FlowControlNone = 0
+export const FlowControlRtsCts = 1
+export const FlowControlXonXoff = 2
+
+// SerialMode stream flags
+const StreamFlagTimestamps = 1
+
+export const FrameModeNone = 0
+export const FrameModeDelimiter = 1
+export const FrameModeSLIP = 2
+export const FrameModeCOBS = 3
+export const FrameModeLengthPrefixed = 4
+export const FrameModeIdleGap = 5
+
+export const FrameCRCNone = 0
+export const FrameCRC8 = 1
+export const FrameCRC16CCITT = 2
+export const FrameCRC16Modbus = 3
+export const FrameCRC32 = 4
+
+// where in the async data the device saw a line error, break or lost data
+export const LineEventParityError = 0
+export const LineEventFrameError = 1
+export const LineEventBreak = 2
+export const LineEventFifoOverflow = 3
+// RS-485, what was sent did not match the bus, data received at the time is lost
+export const LineEventCollision = 4
+
+export interface LineEvent {
+    Event: number
+    // the device's running count of received bytes at the event, wraps at 32 bits
+    // with mark / space parity below 8 data bits it is exact, otherwise the error is within the bytes just before it
+    Offset: number
+}
+
+export interface PortStats {
+    RxBufferSize: number
+    RxBufferHighWaterMark: number
+    RxOverflowBytes: number
+    RxOverflowCount: number
+    FifoOverflowCount: number
+    DriverBufferFullCount: number
+    BreakCount: number
+    ParityErrorCount: number
+    FrameErrorCount: number
+    FramesDecoded: number
+    BadFrameCount: number
+    // bridged data dropped because this port's tx buffer was full
+    BridgeDroppedBytes: number
+    Rs485CollisionCount: number
+}
+
+// BridgeRule.Direction
+export const BridgeToPeer = 0
+export const BridgeFromPeer = 1
+
+// replaces Match with Replace in one direction of a bridge, on the device
+export interface BridgeRule {
+    Direction: number
+    // up to 16 bytes
+    Match: string | Uint8Array
+    // up to 16 bytes, empty drops the match
+    Replace: string | Uint8Array
+}
+
+export const JobTypeStm32Bootloader = 0
+export const JobTypeEspRomFlash = 1
+export const JobTypeModemSequence = 2
+export const JobTypeAutoBaud = 3
+export const JobTypeScript = 4
+export const JobTypeReplay = 5
+
+// InitialStatusBits, the modem lines to assert
+export const ModemLineDTR = 1
+export const ModemLineRTS = 2
+
+export const JobStateQueued = 0
+export const JobStateRunning = 1
+export const JobStateComplete = 2
+export const JobStateFailed = 3
+export const JobStateCancelled = 4
+
+export interface JobProgress {
+    State: number
+    // job specific step
+    Stage: number
+    Processed: number
+    Total: number
+    // job input bytes the device has taken so far
+    InputConsumed: number
+    // set when State is JobStateFailed
+    Error?: string
+    // job specific result, set when State is JobStateComplete
+    Result?: DataView
+}
+
+export interface AutoBaudResult {
+    // the rate the shortest pulse on RX works out to
+    MeasuredBaudRate: number
+    // the standard rate the port was switched to, 0 when only measuring
+    BaudRate: number
+    // bit times in 1/16 UART clock cycles, measured on the line and given by the UART's divisor
+    MeasuredBitTime: number
+    AchievedBitTime: number
+    Edges: number
+    // line errors seen while listening at the chosen rate
+    Errors: number
+}
+
+// TriggerConfig.Triggers flags
+export const TriggerPattern = 1
+// parity, framing or FIFO overflow error
+export const TriggerLineError = 2
+export const TriggerBreak = 4
+
+// TriggerEntry.Flags
+export const TriggerEntryTx = 1
+// Value is a LineEvent
+export const TriggerEntryLineEvent = 2
+
+export interface TriggerConfig {
+    Triggers: number
+    // entries kept from before the trigger, the one that fired is the last of them
+    PreEntries: number
+    PostEntries: number
+    // up to 16 bytes matched in the received data
+    Pattern?: Uint8Array
+}
+
+export interface TriggerEntry {
+    Flags: number
+    Value: number
+}
+
+export interface TriggerCapture {
+    // the Trigger flag that fired
+    Trigger: number
+    // microseconds of the device clock
+    Time: number
+    PreCount: number
+    PostCount: number
+    // oldest first, PreCount entries then PostCount
+    Entries: TriggerEntry[]
+}
+
+export interface PatternHit {
+    // index in the list given to watchPatterns()
+    Pattern: number
+    // the device's running count of received bytes just after the match, wraps at 32 bits
+    Offset: number
+    // microseconds of the device clock
+    Time: number
+    // the received bytes up to and including the match
+    Context: Uint8Array
+}
+
+export interface ReplayDivergence {
+    // position in the received data
+    Offset: number
+    Expected: number
+    Received: number
+}
+
+export interface ReplayResult {
+    TxBytes: number
+    RxExpected: number
+    RxReceived: number
+    // expected bytes that differed or never came
+    Mismatches: number
+    // furthest behind its recorded time a send went out, in microseconds
+    MaxLateUs: number
+    // the first 16 mismatches
+    Divergences: ReplayDivergence[]
+}
+
+export interface FramingMode {
+    Mode: number
+    CRC?: number
+    // delimiter byte, length field format (bit 0 two bytes, bit 1 big endian) or idle gap in symbols
+    Param?: number
+    MaxFrameSize?: number
+}
+
+/**
+ * builds a modem line script for SerialClient.runModemSequence()
+ * the device runs it on its port task so the edges are timed to the microsecond
+ */
+export class ModemSequence {
+    #OpSetLines = 0
+    #OpDelay = 1
+    #OpSetBaudRate = 2
+    #OpWrite = 3
+    #OpFlushInput = 4
+    #steps = new Array<Uint8Array>();
+
+    #step(op: number, arg: number, data?: Uint8Array) {
+        const step = new Uint8Array(5 + (data?.length ?? 0));
+        const dv = new DataView(step.buffer);
+        dv.setUint8(0, op);
+        dv.setUint32(1, arg, true);
+        if (data !== undefined) {
+            step.set(data, 5);
+        }
+        this.#steps.push(step);
+        return this;
+    }
+
+    /**
+     * changes the lines given, true asserts (drives low), undefined leaves the line as it is
+     */
+    setLines(dtr?: boolean, rts?: boolean) {
+        let arg = 0;
+        if (dtr !== undefined) {
+            arg |= 4 | (dtr ? 1 : 0);
+        }
+        if (rts !== undefined) {
+            arg |= 8 | (rts ? 2 : 0);
+        }
+        return this.#step(this.#OpSetLines, arg);
+    }
+
+    delayMicros(us: number) {
+        return this.#step(this.#OpDelay, us);
+    }
+
+    setBaudRate(baudRate: number) {
+        return this.#step(this.#OpSetBaudRate, baudRate);
+    }
+
+    /**
+     * sends the bytes and waits for them to go out, a sync byte for example
+     */
+    write(data: Uint8Array | Array<number>) {
+        const bytes = new Uint8Array(data);
+        return this.#step(this.#OpWrite, bytes.length, bytes);
+    }
+
+    flushInput() {
+        return this.#step(this.#OpFlushInput, 0);
+    }
+
+    build() {
+        const script = new Uint8Array(this.#steps.reduce((size, step) => size + step.length, 0));
+        let offset = 0;
+        this.#steps.forEach(step => {
+            script.set(step, offset);
+            offset += step.length;
+        });
+        return script;
+    }
+}
+
+export interface ScriptResult {
+    // steps run, each pass of a loop counts again
+    StepsRun: number
+    // received bytes that did not fit in Received
+    Dropped: number
+    // what the expect steps read, up to 1KB
+    Received: Uint8Array
+}
+
+/**
+ * builds a send / expect script for SerialClient.runScript()
+ * the device runs the whole script on its port task, jump targets are step numbers as returned by the methods' step count
+ */
+export class Script {
+    #OpWrite = 0
+    #OpExpect = 1
+    #OpDelay = 2
+    #OpLoop = 3
+    #OpEndLoop = 4
+    #OpWritePeriodic = 5
+    #OpSetLines = 6
+    #OpSetBaudRate = 7
+    #OpFlushInput = 8
+    #OpJump = 9
+    #steps = new Array<Uint8Array>();
+
+    static JumpAlways = 0
+    // the last expect received its pattern
+    static JumpIfMatched = 1
+    static JumpIfTimedOut = 2
+
+    #step(op: number, argsSize: number, fill?: (dv: DataView) => void, data?: Uint8Array) {
+        const step = new Uint8Array(1 + argsSize + (data?.length ?? 0));
+        const dv = new DataView(step.buffer);
+        dv.setUint8(0, op);
+        fill?.(dv);
+        if (data !== undefined) {
+            step.set(data, 1 + argsSize);
+        }
+        this.#steps.push(step);
+        return this;
+    }
+
+    static #bytes(data: string | Uint8Array | Array<number>) {
+        return typeof (data) == "string" ? new TextEncoder().encode(data) : new Uint8Array(data);
+    }
+
+    /**
+     * the number the next step will have, for jumps
+     */
+    get stepCount() {
+        return this.#steps.length;
+    }
+
+    /**
+     * sends the bytes and waits for them to go out
+     */
+    write(data: string | Uint8Array | Array<number>) {
+        const bytes = Script.#bytes(data);
+        return this.#step(this.#OpWrite, 2, dv => dv.setUint16(1, bytes.length, true), bytes);
+    }
+
+    /**
+     * reads until the pattern (up to 32 bytes) is received, the script fails on a timeout unless optional is set
+     * with an empty pattern it reads for the whole timeout
+     */
+    expect(pattern: string | Uint8Array | Array<number>, timeoutMs: number, optional = false) {
+        const bytes = Script.#bytes(pattern);
+        return this.#step(this.#OpExpect, 4, dv => {
+            dv.setUint16(1, timeoutMs, true);
+            dv.setUint8(3, optional ? 1 : 0);
+            dv.setUint8(4, bytes.length);
+        }, bytes);
+    }
+
+    delayMicros(us: number) {
+        return this.#step(this.#OpDelay, 4, dv => dv.setUint32(1, us, true));
+    }
+
+    /**
+     * runs the steps up to the matching endLoop() count times, up to 4 deep
+     */
+    loop(count: number) {
+        return this.#step(this.#OpLoop, 2, dv => dv.setUint16(1, count, true));
+    }
+
+    endLoop() {
+        return this.#step(this.#OpEndLoop, 0);
+    }
+
+    /**
+     * sends the bytes count times, each periodUs after the first rather than after the previous
+     */
+    writePeriodic(data: string | Uint8Array | Array<number>, periodUs: number, count: number) {
+        const bytes = Script.#bytes(data);
+        return this.#step(this.#OpWritePeriodic, 8, dv => {
+            dv.setUint32(1, periodUs, true);
+            dv.setUint16(5, count, true);
+            dv.setUint16(7, bytes.length, true);
+        }, bytes);
+    }
+
+    /**
+     * changes the lines given, true asserts (drives low), undefined leaves the line as it is
+     */
+    setLines(dtr?: boolean, rts?: boolean) {
+        let lines = 0;
+        if (dtr !== undefined) {
+            lines |= 4 | (dtr ? 1 : 0);
+        }
+        if (rts !== undefined) {
+            lines |= 8 | (rts ? 2 : 0);
+        }
+        return this.#step(this.#OpSetLines, 1, dv => dv.setUint8(1, lines));
+    }
+
+    setBaudRate(baudRate: number) {
+        return this.#step(this.#OpSetBaudRate, 4, dv => dv.setUint32(1, baudRate, true));
+    }
+
+    flushInput() {
+        return this.#step(this.#OpFlushInput, 0);
+    }
+
+    /**
+     * continues at the step number, which has to be inside the same loop as the jump
+     */
+    jump(step: number, condition = Script.JumpAlways) {
+        return this.#step(this.#OpJump, 3, dv => {
+            dv.setUint8(1, condition);
+            dv.setUint16(2, step, true);
+        });
+    }
+
+    build() {
+        const script = new Uint8Array(this.#steps.reduce((size, step) => size + step.length, 0));
+        let offset = 0;
+        this.#steps.forEach(step => {
+            script.set(step, offset);
+            offset += step.length;
+        });
+        return script;
+    }
+}
+
 export interface SerialMode {
     BaudRate: number
     DataBits: number
     Parity: number,
     StopBits: number,//1 stop bit
     InitialStatusBits: number
+    Profile?: number
+    Framing?: FramingMode
+    FlowControl?: number
+    // send the received data with device timestamps, see onAsyncTimedData(), ignored while framing is on
+    Timestamps?: boolean
+    TxPacing?: TxPacing
+    Rs485?: Rs485Mode
+}
+
+// Rs485Mode.Mode, which pin the transceiver's DE and /RE are wired to
+export const Rs485Off = 0
+export const Rs485DeOnRts = 1
+export const Rs485DeOnDtr = 2
+
+// half duplex RS-485, the device drives DE as it sends so a poll and its answer need no round trip to the browser
+export interface Rs485Mode {
+    Mode: number
+    // idle time after the last byte from another node before the port sends, up to 1000000
+    TurnaroundUs?: number
+}
+
+// spaces out written data on the device, for targets that drop bytes sent back to back
+export interface TxPacing {
+    // idle time after each byte, up to 1000000
+    ByteGapUs?: number
+    // idle time after each line ending (\r, \n or \r\n) in place of the byte gap, up to 10000
+    LineGapMs?: number
+    // after each byte wait up to this long for the target to echo a byte back, up to 10000
+    EchoTimeoutMs?: number
+}
+
+export interface TimedData {
+    // when the first byte started arriving, microseconds of the device clock
+    Start: number
+    // how long the bytes took on the line, so Start + Duration is when the last one finished
+    Duration: number
+    Data: ArrayBuffer
+}
+
+// SniffRecord.Source
+export const SniffSourcePort = 0
+export const SniffSourcePeer = 1
+
+// one entry of the merged sniff timeline, exactly one of the optional fields is set
+export interface SniffRecord {
+    // which side of the link it was received on, SniffSourcePort is the client sniff() was called on
+    Source: number
+    Timed?: TimedData
+    LineEvent?: LineEvent
+    Frame?: ArrayBuffer
+    LostBytes?: number
 }
 
 interface ResponseCallback {
@@ -34,30 +487,54 @@ interface ResponseCallback {
 }
 
 type AsyncResponse = (response: ArrayBuffer) => void
+
+interface WriteCompleteWaiter {
+    offset: number
+    resolve: () => void
+}
+
+// the status of a response, sent in place of the v1 error text frames
+export const ErrorCodeNone = 0
+export const ErrorCodeDecode = 1
+export const ErrorCodeAuthRequired = 2
+export const ErrorCodeAuthFailed = 3
+export const ErrorCodePortClosed = 4
+export const ErrorCodeNotPermitted = 5
+export const ErrorCodeBusy = 6
+export const ErrorCodePortInUse = 7
+export const ErrorCodeNotFound = 8
+export const ErrorCodeFailed = 9
+export const ErrorCodeBufferFull = 10
+export const ErrorCodeUnknownMessage = 11
+export const ErrorCodeTimeout = 12
+export const ErrorCodeInvalidChannel = 13
+
+// ports one socket can have open at once
+export const MaxChannels = 4
+
+const CreditModeAdd = 0
+const CreditModeSet = 1
+const CreditModeOff = 2
+
 /**
- * client interface to the serial server
- * uses a websocket
+ * the websocket shared by the clients of each channel
+ * sends protocol v2 requests and matches the responses by request id so any number can be outstanding
  */
-export class SerialClient {
+export class SerialConnection {
     #CmdAuthenticate = 0
-    #CmdOpen = 1
-    #CmdClose = 2
-    #CmdSetMode = 3
-    #CmdGetMode = 4
-    #CmdReadData = 5
-    #CmdStartAsyncDataRead = 6
-    #CmdAsyncData = 7
-    #CmdStopAsyncDataRead = 8
-    #CmdWriteData = 9
-    #CmdGetPortList = 10
-    #headerSize = 3
-    #RequestProtocolVersion = 1
+    #RequestProtocolVersion = 2
+    // [u8 messageType][u8 version][u16 requestId][u8 channel]
+    #requestHeaderSize = 5
+    // [u8 messageType][u8 status][u16 requestId][u8 channel]
+    #responseHeaderSize = 5
 
     #websocket: WebSocket
-    #responseQueue = new Array<ResponseCallback>();
+    #pending = new Map<number, ResponseCallback>();
+    #nextRequestId = 1
+    #channels = new Map<number, SerialClient>();
     #readyEvents = []
-    #asyncNewDataEvent = new Array<AsyncResponse>();
     #authToken
+
     constructor(address: string, authToken: string) {
         this.#websocket = new WebSocket(address);
         this.#websocket.onopen = this.#onOpen.bind(this);
@@ -67,98 +544,390 @@ export class SerialClient {
         this.#authToken = authToken;
     }
 
-    onSocketError: (message: string) => void = null;
-    onSocketClose: (reason: string) => void = null;
-
-    #onError(event: ErrorEvent) {
-        if (this.onSocketError != null) {
-            this.onSocketError(event.message);
+    /**
+     * @internal routes the unsolicited messages for the channel to the client
+     */
+    addChannel(channel: number, client: SerialClient) {
+        if (channel < 0 || channel >= MaxChannels || this.#channels.has(channel)) {
+            throw "channel " + channel + " not available";
         }
+        this.#channels.set(channel, client);
     }
 
-    #onClose(event: CloseEvent) {
-        if (this.onSocketClose != null) {
-            this.onSocketClose(event.reason);
-        }
+    /**
+     * called once the socket is connected and authenticated
+     */
+    onConnected(f) {
+        this.#connection.onConnected(f);
     }
 
-    #onData(event: MessageEvent<any>) {
-
-        if (typeof (event.data) == "string") {
-            const next = this.#responseQueue.shift()
-            if (next === undefined) {
-                console.log("data unexpected", event);
-                return;
-            }
-            next.onError(event.data)
-        } else {
-            event.data.arrayBuffer().then(buff => {
-                const dv = new DataView(buff)
-                const firstByte = dv.getUint8(0);
-                if (firstByte === this.#CmdAsyncData) {
-                    this.#asyncNewDataEvent.forEach((item) => item(buff.slice(1)))
-                } else {
-                    const next = this.#responseQueue.shift()
-                    if (next === undefined) {
-                        console.log("data unexpected", event, firstByte);
-                        return;
-                    }
+    #onError(event: ErrorEvent) {
+        this.#channels.forEach(client => client.onSocketError?.(event.message));
+    }
 
-                    next.onSuccess(buff.slice(1))
-                }
-            });
-        }
+    #onClose(event: CloseEvent) {
+        // nothing is coming back for requests still waiting
+        this.#pending.forEach(callback => callback.onError("connection closed"));
+        this.#pending.clear();
+        this.#channels.forEach(client => client.onSocketClose?.(event.reason));
     }
 
     #onOpen(event: Event) {
-        this.#sendAuthenticationToken(this.#authToken).then(() => {
+        const token = new TextEncoder().encode(this.#authToken);
+        const payload = new Uint8Array(token.length + 1);
+        payload[0] = token.length;
+        payload.set(token, 1);
+
+        this.send(this.#CmdAuthenticate, 0, payload).then(() => {
             this.#readyEvents.forEach((item) => item())
         }).catch(e => {
-            this.close();
-            if (this.onSocketError != null) {
-                this.onSocketError(e);
-            }
+            this.#websocket.close();
+            this.#channels.forEach(client => client.onSocketError?.(e));
         })
+    }
 
+    #onData(event: MessageEvent<any>) {
+        if (typeof (event.data) == "string") {
+            // only v1 requests get text errors
+            console.log("data unexpected", event);
+            return;
+        }
 
-    }
+        event.data.arrayBuffer().then(buff => {
+            const dv = new DataView(buff)
+            const msgType = dv.getUint8(0);
+            const status = dv.getUint8(1);
+            const requestId = dv.getUint16(2, true);
+            const channel = dv.getUint8(4);
+            const payload = buff.slice(this.#responseHeaderSize);
 
-    async #sendAuthenticationToken(token: string) {
-        const buffer = new ArrayBuffer(token.length + 1);
-        const dv = new DataView(buffer);
-        dv.setUint8(0, token.length)
+            if (requestId === 0) {
+                const client = this.#channels.get(channel);
+                if (client === undefined) {
+                    console.log("data unexpected", channel, msgType);
+                    return;
+                }
+                client.onMessage(msgType, payload);
+                return;
+            }
 
-        const encoder = new TextEncoder();
-        encoder.encodeInto(token, new Uint8Array(buffer, 1, token.length))
+            const callback = this.#pending.get(requestId);
+            if (callback === undefined) {
+                console.log("data unexpected", requestId, msgType);
+                return;
+            }
+            this.#pending.delete(requestId);
 
-        return this.#sendCommandVoidResponse(this.#CmdAuthenticate, new Uint8Array(buffer));
+            if (status !== ErrorCodeNone) {
+                callback.onError(new TextDecoder().decode(payload));
+            } else {
+                callback.onSuccess(payload);
+            }
+        });
+    }
+
+    #allocateRequestId() {
+        // 0 is reserved for unsolicited messages
+        do {
+            this.#nextRequestId = (this.#nextRequestId % 0xFFFF) + 1;
+        } while (this.#pending.has(this.#nextRequestId));
+        return this.#nextRequestId;
     }
 
-    async #send(data: ArrayBuffer | Uint8Array) {
+    /**
+     * sends a request, resolves with the response payload
+     */
+    async send(cmdId: number, channel: number, payload?: Uint8Array | Array<any>) {
         return new Promise<ArrayBuffer>((resolve, reject) => {
             try {
                 if (this.#websocket.readyState != WebSocket.OPEN) {
                     throw "not connected"
                 }
+                if (payload === undefined) {
+                    payload = []
+                }
+
+                const requestId = this.#allocateRequestId();
+                const data = new Uint8Array(this.#requestHeaderSize + payload.length);
+                const dv = new DataView(data.buffer);
+                dv.setUint8(0, cmdId)
+                dv.setUint8(1, this.#RequestProtocolVersion)
+                dv.setUint16(2, requestId, true)
+                dv.setUint8(4, channel)
+                data.set(payload, this.#requestHeaderSize)
+
                 this.#websocket.send(data);
-                this.#responseQueue.push({ onSuccess: resolve, onError: reject });
+                this.#pending.set(requestId, { onSuccess: resolve, onError: reject });
             } catch (e) {
                 reject(e);
             }
         });
     }
 
-    async #sendCommand(cmdId: number, payload?: Uint8Array | Array<any>) {
-        if (payload === undefined) {
-            payload = []
+    close() {
+        this.#websocket.close();
+    }
+}
+
+/**
+ * client interface to one port on the serial server
+ * uses a websocket, several clients can share one through SerialClient.openChannel()
+ */
+export class SerialClient {
+    #CmdOpen = 1
+    #CmdClose = 2
+    #CmdSetMode = 3
+    #CmdGetMode = 4
+    #CmdReadData = 5
+    #CmdStartAsyncDataRead = 6
+    #CmdAsyncData = 7
+    #CmdStopAsyncDataRead = 8
+    #CmdWriteData = 9
+    #CmdGetPortList = 10
+    #CmdGetPortStats = 11
+    #CmdWriteComplete = 12
+    #CmdOpenViewer = 13
+    #CmdAsyncDataLost = 14
+    #CmdAsyncFrame = 15
+    #CmdStartJob = 16
+    #CmdJobData = 17
+    #CmdJobProgress = 18
+    #CmdCancelJob = 19
+    #CmdRxCredit = 20
+    #CmdSendBreak = 21
+    #CmdAsyncLineEvent = 22
+    #CmdAsyncTimedData = 23
+    #CmdArmTrigger = 24
+    #CmdAsyncTriggerCapture = 25
+    #CmdWatchPatterns = 26
+    #CmdAsyncPatternHit = 27
+    #CmdBridge = 28
+    #CmdSniff = 29
+    #CmdAsyncSniffData = 30
+    #maxJobDataSize = 1024
+    #maxStreamChunkSize = 512
+
+    #connection: SerialConnection
+    #channel: number
+    #asyncNewDataEvent = new Array<AsyncResponse>();
+    #writeCompleteWaiters = new Array<WriteCompleteWaiter>();
+    // tx credit, running totals as on the device, the limit is undefined until the port is opened
+    #txSent = 0
+    #txCompleted = 0
+    #txLimit: number = undefined
+    #txCreditWaiters = new Array<() => boolean>();
+    // writes take their credit in call order
+    #txReservation = Promise.resolve()
+    // rx credit, 0 when flow control is off
+    #rxWindow = 0
+    #rxToReturn = 0
+    #asyncDataLostEvent = new Array<(lostBytes: number) => void>();
+    #asyncFrameEvent = new Array<AsyncResponse>();
+    #lineEvent = new Array<(event: LineEvent) => void>();
+    #asyncTimedDataEvent = new Array<(data: TimedData) => void>();
+    #jobProgressEvent = new Array<(progress: JobProgress) => void>();
+    #triggerCaptureEvent = new Array<(capture: TriggerCapture) => void>();
+    #patternHitEvent = new Array<(hit: PatternHit) => void>();
+    #sniffEvent = new Array<(record: SniffRecord) => void>();
+
+    /**
+     * @param address the websocket url, or the connection of another client to share its socket
+     * @param authToken not used when sharing a connection
+     * @param channel the channel of the shared connection this client uses
+     */
+    constructor(address: string | SerialConnection, authToken?: string, channel = 0) {
+        this.#connection = typeof (address) == "string" ? new SerialConnection(address, authToken) : address;
+        this.#channel = channel;
+        this.#connection.addChannel(channel, this);
+    }
+
+    onSocketError: (message: string) => void = null;
+    onSocketClose: (reason: string) => void = null;
+
+    /**
+     * a client for another port on the same socket
+     * @param channel 1 to MaxChannels - 1, channel 0 is used by the client that made the socket
+     */
+    openChannel(channel: number) {
+        return new SerialClient(this.#connection, undefined, channel);
+    }
+
+    /**
+     * @internal called by the connection with the unsolicited messages for this channel
+     */
+    onMessage(msgType: number, buff: ArrayBuffer) {
+        const dv = new DataView(buff)
+        if (msgType === this.#CmdAsyncData) {
+            this.#asyncNewDataEvent.forEach((item) => item(buff))
+            this.#returnRxCredit(buff.byteLength);
+        } else if (msgType === this.#CmdWriteComplete) {
+            if (buff.byteLength >= 12) {
+                this.#onTxLimit(dv.getUint32(8, true));
+            }
+            this.#onWriteComplete(dv.getUint32(0, true));
+        } else if (msgType === this.#CmdAsyncDataLost) {
+            const lostBytes = dv.getUint32(0, true);
+            this.#asyncDataLostEvent.forEach((item) => item(lostBytes))
+        } else if (msgType === this.#CmdAsyncFrame) {
+            this.#asyncFrameEvent.forEach((item) => item(buff))
+            this.#returnRxCredit(buff.byteLength);
+        } else if (msgType === this.#CmdAsyncTimedData) {
+            const timed: TimedData = {
+                Start: Number(dv.getBigUint64(0, true)),
+                Duration: dv.getUint32(8, true),
+                Data: buff.slice(12)
+            }
+            // timed listeners go first so they can place the data before it is shown
+            this.#asyncTimedDataEvent.forEach((item) => item(timed))
+            this.#asyncNewDataEvent.forEach((item) => item(timed.Data))
+            this.#returnRxCredit(buff.byteLength);
+        } else if (msgType === this.#CmdAsyncLineEvent) {
+            const event: LineEvent = { Event: dv.getUint8(0), Offset: dv.getUint32(1, true) };
+            this.#lineEvent.forEach((item) => item(event))
+            this.#returnRxCredit(buff.byteLength);
+        } else if (msgType === this.#CmdJobProgress) {
+            this.#onJobProgress(dv);
+        } else if (msgType === this.#CmdAsyncTriggerCapture) {
+            this.#onTriggerCapture(dv);
+        } else if (msgType === this.#CmdAsyncPatternHit) {
+            const hit: PatternHit = {
+                Pattern: dv.getUint8(0),
+                Offset: dv.getUint32(1, true),
+                Time: Number(dv.getBigUint64(5, true)),
+                Context: new Uint8Array(buff.slice(13))
+            }
+            this.#patternHitEvent.forEach((item) => item(hit))
+            this.#returnRxCredit(buff.byteLength);
+        } else if (msgType === this.#CmdAsyncSniffData) {
+            this.#onSniffData(dv, buff);
+        } else {
+            console.log("data unexpected", msgType);
+        }
+    }
+
+    #onWriteComplete(completedTotal: number) {
+        this.#txCompleted = completedTotal;
+        this.#onTxCredit();
+        // totals are 32 bit running counters so compare using the wrapped difference
+        this.#writeCompleteWaiters = this.#writeCompleteWaiters.filter(waiter => {
+            if (((completedTotal - waiter.offset) | 0) >= 0) {
+                waiter.resolve();
+                return false;
+            }
+            return true;
+        });
+    }
+
+    #onTxLimit(limit: number) {
+        // reports can arrive out of order with write responses, the limit only moves forward
+        if (this.#txLimit === undefined || ((limit - this.#txLimit) | 0) > 0) {
+            this.#txLimit = limit;
         }
-        const data = new Uint8Array(2 + payload.length);
+    }
+
+    #onTxCredit() {
+        this.#txCreditWaiters = this.#txCreditWaiters.filter(check => !check());
+    }
+
+    /**
+     * resolves once the device tx queue has room for length more bytes
+     */
+    #waitTxCredit(length: number) {
+        return new Promise<void>(resolve => {
+            const check = () => {
+                const fits = this.#txLimit === undefined || ((this.#txSent + length - this.#txLimit) | 0) <= 0;
+                // more than the whole queue is sent once everything before it is done, the device rejects it if it still does not fit
+                if (fits || this.#txSent === this.#txCompleted) {
+                    resolve();
+                    return true;
+                }
+                return false;
+            }
+            if (!check()) {
+                this.#txCreditWaiters.push(check);
+            }
+        });
+    }
+
+    #onSniffData(dv: DataView, buff: ArrayBuffer) {
+        const record: SniffRecord = { Source: dv.getUint8(0) };
+        const type = dv.getUint8(1);
+        if (type === this.#CmdAsyncDataLost) {
+            record.LostBytes = dv.getUint32(2, true);
+        } else if (type === this.#CmdAsyncTimedData) {
+            record.Timed = {
+                Start: Number(dv.getBigUint64(2, true)),
+                Duration: dv.getUint32(10, true),
+                Data: buff.slice(14)
+            }
+        } else if (type === this.#CmdAsyncLineEvent) {
+            record.LineEvent = { Event: dv.getUint8(2), Offset: dv.getUint32(3, true) };
+        } else if (type === this.#CmdAsyncFrame) {
+            record.Frame = buff.slice(2);
+        } else {
+            console.log("sniff data unexpected", type);
+            return;
+        }
+        this.#sniffEvent.forEach((item) => item(record))
+        if (record.LostBytes === undefined) {
+            this.#returnRxCredit(buff.byteLength - 2);
+        }
+    }
+
+    #returnRxCredit(length: number) {
+        if (this.#rxWindow === 0) {
+            return;
+        }
+
+        // hand credit back in batches so the grants cost far less than the data
+        this.#rxToReturn += length;
+        if (this.#rxToReturn >= this.#rxWindow / 4) {
+            this.#sendRxCredit(this.#rxToReturn, CreditModeAdd).catch(() => { });
+            this.#rxToReturn = 0;
+        }
+    }
+
+    #sendRxCredit(bytes: number, mode: number) {
+        const data = new Uint8Array(5);
         const dv = new DataView(data.buffer);
-        dv.setUint8(0, cmdId)
-        dv.setUint8(1, this.#RequestProtocolVersion)
-        data.set(payload, 2)
+        dv.setUint32(0, bytes, true);
+        dv.setUint8(4, mode);
+        return this.#sendCommandVoidResponse(this.#CmdRxCredit, data);
+    }
 
-        return this.#send(data)
+    #onJobProgress(dv: DataView) {
+        const progress: JobProgress = {
+            State: dv.getUint8(0),
+            Stage: dv.getUint8(1),
+            Processed: dv.getUint32(2, true),
+            Total: dv.getUint32(6, true),
+            InputConsumed: dv.getUint32(10, true)
+        }
+        if (progress.State === JobStateFailed) {
+            progress.Error = new TextDecoder().decode(new Uint8Array(dv.buffer, 14));
+        } else if (progress.State === JobStateComplete && dv.byteLength > 14) {
+            progress.Result = new DataView(dv.buffer, dv.byteOffset + 14, dv.byteLength - 14);
+        }
+        // copy so a listener can remove itself
+        this.#jobProgressEvent.slice().forEach((item) => item(progress))
+    }
+
+    #onTriggerCapture(dv: DataView) {
+        const capture: TriggerCapture = {
+            Trigger: dv.getUint8(0),
+            Time: Number(dv.getBigUint64(1, true)),
+            PreCount: dv.getUint16(9, true),
+            PostCount: dv.getUint16(11, true),
+            Entries: []
+        }
+        for (let offset = 13; offset + 1 < dv.byteLength; offset += 2) {
+            capture.Entries.push({ Flags: dv.getUint8(offset), Value: dv.getUint8(offset + 1) });
+        }
+        this.#triggerCaptureEvent.forEach((item) => item(capture))
+    }
+
+    async #sendCommand(cmdId: number, payload?: Uint8Array | Array<any>) {
+        return this.#connection.send(cmdId, this.#channel, payload)
     }
 
     #sendCommandVoidResponse(cmdId: number, payload?: Uint8Array | Array<any>) {
@@ -173,8 +942,22 @@ export class SerialClient {
      * @returns 
      */
     async close() {
+        this.#txLimit = undefined;
+        this.#rxWindow = 0;
+        this.#onTxCredit();
         return this.#sendCommandVoidResponse(this.#CmdClose, [])
     }
+    /**
+     * turns on receive flow control, the device sends no more async data than the window until it is handed back
+     * credit is handed back once the data has been passed to the listeners
+     * data the device can not hold while it waits is reported through onAsyncDataLost()
+     * @param windowBytes the bytes the device may send ahead, 0 turns flow control off
+     */
+    async setRxWindow(windowBytes: number) {
+        this.#rxWindow = windowBytes;
+        this.#rxToReturn = 0;
+        return this.#sendRxCredit(windowBytes, windowBytes > 0 ? CreditModeSet : CreditModeOff);
+    }
     /**
      * 
      * @param length the number of bytes to read
@@ -183,10 +966,10 @@ export class SerialClient {
      */
     async read(length: number, timeout: number): Promise<ArrayBuffer> {
         return new Promise(async (resolve, reject) => {
-            const data = new Uint8Array(4);
+            const data = new Uint8Array(8);
             const dv = new DataView(data.buffer);
-            dv.setUint16(0, length, true);
-            dv.setUint16(2, timeout, true);
+            dv.setUint32(0, length, true);
+            dv.setUint32(4, timeout, true);
             try {
                 resolve(await this.#sendCommand(this.#CmdReadData, data))
             } catch (e) {
@@ -195,8 +978,11 @@ export class SerialClient {
         })
     }
 
+    /**
+     * called once the socket is connected and authenticated
+     */
     onConnected(f) {
-        this.#readyEvents.push(f);
+        this.#connection.onConnected(f);
     }
     /**
      * add a callback to be called on new data in async mode
@@ -206,6 +992,45 @@ export class SerialClient {
     async onAsyncData(f: AsyncResponse) {
         this.#asyncNewDataEvent.push(f);
     }
+    /**
+     * add a callback to be called when the device had to drop async data because this client fell behind
+     * @param f the function, given the number of bytes dropped
+     */
+    onAsyncDataLost(f: (lostBytes: number) => void) {
+        this.#asyncDataLostEvent.push(f);
+    }
+    /**
+     * add a callback to be called with each frame when framing is set in the mode
+     * the frame has the framing bytes and CRC removed
+     * @param f the function
+     */
+    onAsyncFrame(f: AsyncResponse) {
+        this.#asyncFrameEvent.push(f);
+    }
+    /**
+     * add a callback to be called when a line error, break or overflow is seen, in order with the async data
+     * @param f the function
+     */
+    onLineEvent(f: (event: LineEvent) => void) {
+        this.#lineEvent.push(f);
+    }
+    /**
+     * add a callback to be called with each burst of data and its device timestamps, when Timestamps is set in the mode
+     * the data is also given to the onAsyncData() callbacks, straight after this one
+     * @param f the function
+     */
+    onAsyncTimedData(f: (data: TimedData) => void) {
+        this.#asyncTimedDataEvent.push(f);
+    }
+    /**
+     * holds TX in the break state once the data already written has been sent
+     * @param durationMs up to 1000
+     */
+    async sendBreak(durationMs = 250) {
+        const data = new Uint8Array(4);
+        new DataView(data.buffer).setUint32(0, durationMs, true);
+        return this.#sendCommandVoidResponse(this.#CmdSendBreak, data);
+    }
     /**
      * calls startAsyncRead() and returns a reader
      * @returns ReadableStream bytes type
@@ -243,17 +1068,76 @@ export class SerialClient {
         return this.#sendCommandVoidResponse(this.#CmdStopAsyncDataRead)
     }
     /**
-     * write data to the serial port
-     * @param payload the string to send
-     * @returns 
+     * queue data to be written to the serial port
+     * resolves once the device has queued the data, not when it has been sent
+     * waits for the device to have room, rejects if it still does not (data larger than the whole queue)
+     * @param payload the data to send
+     * @returns the offset to pass to waitForWriteComplete()
      */
-    async write(payload: Array<any> | Uint8Array) {
-        const data = new Uint8Array(2 + payload.length);
+    async write(payload: Array<any> | Uint8Array): Promise<number> {
+        const data = new Uint8Array(4 + payload.length);
         const dv = new DataView(data.buffer);
-        dv.setUint16(0, payload.length, true);
-        data.set(payload, 2)
+        dv.setUint32(0, payload.length, true);
+        data.set(payload, 4)
+
+        // wait for the device to advertise room rather than have it reject the data
+        const reservation = this.#txReservation.then(() => this.#waitTxCredit(payload.length));
+        this.#txReservation = reservation;
+        await reservation;
+        this.#txSent = (this.#txSent + payload.length) >>> 0;
+
+        try {
+            const response = new DataView(await this.#sendCommand(this.#CmdWriteData, data));
+            if (response.byteLength >= 8) {
+                this.#onTxLimit(response.getUint32(4, true));
+            }
+            return response.getUint32(0, true);
+        } catch (e) {
+            this.#txSent = (this.#txSent - payload.length) >>> 0;
+            this.#onTxCredit();
+            throw e;
+        }
+    }
+    /**
+     * writes any amount of data as fast as the line takes it
+     * the writes are pipelined, each waits only for the device to have room for it
+     * @param onProgress called with the number of bytes queued, return true to stop
+     * @returns the offset to pass to waitForWriteComplete()
+     */
+    async writeStream(payload: Uint8Array, onProgress?: (queued: number) => boolean | void): Promise<number> {
+        let last: Promise<number> = Promise.resolve(this.#txSent);
+        const writes = new Array<Promise<number>>();
+        for (let offset = 0; offset < payload.length; offset += this.#maxStreamChunkSize) {
+            const chunk = payload.subarray(offset, offset + this.#maxStreamChunkSize);
+            last = this.write(chunk);
+            writes.push(last);
+            // let the credit catch up before queuing more so the chunks are not all held here at once
+            await this.#txReservation;
+            if (onProgress !== undefined && onProgress(offset + chunk.length)) {
+                break;
+            }
+        }
 
-        return this.#sendCommandVoidResponse(this.#CmdWriteData, data)
+        await Promise.all(writes);
+        return last;
+    }
+    /**
+     * wait for the device to finish sending queued data
+     * @param offset the value returned by write()
+     * @returns 
+     */
+    async waitForWriteComplete(offset: number) {
+        return new Promise<void>(resolve => {
+            this.#writeCompleteWaiters.push({ offset, resolve });
+        });
+    }
+    /**
+     * write data to the serial port and wait for it to be sent
+     * @param payload the data to send
+     * @returns 
+     */
+    async writeAndWait(payload: Array<any> | Uint8Array) {
+        return this.waitForWriteComplete(await this.write(payload));
     }
     /**
      * write a string to the serial port
@@ -271,7 +1155,7 @@ export class SerialClient {
      */
     async setMode(mode: SerialMode) {
 
-        const data = new Uint8Array(8);
+        const data = new Uint8Array(29);
         const dv = new DataView(data.buffer);
         var offset = 0;
 
@@ -281,6 +1165,23 @@ export class SerialClient {
         dv.setUint8(offset++, mode.Parity);
         dv.setUint8(offset++, mode.StopBits);
         dv.setUint8(offset++, mode.InitialStatusBits);
+        dv.setUint8(offset++, mode.Profile ?? PortProfileDefault);
+        dv.setUint8(offset++, mode.Framing?.Mode ?? FrameModeNone);
+        dv.setUint8(offset++, mode.Framing?.CRC ?? FrameCRCNone);
+        dv.setUint8(offset++, mode.Framing?.Param ?? 0);
+        dv.setUint16(offset, mode.Framing?.MaxFrameSize ?? 256, true);
+        offset += 2
+        dv.setUint8(offset++, mode.FlowControl ?? FlowControlNone);
+        dv.setUint8(offset++, mode.Timestamps ? StreamFlagTimestamps : 0);
+        dv.setUint32(offset, mode.TxPacing?.ByteGapUs ?? 0, true);
+        offset += 4
+        dv.setUint16(offset, mode.TxPacing?.LineGapMs ?? 0, true);
+        offset += 2
+        dv.setUint16(offset, mode.TxPacing?.EchoTimeoutMs ?? 0, true);
+        offset += 2
+        dv.setUint8(offset++, mode.Rs485?.Mode ?? Rs485Off);
+        dv.setUint32(offset, mode.Rs485?.TurnaroundUs ?? 0, true);
+        offset += 4
 
         return this.#sendCommandVoidResponse(this.#CmdSetMode, data)
     }
@@ -298,7 +1199,31 @@ export class SerialClient {
         const encoder = new TextEncoder();
         encoder.encodeInto(portName, new Uint8Array(buffer, 1, portName.length))
 
-        return this.#sendCommandVoidResponse(this.#CmdOpen, new Uint8Array(buffer));
+        const response = new DataView(await this.#sendCommand(this.#CmdOpen, new Uint8Array(buffer)));
+        // [u32 tx queued total][u32 tx limit]
+        if (response.byteLength >= 8) {
+            this.#txSent = response.getUint32(0, true);
+            this.#txCompleted = this.#txSent;
+            this.#txLimit = response.getUint32(4, true);
+        }
+    }
+
+    /**
+     * opens the port read only, async data is sent straight away
+     * any number of clients can view a port while another client owns it
+     * @param portName the name of the port to view
+     * @returns 
+     */
+    async openViewer(portName: string) {
+
+        const buffer = new ArrayBuffer(portName.length + 1);
+        const dv = new DataView(buffer);
+        dv.setUint8(0, portName.length)
+
+        const encoder = new TextEncoder();
+        encoder.encodeInto(portName, new Uint8Array(buffer, 1, portName.length))
+
+        return this.#sendCommandVoidResponse(this.#CmdOpenViewer, new Uint8Array(buffer));
     }
 
     /**
@@ -328,4 +1253,307 @@ export class SerialClient {
             })
         })
     }
+
+    /**
+     * get the buffer usage and data loss counters of the open port
+     * @returns
+     */
+    async getPortStats(): Promise<PortStats> {
+        const buff = await this.#sendCommand(this.#CmdGetPortStats, []);
+        const dv = new DataView(buff)
+
+        return {
+            RxBufferSize: dv.getUint32(0, true),
+            RxBufferHighWaterMark: dv.getUint32(4, true),
+            RxOverflowBytes: dv.getUint32(8, true),
+            RxOverflowCount: dv.getUint32(12, true),
+            FifoOverflowCount: dv.getUint32(16, true),
+            DriverBufferFullCount: dv.getUint32(20, true),
+            BreakCount: dv.getUint32(24, true),
+            ParityErrorCount: dv.getUint32(28, true),
+            FrameErrorCount: dv.getUint32(32, true),
+            FramesDecoded: dv.getUint32(36, true),
+            BadFrameCount: dv.getUint32(40, true),
+            BridgeDroppedBytes: dv.byteLength >= 48 ? dv.getUint32(44, true) : 0,
+            Rs485CollisionCount: dv.byteLength >= 52 ? dv.getUint32(48, true) : 0
+        }
+    }
+    /**
+     * starts a job on the device, the port must be open
+     * @param jobType the job, JobTypeStm32Bootloader
+     * @param flags job specific options
+     * @param address job specific address
+     * @param imageLength the number of image bytes the job processes
+     * @param params job specific settings
+     * @returns the size of the device's job input buffer
+     */
+    async startJob(jobType: number, flags: number, address: number, imageLength: number, params?: Uint8Array): Promise<number> {
+        const data = new Uint8Array(10 + (params?.length ?? 0));
+        const dv = new DataView(data.buffer);
+        dv.setUint8(0, jobType);
+        dv.setUint8(1, flags);
+        dv.setUint32(2, address, true);
+        dv.setUint32(6, imageLength, true);
+        if (params !== undefined) {
+            data.set(params, 10);
+        }
+
+        const response = await this.#sendCommand(this.#CmdStartJob, data);
+        return new DataView(response).getUint32(0, true);
+    }
+    /**
+     * sends input for the running job, the device rejects it if its input buffer does not have room
+     */
+    async sendJobData(payload: Uint8Array) {
+        return this.#sendCommandVoidResponse(this.#CmdJobData, payload)
+    }
+    /**
+     * asks the running job to stop, it reports JobStateCancelled once it has
+     */
+    async cancelJob() {
+        return this.#sendCommandVoidResponse(this.#CmdCancelJob)
+    }
+    /**
+     * runs a modem line script on the device, for example a reset into a bootloader
+     * @param restoreBaudRate put the baud rate back once the script finishes
+     */
+    async runModemSequence(sequence: ModemSequence, restoreBaudRate = false) {
+        return this.runJob(JobTypeModemSequence, restoreBaudRate ? 1 : 0, 0, 0, new Uint8Array(0), undefined, sequence.build());
+    }
+    /**
+     * runs a send / expect script on the device, it takes one round trip however many steps it has
+     * @param restoreBaudRate put the baud rate back once the script finishes
+     * @returns rejects with the reason if a step fails
+     */
+    async runScript(script: Script, restoreBaudRate = false): Promise<ScriptResult> {
+        const code = script.build();
+        const progress = await this.runJob(JobTypeScript, restoreBaudRate ? 1 : 0, 0, code.length, code);
+        const dv = progress.Result;
+        if (dv === undefined || dv.byteLength < 8) {
+            throw "invalid script result";
+        }
+
+        return {
+            StepsRun: dv.getUint32(0, true),
+            Dropped: dv.getUint32(4, true),
+            Received: new Uint8Array(dv.buffer, dv.byteOffset + 8, dv.byteLength - 8)
+        }
+    }
+    /**
+     * plays a capture log recording back into the port with its recorded timing and compares what comes back
+     * with the recorded RX, see CaptureSettings.encodeRecords()
+     * @param timeScale 1 plays at the recorded speed, 2 takes twice as long
+     * @param tailMs how long to keep listening after the last send
+     */
+    async runReplay(recording: Uint8Array, timeScale = 1, tailMs = 500, onProgress?: (progress: JobProgress) => boolean | void): Promise<ReplayResult> {
+        const params = new Uint8Array(8);
+        const pv = new DataView(params.buffer);
+        pv.setUint32(0, Math.round(timeScale * 1000), true);
+        pv.setUint32(4, tailMs, true);
+        const progress = await this.runJob(JobTypeReplay, 0, 0, recording.length, recording, onProgress, params);
+        const dv = progress.Result;
+        if (dv === undefined || dv.byteLength < 21) {
+            throw "invalid replay result";
+        }
+
+        const divergences: ReplayDivergence[] = [];
+        for (let i = 0, offset = 21; i < dv.getUint8(20) && offset + 6 <= dv.byteLength; i++, offset += 6) {
+            divergences.push({ Offset: dv.getUint32(offset, true), Expected: dv.getUint8(offset + 4), Received: dv.getUint8(offset + 5) });
+        }
+
+        return {
+            TxBytes: dv.getUint32(0, true),
+            RxExpected: dv.getUint32(4, true),
+            RxReceived: dv.getUint32(8, true),
+            Mismatches: dv.getUint32(12, true),
+            MaxLateUs: dv.getUint32(16, true),
+            Divergences: divergences
+        }
+    }
+    /**
+     * finds the baud rate of the traffic the device is receiving and switches the port to it
+     * the port needs traffic on RX while this runs, it takes under a second
+     * @param measureOnly report the measured rate without changing the port
+     */
+    async autoBaud(measureOnly = false): Promise<AutoBaudResult> {
+        const progress = await this.runJob(JobTypeAutoBaud, measureOnly ? 1 : 0, 0, 0, new Uint8Array(0));
+        const dv = progress.Result;
+        if (dv === undefined || dv.byteLength < 24) {
+            throw "invalid auto baud result";
+        }
+
+        return {
+            MeasuredBaudRate: dv.getUint32(0, true),
+            BaudRate: dv.getUint32(4, true),
+            MeasuredBitTime: dv.getUint32(8, true),
+            AchievedBitTime: dv.getUint32(12, true),
+            Edges: dv.getUint32(16, true),
+            Errors: dv.getUint32(20, true)
+        }
+    }
+    /**
+     * arms a trigger on the port, the device keeps the recent traffic and once the trigger fires
+     * sends the window around it to the onTriggerCapture() callbacks, then disarms
+     * arming again replaces the current trigger, Triggers 0 disarms
+     */
+    async armTrigger(config: TriggerConfig) {
+        const pattern = config.Pattern ?? new Uint8Array(0);
+        const data = new Uint8Array(6 + pattern.length);
+        const dv = new DataView(data.buffer);
+        dv.setUint8(0, config.Triggers);
+        dv.setUint16(1, config.PreEntries, true);
+        dv.setUint16(3, config.PostEntries, true);
+        dv.setUint8(5, pattern.length);
+        data.set(pattern, 6);
+        return this.#sendCommandVoidResponse(this.#CmdArmTrigger, data);
+    }
+    /**
+     * add a callback to be called with the captured window when an armed trigger fires
+     */
+    onTriggerCapture(f: (capture: TriggerCapture) => void) {
+        this.#triggerCaptureEvent.push(f);
+    }
+    /**
+     * replaces the patterns the device watches the received data for on this channel, an empty list stops watching
+     * hits are sent to onPatternHit() even when async read is stopped, viewers can watch too
+     * the port takes up to 64 patterns of up to 32 bytes from all its clients together
+     */
+    async watchPatterns(patterns: Array<string | Uint8Array>) {
+        const encoded = patterns.map(p => typeof (p) == "string" ? new TextEncoder().encode(p) : p);
+        const data = new Uint8Array(encoded.reduce((size, p) => size + 1 + p.length, 1));
+        data[0] = encoded.length;
+        let offset = 1;
+        encoded.forEach(p => {
+            data[offset] = p.length;
+            data.set(p, offset + 1);
+            offset += 1 + p.length;
+        });
+        return this.#sendCommandVoidResponse(this.#CmdWatchPatterns, data);
+    }
+    /**
+     * connects this client's port to the peer's port on the device, each forwards what it receives to the other's TX
+     * without a round trip through the browser. both must be opened on the same connection, see openChannel()
+     * async read on either client still gets a copy of what its port receives, so the two show both directions
+     * write() injects into the bridged stream. reads and jobs are refused while bridged
+     * @param peer undefined stops the bridge
+     * @param rules applied on the device, up to 8 per direction, the first complete match wins
+     */
+    async bridge(peer: SerialClient | undefined, rules: BridgeRule[] = []) {
+        const encoder = new TextEncoder();
+        const encoded = rules.map(r => ({
+            Direction: r.Direction,
+            Match: typeof (r.Match) == "string" ? encoder.encode(r.Match) : r.Match,
+            Replace: typeof (r.Replace) == "string" ? encoder.encode(r.Replace) : r.Replace
+        }));
+        const data = new Uint8Array(encoded.reduce((size, r) => size + 3 + r.Match.length + r.Replace.length, 2));
+        data[0] = peer === undefined ? 0xFF : peer.#channel;
+        data[1] = encoded.length;
+        let offset = 2;
+        encoded.forEach(r => {
+            data[offset] = r.Direction;
+            data[offset + 1] = r.Match.length;
+            data.set(r.Match, offset + 2);
+            offset += 2 + r.Match.length;
+            data[offset] = r.Replace.length;
+            data.set(r.Replace, offset + 1);
+            offset += 1 + r.Replace.length;
+        });
+        return this.#sendCommandVoidResponse(this.#CmdBridge, data);
+    }
+    /**
+     * listens to both lines of a link, this client's port on one and the peer's on the other, with both TX pins released
+     * the device timestamps both and merges them into one time ordered stream, see onSniffData()
+     * both must be opened on the same connection, see openChannel(), and set to the link's mode
+     * records are held back by up to the rx timeout of the slower profile so a late burst from one side can not arrive out of order
+     * writes, reads, breaks and jobs are refused on both while sniffing. stopping leaves async read off on both
+     * @param peer undefined stops sniffing
+     */
+    async sniff(peer: SerialClient | undefined) {
+        return this.#sendCommandVoidResponse(this.#CmdSniff, [peer === undefined ? 0xFF : peer.#channel]);
+    }
+    /**
+     * add a callback to be called with each record of the merged sniff timeline, in time order
+     * @param f the function
+     */
+    onSniffData(f: (record: SniffRecord) => void) {
+        this.#sniffEvent.push(f);
+    }
+    /**
+     * add a callback to be called each time a watched pattern is received
+     */
+    onPatternHit(f: (hit: PatternHit) => void) {
+        this.#patternHitEvent.push(f);
+    }
+    /**
+     * add a callback to be called when the running job reports progress
+     */
+    onJobProgress(f: (progress: JobProgress) => void) {
+        this.#jobProgressEvent.push(f);
+    }
+    /**
+     * starts a job and streams its input, keeping no more unconsumed data on the device than it can buffer
+     * @param input the job input
+     * @param onProgress called with each progress report, return true to cancel the job
+     * @param params job specific settings
+     * @returns resolves with the final progress when the job completes, rejects if it fails or is cancelled
+     */
+    async runJob(jobType: number, flags: number, address: number, imageLength: number, input: Uint8Array, onProgress?: (progress: JobProgress) => boolean | void, params?: Uint8Array) {
+        return new Promise<JobProgress>(async (resolve, reject) => {
+            let bufferSize = 0;
+            let sent = 0;
+            let consumed = 0;
+            let sending = false;
+            let cancelRequested = false;
+
+            const pump = async () => {
+                if (sending) {
+                    return;
+                }
+                sending = true;
+                try {
+                    while (sent < input.length && sent - consumed < bufferSize) {
+                        const length = Math.min(input.length - sent, bufferSize - (sent - consumed), this.#maxJobDataSize);
+                        const chunk = input.subarray(sent, sent + length);
+                        sent += length;
+                        await this.sendJobData(chunk);
+                    }
+                } catch (e) {
+                    this.cancelJob().catch(() => { });
+                } finally {
+                    sending = false;
+                }
+            }
+
+            const listener = (progress: JobProgress) => {
+                consumed = progress.InputConsumed;
+                if (onProgress !== undefined && onProgress(progress) && !cancelRequested) {
+                    cancelRequested = true;
+                    this.cancelJob().catch(() => { });
+                }
+
+                if (progress.State < JobStateComplete) {
+                    pump();
+                    return;
+                }
+
+                this.#jobProgressEvent = this.#jobProgressEvent.filter(item => item !== listener);
+                if (progress.State === JobStateComplete) {
+                    resolve(progress);
+                } else if (progress.State === JobStateFailed) {
+                    reject(progress.Error);
+                } else {
+                    reject("cancelled");
+                }
+            }
+
+            try {
+                this.#jobProgressEvent.push(listener);
+                bufferSize = await this.startJob(jobType, flags, address, imageLength, params);
+                pump();
+            } catch (e) {
+                this.#jobProgressEvent = this.#jobProgressEvent.filter(item => item !== listener);
+                reject(e);
+            }
+        });
+    }
 }
@@ -248,4 +248,171 @@ export class CertSettings {
         });
     }
 
-}
\ No newline at end of file
+}
+
+export interface CaptureConfig {
+    enabled: boolean
+    port: string
+    baudRate: number
+}
+
+export interface CaptureInfo extends CaptureConfig {
+    available: boolean
+    // log positions, data is available from start up to end
+    start?: number
+    end?: number
+    // device log clock in us, compare with CaptureRecord.Time
+    now?: number
+    // data bytes in each segment, positions are segment sequence * segmentSize + offset
+    segmentSize?: number
+    segmentCount?: number
+    maxEraseCount?: number
+    lostBytes?: number
+}
+
+export const CaptureRecordRx = 0;
+export const CaptureRecordTx = 1;
+export const CaptureRecordLineEvent = 2;
+export const CaptureRecordLost = 3;
+
+export interface CaptureRecord {
+    Type: number
+    Port: number
+    // log clock in us
+    Time: number
+    Data: Uint8Array
+}
+
+export class CaptureSettings {
+    static readonly recordHeaderSize = 12;
+    static readonly recordTypeEnd = 0xFF;
+    #auth: Auth
+
+    get #defaulOptions() {
+        return {
+            headers: this.#auth.authHeader
+        }
+    }
+
+    constructor(auth: Auth) {
+        this.#auth = auth;
+    }
+
+    async getInfo() {
+        return new Promise<CaptureInfo>((resolve, reject) => {
+            fetch(this.#auth.URL + "/capture", this.#defaulOptions).then(result => {
+                if (result.ok) {
+                    result.json().then(obj => resolve(obj as CaptureInfo)).catch(reason => reject(reason));
+                } else {
+                    result.text().then(err => reject(err))
+                }
+            }).catch(reason => reject(reason));
+        })
+    }
+
+    /**
+     * set which port is recorded, the device keeps recording it across reboots
+     */
+    async setConfig(config: CaptureConfig) {
+        return new Promise<void>((resolve, reject) => {
+            fetch(this.#auth.URL + "/capture", { method: "PUT", headers: this.#auth.authHeader, body: JSON.stringify(config) }).then(result => {
+                if (result.ok) {
+                    resolve();
+                } else {
+                    result.text().then(err => reject(err))
+                }
+            }).catch(reason => reject(reason));
+        })
+    }
+
+    /**
+     * the log positions covering the records from from up to (not including) to, times are in log clock us
+     */
+    async findRange(from: number, to: number) {
+        return new Promise<{ start: number, end: number }>((resolve, reject) => {
+            fetch(this.#auth.URL + "/capture/find", { method: "POST", headers: this.#auth.authHeader, body: JSON.stringify({ from, to }) }).then(result => {
+                if (result.ok) {
+                    result.json().then(obj => resolve(obj)).catch(reason => reject(reason));
+                } else {
+                    result.text().then(err => reject(err))
+                }
+            }).catch(reason => reject(reason));
+        })
+    }
+
+    /**
+     * downloads the log bytes from start up to end, the device sends large ranges in pieces
+     */
+    async download(start: number, end: number, onProgress?: (received: number) => void) {
+        const data = new Uint8Array(end - start);
+        let position = start;
+        while (position < end) {
+            const result = await fetch(this.#auth.URL + "/capture/data", {
+                headers: { ...this.#auth.authHeader, range: `bytes=${position}-${end - 1}` }
+            });
+            if (result.status != 206) {
+                throw await result.text();
+            }
+
+            const piece = new Uint8Array(await result.arrayBuffer());
+            if (piece.length == 0) {
+                break;
+            }
+            data.set(piece.subarray(0, end - position), position - start);
+            position += piece.length;
+            onProgress && onProgress(position - start);
+        }
+        return data.subarray(0, position - start);
+    }
+
+    /**
+     * splits downloaded log bytes into records
+     * @param start the log position of data[0], should be the start of a record
+     * @param segmentSize from CaptureInfo
+     */
+    /**
+     * packs records back into the log format, the input of SerialClient.runReplay()
+     */
+    static encodeRecords(records: CaptureRecord[]) {
+        const data = new Uint8Array(records.reduce((size, r) => size + CaptureSettings.recordHeaderSize + r.Data.length, 0));
+        const view = new DataView(data.buffer);
+        let offset = 0;
+        records.forEach(r => {
+            data[offset] = r.Type;
+            data[offset + 1] = r.Port;
+            view.setUint16(offset + 2, r.Data.length, true);
+            view.setBigUint64(offset + 4, BigInt(r.Time), true);
+            data.set(r.Data, offset + CaptureSettings.recordHeaderSize);
+            offset += CaptureSettings.recordHeaderSize + r.Data.length;
+        });
+        return data;
+    }
+
+    static parseRecords(data: Uint8Array, start: number, segmentSize: number) {
+        const records: CaptureRecord[] = [];
+        const view = new DataView(data.buffer, data.byteOffset, data.byteLength);
+        let offset = 0;
+        while (offset + CaptureSettings.recordHeaderSize <= data.length) {
+            const type = data[offset];
+            if (type == CaptureSettings.recordTypeEnd) {
+                // the rest of the segment is unused
+                const position = start + offset;
+                offset += segmentSize - (position % segmentSize);
+                continue;
+            }
+
+            const length = view.getUint16(offset + 2, true);
+            if (offset + CaptureSettings.recordHeaderSize + length > data.length) {
+                break;
+            }
+            records.push({
+                Type: type,
+                Port: data[offset + 1],
+                Time: Number(view.getBigUint64(offset + 4, true)),
+                Data: data.slice(offset + CaptureSettings.recordHeaderSize, offset + CaptureSettings.recordHeaderSize + length)
+            });
+            offset += CaptureSettings.recordHeaderSize + length;
+        }
+        return records;
+    }
+}
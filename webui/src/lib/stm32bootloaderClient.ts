@@ -14,7 +14,7 @@
  You should have received a copy of the GNU General Public License
  along with serialspark. If not, see <https://www.gnu.org/licenses/>.
  */
-import { SerialClient } from './serialClient.js'
+import { SerialClient, JobProgress, JobTypeStm32Bootloader } from './serialClient.js'
 
 export enum IntelHEXRecordType {
     Data = 0,
@@ -546,3 +546,121 @@ export default class Stm32BootLoaderClient {
         });
     }
 }
+
+export interface Stm32FlashOptions {
+    erase: boolean
+    write: boolean
+    verify: boolean
+    run: boolean
+}
+
+/**
+ * flashes an STM32 using the bootloader job on the device
+ * the image is sent once and the device runs every bootloader command itself
+ * so flashing is limited by the UART rather than a round trip per command
+ */
+export class Stm32DeviceFlasher {
+    static StageNames = ["sync", "erase", "write", "verify", "start"];
+
+    #FlagErase = 1;
+    #FlagWrite = 2;
+    #FlagVerify = 4;
+    #FlagGo = 8;
+
+    #maxBlockSize = 256;
+    #blockHeaderSize = 6;
+
+    #client: SerialClient
+
+    constructor(client: SerialClient) {
+        this.#client = client;
+    }
+
+    /**
+     * converts an intel hex file to the job's block stream
+     * each block is [u32 address][u16 length][data] with contiguous data merged up to the max block size
+     */
+    #imageFromIntelHEX(buffer: ArrayBuffer) {
+        const decoder = new IntelHEXDecoder(buffer);
+        const blocks = new Array<{ address: number, data: Uint8Array }>();
+        let baseAddress = 0;
+        let startAddress: number = null;
+        let current: { address: number, data: Array<number> } = null;
+
+        const flush = () => {
+            if (current != null && current.data.length > 0) {
+                blocks.push({ address: current.address, data: new Uint8Array(current.data) });
+            }
+            current = null;
+        }
+
+        while (decoder.next()) {
+            const record = decoder.record;
+            const dv = new DataView(record.data.buffer, record.data.byteOffset, record.data.byteLength);
+            switch (record.type) {
+                case IntelHEXRecordType.Data:
+                    let address = baseAddress + record.address;
+                    for (const value of record.data) {
+                        if (current == null || current.address + current.data.length != address || current.data.length == this.#maxBlockSize) {
+                            flush();
+                            current = { address: address, data: [] };
+                        }
+                        current.data.push(value);
+                        address++;
+                    }
+                    break;
+                case IntelHEXRecordType.ExtendedLinearAddress:
+                    baseAddress = dv.getUint16(0, false) * 0x10000;
+                    break;
+                case IntelHEXRecordType.ExtendedSegmentAddress:
+                    baseAddress = dv.getUint16(0, false) * 16;
+                    break;
+                case IntelHEXRecordType.StartLinearAddress:
+                    startAddress = IntelHEXDecoder.addressFromData(record);
+                    break;
+                case IntelHEXRecordType.EndOfFile:
+                case IntelHEXRecordType.StartSegmentAddress:
+                    break;
+                default:
+                    throw "record type not supported";
+            }
+        }
+        flush();
+
+        const imageLength = blocks.reduce((total, block) => total + block.data.length, 0);
+        const stream = new Uint8Array(imageLength + blocks.length * this.#blockHeaderSize);
+        const dv = new DataView(stream.buffer);
+        let offset = 0;
+        blocks.forEach(block => {
+            dv.setUint32(offset, block.address, true);
+            dv.setUint16(offset + 4, block.data.length, true);
+            stream.set(block.data, offset + this.#blockHeaderSize);
+            offset += this.#blockHeaderSize + block.data.length;
+        });
+
+        return { stream: stream, imageLength: imageLength, startAddress: startAddress };
+    }
+
+    /**
+     * runs the selected steps on the device
+     * @param buffer buffer containing the contents of an intel hex formatted file
+     * @param options the steps to run
+     * @param progressCallback called with the current step and percent complete, return true to cancel
+     */
+    async flashFromIntelHEX(buffer: ArrayBuffer, options: Stm32FlashOptions, progressCallback: (stage: string, percent: number) => boolean) {
+        const image = this.#imageFromIntelHEX(buffer);
+
+        let flags = 0;
+        flags |= options.erase ? this.#FlagErase : 0;
+        flags |= options.write ? this.#FlagWrite : 0;
+        flags |= options.verify ? this.#FlagVerify : 0;
+        flags |= options.run && image.startAddress != null ? this.#FlagGo : 0;
+
+        const sendImage = options.write || options.verify;
+        return this.#client.runJob(JobTypeStm32Bootloader, flags, image.startAddress ?? 0, sendImage ? image.imageLength : 0,
+            sendImage ? image.stream : new Uint8Array(0), (progress: JobProgress) => {
+                const percent = progress.Total > 0 ? (progress.Processed * 100) / progress.Total : 0;
+                return progressCallback(Stm32DeviceFlasher.StageNames[progress.Stage] ?? "", percent);
+            });
+    }
+}
@@ -15,7 +15,7 @@
  along with serialspark. If not, see <https://www.gnu.org/licenses/>.
  */
 import { Attributes, Component, ComponentChild, ComponentChildren, Ref } from "preact";
-import { SerialClient } from "../lib/serialClient";
+import { SerialClient, LineEvent, TimedData } from "../lib/serialClient";
 import { Auth } from "../lib/settingsAPI";
 
 interface TabProps {
@@ -24,6 +24,10 @@ interface TabProps {
     postStatusUpdate: (type: string, message: string) => void,
     //get a callback function for providing new data to the tab without rerendering
     dataUpdateFunc?:(newDataCallback: (func) =>void ) => void
+    //get a callback function for line errors and breaks, delivered in order with the data
+    lineEventFunc?: (lineEventCallback: (event: LineEvent) => void) => void
+    //get a callback function for the timestamps of the data, called just before the data callback
+    timedDataFunc?: (timedDataCallback: (data: TimedData) => void) => void
 }
 
 export abstract class AbstractTab<S = {}> extends Component<TabProps, S>{
@@ -16,10 +16,13 @@
  */
 import { AbstractTab } from "./abstractTab";
 import { DropDown, TextInput } from "../commonControls";
+import { TimedData } from "../lib/serialClient";
 
 interface DisplayTabState {
     sendInProgress: boolean
     colsPerRow: number
+    // idle time that starts a new row, with device timestamps on
+    gapMarkerMicros: number
 }
 
 export default class DisplayTab extends AbstractTab<DisplayTabState> {
@@ -28,6 +31,8 @@ export default class DisplayTab extends AbstractTab<DisplayTabState> {
     #currentRow: HTMLDivElement = null
     #table: Element
     #textForSendElm: HTMLInputElement
+    // device time the last byte shown finished arriving
+    #lastDataEnd: number = undefined
 
     #displayMode = {
         dataWidth: 1,
@@ -103,6 +108,16 @@ export default class DisplayTab extends AbstractTab<DisplayTabState> {
             table.removeChild(table.lastChild);
         }
         this.#addRow();
+        this.#lastDataEnd = undefined;
+    }
+
+    #addGapMarker(gapMicros: number) {
+        this.#addRow();
+        this.#colCount = 0;
+        const gapDiv = document.createElement("div");
+        gapDiv.className = "col gap";
+        gapDiv.innerText = "+" + gapMicros + "µs";
+        this.#currentRow.appendChild(gapDiv);
     }
 
     #onDisplayModeSelectionChange(value) {
@@ -120,13 +135,26 @@ export default class DisplayTab extends AbstractTab<DisplayTabState> {
         this.#displayMode = this.#displayModeMap[this.#displayModeList[0]];
         this.state ={
             sendInProgress: false,
-            colsPerRow: 50
+            colsPerRow: 50,
+            gapMarkerMicros: 1000
         }
     }
 
     componentDidMount(): void {
         this.#addRow();
         this.props.dataUpdateFunc(this.#onAsyncData.bind(this));
+        this.props.timedDataFunc(this.#onAsyncTimedData.bind(this));
+    }
+
+    #onAsyncTimedData(data: TimedData) {
+        // called just before the same data is given to #onAsyncData, so the marker lands in front of it
+        if (this.#lastDataEnd !== undefined) {
+            const gap = data.Start - this.#lastDataEnd;
+            if (gap >= this.state.gapMarkerMicros) {
+                this.#addGapMarker(gap);
+            }
+        }
+        this.#lastDataEnd = data.Start + data.Duration;
     }
 
     #onAsyncData(buffer: ArrayBuffer) {
@@ -186,6 +214,7 @@ export default class DisplayTab extends AbstractTab<DisplayTabState> {
                 <div>
                     <DropDown label="display As" items={this.#displayModeList} onChange={this.#onDisplayModeSelectionChange.bind(this)} />
                     <TextInput value={this.state.colsPerRow.toString()} size={10} label="Columns Per Row" enabled={!this.state.sendInProgress} type="number" onChange={this.#onMaxColsCountChange.bind(this)} />
+                    <TextInput value={this.state.gapMarkerMicros.toString()} size={10} label="Gap Marker (µs)" type="number" onChange={(elm) => this.setState({ gapMarkerMicros: parseInt(elm.value) })} />
                     <TextInput size={20} label="Text For Send"  enabled={!this.state.sendInProgress} onChange={(elm) => { }} inputRef={(r) => this.#textForSendElm = r} >
                         <button {...(this.state.sendInProgress && { disable: true })} onClick={this.#onSendNumbersClick.bind(this)} >Send Numbers</button>
                         <button {...(this.state.sendInProgress && { disable: true })} onClick={this.#onSendTextClick.bind(this)} >Send Text</button>
@@ -15,8 +15,11 @@
  along with serialspark. If not, see <https://www.gnu.org/licenses/>.
  */
 import { AbstractTab } from "./abstractTab";
-import { DropDown, TextInput } from "../commonControls";
-import { SerialModeNoParity, SerialModeOddParity, SerialModeEvenParity, SerialModeMarkParity, SerialModeSpaceParity, SerialMode } from "../lib/serialClient";
+import { DropDown, TextInput, CheckBox } from "../commonControls";
+import { SerialModeNoParity, SerialModeOddParity, SerialModeEvenParity, SerialModeMarkParity, SerialModeSpaceParity, SerialMode, PortProfileDefault, PortProfileInteractive, PortProfileBulk, FlowControlNone, FlowControlRtsCts, FlowControlXonXoff, Rs485Off, Rs485DeOnRts, Rs485DeOnDtr, ModemLineDTR, ModemLineRTS, TriggerPattern, TriggerLineError, TriggerBreak, TriggerCapture, TriggerEntryTx, TriggerEntryLineEvent, PatternHit } from "../lib/serialClient";
+
+// async data bytes the device may send before the page has handed the credit back
+const rxWindowSize = 8 * 1024
 
 interface PortTabProps {
     portList: string[]
@@ -35,8 +38,24 @@ interface State {
     portValue: string
     bandRateValue: string
     parityValue: string
+    profileValue: string
+    flowControlValue: string
+    rs485Value: string
+    turnaroundUs: string
+    dtr: boolean
+    rts: boolean
+    timestamps: boolean
+    charDelayUs: string
+    lineDelayMs: string
+    waitForEcho: boolean
+    triggerPattern: string
+    triggerOnError: boolean
+    triggerArmed: boolean
+    // separated by |
+    watchPatterns: string
 
     portList: string[]
+    viewOnly: boolean
     connected: boolean
     pendingOperation: boolean
 }
@@ -45,6 +64,9 @@ export class PortTab extends AbstractTab<State> {
     #bandRateList: string[];
     #dataBitsList: string[];
     #parityList: string[];
+    #profileList: string[];
+    #flowControlList: string[];
+    #rs485List: string[];
     #lastSerialMode
 
     #bitWidthMap = {
@@ -62,18 +84,54 @@ export class PortTab extends AbstractTab<State> {
         "Space": SerialModeSpaceParity
     }
 
+    #profileMap = {
+        "Default": PortProfileDefault,
+        "Interactive": PortProfileInteractive,
+        "Bulk": PortProfileBulk
+    }
+
+    #flowControlMap = {
+        "None": FlowControlNone,
+        "RTS/CTS": FlowControlRtsCts,
+        "XON/XOFF": FlowControlXonXoff
+    }
+
+    #rs485Map = {
+        "Off": Rs485Off,
+        "DE on RTS": Rs485DeOnRts,
+        "DE on DTR": Rs485DeOnDtr
+    }
+
     constructor(props) {
         super(props);
         this.#bandRateList = ["9600", "57600", "115200"];
         this.#dataBitsList = ["8 bits", "7 bits", "6 bits", "5 bits"];
         this.#parityList = ["None", "Odd", "Even", "Mark", "Space"];
+        this.#profileList = ["Default", "Interactive", "Bulk"];
+        this.#flowControlList = ["None", "RTS/CTS", "XON/XOFF"];
+        this.#rs485List = ["Off", "DE on RTS", "DE on DTR"];
 
         this.state = {
             portValue: "",
             bandRateValue: this.#bandRateList[0],
             dataBitsValue: this.#dataBitsList[0],
             parityValue: this.#parityList[0],
+            profileValue: this.#profileList[0],
+            flowControlValue: this.#flowControlList[0],
+            rs485Value: this.#rs485List[0],
+            turnaroundUs: "0",
+            dtr: false,
+            rts: false,
+            timestamps: false,
+            charDelayUs: "0",
+            lineDelayMs: "0",
+            waitForEcho: false,
+            triggerPattern: "",
+            triggerOnError: false,
+            triggerArmed: false,
+            watchPatterns: "",
             portList: [],
+            viewOnly: false,
             connected: false,
             pendingOperation: false
         }
@@ -84,6 +142,8 @@ export class PortTab extends AbstractTab<State> {
                 this.setState({ 'portList': ports, portValue: ports.length > 0 ? ports[0] : "" });
             })
         });
+        serialClient?.onTriggerCapture(capture => this.#onTriggerCapture(capture));
+        serialClient?.onPatternHit(hit => this.#onPatternHit(hit));
     }
 
     #getSerialMode(): SerialMode {
@@ -92,14 +152,28 @@ export class PortTab extends AbstractTab<State> {
             Parity: this.#parityMap[this.state.parityValue],
             BaudRate: parseInt(this.state.bandRateValue),
             StopBits: 0,
-            InitialStatusBits: 0
+            InitialStatusBits: (this.state.dtr ? ModemLineDTR : 0) | (this.state.rts ? ModemLineRTS : 0),
+            Profile: this.#profileMap[this.state.profileValue],
+            FlowControl: this.#flowControlMap[this.state.flowControlValue],
+            Timestamps: this.state.timestamps,
+            TxPacing: {
+                ByteGapUs: parseInt(this.state.charDelayUs) || 0,
+                LineGapMs: parseInt(this.state.lineDelayMs) || 0,
+                EchoTimeoutMs: this.state.waitForEcho ? 200 : 0
+            },
+            Rs485: {
+                Mode: this.#rs485Map[this.state.rs485Value],
+                TurnaroundUs: parseInt(this.state.turnaroundUs) || 0
+            }
         }
         return sm;
     }
 
     #setStatusBarState() {
-        const { bandRateValue, portValue, connected } = this.state
-        if (connected) {
+        const { bandRateValue, portValue, connected, viewOnly } = this.state
+        if (connected && viewOnly) {
+            this.props.postStatusUpdate('port', "Viewing, " + portValue);
+        } else if (connected) {
             this.props.postStatusUpdate('port', "Open, " + portValue + " " + bandRateValue);
         } else {
             this.props.postStatusUpdate('port', "Closed");
@@ -125,7 +199,10 @@ export class PortTab extends AbstractTab<State> {
     #openPort() {
         this.setState({ pendingOperation: true })
 
-        this.props.serialClient.open(this.state.portValue).then(() => {
+        const { serialClient } = this.props
+        const open = this.state.viewOnly ? serialClient.openViewer(this.state.portValue) : serialClient.open(this.state.portValue)
+        // limit how far the device can get ahead of the rendering
+        open.then(() => serialClient.setRxWindow(rxWindowSize)).then(() => {
             this.setState({ connected: true, pendingOperation: false }, () => {
                 this.#setStatusBarState();
             });
@@ -141,7 +218,7 @@ export class PortTab extends AbstractTab<State> {
     #openButtonClick() {
         const { connected } = this.state;
         if (!connected) {
-            if (!this.#lastSerialMode) {
+            if (!this.#lastSerialMode && !this.state.viewOnly) {
                 this.#setMode().then(() => this.#openPort());
             } else {
                 this.#openPort();
@@ -150,7 +227,7 @@ export class PortTab extends AbstractTab<State> {
             this.props.serialClient.close()
                 .catch(this.#reportError)
                 .finally(() => {
-                    this.setState({ connected: false, pendingOperation: false }, () => {
+                    this.setState({ connected: false, pendingOperation: false, triggerArmed: false }, () => {
                         this.#setStatusBarState();
                     });
 
@@ -158,6 +235,66 @@ export class PortTab extends AbstractTab<State> {
         }
     }
 
+    #detectBaudRate() {
+        this.setState({ pendingOperation: true })
+        this.props.serialClient.autoBaud().then((result) => {
+            this.setState({ bandRateValue: result.BaudRate.toString() }, () => {
+                this.#setStatusBarState();
+            });
+        }).catch((err) => {
+            this.#reportError("baud rate detection failed, " + err);
+        }).finally(() => {
+            this.setState({ pendingOperation: false })
+        })
+    }
+
+    #armTrigger() {
+        const { triggerArmed, triggerPattern, triggerOnError } = this.state;
+        const pattern = new TextEncoder().encode(triggerPattern).subarray(0, 16);
+        const triggers = triggerArmed ? 0 : (pattern.length > 0 ? TriggerPattern : 0) | (triggerOnError ? TriggerLineError | TriggerBreak : 0);
+        this.setState({ pendingOperation: true })
+        this.props.serialClient.armTrigger({ Triggers: triggers, PreEntries: 1024, PostEntries: 1024, Pattern: pattern }).then(() => {
+            this.setState({ triggerArmed: triggers != 0 });
+        }).catch((err) => {
+            this.#reportError("trigger failed, " + err);
+        }).finally(() => {
+            this.setState({ pendingOperation: false })
+        })
+    }
+
+    #onTriggerCapture(capture: TriggerCapture) {
+        this.setState({ triggerArmed: false });
+        // one line per entry, the entry that fired is the last before the marker
+        const lines = capture.Entries.map((entry, i) => {
+            const value = entry.Flags & TriggerEntryLineEvent ? "event " + entry.Value : entry.Value.toString(16).padStart(2, "0");
+            return (i == capture.PreCount ? "--- trigger\n" : "") + (entry.Flags & TriggerEntryTx ? "TX " : "RX ") + value;
+        });
+
+        const link = document.createElement("a");
+        link.href = URL.createObjectURL(new Blob(["triggered at " + capture.Time + "us\n" + lines.join("\n")], { type: "text/plain" }));
+        link.download = "trigger.txt";
+        link.click();
+        URL.revokeObjectURL(link.href);
+        this.props.postStatusUpdate('port', "Triggered, " + capture.Entries.length + " entries saved");
+    }
+
+    #watchPatterns() {
+        const patterns = this.state.watchPatterns.split("|").filter(p => p.length > 0);
+        this.setState({ pendingOperation: true })
+        this.props.serialClient.watchPatterns(patterns).then(() => {
+            this.props.postStatusUpdate('port', patterns.length > 0 ? "Watching " + patterns.length + " patterns" : "Not watching");
+        }).catch((err) => {
+            this.#reportError("watch failed, " + err);
+        }).finally(() => {
+            this.setState({ pendingOperation: false })
+        })
+    }
+
+    #onPatternHit(hit: PatternHit) {
+        const pattern = this.state.watchPatterns.split("|").filter(p => p.length > 0)[hit.Pattern] ?? hit.Pattern;
+        this.props.postStatusUpdate('port', "Seen \"" + pattern + "\" at byte " + hit.Offset);
+    }
+
     #onChange(listId: string, value: string) {
         const id = listId + 'Value';
         let state = {}
@@ -172,9 +309,32 @@ export class PortTab extends AbstractTab<State> {
         return <div class="form-v">
 
             <DropDown onChange={(value) => this.#onChange("port", value)} label="Port" items={state.portList} enabled={!state.pendingOperation && !state.connected} />
+            <CheckBox label="View Only" checked={state.viewOnly} enabled={!state.pendingOperation && !state.connected} onChange={(elm) => this.setState({ viewOnly: elm.checked })} />
             <TextInput type="number" value={state.bandRateValue} size={5} onChange={(elm) => this.#onChange("bandRate", elm.value)} label="Band Rate" valueList={this.#bandRateList} enabled={!state.pendingOperation} />
+            <div>
+                <button {...((state.pendingOperation || !state.connected || state.viewOnly) && { disabled: true })} onClick={() => this.#detectBaudRate()}>Detect Baud Rate</button>
+            </div>
             <DropDown onChange={(value) => this.#onChange("parity", value)} label="Parity" items={this.#parityList} enabled={!state.pendingOperation} />
             <DropDown onChange={(value) => this.#onChange("dataBits", value)} label="Data Bits" items={this.#dataBitsList} enabled={!state.pendingOperation} />
+            <DropDown onChange={(value) => this.#onChange("profile", value)} label="Profile" items={this.#profileList} enabled={!state.pendingOperation} />
+            <DropDown onChange={(value) => this.#onChange("flowControl", value)} label="Flow Control" items={this.#flowControlList} enabled={!state.pendingOperation} />
+            <DropDown onChange={(value) => this.#onChange("rs485", value)} label="RS-485" items={this.#rs485List} enabled={!state.pendingOperation} />
+            <TextInput type="number" label="Turnaround (us)" value={state.turnaroundUs} size={6} enabled={!state.pendingOperation} onChange={(elm) => this.setState({ turnaroundUs: elm.value })} />
+            <CheckBox label="DTR" checked={state.dtr} enabled={!state.pendingOperation} onChange={(elm) => this.setState({ dtr: elm.checked })} />
+            <CheckBox label="RTS" checked={state.rts} enabled={!state.pendingOperation} onChange={(elm) => this.setState({ rts: elm.checked })} />
+            <CheckBox label="Device Timestamps" checked={state.timestamps} enabled={!state.pendingOperation} onChange={(elm) => this.setState({ timestamps: elm.checked })} />
+            <TextInput type="number" label="Char Delay (us)" value={state.charDelayUs} size={6} enabled={!state.pendingOperation} onChange={(elm) => this.setState({ charDelayUs: elm.value })} />
+            <TextInput type="number" label="Line Delay (ms)" value={state.lineDelayMs} size={5} enabled={!state.pendingOperation} onChange={(elm) => this.setState({ lineDelayMs: elm.value })} />
+            <CheckBox label="Wait For Echo" checked={state.waitForEcho} enabled={!state.pendingOperation} onChange={(elm) => this.setState({ waitForEcho: elm.checked })} />
+            <TextInput label="Trigger Pattern" value={state.triggerPattern} size={16} enabled={!state.pendingOperation && !state.triggerArmed} onChange={(elm) => this.setState({ triggerPattern: elm.value })} />
+            <CheckBox label="Trigger On Error / Break" checked={state.triggerOnError} enabled={!state.pendingOperation && !state.triggerArmed} onChange={(elm) => this.setState({ triggerOnError: elm.checked })} />
+            <div>
+                <button {...((state.pendingOperation || !state.connected || state.viewOnly) && { disabled: true })} onClick={() => this.#armTrigger()}>{state.triggerArmed ? "Disarm Trigger" : "Arm Trigger"}</button>
+            </div>
+            <TextInput label="Watch Patterns" value={state.watchPatterns} size={20} enabled={!state.pendingOperation} onChange={(elm) => this.setState({ watchPatterns: elm.value })} />
+            <div>
+                <button {...((state.pendingOperation || !state.connected) && { disabled: true })} onClick={() => this.#watchPatterns()}>Watch</button>
+            </div>
 
             <div>
                 <button onClick={() => this.#openButtonClick()}>{state.connected ? "Close" : "Open"}</button>
@@ -0,0 +1,129 @@
+/*
+ Copyright (c) 2024 Rhys Bryant
+
+ serialspark is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ serialspark is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with serialspark. If not, see <https://www.gnu.org/licenses/>.
+ */
+import { Component } from "preact";
+import { Button, CheckBox, TextInput } from "../../commonControls";
+import { CaptureInfo, CaptureRecord, CaptureRecordLineEvent, CaptureRecordLost, CaptureRecordRx, CaptureSettings } from "../../lib/settingsAPI";
+
+interface CaptureSettingsState {
+    info?: CaptureInfo
+    busy: boolean
+    minutes: number
+}
+
+interface CaptureSettingsProps {
+    settingsAPI: CaptureSettings
+    onStatusChange: (msg: string) => void
+}
+
+export class CaptureSettingsForm extends Component<CaptureSettingsProps, CaptureSettingsState> {
+    #config = { enabled: false, port: "UART 1", baudRate: 115200 };
+
+    constructor(props) {
+        super(props);
+        this.state = { busy: false, minutes: 10 };
+    }
+
+    set currentOperation(status: string) {
+        this.props.onStatusChange(status);
+    }
+
+    componentDidMount() {
+        this.#refresh();
+    }
+
+    #refresh() {
+        this.props.settingsAPI.getInfo().then(info => {
+            if (info.port) {
+                this.#config = { enabled: info.enabled, port: info.port, baudRate: info.baudRate || this.#config.baudRate };
+            }
+            this.setState({ info });
+        }).catch(e => this.currentOperation = e.toString());
+    }
+
+    #onSaveClick() {
+        this.setState({ busy: true });
+        this.props.settingsAPI.setConfig(this.#config).then(() => {
+            this.currentOperation = "capture settings saved";
+            this.#refresh();
+        }).catch(e => this.currentOperation = "Error: " + e.toString())
+            .finally(() => this.setState({ busy: false }));
+    }
+
+    static #formatRecord(record: CaptureRecord) {
+        const types = ["RX", "TX", "EVENT", "LOST"];
+        let text: string;
+        if (record.Type == CaptureRecordLost) {
+            text = new DataView(record.Data.buffer).getUint32(0, true) + " bytes";
+        } else if (record.Type == CaptureRecordLineEvent) {
+            text = ["parity error", "frame error", "break", "fifo overflow"][record.Data[0]] ?? "event " + record.Data[0];
+        } else {
+            text = Array.from(record.Data, b => b.toString(16).padStart(2, "0")).join(" ");
+        }
+        return record.Time + " " + (types[record.Type] ?? record.Type) + " " + text;
+    }
+
+    async #onDownloadClick() {
+        const { settingsAPI } = this.props;
+        this.setState({ busy: true });
+        try {
+            const info = await settingsAPI.getInfo();
+            const { start, end } = await settingsAPI.findRange(Math.max(0, info.now - this.state.minutes * 60e6), info.now + 1);
+            const data = await settingsAPI.download(start, end, received => {
+                this.currentOperation = "downloading " + Math.round(received * 100 / Math.max(1, end - start)) + "%";
+            });
+
+            // times are turned into wall clock using the device clock at the time of the info request
+            const records = CaptureSettings.parseRecords(data, start, info.segmentSize);
+            const offsetMs = Date.now() - info.now / 1000;
+            const lines = records.map(r => new Date(offsetMs + r.Time / 1000).toISOString() + " " + CaptureSettingsForm.#formatRecord(r));
+
+            const link = document.createElement("a");
+            link.href = URL.createObjectURL(new Blob([lines.join("\n")], { type: "text/plain" }));
+            link.download = "capture.txt";
+            link.click();
+            URL.revokeObjectURL(link.href);
+            this.currentOperation = records.filter(r => r.Type == CaptureRecordRx).length + " RX records downloaded";
+        } catch (e) {
+            this.currentOperation = "Error: " + e.toString();
+        } finally {
+            this.setState({ busy: false });
+        }
+    }
+
+    render() {
+        const { info, busy, minutes } = this.state;
+        if (info == null) {
+            return null;
+        }
+
+        if (!info.available) {
+            return <div>No capture partition on this device</div>
+        }
+
+        return <div class="form-v">
+            <CheckBox label="Record" checked={this.#config.enabled} enabled={!busy} onChange={(elm) => this.#config.enabled = elm.checked} />
+            <TextInput label="Port" value={this.#config.port} enabled={!busy} onChange={(elm) => this.#config.port = elm.value} />
+            <TextInput label="Baud Rate" value={this.#config.baudRate.toString()} size={10} enabled={!busy} onChange={(elm) => this.#config.baudRate = parseInt(elm.value)} />
+            <Button label="Save" enabled={!busy} onClick={this.#onSaveClick.bind(this)} />
+            <div>
+                <span>{Math.round((info.end - info.start) / 1024)} KB recorded, {info.lostBytes} bytes lost, max segment erase count {info.maxEraseCount}</span>
+            </div>
+            <TextInput label="Last Minutes" value={minutes.toString()} size={6} enabled={!busy} onChange={(elm) => this.setState({ minutes: parseFloat(elm.value) || 0 })} />
+            <Button label="Download" enabled={!busy} onClick={this.#onDownloadClick.bind(this)} />
+        </div>
+    }
+}
@@ -14,9 +14,10 @@
  You should have received a copy of the GNU General Public License
  along with serialspark. If not, see <https://www.gnu.org/licenses/>.
  */
-import { AuthSettings, CertSettings, WiFiSettings } from "../lib/settingsAPI";
+import { AuthSettings, CaptureSettings, CertSettings, WiFiSettings } from "../lib/settingsAPI";
 import { AbstractTab } from "./abstractTab";
 import { AuthSettingsForm } from "./settings/auth";
+import { CaptureSettingsForm } from "./settings/capture";
 import { CertSettingsForm } from "./settings/cert";
 import { WifiSettingsForm } from "./settings/wifi";
 
@@ -28,12 +29,14 @@ export default class SettingsTab extends AbstractTab<SettingsTabState> {
     #wifiSettings: WiFiSettings;
     #certSettings: CertSettings;
     #authSettings: AuthSettings
+    #captureSettings: CaptureSettings
     constructor(props) {
         super(props);
 
         this.#wifiSettings = new WiFiSettings(props.auth);
         this.#certSettings = new CertSettings(props.auth);
         this.#authSettings = new AuthSettings(props.auth);
+        this.#captureSettings = new CaptureSettings(props.auth);
     }
 
     render() {
@@ -45,6 +48,8 @@ export default class SettingsTab extends AbstractTab<SettingsTabState> {
             <AuthSettingsForm settingsAPI={this.#authSettings} onStatusChange={msg => this.currentOperation = msg} />
             <h3>Wifi Settings</h3>
             <WifiSettingsForm settingsAPI={this.#wifiSettings} onStatusChange={msg => this.currentOperation = msg} />
+            <h3>Capture Log</h3>
+            <CaptureSettingsForm settingsAPI={this.#captureSettings} onStatusChange={msg => this.currentOperation = msg} />
 
         </div>
     }
@@ -17,6 +17,9 @@
 import { Terminal } from "@xterm/xterm";
 import '@xterm/xterm/css/xterm.css'
 import {AbstractTab} from "./abstractTab";
+import { LineEvent } from "../lib/serialClient";
+
+const lineEventNames = ["PARITY", "FRAME", "BREAK", "OVERFLOW", "COLLISION"];
 
 export default class TermTab extends AbstractTab {
     #term: Terminal
@@ -32,15 +35,28 @@ export default class TermTab extends AbstractTab {
         }
 
         this.props.dataUpdateFunc(this.#onAsyncData.bind(this));
+        this.props.lineEventFunc(this.#onLineEvent.bind(this));
     }
 
     #onAsyncData(buffer: ArrayBuffer): void{
         this.#term.write(new Uint8Array(buffer));
     }
 
+    #onLineEvent(event: LineEvent): void {
+        // shown in place so it is clear which bytes were affected
+        this.#term.write("\x1b[41m<" + (lineEventNames[event.Event] ?? "?") + ">\x1b[0m");
+    }
+
+    #onSendBreakClick() {
+        this.props.serialClient.sendBreak().catch((message) => this.props.postStatusUpdate('port', "send break failed, " + message));
+    }
+
     render() {
-        return <div id="term">
+        return <div>
+            <button onClick={() => this.#onSendBreakClick()}>Send Break</button>
+            <div id="term">
 
+            </div>
         </div>
     }
 }
\ No newline at end of file
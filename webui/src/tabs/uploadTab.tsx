@@ -16,8 +16,9 @@
  */
 import { Component } from "preact";
 import { AbstractTab } from "./abstractTab";
-import Stm32BootLoaderClient from "../lib/stm32bootloaderClient";
-import { CheckBox, DropDown } from "../commonControls";
+import Stm32BootLoaderClient, { Stm32DeviceFlasher } from "../lib/stm32bootloaderClient";
+import { EspFlasher } from "../lib/espFlasher";
+import { CheckBox, DropDown, TextInput } from "../commonControls";
 
 interface Stm32OptionsState {
     erase: boolean
@@ -72,15 +73,10 @@ class SimpleFileDumpUpload implements FileUploadHandler {
     processUpload(buffer: ArrayBuffer, onProgressUpdate: (progress: number) => boolean): Promise<any> {
         return new Promise<void>(async (resolve, reject) => {
             try {
-                const maxChunkSize = 2048;
-                for (let i = 0; i < buffer.byteLength; i += maxChunkSize) {
-                    let chunkSize = maxChunkSize;
-
-                    await this.#uploadTab.props.serialClient.write(new Uint8Array(buffer.slice(i, i + chunkSize)))
-                    if (onProgressUpdate(i + chunkSize)) {
-                        return
-                    }
-                }
+                const serialClient = this.#uploadTab.props.serialClient;
+                // the writes are paced by the device's tx credit so its queue stays full without overflowing
+                const offset = await serialClient.writeStream(new Uint8Array(buffer), (queued) => onProgressUpdate(queued));
+                await serialClient.waitForWriteComplete(offset);
                 resolve();
             }
             catch (e) {
@@ -131,70 +127,98 @@ class Stm32FirmwareUpload implements FileUploadHandler {
 
     processUpload(buffer: ArrayBuffer, onProgressUpdate: (progress: number) => boolean) {
         const uploadTab = this.#uploadTab;
-        return new Promise<void>(async (resolve, reject) => {
-            const b = new Stm32BootLoaderClient(uploadTab.props.serialClient);
-
-            const actions = this.#actions
-
-            if (actions.erase) {
-                uploadTab.currentOperation = " STM32, erase started";
-                try {
-                    await b.erase()
-                } catch (e) {
-                    uploadTab.currentOperation = " ";
-                    reject("STM32, erase failed, " + e);
-                    return;
-                }
+        const flasher = new Stm32DeviceFlasher(uploadTab.props.serialClient);
+        let lastStage = "";
+
+        uploadTab.currentOperation = " STM32, started";
+        return flasher.flashFromIntelHEX(buffer, this.#actions, (stage, percent) => {
+            if (stage != lastStage) {
+                lastStage = stage;
+                uploadTab.currentOperation = " STM32, " + stage + " started";
             }
+            return onProgressUpdate(percent);
+        }).catch(e => {
+            throw "STM32, " + lastStage + " failed, " + e;
+        });
+    }
 
-            let startAddress = null;
+    #onActionsChange(elm: HTMLInputElement) {
+        this.#actions[elm.value] = elm.checked;
+    }
 
-            if (actions.write) {
-                uploadTab.currentOperation = " STM32, write started";
-                try {
-                    startAddress = await b.writeFromIntelHEX(buffer, onProgressUpdate);
-                } catch (e) {
-                    reject("STM32, write failed " + e);
-                    return;
-                }
-            }
+    getUIComponent() {
+        return <Stm32UploadControls enabled={!this.#operationInProgress} onChange={this.#onActionsChange.bind(this)} onQueryClick={this.#onStm32QueryClick.bind(this)} />
+    }
+}
 
-            if (actions.verify) {
-                uploadTab.currentOperation = " STM32, verify started";
-                try {
-                    startAddress = await b.verifyWithIntelHEX(buffer, onProgressUpdate);
-                } catch (e) {
-                    reject("STM32, verify failed " + e);
-                    return;
-                }
-            }
+interface EspOptionsProps {
+    onChange: (name: string, value: string | boolean) => void
+    enabled: boolean
+}
 
-            if (actions.run && startAddress != null) {
-                uploadTab.currentOperation = " STM32, start sent";
-                try {
-                    await b.go(startAddress);
-                } catch (e) {
-                    reject("STM32, start failed " + e);
-                }
+class EspUploadControls extends Component<EspOptionsProps> {
+    static BaudRates = ["921600", "460800", "230400", "115200"];
 
-            }
+    render() {
+        const { enabled, onChange } = this.props;
+
+        return <div>
+            <TextInput label="Flash Offset" value="0x10000" size={10} enabled={enabled} onChange={(elm) => onChange("offset", elm.value)} />
+            <DropDown label="Flash Baud Rate" items={EspUploadControls.BaudRates} enabled={enabled} onChange={(value) => onChange("baudRate", value)} />
+            <CheckBox label="Verify" checked={true} enabled={enabled} onChange={(elm) => onChange("verify", elm.checked)} />
+            <CheckBox label="Reboot When Done" checked={true} enabled={enabled} onChange={(elm) => onChange("reboot", elm.checked)} />
+            <CheckBox label="Already In Download Mode" enabled={enabled} onChange={(elm) => onChange("noReset", elm.checked)} />
+        </div>
+    }
+}
+
+class EspFirmwareUpload implements FileUploadHandler {
+    #uploadTab: UploadTab
+    #options = {
+        offset: 0x10000,
+        baudRate: parseInt(EspUploadControls.BaudRates[0]),
+        verify: true,
+        reboot: true,
+        noReset: false
+    };
+
+    constructor(uploadTab: UploadTab) {
+        this.#uploadTab = uploadTab;
+    }
 
-            resolve();
+    processUpload(buffer: ArrayBuffer, onProgressUpdate: (progress: number) => boolean) {
+        const uploadTab = this.#uploadTab;
+        const flasher = new EspFlasher(uploadTab.props.serialClient);
+        let lastStage = "";
+
+        uploadTab.currentOperation = " ESP, started";
+        return flasher.flash(buffer, this.#options, (stage, percent) => {
+            if (stage != lastStage) {
+                lastStage = stage;
+                uploadTab.currentOperation = " ESP, " + stage + " started";
+            }
+            return onProgressUpdate(percent);
+        }).catch(e => {
+            throw "ESP, " + lastStage + " failed, " + e;
         });
     }
 
-    #onActionsChange(elm: HTMLInputElement) {
-        this.#actions[elm.value] = elm.checked;
+    #onOptionChange(name: string, value: string | boolean) {
+        if (name == "offset" || name == "baudRate") {
+            this.#options[name] = parseInt(value as string);
+        } else {
+            this.#options[name] = value;
+        }
     }
 
     getUIComponent() {
-        return <Stm32UploadControls enabled={!this.#operationInProgress} onChange={this.#onActionsChange.bind(this)} onQueryClick={this.#onStm32QueryClick.bind(this)} />
+        return <EspUploadControls enabled={true} onChange={this.#onOptionChange.bind(this)} />
     }
 }
 
 export default class UploadTab extends AbstractTab<UploadState> {
-    #uploadTypes = ["STM32 (.hex) Firmware Upload", "Direct Dump"];
-    #uploadTypeHandler = [Stm32FirmwareUpload, SimpleFileDumpUpload]
+    #uploadTypes = ["STM32 (.hex) Firmware Upload", "ESP (.bin) Firmware Upload", "Direct Dump"];
+    #uploadTypeHandler = [Stm32FirmwareUpload, EspFirmwareUpload, SimpleFileDumpUpload]
     #currentFileUploadHandler = new this.#uploadTypeHandler[0](this);
     #fileUploadInputElm: HTMLInputElement
 